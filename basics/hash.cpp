@@ -1,7 +1,20 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <cstring>
+#include <cstdint>
+#include <cassert>
+#include <strings.h>
+#include <vector>
+#include <map>
+#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 
 namespace Util {
@@ -15,6 +28,238 @@ void hash_combine(std::size_t& seed, const T& v)
 }
 
 
+// murmur3 64 bit finalizer
+inline size_t  mix_hash (size_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+// ================================================================
+// byte string hashing
+//
+//   size_t  hash_bytes (const void* p, size_t len);
+//   size_t  hash_bytes_nocase (const void* p, size_t len);   // ASCII case folded
+//
+// Works on 8 bytes at a time. Inputs of 32 bytes or more are hashed in
+// 32-byte stripes of four 64-bit lanes, with an xxh3-style accumulate:
+// lane ^= key, acc += lo32 * hi32, and the neighbour lane gets the raw
+// data. Every 8 stripes the accumulators are scrambled. The stripe
+// kernel is scalar, SSE2 or AVX2, chosen once at startup from the CPU.
+// All three produce the same bits, so a table built on one machine is
+// valid on any other (CRC32 / aesenc kernels would not be).
+//
+// No-case hashing lower cases 'A'..'Z' only, the same as strcasecmp in
+// the "C" locale: 8 bytes at a time with SWAR, or 16 / 32 with SIMD.
+// ================================================================
+
+namespace hash_detail {
+
+constexpr uint64_t  PRIME64_1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t  PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint32_t  PRIME32_1 = 0x9E3779B1U;
+constexpr size_t    STRIPE    = 32;
+constexpr size_t    SCRAMBLE_EVERY = 8;     // stripes
+
+alignas(32) constexpr uint64_t  LANE_KEY[4] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL
+};
+
+// little endian on every host, so the hash is too
+inline uint64_t  read64 (const uint8_t* p)
+{
+    uint64_t  x;
+    memcpy( &x, p, 8 );
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap64( x );
+#endif
+    return x;
+}
+
+inline uint64_t  read32 (const uint8_t* p)
+{
+    uint32_t  x;
+    memcpy( &x, p, 4 );
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap32( x );
+#endif
+    return x;
+}
+
+// 1 .. 7 bytes, as two overlapping reads (or three bytes) instead of a
+// byte loop. Every byte is covered, and the length is hashed separately.
+inline uint64_t  read_tail (const uint8_t* p, size_t n)
+{
+    if (n >= 4)
+        return read32( p ) | (read32( p + n - 4 ) << 32);
+    return uint64_t( p[0] ) | (uint64_t( p[n / 2] ) << 8) | (uint64_t( p[n - 1] ) << 16);
+}
+
+// 'A'..'Z' -> 'a'..'z' in each byte of 'w'
+inline uint64_t  fold_case64 (uint64_t w)
+{
+    constexpr uint64_t  ONES = 0x0101010101010101ULL;
+    uint64_t  low7  = w & (0x7f * ONES);
+    uint64_t  ge_A  = low7 + (0x80 - 'A') * ONES;       // high bit set where byte >= 'A'
+    uint64_t  gt_Z  = low7 + (0x80 - 'Z' - 1) * ONES;   // high bit set where byte >  'Z'
+    uint64_t  upper = ge_A & ~gt_Z & ~w & (0x80 * ONES);
+    return w | (upper >> 2);
+}
+
+template <bool NoCase>
+inline uint64_t  load64 (const uint8_t* p)
+{
+    return NoCase ? fold_case64( read64( p ) ) : read64( p );
+}
+
+inline void  scramble_scalar (uint64_t* acc)
+{
+    for (int j = 0;  j < 4;  j++)
+        acc[j] = (acc[j] ^ (acc[j] >> 47) ^ LANE_KEY[j]) * PRIME32_1;
+}
+
+// ==== stripe kernels: fold 'nstripes' 32-byte stripes at 'p' into 'acc'
+using StripesFn = void (*) (uint64_t* acc, const uint8_t* p, size_t nstripes);
+
+template <bool NoCase>
+void  stripes_scalar (uint64_t* acc, const uint8_t* p, size_t nstripes)
+{
+    for (size_t s = 0;  s < nstripes;  s++, p += STRIPE) {
+        for (int j = 0;  j < 4;  j++) {
+            uint64_t  d  = load64<NoCase>( p + 8 * j );
+            uint64_t  dk = d ^ LANE_KEY[j];
+            acc[j ^ 1] += d;
+            acc[j]     += (dk & 0xffffffff) * (dk >> 32);
+        }
+        if ((s + 1) % SCRAMBLE_EVERY == 0)
+            scramble_scalar( acc );
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+template <bool NoCase>
+__attribute__((target("sse2")))
+void  stripes_sse2 (uint64_t* acc, const uint8_t* p, size_t nstripes)
+{
+    __m128i  a[2]   = { _mm_loadu_si128( (const __m128i*) acc ), _mm_loadu_si128( (const __m128i*) (acc + 2) ) };
+    __m128i  key[2] = { _mm_load_si128( (const __m128i*) LANE_KEY ), _mm_load_si128( (const __m128i*) (LANE_KEY + 2) ) };
+    __m128i  prime  = _mm_set1_epi32( int(PRIME32_1) );
+    for (size_t s = 0;  s < nstripes;  s++, p += STRIPE) {
+        for (int j = 0;  j < 2;  j++) {
+            __m128i  d = _mm_loadu_si128( (const __m128i*) (p + 16 * j) );
+            if (NoCase) {
+                __m128i  upper = _mm_and_si128( _mm_cmpgt_epi8( d, _mm_set1_epi8( 'A' - 1 ) ),
+                                                _mm_cmplt_epi8( d, _mm_set1_epi8( 'Z' + 1 ) ) );
+                d = _mm_or_si128( d, _mm_and_si128( upper, _mm_set1_epi8( 0x20 ) ) );
+            }
+            __m128i  dk = _mm_xor_si128( d, key[j] );
+            a[j] = _mm_add_epi64( a[j], _mm_shuffle_epi32( d, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+            a[j] = _mm_add_epi64( a[j], _mm_mul_epu32( dk, _mm_srli_epi64( dk, 32 ) ) );
+        }
+        if ((s + 1) % SCRAMBLE_EVERY == 0) {
+            for (int j = 0;  j < 2;  j++) {
+                __m128i  x  = _mm_xor_si128( _mm_xor_si128( a[j], _mm_srli_epi64( a[j], 47 ) ), key[j] );
+                __m128i  lo = _mm_mul_epu32( x, prime );
+                __m128i  hi = _mm_mul_epu32( _mm_srli_epi64( x, 32 ), prime );
+                a[j] = _mm_add_epi64( lo, _mm_slli_epi64( hi, 32 ) );
+            }
+        }
+    }
+    _mm_storeu_si128( (__m128i*) acc, a[0] );
+    _mm_storeu_si128( (__m128i*) (acc + 2), a[1] );
+}
+
+template <bool NoCase>
+__attribute__((target("avx2")))
+void  stripes_avx2 (uint64_t* acc, const uint8_t* p, size_t nstripes)
+{
+    __m256i  a     = _mm256_loadu_si256( (const __m256i*) acc );
+    __m256i  key   = _mm256_load_si256( (const __m256i*) LANE_KEY );
+    __m256i  prime = _mm256_set1_epi32( int(PRIME32_1) );
+    for (size_t s = 0;  s < nstripes;  s++, p += STRIPE) {
+        __m256i  d = _mm256_loadu_si256( (const __m256i*) p );
+        if (NoCase) {
+            __m256i  upper = _mm256_and_si256( _mm256_cmpgt_epi8( d, _mm256_set1_epi8( 'A' - 1 ) ),
+                                               _mm256_cmpgt_epi8( _mm256_set1_epi8( 'Z' + 1 ), d ) );
+            d = _mm256_or_si256( d, _mm256_and_si256( upper, _mm256_set1_epi8( 0x20 ) ) );
+        }
+        __m256i  dk = _mm256_xor_si256( d, key );
+        a = _mm256_add_epi64( a, _mm256_shuffle_epi32( d, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+        a = _mm256_add_epi64( a, _mm256_mul_epu32( dk, _mm256_srli_epi64( dk, 32 ) ) );
+        if ((s + 1) % SCRAMBLE_EVERY == 0) {
+            __m256i  x  = _mm256_xor_si256( _mm256_xor_si256( a, _mm256_srli_epi64( a, 47 ) ), key );
+            __m256i  lo = _mm256_mul_epu32( x, prime );
+            __m256i  hi = _mm256_mul_epu32( _mm256_srli_epi64( x, 32 ), prime );
+            a = _mm256_add_epi64( lo, _mm256_slli_epi64( hi, 32 ) );
+        }
+    }
+    _mm256_storeu_si256( (__m256i*) acc, a );
+}
+
+#endif
+
+template <bool NoCase>
+inline StripesFn  pick_stripes ()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports( "avx2" ))
+        return stripes_avx2<NoCase>;
+    if (__builtin_cpu_supports( "sse2" ))
+        return stripes_sse2<NoCase>;
+#endif
+    return stripes_scalar<NoCase>;
+}
+
+// chosen once, on first use: a function-local static is set before anyone reads
+// it, also from another translation unit's static initializers
+template <bool NoCase>
+inline StripesFn  stripes ()
+{
+    static const StripesFn  kernel = pick_stripes<NoCase>();
+    return kernel;
+}
+
+template <bool NoCase>
+inline size_t  hash_bytes_with (StripesFn kernel, const void* data, size_t len)
+{
+    const uint8_t*  p = (const uint8_t*) data;
+    uint64_t  h = len * PRIME64_1;
+    size_t    nstripes = len / STRIPE;
+    if (nstripes) {
+        uint64_t  acc[4] = { PRIME64_1, PRIME64_2, PRIME32_1, PRIME64_1 ^ PRIME64_2 };
+        kernel( acc, p, nstripes );
+        for (int j = 0;  j < 4;  j++)
+            h = (h ^ mix_hash( acc[j] )) * PRIME64_2;
+        p   += nstripes * STRIPE;
+        len -= nstripes * STRIPE;
+    }
+    for ( ;  len >= 8;  p += 8, len -= 8)
+        h = (h ^ mix_hash( load64<NoCase>( p ) * PRIME64_2 )) * PRIME64_1;
+    if (len) {
+        uint64_t  d = read_tail( p, len );
+        h = (h ^ mix_hash( (NoCase ? fold_case64( d ) : d) * PRIME64_2 )) * PRIME64_1;
+    }
+    return mix_hash( h );
+}
+
+} // namespace hash_detail
+
+inline size_t  hash_bytes (const void* p, size_t len)
+{
+    return hash_detail::hash_bytes_with<false>( hash_detail::stripes<false>(), p, len );
+}
+
+inline size_t  hash_bytes_nocase (const void* p, size_t len)
+{
+    return hash_detail::hash_bytes_with<true>( hash_detail::stripes<true>(), p, len );
+}
+
+
 // ================================================================
 // Basic hash and compare functor types
 // ================================================================
@@ -26,19 +271,28 @@ template <typename T> struct Comp {
 };
 
 template <> struct Hash< const char* > {
-    size_t  operator() (const char* s) const
-                        {
-                            std::size_t  seed = 0;
-                            for ( ; *s; s++)
-                                hash_combine( seed, *s );
-                            return seed;
-                        }
+    size_t  operator() (const char* s) const    { return hash_bytes( s, strlen(s) ); }
 };
 
 template <> struct Comp< const char* > {
     bool  operator() (const char* a, const char* b) const { return strcmp(a, b) == 0; }
 };
 
+// A lookup key with its hash, computed ahead: hash once and look up in several tables,
+// or hash away from the hot loop.  'hash' must be what the container's Hasher gives for
+// 'key'.  The string keyed containers (Dict, Dictionary, NameMap) all hash names with
+// hash_bytes, so prehash() serves them all.
+template <typename K> struct Prehashed {
+    K       key;
+    size_t  hash;
+};
+
+inline Prehashed<std::string_view>  prehash (std::string_view s)
+                        { return { s, hash_bytes( s.data(), s.size() ) }; }
+
+// The std::string hashers stop at the first '\0' like the compares (which
+// go through c_str()), so strings equal to strcasecmp hash the same.
+
 // can be used for both Hasher and Comper
 struct BinStringNoCase {
     // Compare
@@ -47,12 +301,7 @@ struct BinStringNoCase {
                         { return strcasecmp(a.c_str(), b.c_str()) == 0; }
     // Hash
     size_t  operator() (const char* s) const
-                        {
-                            std::size_t  seed = 0;
-                            for ( ; *s; s++)
-                                hash_combine( seed, tolower(*s) );
-                            return seed;
-                        }
+                        {   return hash_bytes_nocase( s, strlen(s) );  }
     size_t  operator() (const std::string& s) const
                         {   return (*this)( s.c_str() );  }
 };
@@ -75,12 +324,8 @@ public:
     // Hash
     std::size_t  operator() (const char* s) const
                         {
-                            std::size_t  seed = 0;
-                            if (case_sense)
-                                for ( ; *s; s++) hash_combine( seed, *s );
-                            else
-                                for ( ; *s; s++) hash_combine( seed, tolower(*s) );
-                            return seed;
+                            size_t  len = strlen(s);
+                            return case_sense ? hash_bytes( s, len ) : hash_bytes_nocase( s, len );
                         }
     size_t  operator() (const std::string& s) const
                         {   return (*this)( s.c_str() );  }
@@ -105,719 +350,6856 @@ public:
 };
 
 
-} // namesapce util
+// ================================================================
+// bucket index policies
+//
+// map a hash value to a bucket in [0, n).  resize(n) is called whenever
+// the bucket count changes and returns the count actually used (a policy
+// may round it up); the table is sized from that return value.
+//
+//   ModuloIndex       h % n. any n. the default, and what the tables always did
+//   PowerOfTwoIndex   mix(h) & (n - 1). n rounded up to a power of 2
+//   FastRangeIndex    (mix(h) * n) >> 64 (Lemire). any n, no division
+//   MagicModIndex     (h ^ h >> 32) % n, low 32 bits of the fold only, by a
+//                     precomputed reciprocal (Lemire "fastmod"). n < 2^32.
+//                     Not h % n: fastmod divides 32 bit values, and the fold
+//                     keeps the high half of h in play
+//
+// The masking and fastrange policies only look at some of the bits of h,
+// so h is put through a finalizer first: std::hash of an integer is the
+// integer itself, and its low / high bits alone are poor bucket indexes.
+// ================================================================
 
-#pragma once
+struct ModuloIndex {
+    size_t  n = 1;
 
-#include <vector>
-#include <map>
-#include <algorithm>
-#include <string>
-#include <cstring>
-#include <ctype.h>
-#include <cassert>
+    size_t  resize (size_t x)                   { n = x ? x : 1;  return n; }
+    size_t  operator() (size_t h) const         { return h % n; }
+};
 
-#include "HashOps.h"
+struct PowerOfTwoIndex {
+    size_t  mask = 0;
 
-namespace Util {
+    size_t  resize (size_t x)
+                        {
+                            size_t  n = 1;
+                            while (n < x)
+                                n *= 2;
+                            mask = n - 1;
+                            return n;
+                        }
+    size_t  operator() (size_t h) const         { return mix_hash( h ) & mask; }
+};
+
+struct FastRangeIndex {
+    uint64_t  n = 1;
+
+    size_t  resize (size_t x)                   { n = x ? x : 1;  return n; }
+    size_t  operator() (size_t h) const
+                        {  return size_t( (unsigned __int128)( mix_hash( h ) ) * n >> 64 );  }
+};
+
+struct MagicModIndex {
+    uint64_t  m = 0;    // ceil( 2^64 / n ), wraps to 0 for n == 1
+    uint32_t  n = 1;
+
+    size_t  resize (size_t x)
+                        {
+                            assert( x <= UINT32_MAX );
+                            n = x ? uint32_t( x ) : 1;
+                            m = UINT64_C( 0xFFFFFFFFFFFFFFFF ) / n + 1;
+                            return n;
+                        }
+    // uint32_t( h ^ h >> 32 ) % n
+    size_t  operator() (size_t h) const
+                        {
+                            uint64_t  lowbits = m * uint32_t( h ^ (h >> 32) );
+                            return size_t( (unsigned __int128)( lowbits ) * n >> 64 );
+                        }
+};
 
 
 // ================================================================
-// hash base
-//
-// do the hash calculations and control the vectors, but don't own
-// any memory.
+// bulk build
 //
-// TODO: make this the base of HashSet and HashMap in "Hash.h"
+// what HashBase::bulk_build / FlatHash::bulkBuild do with equal keys
+// in their input:
+//   FirstWins   keep the first, drop the rest
+//   LastWins    keep the first entry, with the value of the last one
+//   Error       throw std::runtime_error
 // ================================================================
 
-// requires:
-//    T = Entries::value_type;
+enum class DupPolicy { FirstWins, LastWins, Error };
+
+// hashes[i] = hash( i ) for i in [0, n), in 'threads' threads
+// (0 = one per core). 'hash' must be safe to call concurrently.
+template <typename HashI>
+void  parallel_hash (size_t n, size_t* hashes, HashI hash, unsigned threads = 0)
+{
+    if (threads == 0)
+        threads = std::max( 1u, std::thread::hardware_concurrency() );
+    threads = std::min<size_t>( threads, std::max<size_t>( 1, n / 65536 ) );   // not worth a thread otherwise
+    auto  run = [&] (size_t lo, size_t hi) {
+                            for (size_t i = lo;  i < hi;  i++)
+                                hashes[i] = hash( i );
+                        };
+    std::vector<std::thread>  pool;
+    for (unsigned t = 1;  t < threads;  t++)
+        pool.emplace_back( run, n * t / threads, n * (t + 1) / threads );
+    run( 0, n / threads );
+    for (std::thread& t : pool)
+        t.join();
+}
+
+// Counting sort of [0, n) by bucket( hashes[i] ), stable. Items of bucket b
+// end up in order[ starts[b] .. starts[b + 1] ).
+template <typename Bucket>
+void  bucket_order (const size_t* hashes, size_t n, const Bucket& bucket, size_t nbuckets,
+                    std::vector<size_t>& starts, std::vector<size_t>& order)
+{
+    std::vector<size_t>  b( n );
+    starts.assign( nbuckets + 1, 0 );
+    for (size_t i = 0;  i < n;  i++) {
+        b[i] = bucket( hashes[i] );
+        starts[ b[i] + 1 ]++;
+    }
+    for (size_t k = 0;  k < nbuckets;  k++)
+        starts[k + 1] += starts[k];
+    order.resize( n );
+    std::vector<size_t>  fill( starts.begin(), starts.end() - 1 );
+    for (size_t i = 0;  i < n;  i++)
+        order[ fill[ b[i] ]++ ] = i;
+}
+
+
+// ================================================================
+// table statistics
 //
-//    IdType   T::next () const;
-//    void     T::next (IdType id);
+//   HashStats  stats () const;   // HashBase, HashSet, FlatHash, HashMap, Dictionary, Dict
 //
-//    void  T::operator= (AccessT val);  // or ref or const ref
-//    operator AccessT () const;
-
-// //    // ONLY needed if 'remove' is called           possible implementations:
-// //    bool  T::removed(IdType);  // is it removed.   bool  removed (int i) 
-// //    void  T::remove(IdType);   // tag as removed. needed if 'remove' is called
-// 
-//    IdType = IndexAryT::value_type
-// 
-//    size_t  Ops::operator() (const T& x);  // hash value of 't'
-//    bool    Ops::operator() (const T& a, const T& b);  // a == b
+// The shape of the table -- chain lengths, free list, bytes -- is measured
+// by the call, which walks every bucket: O(buckets + entries), for
+// scraping, not for a hot path. The expected probes follow from the shape:
+// a hit on the k-th entry of a chain costs k compares, a miss costs the
+// whole chain.
+//
+// Measured probes need counters in the lookups, so they are compiled in
+// only when the container's Counters parameter is HashCounters; the
+// default, NoHashCounters, is empty and costs nothing. HashCounters are
+// plain (not atomic) mutable counts: a table that keeps them must not be
+// read by several threads at once.
+//
+// Rehash count and time are always kept (RehashClock): rehashes are rare
+// and cost O(n) anyway. Incremental steps count toward the time.
+// ================================================================
 
-template <typename Entries,     // indexable AuData type (StringArray, Array, VarArray, ...)
-                                //  or std::vector<T>, std::deque<T>
-          typename Indexes,     // hash table array type (e.g., Array<int>, std::vector<size_t>)
-          typename Ops = SearchOps< typename Entries::value_type >,
-          typename AccessT = typename Entries::value_type
-          >
-class HashBase
+struct HashStats
 {
-    using  T  = typename Entries::value_type;
-    using  Id = typename Indexes::value_type;
-    static constexpr  Id  EOL = ~0;
+    size_t    size        = 0;      // live entries
+    size_t    buckets     = 0;
+    size_t    slots       = 0;      // entry slots, live or free
+    size_t    free_list   = 0;      // free slots
+    double    load_factor = 0;      // size / buckets
+    size_t    max_chain   = 0;
+    std::vector<size_t>  chains;    // chains[k] = number of buckets with k entries
+
+    double    expected_probes_hit  = 0;     // mean compares per lookup, from the shape
+    double    expected_probes_miss = 0;
+
+    // lookups, HashCounters only
+    bool      counted     = false;
+    uint64_t  hits        = 0;
+    uint64_t  misses      = 0;
+    uint64_t  probes_hit  = 0;      // compares, summed over lookups
+    uint64_t  probes_miss = 0;
+
+    uint64_t  rehashes       = 0;
+    double    rehash_seconds = 0;
+
+    // allocated, not just used
+    size_t    table_bytes  = 0;
+    size_t    entry_bytes  = 0;
+    size_t    string_bytes = 0;     // key storage outside the entries (Dictionary, Dict)
+
+    double  probes_per_hit () const     {  return hits ? double( probes_hit ) / hits : 0;  }
+    double  probes_per_miss () const    {  return misses ? double( probes_miss ) / misses : 0;  }
+    size_t  total_bytes () const        {  return table_bytes + entry_bytes + string_bytes;  }
+
+    // ==== filled in by the containers' stats()
+    void  add_chain (size_t len)
+                        {
+                            if (chains.size() <= len)
+                                chains.resize( len + 1 );
+                            chains[len]++;
+                            max_chain = std::max( max_chain, len );
+                            buckets++;
+                            expected_probes_hit += len * (len + 1) / 2.0;     // summed here, divided in finish()
+                        }
 
-    // // enable 'remove' function by adding "using  Removable = bool;" to T class. TODO: FIX
-    // //// enable 'remove' function by adding "constexpr bool  Removable = true;" to T class.
+    void  finish ()
+                        {
+                            load_factor = buckets ? double( size ) / buckets : 0;
+                            expected_probes_hit = size ? expected_probes_hit / size : 0;
+                            expected_probes_miss = load_factor;
+                        }
 
-    // // primary template handles T witout nested ::Removable member
-    // template <typename, typename = void>
-    // struct  Removable : std::false_type {};
- 
-    // // specialization recognizes T with nested ::Removable member
-    // template <>
-    // struct  Removable< T, std::void_t<typename T::Removable>> : std::true_type {};
+    void  print (FILE* f = NULL) const;     // NULL = stdout
+};
 
-    // ==== Id's for 'remove' -- if remove is not used, -1 is the only special index
-    //        Id >= 0:   index in 'd_entries' of next hash bin entry.
-    //        Id == -1:  end of hash bin list.
-    //        Id == -2:  end of free_list.
-    //        Id < -2:   index (= -3 - 'next')  in 'd_entries' of next free
-    static inline Id  _free_list_link (Id x)  { return -3 - x; }
 
-public:
+inline void  HashStats::print (FILE* f) const
+{
+    if (!f) f = stdout;
+    fprintf( f, "Size %zu in %zu buckets (load %.2f), %zu slots, %zu free\n",
+             size, buckets, load_factor, slots, free_list );
+    fprintf( f, "Chains:" );
+    for (size_t k = 0;  k < chains.size();  k++)
+        if (chains[k])
+            fprintf( f, "  %zu:%zu", k, chains[k] );
+    fprintf( f, "\nProbes per hit %.2f, per miss %.2f (expected from chains)\n",
+             expected_probes_hit, expected_probes_miss );
+    if (counted)
+        fprintf( f, "Lookups: %llu hits at %.2f probes, %llu misses at %.2f probes\n",
+                 (unsigned long long) hits, probes_per_hit(), (unsigned long long) misses, probes_per_miss() );
+    fprintf( f, "Rehashes: %llu, %.3f s\n", (unsigned long long) rehashes, rehash_seconds );
+    fprintf( f, "Bytes: table %zu, entries %zu, strings %zu, total %zu\n",
+             table_bytes, entry_bytes, string_bytes, total_bytes() );
+}
 
-    // grouped data fields needed for serialization
-    class Attrs
-    {
-        friend class HashBase;
 
-        Id            free_list   = -2;     // index of first unused d_entries slot; others are linked
-        Id            size        = 0;      // number of non-removed entries (not d_entries.size())
+// lookup counters, the Counters parameter of the containers
+struct NoHashCounters
+{
+    static constexpr bool  enabled = false;
+    void  hit (size_t) const            {}
+    void  miss (size_t) const           {}
+    void  fill (HashStats&) const       {}
+    void  reset ()                      {}
+};
 
-        // user settable at construction only
-        size_t        hash_size   = 101;    // number of hash buckets (size of d_table)
-        bool          pre_filled  = false;  // set true if contructor input vec's contain valid data
+struct HashCounters
+{
+    static constexpr bool  enabled = true;
+    mutable uint64_t  hits = 0, misses = 0, probes_hit = 0, probes_miss = 0;
+
+    void  hit (size_t probes) const     {  hits++;  probes_hit += probes;  }
+    void  miss (size_t probes) const    {  misses++;  probes_miss += probes;  }
+    void  fill (HashStats& s) const
+                        {
+                            s.counted = true;
+                            s.hits = hits;
+                            s.misses = misses;
+                            s.probes_hit = probes_hit;
+                            s.probes_miss = probes_miss;
+                        }
+    void  reset ()                      {  hits = misses = probes_hit = probes_miss = 0;  }
+};
 
-        // user settable at any time
-        int           max_depth   = 4;      // rehash occurs if average depth exceeds this value
-        int           rehash_mult = 4;      // if a rehash is needed, by how much is hash_size increased
 
+// rehash count and time; Scope adds the time from its construction to its destruction
+struct RehashClock
+{
+    uint64_t  count   = 0;
+    double    seconds = 0;
+
+    class Scope
+    {
+        RehashClock&  d_clock;
+        std::chrono::steady_clock::time_point  d_start = std::chrono::steady_clock::now();
     public:
-        Attrs () {}
-        // for chaining
-        Attrs&  set_hash_size (int x)           { hash_size = x;     return *this; }
-        Attrs&  set_max_depth (int x)           { max_depth = x;     return *this; }
-        Attrs&  set_rehash_mult (int x)         { rehash_mult = x;   return *this; }
-        Attrs&  set_pre_filled (bool x = true)  { pre_filled = x;    return *this; }
+        explicit Scope (RehashClock& c) : d_clock( c ) {}
+        ~Scope ()       {  d_clock.seconds += std::chrono::duration<double>( std::chrono::steady_clock::now() - d_start ).count();  }
     };
 
-private:
+    void  fill (HashStats& s) const     {  s.rehashes = count;  s.rehash_seconds = seconds;  }
+};
 
-    Attrs     d;
 
-    T           d_null_val;  // removed items are set to this, so real entries can be deleted
+// allocated bytes of a vector-like container (its size if it has no capacity)
+template <typename C>
+size_t  container_bytes (const C& c)
+{
+    if constexpr (requires { c.capacity(); })
+        return c.capacity() * sizeof( typename C::value_type );
+    else
+        return c.size() * sizeof( typename C::value_type );
+}
 
-    Indexes&    d_table;
-    Entries&    d_entries;   // entries
-    Ops&        d_ops;       // functors to compute hash value from T and to compare two T's
+// allocated and not in use
+template <typename C>
+size_t  container_slack (const C& c)
+{
+    return (c.capacity() - c.size()) * sizeof( typename C::value_type );
+}
 
+// a std::make_shared<T> allocation: the T, and the vtable pointer and counts beside it
+template <typename T>
+constexpr size_t  shared_block_bytes ()
+{
+    return sizeof( T ) + sizeof( void* ) + 2 * sizeof( int );
+}
 
-public:
 
-    // samples:
-    //    // create new with hash_size = 42
-    //    HashBase  h( evec, hvec, ops, Attrs().set_hash_size(42) );
-    //
-    //    // create from previous vectors and set max_depth = 10
-    //    HashX::Attrs ...
-    //    HashBase  h( evec, hvec, ops, Attrs().set_pre_filled().set_max_depth(10) );
+// ================================================================
+// memory accounting
+//
+//   MemoryUsage  memory_usage () const;   // HashSet, SparseStore, Dict, SparseArray
+//   size_t       size_bytes () const;     // Dict, SparseArray: memory_usage().total()
+//   void         shrink_to_fit ();        // give the slack back to the allocator
+//
+// Bytes are allocated bytes, capacity not size; 'slack' is the part of them
+// not in use, which shrink_to_fit() gives back.  The object itself is not
+// counted, its shared_ptr blocks are.  A Dict or SparseArray counts its
+// share of storage it shares with slices, 1 / holders of it, so the sizes
+// over a tree add up to what the tree holds.  memory_usage() is O(1) for the
+// tables (O(chunks) for a bitmap SparseStore): a scheduler may poll it.
+//
+// MemoryReport sums memory_usage() per schema node: the walk over a DataObj
+// tree calls memory_report( report, node ) on each container.
+// ================================================================
 
-    HashBase (Entries& entries_vec, // memory for values and 'next' index
-              Indexes& table_vec,   // memory for hash table
-              Ops& search_ops,
-              const Attrs& attrs = Attrs());
+struct MemoryUsage
+{
+    size_t  table   = 0;        // buckets, indexes, bitmaps
+    size_t  entries = 0;        // entries and values
+    size_t  strings = 0;        // key storage outside the entries
+    size_t  control = 0;        // shared_ptr blocks and the containers in them
+    size_t  slack   = 0;        // of the above, allocated and not in use
 
-    // to set search hash parameters during construction
-    void  set_null_val (const T& x)             { d_null_val = x; }
+    size_t  total () const      {  return table + entries + strings + control;  }
 
-    void  predict (size_t nnodes);
+    MemoryUsage&  operator+= (const MemoryUsage& x)
+                        {
+                            table += x.table;  entries += x.entries;  strings += x.strings;
+                            control += x.control;  slack += x.slack;
+                            return *this;
+                        }
 
-    Attrs&  attrs ()                            { return d; }
+    // the share of one of 'holders'
+    MemoryUsage  shared (size_t holders) const
+                        {
+                            if (holders <= 1)
+                                return *this;
+                            return { table / holders, entries / holders, strings / holders,
+                                     control / holders, slack / holders };
+                        }
+};
 
-    // ==== insertions / deletions
-    // Insert 'v' if table does not already contain an entry matching 'v'.
-    // If inserting (no previous match to v), return pair( 'v', true ),
-    // else return pair( previous match to 'v', false ).
-    std::pair<const AccessT&, bool>  insert (const AccessT& v);
 
-    // Adds 'v' into the table regardless of whether the table already contain an entry matching 'v'.
-    // If inserting (no previous match to v), return pair( 'v', true ),
-    // else if assigning (previous match to v), return pair( previous match to 'v', false ).
-    std::pair<const AccessT&, bool>  insert_or_assign (const AccessT& v);
+class MemoryReport
+{
+public:
+    void    add (const std::string& node, const MemoryUsage& u)
+                        {  Node& n = d_nodes[node];  n.usage += u;  n.objects++;  }
 
-    void  rehash (size_t new_hash_size);
+    MemoryUsage  total () const
+                        {
+                            MemoryUsage  t;
+                            for (const auto& [name, n] : d_nodes)
+                                t += n.usage;
+                            return t;
+                        }
 
-    // Return true if an entry matching 'v' existed and was removed.
-    bool  remove (const AccessT& v);
+    // a line per node, in name order, then the total
+    void    print (FILE* f = NULL) const;     // NULL = stdout
 
-    void  remove_by_index (Id i);
+private:
+    struct Node {
+        MemoryUsage  usage;
+        size_t       objects = 0;
+    };
+    std::map<std::string, Node>  d_nodes;
+};
 
-    // remove all entries. does not change the hash_size.
-    void  clear ();
 
-    // ==== access
-    bool  empty () const      {  return d.size == 0;  }
-    size_t  size () const     {  return d.size;  }
-    bool  contains (const AccessT& v) const;
+inline void  MemoryReport::print (FILE* f) const
+{
+    if (!f) f = stdout;
+    auto  line = [f] (const char* name, size_t objects, const MemoryUsage& u) {
+        fprintf( f, "%-32s %8zu %12zu %12zu %12zu %10zu %12zu %12zu\n",
+                 name, objects, u.table, u.entries, u.strings, u.control, u.slack, u.total() );
+    };
+    fprintf( f, "%-32s %8s %12s %12s %12s %10s %12s %12s\n",
+             "node", "objects", "table", "entries", "strings", "control", "slack", "total" );
+    size_t  objects = 0;
+    for (const auto& [name, n] : d_nodes) {
+        line( name.c_str(), n.objects, n.usage );
+        objects += n.objects;
+    }
+    line( "total", objects, total() );
+}
 
-    // if set contains 'v', return pair( ref to set's value, true ), else return pair('v', false)
-    std::pair<const AccessT&, bool>  find (const AccessT& v) const;
 
-    // ================ direct indexing support
-    // same as above, but return the entry id as the first element of the return pair
-    std::pair<Id, bool>  insert2 (const AccessT& v);
-    std::pair<Id, bool>  insert_or_assign2 (const AccessT& v);
+} // namesapce util
 
-    // Appends 'v' into the table regardless of whether the table already contain an entry matching 'v'.
-    // If 'v' already exists, only one is returned with 'find' (likely the new entry).
-    Id  insert_end (const AccessT& v);
+#pragma once
 
-    // return ~0 if not found
-    Id  find2 (const AccessT& v) const;
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cassert>
+#include <span>
+#include <stdexcept>
+#include <string>
 
-    // pair.second is false for a bad index or deleted element
-    std::pair<const AccessT&, bool>  at (Id id) const;
+#include "HashOps.h"
+#include "Hash.h"
 
-    // ==== iterate ====
-    // usage:
-    //   for (HashSet<T,...>::Iterator it(hash_set);  it();  ++it) {
-    //       const T&  t = *it;
-    //       ...
-    //   }
-    // or
-    //   for (const T& val : hash_base) { ... }
-    class Iterator {
-        using  Iter = typename Entries::iterator;
-        Iter  it, end;
-        void  _advance ()      { while (it != end && it->next() < EOL) ++it; } // skip deletions
-        Iterator (Iter i, Iter e)       : it(i), end(e) { _advance(); }
-    public:
-        Iterator (HashBase& h)          : it( h.d_entries.begin() ), end( h.d_entries.end() ) { _advance(); }
-        bool  operator() ()             {  return it != end;  }
-        void  operator++ ()             {  if (it != end) ++it;  _advance();  } // skip deletions
-        const AccessT&  operator* ()    {  return it->val();  }
-        bool  operator!= (Iterator& x)  { return it != end; }
-    };
+namespace Util {
 
-    Iterator  begin ()                  { return Iterator( d_entries.begin(), d_entries.end() ); }
-    Iterator  end ()                    { return Iterator( d_entries.end(),   d_entries.end() ); }
 
-    // ================
-    // ==== stats
+// ================================================================
+// sparse store
+//
+// The non-default elements of a sparse array, index -> T, in one of
+// three representations:
+//
+//   Hash     (index, value) pairs in a HashSet. O(1) lookup and write
+//            anywhere; scans sort first. ~ 16 + sizeof(T) bytes an element
+//   Runs     the indexes, sorted, and their values in two vectors. Binary
+//            search; appends O(1), other writes O(n). 4 + sizeof(T) bytes
+//   Bitmap   roaring style: a bitmap per 2^16 indexes, with the number of
+//            bits set before each 64 bit word, and the chunk's values in
+//            index order. Lookup is a bit test and a popcount; writes are
+//            O(chunk). sizeof(T) bytes an element, plus 10 bits per 64
+//            indexes of each chunk with an element
+//
+// Runs and Bitmap scan in index order straight from memory, and gather()
+// copies a full bitmap word's values as one block.
+//
+// Mode::Auto adapts: it starts in Runs, and moves between Runs and Bitmap
+// by density (Bitmap from 1/32 up, where it takes less memory than the
+// indexes and lookups stop searching) each time the size doubles. Writes out
+// of index order cost O(n) there, so once they pass 1/8 of the size it moves
+// to Hash. optimize() (SparseArray calls it before serialize) moves back.
+// ================================================================
 
-    size_t  bucket_count () const       {  return d.hash_size;  }
-    void  print_histogram (FILE* f = NULL) const; // NULL = stdout
+template <typename T>
+class SparseStore
+{
+public:
+    enum class Mode { Auto, Hash, Runs, Bitmap };
+
+    static const char*  mode_name (Mode m)
+                { static const char* names[] = { "auto", "hash", "runs", "bitmap" };  return names[int( m )]; }
+
+    SparseStore (Mode m = Mode::Auto)   : d_auto( m == Mode::Auto ), d_mode( m == Mode::Auto ? Mode::Runs : m ) {}
+
+    size_t  size () const               { return d_size; }
+    bool    empty () const              { return d_size == 0; }
+    size_t  span () const               { return d_span; }      // 1 + the highest index ever set
+    Mode    mode () const               { return d_mode; }      // Hash, Runs or Bitmap
+    bool    adaptive () const           { return d_auto; }
+
+    // pin a representation, or Auto to adapt again
+    void    set_mode (Mode m);
+    // Auto only: the representation for the density, now that writes are over
+    void    optimize ();
+
+    // nullptr if 'i' is not set; valid until the next write
+    const T*  find (size_t i) const;
+    bool      contains (size_t i) const                 { return find( i ) != nullptr; }
+    T         get (size_t i, const T& dflt) const       { const T* p = find( i );  return p ? *p : dflt; }
+
+    // indexes are kept as uint32_t: throws std::out_of_range from 2^32 up
+    void    set (size_t i, const T& v);
+    bool    erase (size_t i);
+    void    clear ();
+
+    // out[k] = element lo + k, or 'dflt', for k < n
+    void    gather (size_t lo, size_t n, T* out, const T& dflt) const;
+
+    // f(size_t index, const T&) for each element in [lo, hi), in index order
+    template <typename F>  void  for_each (size_t lo, size_t hi, F f) const;
+    template <typename F>  void  for_each (F f) const   { for_each( 0, d_span, f ); }
+
+    // the elements in [lo, hi) at indexes from 0, in a store with the same mode
+    SparseStore  range (size_t lo, size_t hi) const;
+
+    // replace the elements by sorted runs, e.g. read back from a file: taken as they are
+    // for Runs, then Auto picks by density and a pinned mode is built from them
+    void    assign (std::vector<uint32_t> index, std::vector<T> vals);
+    // Runs only: the runs with indexes in [lo, hi), where they are stored; false in another mode
+    bool    runs (size_t lo, size_t hi, std::span<const uint32_t>& index, std::span<const T>& vals) const;
+
+    // allocated bytes; see "memory accounting" in HashOps.h
+    MemoryUsage  memory_usage () const;
+    size_t       bytes () const     { return memory_usage().total(); }
+    // give back the slack of every representation's vectors
+    void         shrink_to_fit ();
+
+    // ==== iterate (index, value) in index order.  In Hash mode begin() sorts a
+    // snapshot of the entries, O(n log n).  Writes invalidate iterators.
+    class iterator
+    {
+        friend class SparseStore;
+        static constexpr size_t  END = ~size_t(0);
+
+        const SparseStore*  s;
+        size_t              d_index = END;
+        const T*            d_val = nullptr;
+        size_t              pos = 0;            // Runs, Hash: element;  Bitmap: element in the chunk
+        size_t              chunk = 0;          // Bitmap
+        size_t              word = 0;
+        uint64_t            bits = 0;           //   bits of 'word' not visited yet
+        std::shared_ptr<std::vector<std::pair<size_t, const T*>>>  snapshot;   // Hash
+
+        iterator (const SparseStore* s_)    : s( s_ ) {}
+        void  settle ();
+
+    public:
+        size_t      index () const                          { return d_index; }
+        const T&    value () const                          { return *d_val; }
+        std::pair<size_t, const T&>  operator* () const     { return { d_index, *d_val }; }
+        iterator&   operator++ ();
+        bool        operator== (const iterator& x) const    { return d_index == x.d_index; }
+        bool        operator!= (const iterator& x) const    { return d_index != x.d_index; }
+    };
+
+    iterator  begin () const;
+    iterator  end () const      { return iterator( this ); }
 
 private:
+    // ==== Hash
+    using Pair = std::pair<uint32_t, T>;
+    struct PairOps {
+        size_t  operator() (const Pair& p) const                { return p.first; }    // PowerOfTwoIndex mixes
+        bool    operator() (const Pair& a, const Pair& b) const { return a.first == b.first; }
+    };
+    using HashT = HashSet<Pair, PairOps, PairOps, PowerOfTwoIndex>;
+
+    int     _hash_find (size_t i) const
+                { return d_hash.find_hashed( i, [i] (const Pair& p) { return p.first == i; } ); }
+
+    // ==== Bitmap
+    static constexpr size_t  CHUNK_BITS = 16;
+    static constexpr size_t  CHUNK = size_t(1) << CHUNK_BITS;
+    static constexpr size_t  WORDS = CHUNK / 64;
+
+    struct Chunk {
+        uint64_t        bits[WORDS] = {};
+        uint16_t        rank[WORDS] = {};   // bits set in the words before; valid below 'used'
+        uint16_t        used = 0;           // 1 + the highest word with a bit ever set
+        std::vector<T>  vals;               // a value per bit set, in index order
+
+        size_t  pos (size_t w, uint64_t bit) const  { return rank[w] + std::popcount( bits[w] & (bit - 1) ); }
+        void    use (size_t w)
+                    {
+                        // words past 'used' have no bits: their rank is the chunk's count
+                        for (;  used <= w;  used++)
+                            rank[used] = used ? rank[used - 1] + std::popcount( bits[used - 1] ) : 0;
+                    }
+    };
 
-    Id  _new_entry (const T& val, Id next)
-                        {
-                            d.size++;
-                            if (/* Removable and */ d.free_list != _free_list_link(EOL)) {
-                                Id  idx = _free_list_link( d.free_list );
-                                d.free_list = d_entries[idx].next();
-                                d_entries[idx] = val;
-                                d_entries[idx].next( next );
-                                return idx;
-                            }
-                            else {
-                                Id  idx = d_entries.size();
-                                d_entries.emplace_back( val );
-                                d_entries[idx].next( next );
-                                return idx;
-                            }
-                        }
+    const Chunk*  _chunk (size_t c) const
+                { return c < d_chunk_at.size() && d_chunk_at[c] >= 0 ? &d_chunks[d_chunk_at[c]] : nullptr; }
+    Chunk&        _new_chunk (size_t c);
+
+    // ==== representations
+    const T*  _find (size_t i) const;
+    bool      _set (size_t i, const T& v);      // true if 'i' is new
+    bool      _erase (size_t i);
+    void      _rebuild (Mode to);
+    void      _adapt ();
+
+    bool                   d_auto;
+    Mode                   d_mode;
+    size_t                 d_size = 0;
+    size_t                 d_span = 0;
+    size_t                 d_out_of_order = 0;  // new indexes below span since the last rebuild
+    size_t                 d_next_check = 64;   // size at which Auto looks at the density again
+
+    std::vector<uint32_t>  d_run_index;         // Runs
+    std::vector<T>         d_run_vals;
+    std::vector<int32_t>   d_chunk_at;          // Bitmap: chunk number -> d_chunks position, or -1
+    std::vector<Chunk>     d_chunks;
+    HashT                  d_hash{ 16 };        // Hash
 };
 
 
-// ================================================================
-//  Details:
-//   methods for hash set
-// ================================================================
+template <typename T>
+const T*  SparseStore<T>::find (size_t i) const
+{
+    return i < d_span ? _find( i ) : nullptr;
+}
 
-// ==== create new
-template <typename Entries, typename Indexes, typename Ops, typename AccessT>
-HashBase<Entries,Indexes,Ops,AccessT>::HashBase (Entries& entries,
-                                                 Indexes& table,
-                                                 Ops& search_ops,
-                                                 const Attrs& attrs_)
-    : d( attrs_ ),
-      d_table( table ),
-      d_entries( entries ),
-      d_ops( search_ops )
+template <typename T>
+const T*  SparseStore<T>::_find (size_t i) const
 {
-    if (not d.pre_filled) {
-        d_table.resize( d.hash_size, EOL );
-        for (size_t i = 0;  i < d.hash_size;  i++)
-            d_table[i] = EOL;
-        d.pre_filled = true;
+    switch (d_mode) {
+    case Mode::Hash: {
+        int  id = _hash_find( i );
+        return id < 0 ? nullptr : &d_hash.at( id ).second;
+    }
+    case Mode::Runs: {
+        auto  it = std::lower_bound( d_run_index.begin(), d_run_index.end(), uint32_t( i ) );
+        return it != d_run_index.end() && *it == i ? &d_run_vals[it - d_run_index.begin()] : nullptr;
+    }
+    default: {
+        const Chunk*  ch = _chunk( i >> CHUNK_BITS );
+        if (!ch)
+            return nullptr;
+        size_t    b = i & (CHUNK - 1), w = b / 64;
+        uint64_t  bit = uint64_t(1) << (b % 64);
+        return (ch->bits[w] & bit) ? &ch->vals[ch->pos( w, bit )] : nullptr;
+    }
     }
-    else
-        assert( d.hash_size == table.size() );
 }
 
-
-template <typename Entries, typename Indexes, typename Ops, typename AccessT>
-void  HashBase<Entries,Indexes,Ops,AccessT>::predict (size_t nnodes)
+template <typename T>
+void  SparseStore<T>::set (size_t i, const T& v)
 {
-    rehash( nnodes * 21 / 20 / d.max_depth );  // add 5%
-    d_entries.reserve(nnodes);
+    if (i >= (size_t(1) << 32))
+        throw std::out_of_range( "SparseStore: index " + std::to_string( i ) + " past 2^32" );
+    bool  append = i >= d_span;
+    if (_set( i, v )) {
+        d_size++;
+        if (append)
+            d_span = i + 1;
+        else
+            d_out_of_order++;
+        if (d_auto)
+            _adapt();
+    }
 }
 
-
-// Insert 'v' if set does not already contain an entry matching 'v'.
-// If inserting (no previous match to v), return pair( 'v', true ),
-// else return pair( previous match to 'v', false ).
-template <typename Entries, typename Indexes, typename Ops, typename AccessT>
-inline std::pair< const AccessT&, bool >  HashBase<Entries,Indexes,Ops,AccessT>::insert (const AccessT& v)
+template <typename T>
+bool  SparseStore<T>::_set (size_t i, const T& v)
 {
-    std::pair<Id, bool>  x = insert2( v );
-    return std::pair<const AccessT&, bool>( d_entries[x.first].val(), x.second );
+    switch (d_mode) {
+    case Mode::Hash: {
+        int  id = _hash_find( i );
+        if (id >= 0) {
+            const_cast<Pair&>( d_hash.at( id ) ).second = v;
+            return false;
+        }
+        d_hash.insert( Pair( i, v ) );
+        return true;
+    }
+    case Mode::Runs: {
+        if (d_run_index.empty() || i > d_run_index.back()) {
+            d_run_index.push_back( i );
+            d_run_vals.push_back( v );
+            return true;
+        }
+        auto    it = std::lower_bound( d_run_index.begin(), d_run_index.end(), uint32_t( i ) );
+        size_t  k = it - d_run_index.begin();
+        if (*it == i) {
+            d_run_vals[k] = v;
+            return false;
+        }
+        d_run_index.insert( it, i );
+        d_run_vals.insert( d_run_vals.begin() + k, v );
+        return true;
+    }
+    default: {
+        size_t  c = i >> CHUNK_BITS;
+        Chunk&  ch = _chunk( c ) ? d_chunks[d_chunk_at[c]] : _new_chunk( c );
+        size_t    b = i & (CHUNK - 1), w = b / 64;
+        uint64_t  bit = uint64_t(1) << (b % 64);
+        ch.use( w );
+        size_t  k = ch.pos( w, bit );
+        if (ch.bits[w] & bit) {
+            ch.vals[k] = v;
+            return false;
+        }
+        ch.vals.insert( ch.vals.begin() + k, v );
+        ch.bits[w] |= bit;
+        for (size_t x = w + 1;  x < ch.used;  x++)
+            ch.rank[x]++;
+        return true;
+    }
+    }
 }
 
-
-// Adds 'v' into the set regardless of whether the set already contain an entry matching 'v'.
-// If inserting (no previous match to v), return pair( 'v', true ),
-// else if assigning (previous match to v), return pair( previous match to 'v', false ).
-template <typename Entries, typename Indexes, typename Ops, typename AccessT>
-inline std::pair< const AccessT&, bool >
-HashBase<Entries,Indexes,Ops,AccessT>::insert_or_assign (const AccessT& v)
+template <typename T>
+typename SparseStore<T>::Chunk&  SparseStore<T>::_new_chunk (size_t c)
 {
-    std::pair<Id, bool>  x = insert_or_assign2( v );
-    return std::pair<const AccessT&, bool>( d_entries[x.first].val(), x.second );
+    if (c >= d_chunk_at.size())
+        d_chunk_at.resize( c + 1, -1 );
+    d_chunk_at[c] = d_chunks.size();
+    return d_chunks.emplace_back();
 }
 
-
-template <typename Entries, typename Indexes, typename Ops, typename AccessT>
-void  HashBase<Entries,Indexes,Ops,AccessT>::rehash (size_t new_hash_size)
+template <typename T>
+bool  SparseStore<T>::erase (size_t i)
 {
-    // clear new hash table
-    d_table.resize(new_hash_size, EOL);
-    for (Id i = 0;  i < Id(new_hash_size);  i++)
-        d_table[i] = EOL;
-    // go through entries, compute new table slots and build new list links
-    for (Id i = 0, j = d_entries.size();  i < j;  i++) {
-        if (d_entries[i].next() >= EOL) {
-            size_t  h = d_ops( d_entries[i] ) % new_hash_size;
-            d_entries[i].next( d_table[h] );
-            d_table[h] = i;
-        }
-    }
-    d.hash_size = new_hash_size;
+    if (i >= d_span || !_erase( i ))
+        return false;
+    d_size--;
+    return true;
 }
 
-// Return true if an entry matching 'v' existed and was removed.
-template <typename Entries, typename Indexes, typename Ops, typename AccessT>
-bool  HashBase<Entries,Indexes,Ops,AccessT>::remove (const AccessT& v)
+template <typename T>
+bool  SparseStore<T>::_erase (size_t i)
 {
-    size_t  h = d_ops( v ) % d.hash_size;
-    for (Id* i = d_table.data() + h;  *i != EOL;  i = &(d_entries[*i].next())) {
-        T&  e = d_entries[*i];
-        if (d_ops( v, e )) {
-            Id  idx = *i;
-            *i = e.next();
-            e = d.null_val; // force destruction of removed entry, if relevant
-            e.next( d.free_list );
-            d.free_list = _free_list_link( idx );
-            d.size--;
-            return true;
-        }
+    switch (d_mode) {
+    case Mode::Hash:
+        return d_hash.remove( Pair( i, T{} ) );
+    case Mode::Runs: {
+        auto  it = std::lower_bound( d_run_index.begin(), d_run_index.end(), uint32_t( i ) );
+        if (it == d_run_index.end() || *it != i)
+            return false;
+        d_run_vals.erase( d_run_vals.begin() + (it - d_run_index.begin()) );
+        d_run_index.erase( it );
+        return true;
+    }
+    default: {
+        size_t  c = i >> CHUNK_BITS;
+        if (!_chunk( c ))
+            return false;
+        Chunk&    ch = d_chunks[d_chunk_at[c]];
+        size_t    b = i & (CHUNK - 1), w = b / 64;
+        uint64_t  bit = uint64_t(1) << (b % 64);
+        if (!(ch.bits[w] & bit))
+            return false;
+        ch.vals.erase( ch.vals.begin() + ch.pos( w, bit ) );
+        ch.bits[w] &= ~bit;
+        for (size_t x = w + 1;  x < ch.used;  x++)
+            ch.rank[x]--;
+        return true;
+    }
     }
-    return false;
 }
 
+template <typename T>
+void  SparseStore<T>::clear ()
+{
+    d_size = d_span = d_out_of_order = 0;
+    d_next_check = 64;
+    if (d_auto)
+        d_mode = Mode::Runs;
+    std::vector<uint32_t>().swap( d_run_index );
+    std::vector<T>().swap( d_run_vals );
+    std::vector<int32_t>().swap( d_chunk_at );
+    std::vector<Chunk>().swap( d_chunks );
+    d_hash = HashT( 16 );
+}
 
-template <typename Entries, typename Indexes, typename Ops, typename AccessT>
-void  HashBase<Entries,Indexes,Ops,AccessT>::clear ()
+template <typename T>
+void  SparseStore<T>::set_mode (Mode m)
 {
-    for (Id i = 0;  i < d.hash_size;  i++)
-        d_table[i] = EOL;
-    d_entries.clear();
-    d.size = 0;
+    d_auto = m == Mode::Auto;
+    if (d_auto)
+        optimize();
+    else if (m != d_mode)
+        _rebuild( m );
 }
 
+template <typename T>
+void  SparseStore<T>::optimize ()
+{
+    if (!d_auto)
+        return;
+    Mode  to = d_size * 32 >= d_span ? Mode::Bitmap : Mode::Runs;
+    if (to != d_mode)
+        _rebuild( to );
+    d_out_of_order = 0;
+    d_next_check = std::max<size_t>( 64, d_size * 2 );
+}
 
-template <typename Entries, typename Indexes, typename Ops, typename AccessT>
-bool  HashBase<Entries,Indexes,Ops,AccessT>::contains (const AccessT& v) const
+// after a write that added an element, in Auto mode
+template <typename T>
+void  SparseStore<T>::_adapt ()
 {
-    size_t  h = d_ops( v ) % d.hash_size;
-    for (Id i = d_table[h];  i != EOL;  i = d_entries[i].next()) {
-        if (d_ops( v, d_entries[i] ))
-            return true;
+    if (d_mode != Mode::Hash && d_out_of_order > 64 && d_out_of_order * 8 > d_size) {
+        _rebuild( Mode::Hash );
+        d_next_check = ~size_t(0);          // until optimize()
     }
-    return false;
+    else if (d_size >= d_next_check)
+        optimize();
 }
 
-
-// if set contains 'v', return pair( ref to set's value, true ), else return pair('v', false)
-template <typename Entries, typename Indexes, typename Ops, typename AccessT>
-std::pair< const AccessT&, bool >
-HashBase<Entries,Indexes,Ops,AccessT>::find (const AccessT& v) const
+template <typename T>
+void  SparseStore<T>::_rebuild (Mode to)
 {
-    size_t  h = d_ops( v ) % d.hash_size;
-    for (Id i = d_table[h];  i != EOL;  i = d_entries[i].next()) {
-        if (d_ops( v, d_entries[i] ))
-            return std::pair<const T&, bool>( d_entries[i].val(), true );
+    std::vector<uint32_t>  index;
+    std::vector<T>         vals;
+    index.reserve( d_size );
+    vals.reserve( d_size );
+    for_each( [&] (size_t i, const T& v) { index.push_back( i );  vals.push_back( v ); } );
+
+    size_t  span = d_span;
+    bool    adaptive = d_auto;
+    clear();
+    d_auto = adaptive;
+    d_mode = to;
+    d_span = span;
+    d_size = index.size();
+    d_next_check = std::max<size_t>( 64, d_size * 2 );
+    if (to == Mode::Runs) {
+        d_run_index = std::move( index );
+        d_run_vals = std::move( vals );
+        return;
     }
-    return std::pair<const AccessT&, bool>( v, false );
+    if (to == Mode::Hash)
+        d_hash = HashT( std::max<size_t>( 16, d_size / 2 ) );
+    for (size_t k = 0;  k < index.size();  k++)
+        _set( index[k], vals[k] );
 }
 
-
-template <typename Entries, typename Indexes, typename Ops, typename AccessT>
-std::pair<typename Indexes::value_type, bool>  HashBase<Entries,Indexes,Ops,AccessT>::insert2 (const AccessT& v)
+template <typename T>
+template <typename F>
+void  SparseStore<T>::for_each (size_t lo, size_t hi, F f) const
 {
-    size_t  h = d_ops( v ) % d.hash_size;
-    for (Id i = d_table[h];  i != EOL;  i = d_entries[i].next()) {
-        if (d_ops( v, d_entries[i] ))
-            return std::pair<Id, bool>( i, false );
+    hi = std::min( hi, d_span );
+    if (lo >= hi)
+        return;
+    switch (d_mode) {
+    case Mode::Hash: {
+        std::vector<std::pair<size_t, const T*>>  sorted;
+        d_hash.for_each( [&] (const Pair& p) {
+                                if (p.first >= lo && p.first < hi)
+                                    sorted.emplace_back( p.first, &p.second );
+                            } );
+        std::sort( sorted.begin(), sorted.end(),
+                   [] (const auto& a, const auto& b) { return a.first < b.first; } );
+        for (const auto& [i, v] : sorted)
+            f( i, *v );
+        return;
     }
-    if (d.size / d.hash_size > size_t(d.max_depth)) {
-        this->rehash( d.rehash_mult * d.hash_size );
-        h = d_ops( v ) % d.hash_size;
+    case Mode::Runs: {
+        size_t  k = std::lower_bound( d_run_index.begin(), d_run_index.end(), uint32_t( lo ) ) - d_run_index.begin();
+        for (;  k < d_run_index.size() && d_run_index[k] < hi;  k++)
+            f( size_t( d_run_index[k] ), d_run_vals[k] );
+        return;
+    }
+    default:
+        for (size_t c = lo >> CHUNK_BITS;  c <= (hi - 1) >> CHUNK_BITS;  c++) {
+            const Chunk*  ch = _chunk( c );
+            if (!ch)
+                continue;
+            size_t  base = c << CHUNK_BITS;
+            size_t  w_lo = lo > base ? (lo - base) / 64 : 0;
+            size_t  w_hi = std::min<size_t>( ch->used, (hi - base + 63) / 64 );
+            for (size_t w = w_lo;  w < w_hi;  w++) {
+                uint64_t  bits = ch->bits[w];
+                size_t    k = ch->rank[w];
+                for (;  bits;  bits &= bits - 1, k++) {
+                    size_t  i = base + w * 64 + std::countr_zero( bits );
+                    if (i >= lo && i < hi)
+                        f( i, ch->vals[k] );
+                }
+            }
+        }
     }
-    Id  idx = this->_new_entry( v, d_table[h] );
-    d_table[h] = idx;
-    return std::pair<Id, bool>( idx, true );
 }
 
-
-template <typename Entries, typename Indexes, typename Ops, typename AccessT>
-std::pair< typename Indexes::value_type, bool >
-HashBase<Entries,Indexes,Ops,AccessT>::insert_or_assign2 (const AccessT& v)
+template <typename T>
+void  SparseStore<T>::gather (size_t lo, size_t n, T* out, const T& dflt) const
 {
-    size_t  h = d_ops( v ) % d.hash_size;
-    for (Id i = d_table[h];  i != EOL;  i = d_entries[i].next()) {
-        if (d_ops( v, d_entries[i] )) {
-            d_entries[i].val() = v;
-            return std::pair<ssize_t, bool>( i, false );
+    std::fill( out, out + n, dflt );
+    size_t  hi = lo + n;
+    if (d_mode == Mode::Hash) {
+        if (n < d_size) {
+            for (size_t k = 0;  k < n;  k++)
+                if (const T* p = find( lo + k ))
+                    out[k] = *p;
         }
+        else
+            d_hash.for_each( [&] (const Pair& p) { if (p.first >= lo && p.first < hi) out[p.first - lo] = p.second; } );
+        return;
     }
-    if (d.size / d.hash_size > d.max_depth) {
-        this->rehash( d.rehash_mult * d.hash_size );
-        h = d_ops( v ) % d.hash_size;
+    if (d_mode == Mode::Runs) {
+        for_each( lo, hi, [&] (size_t i, const T& v) { out[i - lo] = v; } );
+        return;
+    }
+    // a full word inside the range is 64 values in a row: one block copy
+    hi = std::min( hi, d_span );
+    for (size_t c = lo >> CHUNK_BITS;  lo < hi && c <= (hi - 1) >> CHUNK_BITS;  c++) {
+        const Chunk*  ch = _chunk( c );
+        if (!ch)
+            continue;
+        size_t  base = c << CHUNK_BITS;
+        size_t  w_lo = lo > base ? (lo - base) / 64 : 0;
+        size_t  w_hi = std::min<size_t>( ch->used, (hi - base + 63) / 64 );
+        for (size_t w = w_lo;  w < w_hi;  w++) {
+            uint64_t  bits = ch->bits[w];
+            size_t    first = base + w * 64;
+            const T*  v = ch->vals.data() + ch->rank[w];
+            if (bits == ~uint64_t(0) && first >= lo && first + 64 <= hi) {
+                std::copy( v, v + 64, out + (first - lo) );
+                continue;
+            }
+            for (;  bits;  bits &= bits - 1, v++) {
+                size_t  i = first + std::countr_zero( bits );
+                if (i >= lo && i < hi)
+                    out[i - lo] = *v;
+            }
+        }
     }
-    Id  idx = this->_new_entry( v, d_table[h] );
-    d_table[h] = idx;
-    return std::pair<ssize_t, bool>( idx, true );
 }
 
-
-template <typename Entries, typename Indexes, typename Ops, typename AccessT>
-typename Indexes::value_type  HashBase<Entries,Indexes,Ops,AccessT>::insert_end (const AccessT& v)
+template <typename T>
+SparseStore<T>  SparseStore<T>::range (size_t lo, size_t hi) const
 {
-    if (d.size / d.hash_size > size_t(d.max_depth))
-        this->rehash( d.rehash_mult * d.hash_size );
-
-    Id  idx = d_entries.size();
-    d_entries.emplace_back( v );
-    size_t  h = d_ops( v ) % d.hash_size;
-    d_entries[idx].next( d_table[h] );
-    d_table[h] = idx;
-    d.size++;
-    return idx;
+    SparseStore  r( d_auto ? Mode::Auto : d_mode );
+    for_each( lo, hi, [&] (size_t i, const T& v) { r.set( i - lo, v ); } );
+    r.optimize();
+    return r;
 }
 
+template <typename T>
+void  SparseStore<T>::assign (std::vector<uint32_t> index, std::vector<T> vals)
+{
+    assert( index.size() == vals.size() );
+    bool  adaptive = d_auto;
+    Mode  pinned = d_mode;
+    clear();
+    d_auto = adaptive;
+    d_mode = Mode::Runs;
+    d_size = index.size();
+    d_span = index.empty() ? 0 : index.back() + 1;
+    d_run_index = std::move( index );
+    d_run_vals = std::move( vals );
+    if (d_auto)
+        optimize();
+    else if (pinned != Mode::Runs)
+        _rebuild( pinned );
+}
 
-template <typename Entries, typename Indexes, typename Ops, typename AccessT>
-typename Indexes::value_type  HashBase<Entries,Indexes,Ops,AccessT>::find2 (const AccessT& v) const
+template <typename T>
+bool  SparseStore<T>::runs (size_t lo, size_t hi, std::span<const uint32_t>& index, std::span<const T>& vals) const
 {
-    size_t  h = d_ops( v ) % d.hash_size;
+    if (d_mode != Mode::Runs)
+        return false;
+    size_t  a = std::lower_bound( d_run_index.begin(), d_run_index.end(), lo ) - d_run_index.begin();
+    size_t  b = std::lower_bound( d_run_index.begin() + a, d_run_index.end(), hi ) - d_run_index.begin();
+    index = { d_run_index.data() + a, b - a };
+    vals = { d_run_vals.data() + a, b - a };
+    return true;
+}
 
-    for (Id i = d_table[h];  i != EOL;  i = d_entries[i].next()) {
-        if (d_ops( v, d_entries[i] ))
-            return i;
+template <typename T>
+MemoryUsage  SparseStore<T>::memory_usage () const
+{
+    MemoryUsage  u = d_hash.memory_usage();
+    u.table += container_bytes( d_run_index ) + container_bytes( d_chunk_at ) + container_bytes( d_chunks );
+    u.entries += container_bytes( d_run_vals );
+    u.slack += container_slack( d_run_index ) + container_slack( d_run_vals ) +
+               container_slack( d_chunk_at ) + container_slack( d_chunks );
+    for (const Chunk& ch : d_chunks) {
+        u.entries += container_bytes( ch.vals );
+        u.slack += container_slack( ch.vals );
     }
-    return -1;
+    return u;
 }
 
+template <typename T>
+void  SparseStore<T>::shrink_to_fit ()
+{
+    d_run_index.shrink_to_fit();
+    d_run_vals.shrink_to_fit();
+    d_chunk_at.shrink_to_fit();
+    d_chunks.shrink_to_fit();
+    for (Chunk& ch : d_chunks)
+        ch.vals.shrink_to_fit();
+    d_hash.shrink_to_fit();
+}
 
-// pair.second is false for a bad index or deleted element
-template <typename Entries, typename Indexes, typename Ops, typename AccessT>
-std::pair<const AccessT&, bool>  HashBase<Entries,Indexes,Ops,AccessT>::at (Id id) const
+template <typename T>
+typename SparseStore<T>::iterator  SparseStore<T>::begin () const
 {
-    if (size_t(id) < d_entries.size()) {
-        if (d_entries[id].next() >= -1)
-            return std::pair<const T&, bool>( d_entries[id].val(), true );
+    iterator  it( this );
+    if (d_size == 0)
+        return it;
+    if (d_mode == Mode::Hash) {
+        it.snapshot = std::make_shared<std::vector<std::pair<size_t, const T*>>>();
+        it.snapshot->reserve( d_size );
+        for_each( [&] (size_t i, const T& v) { it.snapshot->emplace_back( i, &v ); } );
+    }
+    else if (d_mode == Mode::Bitmap) {
+        it.chunk = ~size_t(0);
+        it.word = WORDS - 1;                // settle() moves on to the first chunk
     }
-    return std::pair<const T&, bool>( d.null_val, false );
+    it.d_index = 0;
+    it.settle();
+    return it;
 }
 
-
-template <typename Entries, typename Indexes, typename Ops, typename AccessT>
-void  HashBase<Entries,Indexes,Ops,AccessT>::print_histogram (FILE* f) const
+// point at element 'pos' (Runs, Hash), or the lowest bit left in 'bits' (Bitmap)
+template <typename T>
+void  SparseStore<T>::iterator::settle ()
 {
-    if (!f) f = stdout;
-    std::map< Id, int >  hist;
-    for (size_t h = 0;  h < d.hash_size;  h++) {
-        int  sz = 0;
-        for (Id i = d_table[h];  i != EOL;  i = d_entries[i].next())
-            sz++;
-        hist[sz] += 1;
+    switch (s->d_mode) {
+    case Mode::Hash:
+        if (pos == snapshot->size()) {
+            d_index = END;
+            return;
+        }
+        d_index = (*snapshot)[pos].first;
+        d_val = (*snapshot)[pos].second;
+        return;
+    case Mode::Runs:
+        if (pos == s->d_run_index.size()) {
+            d_index = END;
+            return;
+        }
+        d_index = s->d_run_index[pos];
+        d_val = &s->d_run_vals[pos];
+        return;
+    default: {
+        const Chunk*  ch = chunk == ~size_t(0) ? nullptr : s->_chunk( chunk );
+        while (bits == 0) {
+            if (ch && ++word < ch->used) {
+                bits = ch->bits[word];
+                continue;
+            }
+            // next chunk with elements
+            do {
+                if (++chunk >= s->d_chunk_at.size()) {
+                    d_index = END;
+                    return;
+                }
+                ch = s->_chunk( chunk );
+            } while (!ch || ch->vals.empty());
+            word = 0;
+            pos = 0;
+            bits = ch->bits[0];
+        }
+        d_index = (chunk << CHUNK_BITS) + word * 64 + std::countr_zero( bits );
+        d_val = &ch->vals[pos];
+    }
     }
-
-    fprintf( f, "Table Histogram:\n" );
-    for (auto x : hist)
-        fprintf( f, "   %5lu %8d\n", x.first, x.second );
-
-    fprintf( f, "\n" );
 }
 
-
-} // namesapce Util
-
-
 template <typename T>
-class SparseArray : public DataObj
+typename SparseStore<T>::iterator&  SparseStore<T>::iterator::operator++ ()
 {
-    T                                      dflt   = T{};
-    size_t                                 d_size = 0;
-    size_t                                 offset = 0;
-    size_t                                 siz    = ~0;
-    std::shared_ptr<Util::HashMap<int, T>> d;
+    if (s->d_mode == Mode::Bitmap)
+        bits &= bits - 1;
+    pos++;
+    settle();
+    return *this;
+}
 
-    SparseArray (SchemaPtr sch_,std::shared_ptr<Util::HashMap<int, T>> d_, size_t offset_, size_t slice_size_, T dflt_)
-        :DataObj(sch_), dflt(dflt_), offset(offset_), siz(slice_size_), d(d_) {}
-public:
-    class Ref
-    {
-    private:
-        using HashMap = Util::HashMap<int, T>;
-    public:
-        T _dflt;
-        int _n;
-        HashMap& _d;
 
-        Ref(T dflt_, int n_, HashMap& d_) : _dflt(dflt_), _n(n_), _d(d_) {};
+} // namespace Util
 
-        Ref& operator=(T value);
 
-        friend std::ostream&  operator<< (std::ostream& s, const Ref& c)
-        {
-            auto val = [iter = c._d.find(c._n), &c](){ if(iter.second) return iter.first; else return c._dflt; };
-            return s<< val();
-        }
+// ================================================================
+// to test:
+//   create file with:
+//          #define TEST_SPARSE_STORE
+//          #include "SparseStore.h"
+//   compile and run.  Random writes and erases against a std::map in
+//   every mode; each mode must agree with the map on find, for_each,
+//   gather and iteration
 
-    };
+#ifdef TEST_SPARSE_STORE
 
-public:
-    SparseArray (SchemaPtr sch)
-        : DataObj(sch), d(std::make_shared<Util::HashMap<int, T>>()) {}
+#include <cstdio>
+#include <map>
 
-    SparseArray (SchemaPtr sch, size_t sz)
-        : DataObj(sch), d_size( sz ), d(std::make_shared<Util::HashMap<int, T>>()) {}
+using Store = Util::SparseStore<long>;
 
-    SparseArray (SchemaPtr sch, size_t sz, const T& dflt_)
-        : DataObj(sch), dflt(dflt_), d_size(sz),d(std::make_shared<Util::HashMap<int, T>>()) {}
+int  check (const Store& s, const std::map<size_t, long>& m, size_t span)
+{
+    int  errors = 0;
+    for (size_t i = 0;  i < span + 10;  i++) {
+        auto  it = m.find( i );
+        const long*  p = s.find( i );
+        if ((it == m.end()) != (p == nullptr) || (p && *p != it->second))
+            errors++;
+    }
+    std::vector<std::pair<size_t, long>>  seen, iterated;
+    s.for_each( [&] (size_t i, long v) { seen.emplace_back( i, v ); } );
+    for (auto x : s)
+        iterated.emplace_back( x.first, x.second );
+    std::vector<std::pair<size_t, long>>  want( m.begin(), m.end() );
+    errors += seen != want;
+    errors += iterated != want;
+
+    std::vector<long>  out( 1000 );
+    for (size_t lo = 0;  lo < span;  lo += 777) {
+        s.gather( lo, out.size(), out.data(), -1 );
+        for (size_t k = 0;  k < out.size();  k++) {
+            auto  it = m.find( lo + k );
+            errors += out[k] != (it == m.end() ? -1 : it->second);
+        }
+    }
+    return errors;
+}
 
-    size_t          size () const override              { return std::min(d_size - offset, siz); }
+int  main ()
+{
+    int  errors = 0;
+    for (Store::Mode mode : { Store::Mode::Auto, Store::Mode::Hash, Store::Mode::Runs, Store::Mode::Bitmap }) {
+        Store  s( mode );
+        std::map<size_t, long>  m;
+        const size_t  span = 300000;
+        unsigned  seed = 1;
+
+        // appends, dense then sparse, then random writes and erases
+        for (size_t i = 0;  i < span;  i += i < 100000 ? 3 : 517) {
+            s.set( i, i * 10 );
+            m[i] = i * 10;
+        }
+        int  e1 = check( s, m, span );
+        Store::Mode  after_appends = s.mode();
+        for (int k = 0;  k < 20000;  k++) {
+            seed = seed * 1103515245 + 12345;
+            size_t  i = (seed >> 8) % span;
+            if (k % 3 == 0) {
+                bool  had = m.erase( i );
+                errors += s.erase( i ) != had;
+            }
+            else {
+                s.set( i, k );
+                m[i] = k;
+            }
+        }
+        int  e2 = check( s, m, span );
+        Store::Mode  after_writes = s.mode();
+        s.optimize();
+        int  e3 = check( s, m, span );
+        printf( "%-6s  size %zu (%zu), modes %s -> %s -> %s, %zu bytes, errors %d %d %d\n",
+                Store::mode_name( mode ), s.size(), m.size(), Store::mode_name( after_appends ),
+                Store::mode_name( after_writes ), Store::mode_name( s.mode() ), s.bytes(), e1, e2, e3 );
+        errors += e1 + e2 + e3 + (s.size() != m.size());
+    }
 
-    size_t          size_bytes () const override        { return 0; } // TODO:  sizeof(T) * d.size(); }
+    // an index past uint32_t is refused, not truncated
+    Store  big;
+    bool  refused = false;
+    try {
+        big.set( size_t(1) << 32, 1 );
+    }
+    catch (const std::out_of_range&) {
+        refused = true;
+    }
+    errors += !refused || big.size() != 0 || big.contains( 0 );
+    printf( "%s\n", errors ? "FAILED" : "ok" );
+    return errors != 0;
+}
 
-    DataObjPtr      slice (size_t offset, size_t slice_size = ~0) override;
+#endif
 
-    DataObjPtr      slice_copy ( size_t offset, size_t slice_size = ~0) override;
+#pragma once
 
-    Ref       operator[] ( Id<T> i )                    { return Ref(dflt, i.get() + offset, *d); }
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
-    const Ref operator[] ( Id<T> i ) const              { return Ref(dflt, i.get() + offset, *d); }
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
-    const void*     vget (int i) const override;
-    GenericValue    gvget (int i) const override;
+namespace Util {
 
-    void            vset (int i, const void* val) override;
 
-    void            vappend (const void* val) override;
+// ================================================================
+// lazy loading
+//
+// A Dict or SparseArray attached to a LoadPool (set_pool) comes back by itself
+// after unload():
+//   unload()        writes its tables to a spill file in the pool's directory,
+//                   unless the file holds them already (nothing was written
+//                   since it was spilled or loaded), then frees them
+//   next access     maps the file and copies the sections into the tables as
+//                   they were -- hash info, table, entries and names of a Dict,
+//                   the sorted runs of a SparseArray: no hashing, no inserts
+// The pool keeps its loaded objects under a cap on their size_bytes(): after
+// each load, and on trim(), it unloads the least recently used ones.  Use is
+// a stamp from the pool's clock, stored by every access; unloading looks for
+// the oldest stamp, O(objects).
+//
+// A directory on a tmpfs (/dev/shm) keeps the spill files in shared memory;
+// elsewhere they go through the page cache to disk.  Entries and values are
+// written as raw bytes: T must be trivially copyable.  The files belong to
+// the process and go away with their objects.
+//
+// A pool and its objects belong to one thread: an access to one object may
+// unload any other.  So a reference, pointer or iterator into an object's
+// tables (Dict::lookup, operator[], begin(), SparseArray::vget ...) is valid
+// until the next write to it or the next access to any object in its pool,
+// whichever comes first.  To hold one longer, pin the object (Lazy::Pin):
+// the pool does not unload a pinned object, and trim() passes over it.  A
+// concurrent Dict (set_concurrent) cannot be attached: its readers would load
+// and stamp it from many threads.  Slices are not attached; a Dict or
+// SparseArray that is attached copies out of storage shared with slices
+// before it spills.
+// ================================================================
 
-    void            serialize (MPSys::Message& msg, DataObjPtr p) override;
-    void            unload () override;
+constexpr char      spill_magic[8] = { 'A', 'U', 'S', 'P', 'I', 'L', 'L', '\0' };
+constexpr uint32_t  spill_version = 1;
+constexpr size_t    SPILL_SECTIONS = 4;
 
-    void            repr (std::ostream& s, int level) const override;
-    void            print (int level=0) const override;
+struct SpillHeader
+{
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  sections;
+    uint64_t  layout;                       // the writer's type sizes, see spill_layout
+    uint64_t  offset[SPILL_SECTIONS];       // from the start of the file, 64 byte aligned
+    uint64_t  bytes[SPILL_SECTIONS];
 };
 
-template<typename T>
-DataObjPtr  SparseArray<T>::slice (size_t offset, size_t slice_size)
+// sizes of the types a spill file holds, to refuse one written for other types
+template <typename A, typename B = char>
+constexpr uint64_t  spill_layout ()
 {
-    SparseArrayData<T>* sliced = new SparseArrayData<T>(this->schema(), d, offset, slice_size, dflt);
-    sliced->d_parent = d_parent;
-    return DataObjPtr(sliced);
+    return uint64_t( sizeof( A ) ) | uint64_t( sizeof( B ) ) << 16 | uint64_t( alignof( A ) ) << 32 |
+           uint64_t( alignof( B ) ) << 48;
 }
 
-template<typename T>
-DataObjPtr SparseArray<T>::slice_copy ( size_t offset, size_t slice_size)
+template <typename C>
+std::span<const char>  spill_bytes (const C& c)
 {
-    SchemaPtr sch = SchemaPtr( this->schema()->copy() );
-    std::shared_ptr<Util::HashMap<int, T>> op = std::make_shared< Util::HashMap<int, T> >( *d );
-    SparseArray<T>* copy_sparse_array_data = new SparseArray<T>(sch, op, offset, slice_size, dflt);
-    return DataObjPtr( copy_sparse_array_data );
+    return { reinterpret_cast<const char*>( c.data() ), c.size() * sizeof( typename C::value_type ) };
 }
 
-template<typename T>
-typename SparseArray<T>::Ref& SparseArray<T>::Ref::operator=(T value)
+// write 'sections' to 'path', through a temporary renamed over it
+inline void  spill_write (const std::string& path, uint64_t layout, std::initializer_list<std::span<const char>> sections)
 {
-    if (value != _dflt)
-        _d[_n] = value;
-    return *this;
+    assert( sections.size() <= SPILL_SECTIONS );
+    SpillHeader  h{};
+    memcpy( h.magic, spill_magic, sizeof( spill_magic ) );
+    h.version = spill_version;
+    h.sections = sections.size();
+    h.layout = layout;
+    uint64_t  at = (sizeof( h ) + 63) & ~uint64_t( 63 );
+    size_t    k = 0;
+    for (std::span<const char> s : sections) {
+        h.offset[k] = at;
+        h.bytes[k++] = s.size();
+        at = (at + s.size() + 63) & ~uint64_t( 63 );
+    }
+
+    std::string  tmp = path + ".tmp";
+    FILE*  out = fopen( tmp.c_str(), "wb" );
+    if (!out)
+        throw std::runtime_error( "spill_write: cannot create " + tmp + ": " + strerror( errno ) );
+    static const char  zeros[64] = {};
+    bool      ok = fwrite( &h, sizeof( h ), 1, out ) == 1;
+    uint64_t  pos = sizeof( h );
+    k = 0;
+    for (std::span<const char> s : sections) {
+        ok = ok && fwrite( zeros, 1, h.offset[k] - pos, out ) == h.offset[k] - pos &&
+                   (s.empty() || fwrite( s.data(), 1, s.size(), out ) == s.size());
+        pos = h.offset[k++] + s.size();
+    }
+    ok = fclose( out ) == 0 && ok;
+    if (!ok || rename( tmp.c_str(), path.c_str() ) != 0) {
+        int  error = errno;
+        remove( tmp.c_str() );
+        throw std::runtime_error( "spill_write: cannot write " + path + ": " + strerror( error ) );
+    }
 }
 
-template<typename T>
-const void*  SparseArray<T>::vget (int i) const
+// a spill file mapped read-only, its header checked
+class SpillMap
 {
-    auto non_const_this = const_cast<SparseArray<T>*> (this);
+public:
+    SpillMap (const std::string& path, uint64_t layout, size_t sections);
+    ~SpillMap ()                                    { if (d_addr) munmap( d_addr, d_len ); }
+
+    SpillMap (const SpillMap&) = delete;
+    SpillMap&  operator= (const SpillMap&) = delete;
+
+    template <typename X>
+    std::span<const X>  section (size_t k) const
+                            {
+                                const SpillHeader*  h = static_cast<const SpillHeader*>( d_addr );
+                                return { reinterpret_cast<const X*>( static_cast<const char*>( d_addr ) + h->offset[k] ),
+                                         h->bytes[k] / sizeof( X ) };
+                            }
 
-    std::pair<T&, bool>  iter = non_const_this->d->find(i+offset);
-    if (iter.second)
-        return (const void*) &(iter.first); // TODO: address of local variable???
-    else
-        return (const void*) &dflt;
+private:
+    void*   d_addr = nullptr;
+    size_t  d_len = 0;
+};
+
+inline SpillMap::SpillMap (const std::string& path, uint64_t layout, size_t sections)
+{
+    int  fd = ::open( path.c_str(), O_RDONLY );
+    if (fd < 0)
+        throw std::runtime_error( "SpillMap: cannot open " + path + ": " + strerror( errno ) );
+    struct stat  st;
+    if (fstat( fd, &st ) == 0 && size_t( st.st_size ) >= sizeof( SpillHeader )) {
+        d_len = st.st_size;
+        d_addr = mmap( nullptr, d_len, PROT_READ, MAP_SHARED, fd, 0 );
+        if (d_addr == MAP_FAILED)
+            d_addr = nullptr;
+    }
+    ::close( fd );
+    if (!d_addr)
+        throw std::runtime_error( "SpillMap: cannot map " + path );
+
+    const SpillHeader*  h = static_cast<const SpillHeader*>( d_addr );
+    bool  ok = memcmp( h->magic, spill_magic, sizeof( spill_magic ) ) == 0 && h->version == spill_version &&
+               h->layout == layout && h->sections == sections;
+    for (size_t k = 0;  ok && k < sections;  k++)
+        ok = h->offset[k] % 64 == 0 && h->offset[k] <= d_len && h->bytes[k] <= d_len - h->offset[k];
+    if (!ok) {
+        munmap( d_addr, d_len );
+        d_addr = nullptr;
+        throw std::runtime_error( "SpillMap: " + path + ": not a spill file for this type" );
+    }
 }
 
-template<typename T>
-GenericValue  SparseArray<T>::gvget (int i) const
+
+// ================================================================
+// frames on the wire
+//
+// The sections of a spill file also go over a socket or a pipe:
+//   send_frames()     a FrameHeader, then each section straight from the
+//                     tables, in one sendmsg (writev for a pipe)
+//   adopt_frames()    (Dict, SparseArray) reads the header, sizes the
+//                     vectors the tables will own, and readv's each section
+//                     into them: no message buffer, no parsing, no inserts
+// The header carries the sender's fingerprint: byte order, type sizes
+// (spill_layout) and a probe of its hash function and bucket index.  A
+// receiver with the same fingerprint adopts the tables as they are; one with
+// another entry layout or hash function rebuilds them from the entries,
+// which the header locates; another byte order or value size is refused.
+//
+// Nothing read is trusted: section sizes are checked against the item sizes
+// (frame_count) before a vector is sized from them, and the tables against
+// themselves -- every link, id and name in range -- before they are adopted.
+// A peer that goes away is an exception on both sides, not a SIGPIPE.
+// ================================================================
+
+constexpr char      frame_magic[8] = { 'A', 'U', 'F', 'R', 'A', 'M', 'E', '\0' };
+constexpr uint32_t  frame_version = 1;
+constexpr uint32_t  frame_byte_order = 0x01020304;
+
+struct FrameHeader
 {
-    auto non_const_this = const_cast<SparseArray<T>*> (this);
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  byte_order;                   // frame_byte_order as the sender has it
+    uint64_t  layout;                       // spill_layout of the sender's types
+    uint64_t  hash_probe;                   // the sender's bucket of a fixed string, 0 for none
+    uint32_t  value_size;                   // sizeof( T )
+    uint32_t  entry_size;                   // where the entries keep their fields, to rebuild
+    uint32_t  id_offset;
+    uint32_t  value_offset;
+    uint32_t  next_offset;
+    uint32_t  sections;
+    uint64_t  bytes[SPILL_SECTIONS];
+};
 
-    std::pair<T&, bool>  iter = non_const_this->d->find(i+offset);
-    if (iter.second)
-        return GenericValue( iter.first );
-    else
-        return GenericValue( dflt );
-}
+// a header and the sections it describes, pointing into the tables: valid until they are written
+struct Frames
+{
+    FrameHeader         header{};
+    std::vector<iovec>  iov;
+    std::shared_ptr<const void>  keep;     // the tables 'iov' points into, should the pool unload them
+
+    explicit Frames (uint64_t layout)
+                        {
+                            memcpy( header.magic, frame_magic, sizeof( frame_magic ) );
+                            header.version = frame_version;
+                            header.byte_order = frame_byte_order;
+                            header.layout = layout;
+                        }
 
+    void  add (std::span<const char> section)
+                        {
+                            assert( header.sections < SPILL_SECTIONS );
+                            header.bytes[header.sections++] = section.size();
+                            if (!section.empty())
+                                iov.push_back( { const_cast<char*>( section.data() ), section.size() } );
+                        }
+};
 
-template<typename T>
-void  SparseArray<T>::vset (int i, const void* val)
+// SIGPIPE blocked in this thread while in scope, for writes that are not to a socket
+// (no MSG_NOSIGNAL); one the writes raised is taken back, one already pending is left
+class SigpipeGuard
 {
-    const T&  v = * (const T*) val;
-    if (v != dflt)
-        (*d)[i+offset] = v;
-    else
-        d->remove(i);           // ok if it doesn't exist in 'd'
-}
+public:
+    SigpipeGuard ()
+    {
+        sigset_t  pending;
+        sigemptyset( &d_pipe );
+        sigaddset( &d_pipe, SIGPIPE );
+        sigpending( &pending );
+        d_was_pending = sigismember( &pending, SIGPIPE );
+        pthread_sigmask( SIG_BLOCK, &d_pipe, &d_old );
+    }
+    ~SigpipeGuard ()
+    {
+        timespec  now{};
+        if (!d_was_pending)
+            sigtimedwait( &d_pipe, nullptr, &now );
+        pthread_sigmask( SIG_SETMASK, &d_old, nullptr );
+    }
+    SigpipeGuard (const SigpipeGuard&) = delete;
+    SigpipeGuard&  operator= (const SigpipeGuard&) = delete;
 
-template<typename T>
-void  SparseArray<T>::vappend (const void* val)
+private:
+    sigset_t  d_pipe, d_old;
+    bool      d_was_pending;
+};
+
+// all of 'iov', over as many sendmsg (writev) / readv calls as it takes; throw on error
+// or EOF.  A closed peer is EPIPE, not a signal
+inline void  frame_io (int fd, iovec* iov, size_t n, bool write)
 {
-    assert( siz == (size_t)~0);
-    const T&  v = * (const T*) val;
-    if (v != dflt)
-        (*d)[d_size] = v;
-    d_size++;
+    bool  socket = true;
+    std::optional<SigpipeGuard>  guard;
+    while (n > 0) {
+        int      batch = int( std::min<size_t>( n, IOV_MAX ) );
+        ssize_t  done;
+        if (!write)
+            done = ::readv( fd, iov, batch );
+        else if (socket) {
+            msghdr  msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = batch;
+            done = ::sendmsg( fd, &msg, MSG_NOSIGNAL );
+            if (done < 0 && errno == ENOTSOCK) {
+                socket = false;
+                guard.emplace();
+                continue;
+            }
+        }
+        else
+            done = ::writev( fd, iov, batch );
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            throw std::runtime_error( std::string( write ? "send_frames: " : "adopt_frames: " ) +
+                                      (done < 0 ? strerror( errno ) : "connection closed") );
+        for (;  n > 0 && size_t( done ) >= iov->iov_len;  iov++, n--)
+            done -= iov->iov_len;
+        if (n > 0) {
+            iov->iov_base = static_cast<char*>( iov->iov_base ) + done;
+            iov->iov_len -= done;
+        }
+    }
 }
 
-template<typename T>
-void  SparseArray<T>::serialize (MPSys::Message& msg, DataObjPtr p)
+inline void  send_frames (int fd, const Frames& f)
 {
-    msg.frame( MPSys::make_frame< ValueReferenceData<size_t> >( offset, Defer(p) ));
-    msg.frame( MPSys::make_frame< ValueReferenceData<size_t> >( d_size, Defer(p) ));
-    msg.frame( MPSys::make_frame< ValueReferenceData<size_t> >( siz, Defer(p) ));
-    msg.frame( MPSys::make_frame< StaticMemoryData >( d->get_hash_info(), Defer(p) ));
-    //msg.frame( MPSys::make_frame< StaticMemoryData >( d->get_hash_table(), d->get_hash_info()->hash_size) );
-    msg.frame( MPSys::make_frame< StdVectorReferenceData<int> >( d->get_hash_table(), Defer(p) ));
-    using  HashMapData = typename Util::HashMap<int, T>::Base::Entry;
-    msg.frame( MPSys::make_frame< StdVectorReferenceData<HashMapData> >( d->get_hash_data(), Defer(p) ));
+    std::vector<iovec>  iov;
+    iov.reserve( f.iov.size() + 1 );
+    iov.push_back( { const_cast<FrameHeader*>( &f.header ), sizeof( f.header ) } );
+    iov.insert( iov.end(), f.iov.begin(), f.iov.end() );
+    frame_io( fd, iov.data(), iov.size(), true );
 }
 
-
-template<typename T>
-void  SparseArray<T>::unload ()
+// the header, checked for a format this code reads; the caller checks the fingerprint
+inline FrameHeader  recv_frame_header (int fd, size_t sections)
 {
-    offset = d_size = siz = 0L;
-    d = std::make_shared< Util::HashMap<int, T> >();
-    d_deferral->unload( *this );
+    FrameHeader  h;
+    iovec        iov{ &h, sizeof( h ) };
+    frame_io( fd, &iov, 1, false );
+    if (memcmp( h.magic, frame_magic, sizeof( frame_magic ) ) != 0 || h.version != frame_version ||
+        h.sections != sections)
+        throw std::runtime_error( "adopt_frames: not frames of this kind" );
+    if (h.byte_order != frame_byte_order)
+        throw std::runtime_error( "adopt_frames: sender has another byte order" );
+    return h;
 }
 
+// section 'k' as a count of items of 'size' bytes, refused unless it is a whole number
+// of them that an int indexes: check before sizing a vector from the header
+inline size_t  frame_count (const FrameHeader& h, size_t k, size_t size)
+{
+    if (size == 0 || h.bytes[k] % size != 0 || h.bytes[k] / size > size_t( INT_MAX ))
+        throw std::runtime_error( "adopt_frames: section " + std::to_string( k ) + " is not a whole number of its items, or too many" );
+    return h.bytes[k] / size;
+}
 
-#pragma once
+// read and drop 'bytes', a section this receiver has no use for
+inline void  frame_skip (int fd, uint64_t bytes)
+{
+    char  scratch[1 << 14];
+    while (bytes > 0) {
+        iovec  iov{ scratch, size_t( std::min<uint64_t>( bytes, sizeof( scratch ) ) ) };
+        bytes -= iov.iov_len;
+        frame_io( fd, &iov, 1, false );
+    }
+}
 
-#include "Hash.h"
+// read sections first, first + 1, ... into 'dest', one buffer per section, sized to the header
+inline void  recv_sections (int fd, const FrameHeader& h, std::initializer_list<std::span<char>> dest, size_t first = 0)
+{
+    std::vector<iovec>  iov;
+    size_t  k = first;
+    for (std::span<char> d : dest) {
+        if (k >= h.sections || d.size() != h.bytes[k++])
+            throw std::runtime_error( "adopt_frames: section size does not match its header" );
+        if (!d.empty())
+            iov.push_back( { d.data(), d.size() } );
+    }
+    frame_io( fd, iov.data(), iov.size(), false );
+}
 
+template <typename C>
+std::span<char>  frame_dest (C& c)
+{
+    return { reinterpret_cast<char*>( c.data() ), c.size() * sizeof( typename C::value_type ) };
+}
 
-namespace AuData {
 
-// ================================================================
+class LoadPool;
 
-template <typename T>
-class Dict : public DataObj {
+// what a LoadPool needs of an object; Dict and SparseArray derive from it
+class Lazy
+{
 public:
+    Lazy () = default;
+    Lazy (const Lazy&)                      {}          // a copy is not in the pool
+    Lazy&  operator= (const Lazy&)          { return *this; }
+    virtual ~Lazy ();
+
+    // attach to 'pool', or detach (loading it) for nullptr
+    void        set_pool (LoadPool* pool);
+    LoadPool*   pool () const               { return d_pool; }
+    bool        loaded () const             { return d_loaded; }
+
+    // a pinned object is loaded and stays loaded: references into it stay valid until it
+    // is written.  Pins count; unpin() may come from another thread (a message sent)
+    void        pin () const                { _touch();  d_pins.fetch_add( 1, std::memory_order_relaxed ); }
+    void        unpin () const              { assert( pinned() );  d_pins.fetch_sub( 1, std::memory_order_release ); }
+    bool        pinned () const             { return d_pins.load( std::memory_order_acquire ) > 0; }
+
+    // pin() for a scope
+    class Pin
+    {
+    public:
+        explicit Pin (const Lazy& x) : d_x( &x )    { x.pin(); }
+        Pin (Pin&& p) : d_x( p.d_x )                { p.d_x = nullptr; }
+        ~Pin ()                                     { if (d_x) d_x->unpin(); }
+        Pin (const Pin&) = delete;
+        Pin&  operator= (const Pin&) = delete;
+    private:
+        const Lazy*  d_x;
+    };
 
-    using Id = int;
-    using StringId = int;
+protected:
+    // before each access: load if unloaded, stamp the use
+    void        _touch () const;
+    // before each write: the spill file no longer holds the tables
+    void        _touch_write ()             { _touch();  d_clean = false; }
+
+    // for the pool
+    virtual bool    _spillable () const = 0;
+    virtual size_t  _loaded_bytes () const = 0;
+    virtual void    _spill (const std::string& path) = 0;
+    virtual void    _load (const std::string& path) = 0;
+    virtual void    _drop () = 0;                           // free the tables
+    virtual bool    _concurrent () const        { return false; }   // read from many threads
 
-    // HashSet entry type
-    using V = std::pair<StringId, T>;  // [ index of string in the 'names' vector, data value ]
+private:
+    friend class LoadPool;
+
+    LoadPool*         d_pool = nullptr;
+    mutable std::atomic<int>  d_pins{ 0 };
+    mutable uint64_t  d_last_use = 0;
+    bool              d_loaded = true;
+    bool              d_clean = false;      // the spill file holds the tables
+    std::string       d_spill_path;
+};
 
-    // ================
-    // Hash and compare function class for the hash table
-    class NameIdPair {
-        static const Id   NotSet = ~0; // use local rather than stored
-        // Reason to use reference here: to make hasher and comper have the same things with nip;
-        const char*&              local_name_;
-        const std::vector<char>*  stored_names_;
 
-    public:
-        NameIdPair ( const char*& local_name, std::shared_ptr<std::vector<char>>& names )
-                                                         : local_name_( local_name ),
-                                                           stored_names_( names.get() ) {}
+class LoadPool
+{
+public:
+    // spill files go to 'dir'; 'cap' is on the size_bytes() of the loaded objects, 0 for none
+    explicit LoadPool (const std::string& dir, size_t cap = 0)
+        : d_dir( dir ), d_cap( cap ), d_serial( s_serial++ ) {}
+    ~LoadPool ();                           // detaches the objects, loading them
 
-        Id           local_name( const char* name )      { local_name_ = name; return NotSet; }
-        const char*  name ( StringId id ) const          { return id == NotSet ? local_name_ : stored_names_->data() + id; }
+    void     set_cap (size_t cap)           { d_cap = cap;  trim(); }
+    size_t   cap () const                   { return d_cap; }
+    size_t   objects () const               { return d_objects.size(); }
+    size_t   loaded_bytes () const;         // O(objects)
 
-        void         operator= ( const NameIdPair& nip ) { local_name_ = nip.local_name_;
-                                                           stored_names_ = nip.stored_names_; }
-        // Hasher
-        size_t       operator() ( V v ) const            { return Util::Hash<const char*>()( name( v.first ) ); }
+    // unload the least recently used until under the cap; not 'keep', nor a pinned one
+    void     trim (const Lazy* keep = nullptr);
 
-        // Comper
-        bool         operator() ( V a, V b ) const       { return strcmp( name( a.first ), name( b.first ) ) == 0; }
-    };
+    void     unload (Lazy& x);                // throws for a pinned 'x'
+    void     load (Lazy& x);
 
+    uint64_t  loads () const                { return d_loads; }
+    uint64_t  unloads () const              { return d_unloads; }
+    uint64_t  spills () const               { return d_spills; }     // unloads that wrote the file
 
-    using Hset = Util::HashSet<V, NameIdPair, NameIdPair>;
-    using Iter = typename std::vector<typename Hset::Entry>::iterator;
+private:
+    friend class Lazy;
 
-    // ================
-    class Reference {
-    public:
-        std::string                        _key;
-        std::shared_ptr<std::vector<char>> _names;
-        std::shared_ptr<NameIdPair>        _nip;
-        std::shared_ptr<Hset>              _d;
+    void     _attach (Lazy& x);
+    void     _forget (Lazy& x);
+    uint64_t _tick ()                       { return ++d_clock; }
 
-        Reference( const std::string& key_,
-                   std::shared_ptr<std::vector<char>>& names_,
-                   std::shared_ptr<NameIdPair>& nip_,
-                   std::shared_ptr<Hset>& d_ )
-            : _key( key_ ),  _names( names_ ), _nip( nip_ ), _d( d_ ) {};
+    std::string          d_dir;
+    size_t               d_cap;
+    uint64_t             d_serial;
+    uint64_t             d_clock = 0;
+    uint64_t             d_next_id = 0;
+    uint64_t             d_loads = 0, d_unloads = 0, d_spills = 0;
+    std::vector<Lazy*>   d_objects;
 
-        Reference& operator= ( T value );
+    static inline std::atomic<uint64_t>  s_serial{ 0 };
+};
 
-        // unlike std::map or ordered_map, do NOT insert if key is not already in the dict, throw Error instead
-        operator T () const;
 
-        // friend std::ostream&  operator<< ( std::ostream& s, const Reference& c );
+// 'p' that keeps 'x' pinned until its last copy goes: for message frames that
+// reference the tables, released whenever the message is done with them
+template <typename P>
+std::shared_ptr<P>  pinned (const std::shared_ptr<P>& p, const Lazy& x)
+{
+    struct Held
+    {
+        std::shared_ptr<P>  p;
+        Lazy::Pin           pin;
+        Held (const std::shared_ptr<P>& p_, const Lazy& x_) : p( p_ ), pin( x_ ) {}
     };
+    return std::shared_ptr<P>( std::make_shared<Held>( p, x ), p.get() );
+}
 
-    // ================
-    class iterator {
-        Iter _current;
-        Dict& _d;
-        using V = std::pair<std::string, Reference>;
-    public:
 
-        iterator( Iter iter_, Dict& d_ ) : _current( iter_ ), _d( d_ ) {}
+inline Lazy::~Lazy ()
+{
+    assert( !pinned() );
+    if (d_pool)
+        d_pool->_forget( *this );
+}
 
-        StringId       string_id () const               { return _current->first; }
+inline void  Lazy::set_pool (LoadPool* pool)
+{
+    if (pool == d_pool)
+        return;
+    if (d_pool) {
+        _touch();
+        d_pool->_forget( *this );
+    }
+    if (pool)
+        pool->_attach( *this );
+}
 
-        V              operator*()                      { std::string name = _d.nip->name( ( *_current ).val.first ); return V( name, _d[name] ); }
-        const V        operator*() const                { std::string name = _d.nip->name( ( *_current ).val.first ); return V( name, _d[name] ); }
-        iterator&      operator++() noexcept            { _current++; return *this; }
-        iterator       operator++( int ) noexcept       { iterator temp( *this );  ++( *this ); return temp; }
+inline void  Lazy::_touch () const
+{
+    if (!d_pool)
+        return;
+    if (!d_loaded)
+        d_pool->load( const_cast<Lazy&>( *this ) );
+    d_last_use = d_pool->_tick();
+}
+
+inline LoadPool::~LoadPool ()
+{
+    while (!d_objects.empty())
+        d_objects.back()->set_pool( nullptr );
+}
+
+inline void  LoadPool::_attach (Lazy& x)
+{
+    if (!x._spillable())
+        throw std::runtime_error( "LoadPool: values are not trivially copyable, cannot spill them" );
+    if (x._concurrent())
+        throw std::runtime_error( "LoadPool: a concurrent object is read from many threads, a pool belongs to one" );
+    x.d_pool = this;
+    x.d_loaded = true;
+    x.d_clean = false;
+    x.d_last_use = _tick();
+    x.d_spill_path = d_dir + "/spill." + std::to_string( getpid() ) + "." + std::to_string( d_serial ) + "." +
+                     std::to_string( d_next_id++ );
+    d_objects.push_back( &x );
+    trim( &x );
+}
+
+inline void  LoadPool::_forget (Lazy& x)
+{
+    d_objects.erase( std::find( d_objects.begin(), d_objects.end(), &x ) );
+    ::unlink( x.d_spill_path.c_str() );
+    x.d_pool = nullptr;
+    x.d_loaded = true;
+}
+
+inline size_t  LoadPool::loaded_bytes () const
+{
+    size_t  n = 0;
+    for (const Lazy* x : d_objects)
+        if (x->d_loaded)
+            n += x->_loaded_bytes();
+    return n;
+}
+
+inline void  LoadPool::unload (Lazy& x)
+{
+    assert( x.d_pool == this );
+    if (!x.d_loaded)
+        return;
+    if (x.pinned())
+        throw std::runtime_error( "LoadPool: cannot unload a pinned object" );
+    if (!x.d_clean) {
+        x._spill( x.d_spill_path );
+        x.d_clean = true;
+        d_spills++;
+    }
+    x._drop();
+    x.d_loaded = false;
+    d_unloads++;
+}
+
+inline void  LoadPool::load (Lazy& x)
+{
+    assert( x.d_pool == this );
+    if (x.d_loaded)
+        return;
+    x._load( x.d_spill_path );
+    x.d_loaded = true;
+    x.d_clean = true;
+    x.d_last_use = _tick();
+    d_loads++;
+    trim( &x );
+}
+
+inline void  LoadPool::trim (const Lazy* keep)
+{
+    if (d_cap == 0)
+        return;
+    size_t  bytes = loaded_bytes();
+    while (bytes > d_cap) {
+        Lazy*  coldest = nullptr;
+        for (Lazy* x : d_objects)
+            if (x->d_loaded && x != keep && !x->pinned() && (!coldest || x->d_last_use < coldest->d_last_use))
+                coldest = x;
+        if (!coldest)
+            break;
+        bytes -= std::min( bytes, coldest->_loaded_bytes() );
+        unload( *coldest );
+    }
+}
+
+
+} // namespace Util
+
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <cstring>
+#include <ctype.h>
+#include <cassert>
+#include <span>
+#include <stdexcept>
+
+#include "HashOps.h"
+#include "SparseStore.h"
+#include "Spill.h"
+
+namespace Util {
+
+
+// ================================================================
+// hash base
+//
+// do the hash calculations and control the vectors, but don't own
+// any memory.
+//
+// TODO: make this the base of HashSet and HashMap in "Hash.h"
+// ================================================================
+
+// requires:
+//    T = Entries::value_type;
+//
+//    IdType   T::next () const;
+//    void     T::next (IdType id);
+//
+//    void  T::operator= (AccessT val);  // or ref or const ref
+//    operator AccessT () const;
+
+// //    // ONLY needed if 'remove' is called           possible implementations:
+// //    bool  T::removed(IdType);  // is it removed.   bool  removed (int i) 
+// //    void  T::remove(IdType);   // tag as removed. needed if 'remove' is called
+// 
+//    IdType = IndexAryT::value_type
+// 
+//    size_t  Ops::operator() (const T& x);  // hash value of 't'
+//    bool    Ops::operator() (const T& a, const T& b);  // a == b
+//
+// optional, to keep the hash value in the entry (see HashedEntry):
+//    using  CachedHash = uint32_t;           // or uint64_t
+//    CachedHash  T::hash () const;
+//    void        T::hash (CachedHash h);
+//
+//  Chain hops then compare the stored hash before calling Ops, and
+//  rehash moves entries without hashing them again. All hash values
+//  are truncated to CachedHash, also for picking buckets.
+
+template <typename T, typename = void>
+struct has_cached_hash : std::false_type {};
+
+template <typename T>
+struct has_cached_hash< T, std::void_t<typename T::CachedHash> > : std::true_type {};
+
+// an entry with a cached hash, for values that are expensive to hash or compare
+template <typename V, typename CachedHashT = uint32_t, typename IdT = int>
+class HashedEntry
+{
+    V            d_val;
+    IdT          d_next = -1;
+    CachedHashT  d_hash = 0;
+public:
+    using  CachedHash = CachedHashT;
+
+    HashedEntry (const V& v = V())              : d_val( v ) {}
+    HashedEntry&  operator= (const V& v)        { d_val = v;  return *this; }
+
+    IdT&        next ()                         { return d_next; }
+    IdT         next () const                   { return d_next; }
+    void        next (IdT x)                    { d_next = x; }
+    V&          val ()                          { return d_val; }
+    const V&    val () const                    { return d_val; }
+    CachedHash  hash () const                   { return d_hash; }
+    void        hash (CachedHash h)             { d_hash = h; }
+};
+
+
+template <typename Entries,     // indexable AuData type (StringArray, Array, VarArray, ...)
+                                //  or std::vector<T>, std::deque<T>
+          typename Indexes,     // hash table array type (e.g., Array<int>, std::vector<size_t>)
+          typename Ops = SearchOps< typename Entries::value_type >,
+          typename AccessT = typename Entries::value_type,
+          typename Bucket = ModuloIndex,    // hash value -> bucket, see "bucket index policies"
+          typename Counters = NoHashCounters    // HashCounters to count lookups, see "table statistics"
+          >
+class HashBase
+{
+    using  T  = typename Entries::value_type;
+    using  Id = typename Indexes::value_type;
+    static constexpr  Id  EOL = ~0;
+
+    // // enable 'remove' function by adding "using  Removable = bool;" to T class. TODO: FIX
+    // //// enable 'remove' function by adding "constexpr bool  Removable = true;" to T class.
+
+    // // primary template handles T witout nested ::Removable member
+    // template <typename, typename = void>
+    // struct  Removable : std::false_type {};
+ 
+    // // specialization recognizes T with nested ::Removable member
+    // template <>
+    // struct  Removable< T, std::void_t<typename T::Removable>> : std::true_type {};
+
+    // ==== Id's for 'remove' -- if remove is not used, -1 is the only special index
+    //        Id >= 0:   index in 'd_entries' of next hash bin entry.
+    //        Id == -1:  end of hash bin list.
+    //        Id == -2:  end of free_list.
+    //        Id < -2:   index (= -3 - 'next')  in 'd_entries' of next free
+    static inline Id  _free_list_link (Id x)  { return -3 - x; }
+
+    static constexpr bool  CACHED_HASH = has_cached_hash<T>::value;
+
+public:
+
+    // grouped data fields needed for serialization
+    class Attrs
+    {
+        friend class HashBase;
+
+        Id            free_list   = -2;     // index of first unused d_entries slot; others are linked
+        Id            size        = 0;      // number of non-removed entries (not d_entries.size())
+
+        // user settable at construction only
+        size_t        hash_size   = 101;    // number of hash buckets (size of d_table);
+                                            //  the Bucket policy may round it (PowerOfTwoIndex)
+        bool          pre_filled  = false;  // set true if contructor input vec's contain valid data
+
+        // user settable at any time
+        int           max_depth   = 4;      // rehash occurs if average depth exceeds this value
+        int           rehash_mult = 4;      // if a rehash is needed, by how much is hash_size increased
+        int           rehash_step_budget = 0;  // if > 0, grow incrementally: old buckets migrated per
+                                               // insert / remove, instead of one full rehash
+
+    public:
+        Attrs () {}
+        // for chaining
+        Attrs&  set_hash_size (int x)           { hash_size = x;     return *this; }
+        Attrs&  set_max_depth (int x)           { max_depth = x;     return *this; }
+        Attrs&  set_rehash_mult (int x)         { rehash_mult = x;   return *this; }
+        Attrs&  set_pre_filled (bool x = true)  { pre_filled = x;    return *this; }
+        Attrs&  set_rehash_step_budget (int x)  { rehash_step_budget = x;  return *this; }
+    };
+
+private:
+
+    Attrs     d;
+
+    T           d_null_val;  // removed items are set to this, so real entries can be deleted
+
+    Indexes&    d_table;
+    Entries&    d_entries;   // entries
+    Ops&        d_ops;       // functors to compute hash value from T and to compare two T's
+    Bucket      d_bucket;    // hash value -> index in d_table
+
+    // ==== incremental rehash: the previous table, while its buckets are moved into 'd_table'.
+    // Only writes move buckets: lookups search both tables and move nothing, so a rehash in
+    // progress does not stop const readers sharing the table.
+    Indexes   d_old_table;
+    size_t    d_old_size     = 0;   // 0 when no rehash is in progress
+    size_t    d_migrate_next = 0;   // old buckets below this one have been moved
+    Bucket    d_old_bucket;
+
+    [[no_unique_address]] Counters  d_counters;
+    mutable RehashClock  d_rehash_clock;
+
+
+public:
+
+    // samples:
+    //    // create new with hash_size = 42
+    //    HashBase  h( evec, hvec, ops, Attrs().set_hash_size(42) );
+    //
+    //    // create from previous vectors and set max_depth = 10
+    //    HashX::Attrs ...
+    //    HashBase  h( evec, hvec, ops, Attrs().set_pre_filled().set_max_depth(10) );
+
+    HashBase (Entries& entries_vec, // memory for values and 'next' index
+              Indexes& table_vec,   // memory for hash table
+              Ops& search_ops,
+              const Attrs& attrs = Attrs());
+
+    // to set search hash parameters during construction
+    void  set_null_val (const T& x)             { d_null_val = x; }
+
+    void  predict (size_t nnodes);
+
+    Attrs&  attrs ()                            { return d; }
+
+    // ==== insertions / deletions
+    // Insert 'v' if table does not already contain an entry matching 'v'.
+    // If inserting (no previous match to v), return pair( 'v', true ),
+    // else return pair( previous match to 'v', false ).
+    std::pair<const AccessT&, bool>  insert (const AccessT& v);
+
+    // Adds 'v' into the table regardless of whether the table already contain an entry matching 'v'.
+    // If inserting (no previous match to v), return pair( 'v', true ),
+    // else if assigning (previous match to v), return pair( previous match to 'v', false ).
+    std::pair<const AccessT&, bool>  insert_or_assign (const AccessT& v);
+
+    void  rehash (size_t new_hash_size);
+
+    // complete an incremental rehash now, e.g. before serializing the table
+    void  rehash_finish ()                      { _rehash_step( ~size_t(0) ); }
+    bool  rehashing () const                    { return d_old_size != 0; }
+
+    // Return true if an entry matching 'v' existed and was removed.
+    bool  remove (const AccessT& v);
+
+    void  remove_by_index (Id i);
+
+    // remove all entries. does not change the hash_size.
+    void  clear ();
+
+    // ==== access
+    bool  empty () const      {  return d.size == 0;  }
+    size_t  size () const     {  return d.size;  }
+    bool  contains (const AccessT& v) const;
+
+    // if set contains 'v', return pair( ref to set's value, true ), else return pair('v', false)
+    std::pair<const AccessT&, bool>  find (const AccessT& v) const;
+
+    // ================ direct indexing support
+    // same as above, but return the entry id as the first element of the return pair
+    std::pair<Id, bool>  insert2 (const AccessT& v);
+    std::pair<Id, bool>  insert_or_assign2 (const AccessT& v);
+
+    // Appends 'v' into the table regardless of whether the table already contain an entry matching 'v'.
+    // If 'v' already exists, only one is returned with 'find' (likely the new entry).
+    Id  insert_end (const AccessT& v);
+
+    // Replace the contents with 'values'. The table is sized once (at least one bucket
+    // per value), the values are hashed in 'threads' threads (0 = one per core; Ops must
+    // be safe to call concurrently, else pass 1), grouped by bucket with a counting sort
+    // and written out in one sweep, each chain contiguous in d_entries.
+    // Entry ids follow bucket order, not input order. Returns size().
+    size_t  bulk_build (std::span<const AccessT> values, DupPolicy dups = DupPolicy::FirstWins,
+                        unsigned threads = 0);
+
+    // return ~0 if not found
+    Id  find2 (const AccessT& v) const;
+
+    // ==== batched lookup
+    // out[k] = find2( keys[k] ) / contains( keys[k] ); out.size() must be >= keys.size().
+    // Keys are done BATCH_STRIDE at a time: hash all and prefetch their buckets, then
+    // load the heads and prefetch the first entries, then walk the chains. The cache
+    // misses of a stride overlap instead of being paid one key after the other.
+    static constexpr size_t  BATCH_STRIDE = 16;
+    void  find2_batch (std::span<const AccessT> keys, std::span<Id> out) const;
+    void  contains_batch (std::span<const AccessT> keys, std::span<bool> out) const;
+
+    // pair.second is false for a bad index or deleted element
+    std::pair<const AccessT&, bool>  at (Id id) const;
+
+    // ==== iterate ====
+    // usage:
+    //   for (HashSet<T,...>::Iterator it(hash_set);  it();  ++it) {
+    //       const T&  t = *it;
+    //       ...
+    //   }
+    // or
+    //   for (const T& val : hash_base) { ... }
+    class Iterator {
+        using  Iter = typename Entries::iterator;
+        Iter  it, end;
+        void  _advance ()      { while (it != end && it->next() < EOL) ++it; } // skip deletions
+        Iterator (Iter i, Iter e)       : it(i), end(e) { _advance(); }
+        friend class HashBase;
+    public:
+        Iterator (HashBase& h)          : it( h.d_entries.begin() ), end( h.d_entries.end() ) { _advance(); }
+        bool  operator() ()             {  return it != end;  }
+        void  operator++ ()             {  if (it != end) ++it;  _advance();  } // skip deletions
+        const AccessT&  operator* ()    {  return it->val();  }
+        bool  operator!= (Iterator& x)  { return it != end; }
+    };
+
+    Iterator  begin ()                  { return Iterator( d_entries.begin(), d_entries.end() ); }
+    Iterator  end ()                    { return Iterator( d_entries.end(),   d_entries.end() ); }
+
+    // ================
+    // ==== stats
+
+    size_t  bucket_count () const       {  return d.hash_size;  }
+    void  print_histogram (FILE* f = NULL) const; // NULL = stdout
+
+    // shape, probes, rehashes and bytes; see "table statistics" in HashOps.h.
+    // Lookups (find, find2, contains, the batches) are counted if Counters is HashCounters.
+    HashStats  stats () const;
+    void  reset_counters ()             {  d_counters.reset();  }
+
+private:
+
+    // ==== hash values, through the entry's CachedHash if it has one
+    size_t  _hash (const AccessT& v) const
+                        {
+                            if constexpr (CACHED_HASH)
+                                return typename T::CachedHash( d_ops( v ) );
+                            else
+                                return d_ops( v );
+                        }
+
+    size_t  _entry_hash (Id i) const
+                        {
+                            if constexpr (CACHED_HASH)
+                                return d_entries[i].hash();
+                            else
+                                return d_ops( d_entries[i] );
+                        }
+
+    // entry 'i' matches 'v', whose hash is 'h'
+    bool  _match (const AccessT& v, size_t h, Id i) const
+                        {
+                            if constexpr (CACHED_HASH)
+                                if (d_entries[i].hash() != h)
+                                    return false;
+                            return d_ops( v, d_entries[i] );
+                        }
+
+    void  _set_hash (Id i, size_t h)
+                        {
+                            if constexpr (CACHED_HASH)
+                                d_entries[i].hash( typename T::CachedHash( h ) );
+                        }
+
+    // head of the chain for hash value 'h'; in the old table if that bucket has not moved yet
+    Id*  _head (size_t h)
+                        {
+                            if (d_old_size) {
+                                size_t  ob = d_old_bucket( h );
+                                if (ob >= d_migrate_next)
+                                    return &d_old_table[ob];
+                            }
+                            return &d_table[ d_bucket( h ) ];
+                        }
+    const Id*  _head (size_t h) const
+                        {
+                            if (d_old_size) {
+                                size_t  ob = d_old_bucket( h );
+                                if (ob >= d_migrate_next)
+                                    return &d_old_table[ob];
+                            }
+                            return &d_table[ d_bucket( h ) ];
+                        }
+
+    // move up to 'budget' old buckets into the new table
+    void  _rehash_step (size_t budget)
+                        {
+                            if (!d_old_size)
+                                return;
+                            RehashClock::Scope  timer( d_rehash_clock );
+                            for ( ;  d_old_size && budget;  budget--) {
+                                for (Id i = d_old_table[d_migrate_next];  i != EOL; ) {
+                                    Id      next = d_entries[i].next();
+                                    size_t  h = d_bucket( _entry_hash( i ) );
+                                    d_entries[i].next( d_table[h] );
+                                    d_table[h] = i;
+                                    i = next;
+                                }
+                                if (++d_migrate_next == d_old_size) {
+                                    d_old_table = Indexes();
+                                    d_old_size = 0;
+                                }
+                            }
+                        }
+
+    void  _rehash_step ()
+                        {  if (d_old_size) _rehash_step( d.rehash_step_budget );  }
+
+    // table is too deep: rehash now, or start moving buckets over a bounded number per call
+    void  _grow ()
+                        {
+                            size_t  new_hash_size = d.rehash_mult * d.hash_size;
+                            if (d.rehash_step_budget <= 0) {
+                                this->rehash( new_hash_size );
+                                return;
+                            }
+                            rehash_finish();
+                            RehashClock::Scope  timer( d_rehash_clock );
+                            d_rehash_clock.count++;
+                            std::swap( d_table, d_old_table );
+                            d_old_size = d.hash_size;
+                            d_old_bucket = d_bucket;
+                            d_migrate_next = 0;
+                            new_hash_size = d_bucket.resize( new_hash_size );
+                            d_table.resize( new_hash_size, EOL );
+                            for (size_t i = 0;  i < new_hash_size;  i++)
+                                d_table[i] = EOL;
+                            d.hash_size = new_hash_size;
+                        }
+
+    Id  _new_entry (const T& val, Id next, size_t h)
+                        {
+                            d.size++;
+                            if (/* Removable and */ d.free_list != _free_list_link(EOL)) {
+                                Id  idx = _free_list_link( d.free_list );
+                                d.free_list = d_entries[idx].next();
+                                d_entries[idx] = val;
+                                d_entries[idx].next( next );
+                                _set_hash( idx, h );
+                                return idx;
+                            }
+                            else {
+                                Id  idx = d_entries.size();
+                                d_entries.emplace_back( val );
+                                d_entries[idx].next( next );
+                                _set_hash( idx, h );
+                                return idx;
+                            }
+                        }
+};
+
+
+// ================================================================
+//  Details:
+//   methods for hash set
+// ================================================================
+
+// ==== create new
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::HashBase (Entries& entries,
+                                                                 Indexes& table,
+                                                                 Ops& search_ops,
+                                                                 const Attrs& attrs_)
+    : d( attrs_ ),
+      d_table( table ),
+      d_entries( entries ),
+      d_ops( search_ops )
+{
+    if (not d.pre_filled) {
+        d.hash_size = d_bucket.resize( d.hash_size );
+        d_table.resize( d.hash_size, EOL );
+        for (size_t i = 0;  i < d.hash_size;  i++)
+            d_table[i] = EOL;
+        d.pre_filled = true;
+    }
+    else {
+        assert( d.hash_size == table.size() );
+        d.hash_size = d_bucket.resize( d.hash_size );
+        assert( d.hash_size == table.size() );  // a table saved with a different Bucket policy
+    }
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+void  HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::predict (size_t nnodes)
+{
+    rehash( nnodes * 21 / 20 / d.max_depth );  // add 5%
+    d_entries.reserve(nnodes);
+}
+
+
+// Insert 'v' if set does not already contain an entry matching 'v'.
+// If inserting (no previous match to v), return pair( 'v', true ),
+// else return pair( previous match to 'v', false ).
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+inline std::pair< const AccessT&, bool >  HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::insert (const AccessT& v)
+{
+    std::pair<Id, bool>  x = insert2( v );
+    return std::pair<const AccessT&, bool>( d_entries[x.first].val(), x.second );
+}
+
+
+// Adds 'v' into the set regardless of whether the set already contain an entry matching 'v'.
+// If inserting (no previous match to v), return pair( 'v', true ),
+// else if assigning (previous match to v), return pair( previous match to 'v', false ).
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+inline std::pair< const AccessT&, bool >
+HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::insert_or_assign (const AccessT& v)
+{
+    std::pair<Id, bool>  x = insert_or_assign2( v );
+    return std::pair<const AccessT&, bool>( d_entries[x.first].val(), x.second );
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+void  HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::rehash (size_t new_hash_size)
+{
+    RehashClock::Scope  timer( d_rehash_clock );
+    d_rehash_clock.count++;
+    // a pending incremental rehash is dropped: every live entry is relinked below
+    d_old_table = Indexes();
+    d_old_size = 0;
+    new_hash_size = d_bucket.resize( new_hash_size );
+    // clear new hash table
+    d_table.resize(new_hash_size, EOL);
+    for (Id i = 0;  i < Id(new_hash_size);  i++)
+        d_table[i] = EOL;
+    // go through entries, compute new table slots and build new list links
+    for (Id i = 0, j = d_entries.size();  i < j;  i++) {
+        if (d_entries[i].next() >= EOL) {
+            size_t  h = d_bucket( _entry_hash( i ) );
+            d_entries[i].next( d_table[h] );
+            d_table[h] = i;
+        }
+    }
+    d.hash_size = new_hash_size;
+}
+
+// Return true if an entry matching 'v' existed and was removed.
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+bool  HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::remove (const AccessT& v)
+{
+    _rehash_step();
+    size_t  h = _hash( v );
+    for (Id* i = _head( h );  *i != EOL;  i = &(d_entries[*i].next())) {
+        T&  e = d_entries[*i];
+        if (_match( v, h, *i )) {
+            Id  idx = *i;
+            *i = e.next();
+            e = d_null_val; // force destruction of removed entry, if relevant
+            e.next( d.free_list );
+            d.free_list = _free_list_link( idx );
+            d.size--;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+void  HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::clear ()
+{
+    d_old_table = Indexes();
+    d_old_size = 0;
+    for (Id i = 0;  i < d.hash_size;  i++)
+        d_table[i] = EOL;
+    d_entries.clear();
+    d.size = 0;
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+bool  HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::contains (const AccessT& v) const
+{
+    size_t  h = _hash( v );
+    size_t  probes = 0;
+    for (Id i = *_head( h );  i != EOL;  i = d_entries[i].next()) {
+        probes++;
+        if (_match( v, h, i )) {
+            d_counters.hit( probes );
+            return true;
+        }
+    }
+    d_counters.miss( probes );
+    return false;
+}
+
+
+// if set contains 'v', return pair( ref to set's value, true ), else return pair('v', false)
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+std::pair< const AccessT&, bool >
+HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::find (const AccessT& v) const
+{
+    size_t  h = _hash( v );
+    size_t  probes = 0;
+    for (Id i = *_head( h );  i != EOL;  i = d_entries[i].next()) {
+        probes++;
+        if (_match( v, h, i )) {
+            d_counters.hit( probes );
+            return std::pair<const AccessT&, bool>( d_entries[i].val(), true );
+        }
+    }
+    d_counters.miss( probes );
+    return std::pair<const AccessT&, bool>( v, false );
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+std::pair<typename Indexes::value_type, bool>  HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::insert2 (const AccessT& v)
+{
+    _rehash_step();
+    size_t  h = _hash( v );
+    for (Id i = *_head( h );  i != EOL;  i = d_entries[i].next()) {
+        if (_match( v, h, i ))
+            return std::pair<Id, bool>( i, false );
+    }
+    if (d.size / d.hash_size > size_t(d.max_depth))
+        this->_grow();
+    Id*  head = _head( h );
+    Id  idx = this->_new_entry( v, *head, h );
+    *head = idx;
+    return std::pair<Id, bool>( idx, true );
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+std::pair< typename Indexes::value_type, bool >
+HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::insert_or_assign2 (const AccessT& v)
+{
+    _rehash_step();
+    size_t  h = _hash( v );
+    for (Id i = *_head( h );  i != EOL;  i = d_entries[i].next()) {
+        if (_match( v, h, i )) {
+            d_entries[i].val() = v;
+            return std::pair<ssize_t, bool>( i, false );
+        }
+    }
+    if (d.size / d.hash_size > d.max_depth)
+        this->_grow();
+    Id*  head = _head( h );
+    Id  idx = this->_new_entry( v, *head, h );
+    *head = idx;
+    return std::pair<ssize_t, bool>( idx, true );
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+typename Indexes::value_type  HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::insert_end (const AccessT& v)
+{
+    _rehash_step();
+    if (d.size / d.hash_size > size_t(d.max_depth))
+        this->_grow();
+
+    size_t  h = _hash( v );
+    Id  idx = d_entries.size();
+    d_entries.emplace_back( v );
+    _set_hash( idx, h );
+    Id*  head = _head( h );
+    d_entries[idx].next( *head );
+    *head = idx;
+    d.size++;
+    return idx;
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+size_t  HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::bulk_build (std::span<const AccessT> values,
+                                                                           DupPolicy dups,
+                                                                           unsigned threads)
+{
+    size_t  n = values.size();
+    std::vector<size_t>  hashes( n ), starts, order;
+    parallel_hash( n, hashes.data(), [&] (size_t i) { return _hash( values[i] ); }, threads );
+
+    d_old_table = Indexes();
+    d_old_size = 0;
+    d.hash_size = d_bucket.resize( std::max( d.hash_size, n ) );
+    d_table.resize( d.hash_size, EOL );
+    bucket_order( hashes.data(), n, d_bucket, d.hash_size, starts, order );
+
+    d_entries.clear();
+    d_entries.reserve( n );
+    d.free_list = _free_list_link( EOL );
+    for (size_t b = 0;  b < d.hash_size;  b++) {
+        Id  first = d_entries.size();
+        for (size_t k = starts[b];  k < starts[b + 1];  k++) {
+            size_t  i = order[k];
+            Id      dup = EOL;
+            for (Id j = first;  j < Id(d_entries.size()) && dup == EOL;  j++)
+                if (_match( values[i], hashes[i], j ))
+                    dup = j;
+            if (dup == EOL) {
+                d_entries.emplace_back( values[i] );
+                _set_hash( d_entries.size() - 1, hashes[i] );
+            }
+            else if (dups == DupPolicy::LastWins)
+                d_entries[dup].val() = values[i];
+            else if (dups == DupPolicy::Error) {
+                clear();
+                throw std::runtime_error( "HashBase::bulk_build: duplicate key" );
+            }
+        }
+        // the bucket's entries are contiguous: chain them in order
+        Id  end = d_entries.size();
+        d_table[b] = first < end ? first : EOL;
+        for (Id j = first;  j < end;  j++)
+            d_entries[j].next( j + 1 < end ? j + 1 : EOL );
+    }
+    d.size = d_entries.size();
+    return d.size;
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+typename Indexes::value_type  HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::find2 (const AccessT& v) const
+{
+    size_t  h = _hash( v );
+    size_t  probes = 0;
+    for (Id i = *_head( h );  i != EOL;  i = d_entries[i].next()) {
+        probes++;
+        if (_match( v, h, i )) {
+            d_counters.hit( probes );
+            return i;
+        }
+    }
+    d_counters.miss( probes );
+    return -1;
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+void  HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::find2_batch (std::span<const AccessT> keys,
+                                                                          std::span<Id> out) const
+{
+    assert( out.size() >= keys.size() );
+    const Id*  heads[BATCH_STRIDE];
+    size_t  hashes[BATCH_STRIDE];
+    for (size_t base = 0;  base < keys.size();  base += BATCH_STRIDE) {
+        size_t  n = std::min( BATCH_STRIDE, keys.size() - base );
+        for (size_t k = 0;  k < n;  k++) {
+            hashes[k] = _hash( keys[base + k] );
+            heads[k] = _head( hashes[k] );
+            __builtin_prefetch( heads[k] );
+        }
+        for (size_t k = 0;  k < n;  k++) {
+            Id  i = *heads[k];
+            if (i != EOL)
+                __builtin_prefetch( &d_entries[i] );
+            out[base + k] = i;
+        }
+        for (size_t k = 0;  k < n;  k++) {
+            Id      i = out[base + k];
+            size_t  probes = i != EOL;
+            while (i != EOL && not _match( keys[base + k], hashes[k], i )) {
+                i = d_entries[i].next();
+                probes += i != EOL;
+            }
+            if (i != EOL)
+                d_counters.hit( probes );
+            else
+                d_counters.miss( probes );
+            out[base + k] = i;
+        }
+    }
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+void  HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::contains_batch (std::span<const AccessT> keys,
+                                                                             std::span<bool> out) const
+{
+    assert( out.size() >= keys.size() );
+    Id  ids[BATCH_STRIDE];
+    for (size_t base = 0;  base < keys.size();  base += BATCH_STRIDE) {
+        size_t  n = std::min( BATCH_STRIDE, keys.size() - base );
+        find2_batch( keys.subspan( base, n ), std::span<Id>( ids, n ) );
+        for (size_t k = 0;  k < n;  k++)
+            out[base + k] = ids[k] != EOL;
+    }
+}
+
+
+// pair.second is false for a bad index or deleted element
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+std::pair<const AccessT&, bool>  HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::at (Id id) const
+{
+    if (size_t(id) < d_entries.size()) {
+        if (d_entries[id].next() >= -1)
+            return std::pair<const AccessT&, bool>( d_entries[id].val(), true );
+    }
+    return std::pair<const AccessT&, bool>( d_null_val.val(), false );
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+void  HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::print_histogram (FILE* f) const
+{
+    if (!f) f = stdout;
+    std::map< Id, int >  hist;
+    auto  chain = [&] (Id head) {
+                            int  sz = 0;
+                            for (Id i = head;  i != EOL;  i = d_entries[i].next())
+                                sz++;
+                            hist[sz] += 1;
+                        };
+    // while rehashing incrementally, the old buckets not moved yet are chains too
+    for (size_t h = 0;  h < d.hash_size;  h++)
+        chain( d_table[h] );
+    for (size_t h = d_migrate_next;  h < d_old_size;  h++)
+        chain( d_old_table[h] );
+
+    fprintf( f, "Table Histogram:\n" );
+    for (auto x : hist)
+        fprintf( f, "   %5lu %8d\n", x.first, x.second );
+
+    fprintf( f, "\n" );
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+HashStats  HashBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::stats () const
+{
+    HashStats  s;
+    s.size = d.size;
+    s.slots = d_entries.size();
+    s.free_list = s.slots - d.size;
+    auto  chain = [&] (Id head) {
+                            size_t  len = 0;
+                            for (Id i = head;  i != EOL;  i = d_entries[i].next())
+                                len++;
+                            s.add_chain( len );
+                        };
+    // while rehashing incrementally, the old buckets not moved yet count too
+    for (size_t h = 0;  h < d.hash_size;  h++)
+        chain( d_table[h] );
+    for (size_t h = d_migrate_next;  h < d_old_size;  h++)
+        chain( d_old_table[h] );
+    s.finish();
+
+    d_counters.fill( s );
+    d_rehash_clock.fill( s );
+    s.table_bytes = container_bytes( d_table ) + container_bytes( d_old_table );
+    s.entry_bytes = container_bytes( d_entries );
+    return s;
+}
+
+
+} // namesapce Util
+
+
+// The elements that are not 'dflt' live in a SparseStore, which picks a hash, sorted runs
+// or a bitmap by density and write pattern.  slice() shares the store and sees elements
+// [offset, offset + siz) of it.  A shared store is not written: the first write to a slice,
+// or to an array that has slices, copies its own elements (only those) into a new store.
+// In a Util::LoadPool, unload() spills the elements and the next access maps them back.
+template <typename T>
+class SparseArray : public DataObj, public Util::Lazy
+{
+    using Store = Util::SparseStore<T>;
+
+    T                       dflt   = T{};
+    size_t                  d_size = 0;
+    size_t                  offset = 0;
+    size_t                  siz    = ~0;
+    std::shared_ptr<Store>  d;
+
+    // what serialize() or frames() sent: sorted indexes and their values, alive as long as 'this'
+    std::vector<uint32_t>   d_wire_index;
+    std::vector<T>          d_wire_vals;
+    uint64_t                d_wire_shape[3] = {};   // frames(): offset, d_size, siz
+
+    SparseArray (SchemaPtr sch_,std::shared_ptr<Store> d_, size_t offset_, size_t slice_size_, T dflt_)
+        :DataObj(sch_), dflt(dflt_), offset(offset_), siz(slice_size_), d(d_) {}
+public:
+    class Ref
+    {
+    public:
+        int _n;
+        SparseArray& _a;
+
+        Ref(int n_, SparseArray& a_) : _n(n_), _a(a_) {};
+
+        Ref& operator=(T value)                         { _a.vset(_n, &value); return *this; }
+
+        operator T () const                             { _a._touch(); return _a.d->get(_n + _a.offset, _a.dflt); }
+
+        friend std::ostream&  operator<< (std::ostream& s, const Ref& c)
+        {
+            return s << T(c);
+        }
+
+    };
+
+public:
+    SparseArray (SchemaPtr sch)
+        : DataObj(sch), d(std::make_shared<Store>()) {}
+
+    SparseArray (SchemaPtr sch, size_t sz)
+        : DataObj(sch), d_size( sz ), d(std::make_shared<Store>()) {}
+
+    SparseArray (SchemaPtr sch, size_t sz, const T& dflt_)
+        : DataObj(sch), dflt(dflt_), d_size(sz),d(std::make_shared<Store>()) {}
+
+    size_t          size () const override              { return std::min(d_size - offset, siz); }
+
+    // this object's share of the store; see "memory accounting" in HashOps.h
+    Util::MemoryUsage  memory_usage () const;
+    size_t          size_bytes () const override        { return memory_usage().total(); }
+    // give the store's slack back, unless slices share it
+    void            shrink_to_fit ()                    { if (d.use_count() == 1) d->shrink_to_fit(); }
+    void            memory_report (Util::MemoryReport& report, const std::string& node) const
+                                                        { report.add(node, memory_usage()); }
+
+    DataObjPtr      slice (size_t offset, size_t slice_size = ~0) override;
+
+    DataObjPtr      slice_copy ( size_t offset, size_t slice_size = ~0) override;
+
+    Ref       operator[] ( Id<T> i )                    { return Ref(i.get(), *this); }
+
+    const Ref operator[] ( Id<T> i ) const              { return Ref(i.get(), const_cast<SparseArray&>(*this)); }
+
+    // out[k] = element i + k for k < n, defaults included
+    void            gather (size_t i, size_t n, T* out) const   { _touch(); d->gather(i + offset, n, out, dflt); }
+
+    // f(size_t i, const T&) for each element that is not the default, in order
+    template <typename F>
+    void            for_each (F f) const
+                        { _touch(); d->for_each(offset, offset + size(), [&](size_t i, const T& v) { f(i - offset, v); }); }
+
+    // the store, e.g. to pin its mode (see SparseStore); not shared with slices
+    Store&          store ()                            { _own();  return *d; }
+
+    const void*     vget (int i) const override;
+    GenericValue    gvget (int i) const override;
+
+    void            vset (int i, const void* val) override;
+
+    void            vappend (const void* val) override;
+
+    void            serialize (MPSys::Message& msg, DataObjPtr p) override;
+    void            unload () override;
+
+    // frames: see "frames on the wire" in Spill.h.  The sections are the offset and sizes,
+    // then the slice's sorted runs as serialize() sends them: straight from the store in
+    // Runs mode, else from copies; valid until the next write or call
+    Util::Frames    frames ();
+    // replace the contents with frames read from 'fd': the runs become the store's.
+    // Throws std::runtime_error
+    void            adopt_frames (int fd);
+
+    void            repr (std::ostream& s, int level) const override;
+    void            print (int level=0) const override;
+
+private:
+    // before a write: a store of its own if 'd' is shared
+    void            _own ();
+
+    // ==== Util::Lazy: the sections are the slice's sorted runs, indexes and values
+    bool            _spillable () const override        { return std::is_trivially_copyable_v<T>; }
+    size_t          _loaded_bytes () const override     { return memory_usage().total(); }
+    void            _spill (const std::string& path) override;
+    void            _load (const std::string& path) override;
+    void            _drop () override;
+};
+
+// 'offset' and 'slice_size' are in this array's indexes and clipped to its size
+template<typename T>
+DataObjPtr  SparseArray<T>::slice (size_t offset, size_t slice_size)
+{
+    _touch();
+    size_t  n = size();
+    offset = std::min(offset, n);
+    slice_size = std::min(slice_size, n - offset);
+    SparseArrayData<T>* sliced = new SparseArrayData<T>(this->schema(), d, this->offset + offset, slice_size, dflt);
+    static_cast<SparseArray<T>*>(sliced)->d_size = d_size;
+    sliced->d_parent = d_parent;
+    return DataObjPtr(sliced);
+}
+
+// only the elements in the range are copied
+template<typename T>
+DataObjPtr SparseArray<T>::slice_copy ( size_t offset, size_t slice_size)
+{
+    _touch();
+    size_t  n = size();
+    offset = std::min(offset, n);
+    slice_size = std::min(slice_size, n - offset);
+    SchemaPtr sch = SchemaPtr( this->schema()->copy() );
+    std::shared_ptr<Store> op = std::make_shared<Store>( d->range(this->offset + offset, this->offset + offset + slice_size) );
+    SparseArray<T>* copy_sparse_array_data = new SparseArray<T>(sch, op, 0, ~0, dflt);
+    copy_sparse_array_data->d_size = slice_size;
+    return DataObjPtr( copy_sparse_array_data );
+}
+
+// what serialize() sent is this object's alone; does not load the store
+template<typename T>
+Util::MemoryUsage  SparseArray<T>::memory_usage () const
+{
+    Util::MemoryUsage  u = d->memory_usage();
+    u.control = Util::shared_block_bytes<Store>();
+    u = u.shared(d.use_count());
+    u.entries += Util::container_bytes(d_wire_index) + Util::container_bytes(d_wire_vals);
+    u.slack += Util::container_slack(d_wire_index) + Util::container_slack(d_wire_vals);
+    return u;
+}
+
+// the slices and the array they came from go on reading the shared store
+template<typename T>
+void  SparseArray<T>::_own ()
+{
+    _touch_write();
+    if (d.use_count() == 1)
+        return;
+    size_t  n = size();
+    d = std::make_shared<Store>( d->range(offset, offset + n) );
+    d_size = n;
+    offset = 0;
+}
+
+// valid until the next write, or the pool's next access to another object unless pinned;
+// see "lazy loading" in Spill.h
+template<typename T>
+const void*  SparseArray<T>::vget (int i) const
+{
+    _touch();
+    const T*  p = d->find(i+offset);
+    return (const void*) (p ? p : &dflt);
+}
+
+template<typename T>
+GenericValue  SparseArray<T>::gvget (int i) const
+{
+    _touch();
+    return GenericValue( d->get(i+offset, dflt) );
+}
+
+
+template<typename T>
+void  SparseArray<T>::vset (int i, const void* val)
+{
+    const T&  v = * (const T*) val;
+    _own();
+    if (v != dflt)
+        d->set(i+offset, v);
+    else
+        d->erase(i+offset);     // ok if it doesn't exist in 'd'
+}
+
+template<typename T>
+void  SparseArray<T>::vappend (const void* val)
+{
+    assert( siz == (size_t)~0);
+    const T&  v = * (const T*) val;
+    _own();
+    if (v != dflt)
+        d->set(d_size, v);
+    d_size++;
+}
+
+// the elements in the slice go as sorted runs, whatever the store's mode: indexes, then values
+template<typename T>
+void  SparseArray<T>::serialize (MPSys::Message& msg, DataObjPtr p)
+{
+    _touch();
+    if (d.use_count() == 1)     // slices may be reading it
+        d->optimize();
+    d_wire_index.clear();
+    d_wire_vals.clear();
+    d->for_each(offset, offset + size(), [&](size_t i, const T& v) { d_wire_index.push_back(i);  d_wire_vals.push_back(v); });
+
+    msg.frame( MPSys::make_frame< ValueReferenceData<size_t> >( offset, Defer(p) ));
+    msg.frame( MPSys::make_frame< ValueReferenceData<size_t> >( d_size, Defer(p) ));
+    msg.frame( MPSys::make_frame< ValueReferenceData<size_t> >( siz, Defer(p) ));
+    msg.frame( MPSys::make_frame< StdVectorReferenceData<uint32_t> >( d_wire_index, Defer(p) ));
+    msg.frame( MPSys::make_frame< StdVectorReferenceData<T> >( d_wire_vals, Defer(p) ));
+}
+
+
+template<typename T>
+Util::Frames  SparseArray<T>::frames ()
+{
+    static_assert(std::is_trivially_copyable_v<T>, "SparseArray::frames: values are sent as bytes");
+    _touch();
+    if (d.use_count() == 1)
+        d->optimize();
+    d_wire_index.clear();
+    d_wire_vals.clear();
+    std::span<const uint32_t>  index;
+    std::span<const T>         vals;
+    if (!d->runs(offset, offset + size(), index, vals)) {
+        d->for_each(offset, offset + size(), [&](size_t i, const T& v) { d_wire_index.push_back(i);  d_wire_vals.push_back(v); });
+        index = d_wire_index;
+        vals = d_wire_vals;
+    }
+    d_wire_shape[0] = offset;
+    d_wire_shape[1] = d_size;
+    d_wire_shape[2] = siz;
+
+    Util::Frames  f(Util::spill_layout<uint32_t, T>());
+    f.header.value_size = sizeof(T);
+    f.add({ reinterpret_cast<const char*>(d_wire_shape), sizeof(d_wire_shape) });
+    f.add(Util::spill_bytes(index));
+    f.add(Util::spill_bytes(vals));
+    f.keep = d;
+    return f;
+}
+
+// the indexes stay those of the sender's store, with its offset
+template<typename T>
+void  SparseArray<T>::adopt_frames (int fd)
+{
+    static_assert(std::is_trivially_copyable_v<T>, "SparseArray::adopt_frames: values are sent as bytes");
+    Util::FrameHeader  h = Util::recv_frame_header(fd, 3);
+    if (h.value_size != sizeof(T) || h.layout != Util::spill_layout<uint32_t, T>())
+        throw std::runtime_error("SparseArray::adopt_frames: sender has another value type");
+    uint64_t  shape[3];
+    size_t    n = Util::frame_count(h, 1, sizeof(uint32_t));
+    if (Util::frame_count(h, 2, sizeof(T)) != n)
+        throw std::runtime_error("SparseArray::adopt_frames: indexes and values do not pair up");
+    std::vector<uint32_t>  index(n);
+    std::vector<T>         vals(n);
+    Util::recv_sections(fd, h, { { reinterpret_cast<char*>(shape), sizeof(shape) }, Util::frame_dest(index), Util::frame_dest(vals) });
+    // what frames() sends: offset <= size, the indexes sorted, each once, in [offset, size)
+    if (shape[0] > shape[1] || (n > 0 && (index.front() < shape[0] || index.back() >= shape[1])) ||
+        std::adjacent_find(index.begin(), index.end(), std::greater_equal<uint32_t>()) != index.end())
+        throw std::runtime_error("SparseArray::adopt_frames: indexes are not sorted, or not in the array");
+    _touch_write();
+    _drop();
+    d->assign(std::move(index), std::move(vals));
+    offset = shape[0];
+    d_size = shape[1];
+    siz = shape[2];
+}
+
+
+// in a pool, the elements come back on the next access
+template<typename T>
+void  SparseArray<T>::unload ()
+{
+    if (pool()) {
+        pool()->unload(*this);
+        return;
+    }
+    offset = d_size = siz = 0L;
+    d = std::make_shared<Store>();
+    std::vector<uint32_t>().swap( d_wire_index );
+    std::vector<T>().swap( d_wire_vals );
+    d_deferral->unload( *this );
+}
+
+// indexes stay those of the store, so 'offset' holds after a load
+template<typename T>
+void  SparseArray<T>::_spill (const std::string& path)
+{
+    if constexpr (std::is_trivially_copyable_v<T>) {
+        std::vector<uint32_t>  index;
+        std::vector<T>         vals;
+        index.reserve(d->size());
+        vals.reserve(d->size());
+        d->for_each(offset, offset + size(), [&](size_t i, const T& v) { index.push_back(i);  vals.push_back(v); });
+        Util::spill_write(path, Util::spill_layout<uint32_t, T>(), { Util::spill_bytes(index), Util::spill_bytes(vals) });
+    }
+}
+
+template<typename T>
+void  SparseArray<T>::_load (const std::string& path)
+{
+    Util::SpillMap  m(path, Util::spill_layout<uint32_t, T>(), 2);
+    auto  index = m.section<uint32_t>(0);
+    auto  vals = m.section<T>(1);
+    d->assign(std::vector<uint32_t>(index.begin(), index.end()), std::vector<T>(vals.begin(), vals.end()));
+}
+
+// an empty store in the same mode, for _load
+template<typename T>
+void  SparseArray<T>::_drop ()
+{
+    d = std::make_shared<Store>(d->adaptive() ? Store::Mode::Auto : d->mode());
+}
+
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+#include <span>
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "HashOps.h"
+#include "HashBase.h"
+
+namespace Util {
+
+
+// ================================================================
+// group probe base
+//
+// open addressing alternative to HashBase, with the same interface and
+// the same requirements on Entries, Indexes and Ops.
+//
+// 'd_table' holds one entry id per slot.  A parallel control byte per
+// slot holds the low 7 bits of the hash (or EMPTY / DELETED), and a
+// probe compares a group of 16 control bytes at once (SSE2), so a
+// lookup reads one line of control bytes instead of following 'next'
+// links through 'd_entries'.
+//
+// Entries are appended to 'd_entries' exactly as in HashBase, so Ids,
+// at(), the free list and Iterator mean the same thing.  T::next() is
+// only used to tag live entries (EOL) and to link removed ones.
+//
+// The control bytes are derived data and are not part of Attrs: a
+// pre_filled table is re-slotted from 'd_entries' on construction.
+//
+// The template arguments are HashBase's, so HashEngine (below) switches
+// a caller between the two with its Layout alone.  Counters counts
+// lookups as HashBase does, a probe being one group of 16 slots.  Bucket
+// is not used: the slot count is a power of 2 and the group comes from
+// the mixed hash.
+// ================================================================
+
+template <typename Entries,
+          typename Indexes,
+          typename Ops = SearchOps< typename Entries::value_type >,
+          typename AccessT = typename Entries::value_type,
+          typename Bucket = ModuloIndex,        // accepted for HashBase callers, not used
+          typename Counters = NoHashCounters    // HashCounters to count lookups, see "table statistics"
+          >
+class GroupProbeBase
+{
+    using  T  = typename Entries::value_type;
+    using  Id = typename Indexes::value_type;
+    static constexpr  Id  EOL = ~0;
+
+    static inline Id  _free_list_link (Id x)  { return -3 - x; }
+
+    // ==== control bytes
+    //        0x00 - 0x7f:  slot in use, low 7 bits of the hash
+    //        EMPTY:        never used since the last rehash; ends a probe
+    //        DELETED:      removed; probes continue past it
+    static constexpr  uint8_t  EMPTY   = 0x80;
+    static constexpr  uint8_t  DELETED = 0xfe;
+    static constexpr  size_t   GROUP   = 16;
+
+public:
+
+    // grouped data fields needed for serialization
+    class Attrs
+    {
+        friend class GroupProbeBase;
+
+        Id            free_list   = -2;     // index of first unused d_entries slot; others are linked
+        Id            size        = 0;      // number of non-removed entries (not d_entries.size())
+
+        // user settable at construction only
+        size_t        hash_size   = 128;    // number of slots, rounded up to a power of 2 (>= 16)
+        bool          pre_filled  = false;  // set true if contructor input vec's contain valid data
+
+        // user settable at any time
+        int           max_load    = 87;     // rehash if more than this % of the slots are not EMPTY
+        int           rehash_mult = 2;      // if a rehash is needed, by how much is hash_size increased
+
+    public:
+        Attrs () {}
+        // for chaining
+        Attrs&  set_hash_size (int x)           { hash_size = x;     return *this; }
+        Attrs&  set_max_load (int x)            { max_load = x;      return *this; }
+        Attrs&  set_max_depth (int)             { return *this; }    // no chains; accepted for HashBase callers
+        Attrs&  set_rehash_mult (int x)         { rehash_mult = x;   return *this; }
+        Attrs&  set_pre_filled (bool x = true)  { pre_filled = x;    return *this; }
+        Attrs&  set_rehash_step_budget (int)    { return *this; }    // slots move all at once; as above
+    };
+
+private:
+
+    Attrs     d;
+    size_t    d_used = 0;            // slots that are not EMPTY (live + DELETED)
+
+    T           d_null_val;  // removed items are set to this, so real entries can be deleted
+
+    std::vector<uint8_t>  d_ctrl;    // control byte per slot
+    Indexes&    d_table;
+    Entries&    d_entries;   // entries
+    Ops&        d_ops;       // functors to compute hash value from T and to compare two T's
+
+    [[no_unique_address]] Counters  d_counters;
+    mutable RehashClock  d_rehash_clock;
+
+
+public:
+
+    GroupProbeBase (Entries& entries_vec, // memory for values and 'next' tag
+                    Indexes& table_vec,   // memory for slots
+                    Ops& search_ops,
+                    const Attrs& attrs = Attrs());
+
+    void  set_null_val (const T& x)             { d_null_val = x; }
+
+    void  predict (size_t nnodes);
+
+    Attrs&  attrs ()                            { return d; }
+
+    // ==== insertions / deletions  (see HashBase)
+    std::pair<const AccessT&, bool>  insert (const AccessT& v);
+    std::pair<const AccessT&, bool>  insert_or_assign (const AccessT& v);
+
+    void  rehash (size_t new_hash_size);
+
+    // no incremental rehash: for HashBase callers
+    void  rehash_finish ()                      {}
+    bool  rehashing () const                    { return false; }
+
+    bool  remove (const AccessT& v);
+    void  remove_by_index (Id i);
+
+    void  clear ();
+
+    // ==== access
+    bool  empty () const      {  return d.size == 0;  }
+    size_t  size () const     {  return d.size;  }
+    bool  contains (const AccessT& v) const;
+
+    std::pair<const AccessT&, bool>  find (const AccessT& v) const;
+
+    // ================ direct indexing support
+    std::pair<Id, bool>  insert2 (const AccessT& v);
+    std::pair<Id, bool>  insert_or_assign2 (const AccessT& v);
+
+    Id  insert_end (const AccessT& v);
+
+    // Replace the contents with 'values', slotted once for all of them.  The values are
+    // hashed in 'threads' threads (0 = one per core; Ops must be safe to call concurrently,
+    // else pass 1).  Entry ids follow input order.  Returns size().
+    size_t  bulk_build (std::span<const AccessT> values, DupPolicy dups = DupPolicy::FirstWins,
+                        unsigned threads = 0);
+
+    // return -1 if not found
+    Id  find2 (const AccessT& v) const;
+
+    // ==== batched lookup  (see HashBase)
+    // Keys are done BATCH_STRIDE at a time: hash all and prefetch their home groups, then
+    // match the tags and prefetch the first candidate entries, then probe.
+    static constexpr size_t  BATCH_STRIDE = 16;
+    void  find2_batch (std::span<const AccessT> keys, std::span<Id> out) const;
+    void  contains_batch (std::span<const AccessT> keys, std::span<bool> out) const;
+
+    std::pair<const AccessT&, bool>  at (Id id) const;
+
+    // ==== iterate ====
+    class Iterator {
+        using  Iter = typename Entries::iterator;
+        Iter  it, end;
+        void  _advance ()      { while (it != end && it->next() < EOL) ++it; } // skip deletions
+        Iterator (Iter i, Iter e)       : it(i), end(e) { _advance(); }
+        friend class GroupProbeBase;
+    public:
+        Iterator (GroupProbeBase& h)    : it( h.d_entries.begin() ), end( h.d_entries.end() ) { _advance(); }
+        bool  operator() ()             {  return it != end;  }
+        void  operator++ ()             {  if (it != end) ++it;  _advance();  } // skip deletions
+        const AccessT&  operator* ()    {  return it->val();  }
+        bool  operator!= (Iterator& x)  { return it != end; }
+    };
+
+    Iterator  begin ()                  { return Iterator( d_entries.begin(), d_entries.end() ); }
+    Iterator  end ()                    { return Iterator( d_entries.end(),   d_entries.end() ); }
+
+    // ================
+    // ==== stats
+
+    size_t  bucket_count () const       {  return d.hash_size;  }
+    void  print_histogram (FILE* f = NULL) const; // NULL = stdout; groups probed per entry
+
+    // as HashBase's, with slots for buckets and groups probed for chain lengths:
+    // chains[k] = entries found in the k-th group of their probe
+    HashStats  stats () const;
+    void  reset_counters ()             {  d_counters.reset();  }
+
+private:
+
+    // identity hashes (std::hash<int>) would put every key in the same 7-bit tag
+    static size_t  _mix (size_t h)      { return mix_hash( h ); }
+    static uint8_t  _h2 (size_t h)      { return h & 0x7f; }
+    size_t  _home (size_t h) const      { return (h >> 7) & _group_mask(); }
+    size_t  _group_mask () const        { return d.hash_size / GROUP - 1; }
+
+    // bit i is set if control byte i of group 'g' equals 'x'
+    uint32_t  _match (size_t g, uint8_t x) const
+                        {
+#if defined(__SSE2__)
+                            __m128i  c = _mm_loadu_si128( (const __m128i*) (d_ctrl.data() + g * GROUP) );
+                            return _mm_movemask_epi8( _mm_cmpeq_epi8( c, _mm_set1_epi8( (char) x ) ));
+#else
+                            const uint8_t*  c = d_ctrl.data() + g * GROUP;
+                            uint32_t  m = 0;
+                            for (size_t i = 0;  i < GROUP;  i++)
+                                m |= uint32_t( c[i] == x ) << i;
+                            return m;
+#endif
+                        }
+
+    // bit i is set if slot i of group 'g' is EMPTY or DELETED (high bit set)
+    uint32_t  _match_free (size_t g) const
+                        {
+#if defined(__SSE2__)
+                            return _mm_movemask_epi8( _mm_loadu_si128( (const __m128i*) (d_ctrl.data() + g * GROUP) ));
+#else
+                            const uint8_t*  c = d_ctrl.data() + g * GROUP;
+                            uint32_t  m = 0;
+                            for (size_t i = 0;  i < GROUP;  i++)
+                                m |= uint32_t( c[i] >> 7 ) << i;
+                            return m;
+#endif
+                        }
+
+    // slot holding a match to 'v', or ~0; 'groups' probed.  Triangular steps visit
+    // every group once.
+    size_t  _find_slot (const AccessT& v, size_t h, size_t& groups) const
+                        {
+                            size_t  mask = _group_mask();
+                            size_t  g = _home( h );
+                            groups = 0;
+                            for (size_t step = 1;  step <= mask + 1;  g = (g + step++) & mask) {
+                                groups++;
+                                for (uint32_t m = _match( g, _h2( h ) );  m;  m &= m - 1) {
+                                    size_t  slot = g * GROUP + __builtin_ctz( m );
+                                    if (d_ops( v, d_entries[ d_table[slot] ] ))
+                                        return slot;
+                                }
+                                if (_match( g, EMPTY ))
+                                    break;
+                            }
+                            return ~size_t(0);
+                        }
+
+    size_t  _find_slot (const AccessT& v, size_t h) const
+                        {  size_t  groups;  return _find_slot( v, h, groups );  }
+
+    // _find_slot for find, find2, contains and the batches: counted
+    size_t  _lookup (const AccessT& v, size_t h) const
+                        {
+                            size_t  groups;
+                            size_t  slot = _find_slot( v, h, groups );
+                            if (slot != ~size_t(0))
+                                d_counters.hit( groups );
+                            else
+                                d_counters.miss( groups );
+                            return slot;
+                        }
+
+    // groups probed to reach 'slot', which holds a live entry
+    size_t  _probe_length (size_t slot) const
+                        {
+                            size_t  mask = _group_mask();
+                            size_t  g = _home( _mix( d_ops( d_entries[ d_table[slot] ] ) ) ), steps = 1;
+                            while (g != slot / GROUP)
+                                g = (g + steps++) & mask;
+                            return steps;
+                        }
+
+    // every slot EMPTY, then the live entries of 'd_entries' placed
+    void  _reslot (size_t new_hash_size);
+
+    // put entry 'idx' into the first free slot on the probe path of 'h'
+    void  _place (size_t h, Id idx)
+                        {
+                            size_t  mask = _group_mask();
+                            size_t  g = _home( h );
+                            for (size_t step = 1;  ;  g = (g + step++) & mask) {
+                                if (uint32_t m = _match_free( g )) {
+                                    size_t  slot = g * GROUP + __builtin_ctz( m );
+                                    if (d_ctrl[slot] == EMPTY)
+                                        d_used++;
+                                    d_ctrl[slot] = _h2( h );
+                                    d_table[slot] = idx;
+                                    return;
+                                }
+                            }
+                        }
+
+    // a probe never passed through a group that still has an EMPTY slot, so the
+    // slot can go back to EMPTY rather than DELETED
+    void  _erase_slot (size_t slot)
+                        {
+                            if (_match( slot / GROUP, EMPTY )) {
+                                d_ctrl[slot] = EMPTY;
+                                d_used--;
+                            }
+                            else
+                                d_ctrl[slot] = DELETED;
+                            d_table[slot] = EOL;
+                        }
+
+    // called before taking a slot: drop tombstones if they are most of the load, else grow
+    void  _check_load ()
+                        {
+                            if ((d_used + 1) * 100 <= d.hash_size * d.max_load)
+                                return;
+                            if (size_t(d.size) * 2 < d_used)
+                                this->rehash( d.hash_size );
+                            else
+                                this->rehash( d.hash_size * d.rehash_mult );
+                        }
+
+    void  _free_entry (Id idx)
+                        {
+                            T&  e = d_entries[idx];
+                            e = d_null_val; // force destruction of removed entry, if relevant
+                            e.next( d.free_list );
+                            d.free_list = _free_list_link( idx );
+                            d.size--;
+                        }
+
+    Id  _new_entry (const AccessT& val)
+                        {
+                            d.size++;
+                            if (d.free_list != _free_list_link(EOL)) {
+                                Id  idx = _free_list_link( d.free_list );
+                                d.free_list = d_entries[idx].next();
+                                d_entries[idx] = val;
+                                d_entries[idx].next( EOL );
+                                return idx;
+                            }
+                            else {
+                                Id  idx = d_entries.size();
+                                d_entries.emplace_back( val );
+                                d_entries[idx].next( EOL );
+                                return idx;
+                            }
+                        }
+};
+
+
+// ================================================================
+//  Details:
+//   methods for group probe base
+// ================================================================
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::GroupProbeBase (Entries& entries,
+                                                                             Indexes& table,
+                                                                             Ops& search_ops,
+                                                                             const Attrs& attrs_)
+    : d( attrs_ ),
+      d_table( table ),
+      d_entries( entries ),
+      d_ops( search_ops )
+{
+    // slots are rebuilt from 'd_entries' either way; that is a no-op for a new table
+    _reslot( d.hash_size );
+    d.pre_filled = true;
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+void  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::predict (size_t nnodes)
+{
+    this->rehash( nnodes * 100 / d.max_load + 1 );
+    d_entries.reserve(nnodes);
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+inline std::pair< const AccessT&, bool >  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::insert (const AccessT& v)
+{
+    std::pair<Id, bool>  x = insert2( v );
+    return std::pair<const AccessT&, bool>( d_entries[x.first].val(), x.second );
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+inline std::pair< const AccessT&, bool >
+GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::insert_or_assign (const AccessT& v)
+{
+    std::pair<Id, bool>  x = insert_or_assign2( v );
+    return std::pair<const AccessT&, bool>( d_entries[x.first].val(), x.second );
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+void  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::rehash (size_t new_hash_size)
+{
+    RehashClock::Scope  timer( d_rehash_clock );
+    d_rehash_clock.count++;
+    _reslot( new_hash_size );
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+void  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::_reslot (size_t new_hash_size)
+{
+    // power of 2 number of groups, and room for every live entry under max_load
+    size_t  n = GROUP;
+    while (n < new_hash_size || n * d.max_load <= 100 * size_t(d.size))
+        n *= 2;
+
+    d_table.resize(n, EOL);
+    for (size_t i = 0;  i < n;  i++)
+        d_table[i] = EOL;
+    d_ctrl.assign( n, EMPTY );
+    d.hash_size = n;
+    d_used = 0;
+
+    for (Id i = 0, j = d_entries.size();  i < j;  i++) {
+        if (d_entries[i].next() >= EOL)
+            _place( _mix( d_ops( d_entries[i] ) ), i );
+    }
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+bool  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::remove (const AccessT& v)
+{
+    size_t  slot = _find_slot( v, _mix( d_ops( v ) ) );
+    if (slot == ~size_t(0))
+        return false;
+    Id  idx = d_table[slot];
+    _erase_slot( slot );
+    _free_entry( idx );
+    return true;
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+void  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::remove_by_index (Id i)
+{
+    if (size_t(i) >= d_entries.size() || d_entries[i].next() < EOL)
+        return;
+    size_t  h = _mix( d_ops( d_entries[i] ) );
+    size_t  mask = _group_mask();
+    size_t  g = _home( h );
+    for (size_t step = 1;  step <= mask + 1;  g = (g + step++) & mask) {
+        for (uint32_t m = _match( g, _h2( h ) );  m;  m &= m - 1) {
+            size_t  slot = g * GROUP + __builtin_ctz( m );
+            if (d_table[slot] == i) {
+                _erase_slot( slot );
+                _free_entry( i );
+                return;
+            }
+        }
+    }
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+void  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::clear ()
+{
+    for (size_t i = 0;  i < d.hash_size;  i++)
+        d_table[i] = EOL;
+    d_ctrl.assign( d.hash_size, EMPTY );
+    d_entries.clear();
+    d.size = 0;
+    d.free_list = _free_list_link( EOL );
+    d_used = 0;
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+bool  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::contains (const AccessT& v) const
+{
+    return _lookup( v, _mix( d_ops( v ) ) ) != ~size_t(0);
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+std::pair< const AccessT&, bool >
+GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::find (const AccessT& v) const
+{
+    size_t  slot = _lookup( v, _mix( d_ops( v ) ) );
+    if (slot != ~size_t(0))
+        return std::pair<const AccessT&, bool>( d_entries[ d_table[slot] ].val(), true );
+    return std::pair<const AccessT&, bool>( v, false );
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+std::pair<typename Indexes::value_type, bool>  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::insert2 (const AccessT& v)
+{
+    size_t  h = _mix( d_ops( v ) );
+    size_t  slot = _find_slot( v, h );
+    if (slot != ~size_t(0))
+        return std::pair<Id, bool>( d_table[slot], false );
+    _check_load();
+    Id  idx = this->_new_entry( v );
+    _place( h, idx );
+    return std::pair<Id, bool>( idx, true );
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+std::pair< typename Indexes::value_type, bool >
+GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::insert_or_assign2 (const AccessT& v)
+{
+    size_t  h = _mix( d_ops( v ) );
+    size_t  slot = _find_slot( v, h );
+    if (slot != ~size_t(0)) {
+        d_entries[ d_table[slot] ].val() = v;
+        return std::pair<Id, bool>( d_table[slot], false );
+    }
+    _check_load();
+    Id  idx = this->_new_entry( v );
+    _place( h, idx );
+    return std::pair<Id, bool>( idx, true );
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+typename Indexes::value_type  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::insert_end (const AccessT& v)
+{
+    _check_load();
+    Id  idx = d_entries.size();
+    d_entries.emplace_back( v );
+    d_entries[idx].next( EOL );
+    _place( _mix( d_ops( v ) ), idx );
+    d.size++;
+    return idx;
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+size_t  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::bulk_build (std::span<const AccessT> values,
+                                                                                 DupPolicy dups,
+                                                                                 unsigned threads)
+{
+    size_t  n = values.size();
+    std::vector<size_t>  hashes( n );
+    parallel_hash( n, hashes.data(), [&] (size_t i) { return _mix( d_ops( values[i] ) ); }, threads );
+
+    d_entries.clear();
+    d_entries.reserve( n );
+    d.size = 0;
+    d.free_list = _free_list_link( EOL );
+    _reslot( n * 100 / d.max_load + 1 );
+    for (size_t i = 0;  i < n;  i++) {
+        size_t  slot = _find_slot( values[i], hashes[i] );
+        if (slot == ~size_t(0))
+            _place( hashes[i], _new_entry( values[i] ) );
+        else if (dups == DupPolicy::LastWins)
+            d_entries[ d_table[slot] ].val() = values[i];
+        else if (dups == DupPolicy::Error) {
+            clear();
+            throw std::runtime_error( "GroupProbeBase::bulk_build: duplicate key" );
+        }
+    }
+    return d.size;
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+typename Indexes::value_type  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::find2 (const AccessT& v) const
+{
+    size_t  slot = _lookup( v, _mix( d_ops( v ) ) );
+    return slot != ~size_t(0) ? d_table[slot] : -1;
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+void  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::find2_batch (std::span<const AccessT> keys,
+                                                                                std::span<Id> out) const
+{
+    assert( out.size() >= keys.size() );
+    size_t  hashes[BATCH_STRIDE];
+    for (size_t base = 0;  base < keys.size();  base += BATCH_STRIDE) {
+        size_t  n = std::min( BATCH_STRIDE, keys.size() - base );
+        for (size_t k = 0;  k < n;  k++) {
+            hashes[k] = _mix( d_ops( keys[base + k] ) );
+            size_t  g = _home( hashes[k] );
+            __builtin_prefetch( d_ctrl.data() + g * GROUP );
+            __builtin_prefetch( &d_table[g * GROUP] );
+        }
+        for (size_t k = 0;  k < n;  k++) {
+            size_t  g = _home( hashes[k] );
+            if (uint32_t m = _match( g, _h2( hashes[k] ) ))
+                __builtin_prefetch( &d_entries[ d_table[g * GROUP + __builtin_ctz( m )] ] );
+        }
+        for (size_t k = 0;  k < n;  k++) {
+            size_t  slot = _lookup( keys[base + k], hashes[k] );
+            out[base + k] = slot != ~size_t(0) ? d_table[slot] : -1;
+        }
+    }
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+void  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::contains_batch (std::span<const AccessT> keys,
+                                                                                   std::span<bool> out) const
+{
+    assert( out.size() >= keys.size() );
+    Id  ids[BATCH_STRIDE];
+    for (size_t base = 0;  base < keys.size();  base += BATCH_STRIDE) {
+        size_t  n = std::min( BATCH_STRIDE, keys.size() - base );
+        find2_batch( keys.subspan( base, n ), std::span<Id>( ids, n ) );
+        for (size_t k = 0;  k < n;  k++)
+            out[base + k] = ids[k] != -1;
+    }
+}
+
+
+// pair.second is false for a bad index or deleted element
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+std::pair<const AccessT&, bool>  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::at (Id id) const
+{
+    if (size_t(id) < d_entries.size()) {
+        if (d_entries[id].next() >= -1)
+            return std::pair<const AccessT&, bool>( d_entries[id].val(), true );
+    }
+    return std::pair<const AccessT&, bool>( d_null_val.val(), false );
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+void  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::print_histogram (FILE* f) const
+{
+    if (!f) f = stdout;
+    std::map< size_t, int >  hist;
+    for (size_t slot = 0;  slot < d.hash_size;  slot++) {
+        if (d_ctrl[slot] & 0x80)
+            continue;
+        hist[ _probe_length( slot ) ] += 1;
+    }
+
+    fprintf( f, "Probe Histogram: %zu slots, %zu used, %zu deleted\n",
+             size_t(d.hash_size), d_used, d_used - size_t(d.size) );
+    for (auto x : hist)
+        fprintf( f, "   %5zu %8d\n", x.first, x.second );
+
+    fprintf( f, "\n" );
+}
+
+
+template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+HashStats  GroupProbeBase<Entries,Indexes,Ops,AccessT,Bucket,Counters>::stats () const
+{
+    HashStats  s;
+    s.size = d.size;
+    s.buckets = d.hash_size;
+    s.slots = d_entries.size();
+    s.free_list = s.slots - d.size;
+    size_t  hit = 0;
+    for (size_t slot = 0;  slot < d.hash_size;  slot++) {
+        if (d_ctrl[slot] & 0x80)
+            continue;
+        size_t  len = _probe_length( slot );
+        if (s.chains.size() <= len)
+            s.chains.resize( len + 1 );
+        s.chains[len]++;
+        s.max_chain = std::max( s.max_chain, len );
+        hit += len;
+    }
+    // a miss ends at the first group with an EMPTY slot
+    size_t  mask = _group_mask(), miss = 0;
+    for (size_t home = 0;  home <= mask;  home++) {
+        size_t  g = home, steps = 1;
+        while (not _match( g, EMPTY ) && steps <= mask)
+            g = (g + steps++) & mask;
+        miss += steps;
+    }
+    s.load_factor = double( d.size ) / d.hash_size;
+    s.expected_probes_hit = d.size ? double( hit ) / d.size : 0;
+    s.expected_probes_miss = double( miss ) / (mask + 1);
+
+    d_counters.fill( s );
+    d_rehash_clock.fill( s );
+    s.table_bytes = container_bytes( d_table ) + container_bytes( d_ctrl );
+    s.entry_bytes = container_bytes( d_entries );
+    return s;
+}
+
+
+// ================================================================
+// layout policy
+//
+// lets a HashBase caller pick the engine with one template argument:
+//
+//     template <typename Layout = ChainedLayout>
+//     class Foo {
+//         HashEngine< Layout, std::vector<Entry>, std::vector<int>, Ops >  d_hash;
+//         ...
+//     };
+//
+// Both engines take the same template and constructor arguments and have
+// the same members, Attrs setters included.  The serialized table is not
+// interchangeable.
+// ================================================================
+
+struct ChainedLayout {
+    template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+    using Base = HashBase<Entries, Indexes, Ops, AccessT, Bucket, Counters>;
+};
+
+struct GroupProbeLayout {
+    template <typename Entries, typename Indexes, typename Ops, typename AccessT, typename Bucket, typename Counters>
+    using Base = GroupProbeBase<Entries, Indexes, Ops, AccessT, Bucket, Counters>;
+};
+
+template <typename Layout,
+          typename Entries,
+          typename Indexes,
+          typename Ops = SearchOps< typename Entries::value_type >,
+          typename AccessT = typename Entries::value_type,
+          typename Bucket = ModuloIndex,
+          typename Counters = NoHashCounters
+          >
+using HashEngine = typename Layout::template Base<Entries, Indexes, Ops, AccessT, Bucket, Counters>;
+
+} // namesapce Util
+
+
+// ================================================================
+// to benchmark against HashBase:
+//   create file with:
+//          #define BENCH_GROUP_PROBE
+//          #include "GroupProbeBase.h"
+//   compile with -O2 and run, optionally with key counts as arguments
+//   (default 1M 10M 100M; 100M string keys need ~12 GB)
+
+#ifdef BENCH_GROUP_PROBE
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+
+template <typename V>
+class BenchEntry {
+    V    v;
+    int  n = -1;
+public:
+    BenchEntry (const V& x = V())               : v( x ) {}
+    BenchEntry&  operator= (const V& x)         { v = x;  return *this; }
+    int&         next ()                        { return n; }
+    int          next () const                  { return n; }
+    void         next (int x)                   { n = x; }
+    V&           val ()                         { return v; }
+    const V&     val () const                   { return v; }
+};
+
+template <typename V>
+struct BenchOps {
+    size_t  operator() (const V& x) const                           { return std::hash<V>()( x ); }
+    size_t  operator() (const BenchEntry<V>& e) const               { return std::hash<V>()( e.val() ); }
+    bool    operator() (const V& a, const BenchEntry<V>& b) const   { return a == b.val(); }
+};
+
+static double  ns_per (std::chrono::steady_clock::time_point t0, size_t n)
+{
+    std::chrono::duration<double, std::nano>  dt = std::chrono::steady_clock::now() - t0;
+    return dt.count() / n;
+}
+
+template <typename Layout, typename V>
+void  bench_layout (const char* name, const std::vector<V>& keys, const std::vector<V>& misses)
+{
+    using  Entries = std::vector< BenchEntry<V> >;
+    using  Base    = Util::HashEngine< Layout, Entries, std::vector<int>, BenchOps<V>, V >;
+
+    Entries           ev;
+    std::vector<int>  tv;
+    BenchOps<V>       ops;
+    Base              h( ev, tv, ops );
+
+    auto  t0 = std::chrono::steady_clock::now();
+    for (const V& k : keys)
+        h.insert2( k );
+    double  ins = ns_per( t0, keys.size() );
+
+    size_t  found = 0;
+    t0 = std::chrono::steady_clock::now();
+    for (const V& k : keys)
+        found += h.find2( k ) != -1;
+    double  hit = ns_per( t0, keys.size() );
+
+    t0 = std::chrono::steady_clock::now();
+    for (const V& k : misses)
+        found += h.find2( k ) != -1;
+    double  miss = ns_per( t0, misses.size() );
+
+    printf( "  %-12s %11zu   insert %7.1f   hit %7.1f   miss %7.1f  ns/op  (%zu)\n",
+            name, keys.size(), ins, hit, miss, found );
+}
+
+int  main (int argc, char** argv)
+{
+    std::vector<size_t>  counts;
+    for (int i = 1;  i < argc;  i++)
+        counts.push_back( strtoull( argv[i], nullptr, 10 ));
+    if (counts.empty())
+        counts = { 1000000, 10000000, 100000000 };
+
+    for (size_t n : counts) {
+        std::vector<int>  ik, im;
+        for (size_t i = 0;  i < n;  i++) {
+            // one to one below 2^31, so no key repeats: odd keys hit, even keys miss
+            uint32_t  y = uint32_t( i * 2654435761u ) & 0x7FFFFFFF;
+            ik.push_back( int( y << 1 | 1 ));
+            im.push_back( int( y << 1 ));
+        }
+        printf( "int keys\n" );
+        bench_layout< Util::ChainedLayout >( "chained", ik, im );
+        bench_layout< Util::GroupProbeLayout >( "group probe", ik, im );
+    }
+    for (size_t n : counts) {
+        std::vector<std::string>  sk, sm;
+        for (size_t i = 0;  i < n;  i++) {
+            sk.push_back( "key:" + std::to_string( i ));
+            sm.push_back( "miss:" + std::to_string( i ));
+        }
+        printf( "string keys\n" );
+        bench_layout< Util::ChainedLayout >( "chained", sk, sm );
+        bench_layout< Util::GroupProbeLayout >( "group probe", sk, sm );
+    }
+}
+
+#endif
+
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include "Hash.h"
+#include "Spill.h"
+
+
+namespace AuData {
+
+// ================================================================
+
+template <typename T>
+class Dict : public DataObj, public Util::Lazy {
+public:
+
+    using Id = int;
+    using StringId = int;
+
+    // HashSet entry type
+    using V = std::pair<StringId, T>;  // [ index of string in the 'names' vector, data value ]
+
+    // ================
+    // Hash and compare function class for the hash table.  Both only see stored names:
+    // lookups pass their key on the stack to find_hashed, so nothing here is written
+    // after construction and any number of threads can share it.
+    class NameIdPair {
+        const std::vector<char>*  stored_names_;
+
+    public:
+        NameIdPair ( std::shared_ptr<std::vector<char>>& names ) : stored_names_( names.get() ) {}
+
+        const char*  name ( StringId id ) const          { return stored_names_->data() + id; }
+
+        // the stored name 'id' is 'key', which need not be '\0' terminated
+        bool         equal ( StringId id, std::string_view key ) const
+                        { const char* s = stored_names_->data() + id;
+                          return strnlen( s, key.size() + 1 ) == key.size() && memcmp( s, key.data(), key.size() ) == 0; }
+
+        // Hasher
+        size_t       operator() ( const V& v ) const     { return Util::Hash<const char*>()( name( v.first ) ); }
+
+        // Comper
+        bool         operator() ( const V& a, const V& b ) const { return strcmp( name( a.first ), name( b.first ) ) == 0; }
+    };
+
+
+    // entries keep a 32 bit hash: chain hops skip strcmp on a hash mismatch and rehash
+    // does not rehash the names. 4 more bytes per entry (BENCH_CACHED_HASH)
+    using Hset = Util::HashSet<V, NameIdPair, NameIdPair, Util::ModuloIndex, uint32_t>;
+    using Iter = typename std::vector<typename Hset::Entry>::iterator;
+
+    // ================
+    // set_concurrent()'s lock.  A waiting writer holds off new readers: glibc's rwlock
+    // prefers readers, and a steady stream of them starves a writer for good.  So a thread
+    // that read-locked a Dict and reads it again would wait for a writer that waits for it:
+    // Lock keeps what its thread holds, and a call nested in another of the same Dict (repr()
+    // calls size(); a read inside a write) takes nothing.  A write nested in a read
+    // of the same Dict cannot wait its own read out: it throws std::logic_error.
+    struct RWLock {
+        std::shared_mutex  mutex;
+        std::atomic<int>   writers_waiting{ 0 };
+    };
+
+    // holds 'lock', shared or exclusive, unless it is null or this thread holds it already
+    class Lock {
+    public:
+        Lock () = default;
+        Lock ( RWLock* lock, bool exclusive );
+        Lock ( Lock&& x ) noexcept : d_lock( std::exchange( x.d_lock, nullptr ) ), d_exclusive( x.d_exclusive ) {}
+        Lock&  operator= ( Lock&& ) = delete;
+        ~Lock ();
+
+    private:
+        struct Held { RWLock* lock; bool exclusive; };
+        static std::vector<Held>&  _held ()            { thread_local std::vector<Held> held; return held; }
+
+        RWLock*  d_lock = nullptr;
+        bool     d_exclusive = false;
+    };
+
+    using ReadLock  = Lock;
+    using WriteLock = Lock;
+
+    // no-ops for a null 'lock'
+    static ReadLock   read_lock ( RWLock* lock )        { return Lock( lock, false ); }
+    static WriteLock  write_lock ( RWLock* lock )       { return Lock( lock, true ); }
+
+    // ================
+    // goes through the Dict, so it sees a slice's range and writes copy a shared table
+    class Reference {
+    public:
+        std::string  _key;
+        Dict&        _dict;
+
+        Reference( const std::string& key_, Dict& dict_ ) : _key( key_ ), _dict( dict_ ) {};
+
+        Reference& operator= ( T value )                { _dict.insert( _key, value ); return *this; }
+
+        // unlike std::map or ordered_map, do NOT insert if key is not already in the dict, throw Error instead
+        operator T () const;
+
+        // friend std::ostream&  operator<< ( std::ostream& s, const Reference& c );
+    };
+
+    // ================
+    class iterator {
+        Iter _current;
+        Dict& _d;
+        using V = std::pair<std::string, Reference>;
+    public:
+
+        iterator( Iter iter_, Dict& d_ ) : _current( iter_ ), _d( d_ ) {}
+
+        StringId       string_id () const               { return _current->first; }
+
+        V              operator*()                      { std::string name = _d.nip->name( ( *_current ).val.first ); return V( name, _d[name] ); }
+        const V        operator*() const                { std::string name = _d.nip->name( ( *_current ).val.first ); return V( name, _d[name] ); }
+        iterator&      operator++() noexcept            { _current++; return *this; }
+        iterator       operator++( int ) noexcept       { iterator temp( *this );  ++( *this ); return temp; }
+        iterator       operator+( int i ) noexcept      { iterator temp( *this );  _current += i; return temp; }
+        const iterator operator++( int ) const noexcept { iterator temp( *this );  ++( *const_cast<iterator*>( this ) ); return temp; }
+        iterator&      operator--() noexcept            {  _current--; return *this; }
+        iterator       operator--( int )  noexcept      { iterator temp( *this );  --( *this ); return temp; }
+        iterator       operator-( int i )  noexcept     {  _current -= i; return *this; }
+        const iterator operator--( int ) const noexcept { iterator temp( *this );  --( *const_cast<iterator*>( this ) ); return temp; }
+
+        // comparison
+        bool operator== ( const iterator& rhs ) const noexcept  { return _current == rhs._current; }
+        bool operator!= ( const iterator& rhs ) const noexcept  { return _current != rhs._current; }
+        bool operator<  ( const iterator& rhs ) const noexcept  { return _current < rhs._current; }
+        bool operator>  ( const iterator& rhs ) const noexcept  { return _current > rhs._current; }
+        bool operator<= ( const iterator& rhs ) const noexcept  { return _current <= rhs._current; }
+        bool operator>= ( const iterator& rhs ) const noexcept  { return _current >= rhs._current; }
+    };
+
+
+    //public:      // why public?
+    std::shared_ptr<std::vector<char>> names;
+    std::shared_ptr<NameIdPair>        nip;
+    std::shared_ptr<Hset>              d;
+
+    Dict ( SchemaPtr sch_,
+               std::shared_ptr<std::vector<char>>& names_,
+               std::shared_ptr<NameIdPair>& nip_,
+               std::shared_ptr<Hset>& d_ );
+
+public: // ================================================================
+
+    using value_type = T;
+
+    Dict ( SchemaPtr sch );
+    Dict ( SchemaPtr sch, const std::string& path );
+
+    // If not find key in d, insert the value
+    // If dind key in d, update the old value with provided one
+    // returns string_id
+    StringId        insert ( std::string_view key, T value );
+
+    // Lookups take a std::string_view (a std::string or a const char* converts), a
+    // pointer and a length, or a key hashed ahead by Util::prehash().  They do not
+    // allocate and do not write to the dict.
+    //
+    // Reads are const and reentrant: any number of threads may read a Dict no thread is
+    // writing (and that is not in a LoadPool, whose reads load and stamp it).  To read while
+    // others write, call set_concurrent() before sharing the Dict: every call then holds a
+    // std::shared_mutex for its duration, shared for reads and exclusive for insert, clear
+    // and Reference::operator=; calls nest (see RWLock).  What a call returns is not covered
+    // once it is back: lookup and operator[] return references into the table, and find(),
+    // begin() and end() iterators into it, which an insert may move.  Concurrent readers
+    // use lookup_copy, and iterate only while no thread writes.  In a LoadPool, an
+    // access to another object of the pool may unload this one too: pin it (Util::Lazy::Pin)
+    // to keep references, iterators and frames valid across such accesses.
+    //
+    // slice( offset, n ) is the entries with ids [offset, offset + n) of this one, with ids
+    // from 0; it shares the tables.  Shared tables are not written: the first write to a
+    // slice, or to a Dict that has slices, copies its entries into tables of its own
+    // (ids close up over any holes Hset::remove left).  Slices need no lock.
+    //
+    // Attached to a Util::LoadPool (set_pool), unload() spills the tables to a file and
+    // the next access maps them back; see "lazy loading" in Spill.h.
+    //
+    // frames() and adopt_frames() move the tables between processes as they are, in the
+    // sections of a spill file; see "frames on the wire" in Spill.h.
+    using Key = Util::Prehashed<std::string_view>;
+
+    // not for a Dict in a LoadPool: throws std::runtime_error
+    void            set_concurrent ( bool on = true );
+    bool            concurrent () const                      { return d_lock != nullptr; }
+
+    bool            contains ( const Key& key ) const                { auto lock = _read_lock(); return _find( key ) >= 0; }
+    bool            contains ( std::string_view key ) const          { return contains( Util::prehash( key ) ); }
+    bool            contains ( const char* key, size_t len ) const   { return contains( Util::prehash( { key, len } ) ); }
+
+    // return value connected with 'key' if it exists in dictionary, else return 'dflt'
+    const T&        lookup ( const Key& key, const T& dflt = T{} ) const;
+    // (no pointer and length form: lookup( p, n ) would take n for 'dflt'; pass a string_view)
+    const T&        lookup ( std::string_view key, const T& dflt = T{} ) const
+                                                             { return lookup( Util::prehash( key ), dflt ); }
+    // the same, copied while the lock is held
+    T               lookup_copy ( const Key& key, const T& dflt = T{} ) const;
+    T               lookup_copy ( std::string_view key, const T& dflt = T{} ) const
+                                                             { return lookup_copy( Util::prehash( key ), dflt ); }
+    // return id which can be efficently stored and used to lookup string with dict[str_id]; or ~0 if not found
+    IdType          string_id ( const Key& key ) const               { auto lock = _read_lock(); int id = _find( key ); return id >= 0 ? IdType( id - d_lo ) : -1; }
+    IdType          string_id ( std::string_view key ) const         { return string_id( Util::prehash( key ) ); }
+    IdType          string_id ( const char* key, size_t len ) const  { return string_id( Util::prehash( { key, len } ) ); }
+
+    // Operator= of reference will perform the same thing as insert function
+    Reference       operator[] ( const std::string& key )    { return Reference( key, *this ); }
+
+    const T&        operator[] ( const Key& key ) const;    // same as lookup, but throws excetion on error
+    const T&        operator[] ( std::string_view key ) const                { return ( *this )[ Util::prehash( key ) ]; }
+    const T&        operator[] ( IdType id ) const;
+    std::string     key_at ( IdType id ) const;
+
+    bool            empty () const                           { return size() == 0; }
+
+    void            clear ()                                 { auto lock = _write_lock(); _own( false ); std::vector<char>().swap( *names ); d->clear(); }
+
+    iterator        find ( const std::string& key );
+
+    iterator        begin ()                                 { auto lock = _read_lock(); return iterator( _at( d_lo ), *this );  }
+    iterator        end ()                                   { auto lock = _read_lock(); return iterator( _at( d_hi ), *this ); }
+
+    const iterator  begin () const                           { auto lock = _read_lock(); return iterator( _at( d_lo ), *this );  }
+    const iterator  end () const                             { auto lock = _read_lock(); return iterator( _at( d_hi ), *this ); }
+
+    size_t          size () const override                   { auto lock = _read_lock(); return _sliced() ? d_count : d->size(); }
+    // this object's share of the tables; see "memory accounting" in HashOps.h
+    Util::MemoryUsage  memory_usage () const;
+    size_t          size_bytes () const override             { return memory_usage().total(); }
+    // give the tables' slack back, unless slices share them.  Entry ids stay
+    void            shrink_to_fit ();
+    void            memory_report ( Util::MemoryReport& report, const std::string& node ) const
+                                                             { report.add( node, memory_usage() ); }
+    Util::HashStats stats () const                           { auto lock = _read_lock(); auto s = d->stats(); s.string_bytes = names->capacity(); return s; }
+
+    DataObjPtr      slice ( size_t offset, size_t slice_size = ~0 ) override;
+    DataObjPtr      slice_copy ( size_t offset, size_t slice_size = ~0 ) override;
+
+    void            repr (std::ostream& s, int level) const override;
+    void            print ( int level = 0 ) const override;
+
+    // a header and sections pointing into the tables, for Util::send_frames; valid until the
+    // next write.  A slice copies its entries out of the shared tables first
+    Util::Frames    frames ();
+    // replace the contents with frames read from 'fd': the tables as sent if the sender's
+    // fingerprint is ours, else rebuilt from its entries.  Throws std::runtime_error
+    void            adopt_frames ( int fd );
+
+    // ================ internal ================
+    GenericValue    gvget ( const char* key ) const override;
+    GenericValue    gvget ( int id ) const override;
+    int             gvset ( const char* key, GenericValue val ) override;
+    void            serialize ( MPSys::Message& msg, DataObjPtr p ) override;
+    void            unload () override;
+    void            set_reference_ptrs ( DataObjPtr this_node );
+    DataObjPtr      reference ()        { return d_reference; }
+
+private:
+    // entry id of 'key' in 'd', or -1
+    static int      _find ( const Hset& d, const NameIdPair& nip, const Key& key )
+                        { return d.find_hashed( key.hash, [&]( const V& v ) { return nip.equal( v.first, key.key ); } ); }
+    // ... and in this slice
+    int             _find ( const Key& key ) const           { int id = _find( *d, *nip, key ); return id >= 0 && size_t( id ) >= d_lo && size_t( id ) < d_hi ? id : -1; }
+    // entry id of this object's 'id', or -1 if there is no such live entry
+    int             _entry ( IdType id ) const;
+    Iter            _at ( size_t id ) const                  { _touch(); auto& v = d->get_hash_data(); return v.begin() + std::min( id, v.size() ); }
+
+    // set 'key' to 'value', adding it to 'names' if new; its entry id
+    static int      _insert ( std::vector<char>& names, Hset& d, const NameIdPair& nip, std::string_view key, const T& value );
+
+    // ==== slices
+    bool            _sliced () const                         { return d_lo != 0 || d_hi != ~size_t(0); }
+    // [lo, hi) in entry ids for ids [offset, offset + n) of this object
+    std::pair<size_t, size_t>  _range ( size_t offset, size_t n ) const;
+    // before a write: tables of its own, with a copy of its entries unless not 'copy'
+    void            _own ( bool copy = true );
+    // the live entries with entry ids in [lo, hi), in order, into empty 'names_' and 'd_'
+    void            _copy ( size_t lo, size_t hi, std::vector<char>& names_, Hset& d_ ) const;
+
+    // no-ops unless concurrent(); and the Util::Lazy access, which loads the tables if
+    // the pool unloaded them
+    ReadLock        _read_lock () const                      { _touch(); return read_lock( d_lock.get() ); }
+    WriteLock       _write_lock ()                           { _touch_write(); return write_lock( d_lock.get() ); }
+
+    // ==== Util::Lazy: the sections are hash info, table, entries and names
+    bool            _spillable () const override             { return std::is_trivially_copyable_v<T>; }
+    size_t          _loaded_bytes () const override          { return memory_usage().total(); }
+    void            _spill ( const std::string& path ) override;
+    void            _load ( const std::string& path ) override;
+    void            _drop () override;
+    bool            _concurrent () const override            { return concurrent(); }
+
+    // ==== frames: this build's hash and bucket of a fixed name
+    static uint64_t _frame_probe ();
+    // new tables, taking 'names_'
+    void            _reset ( std::vector<char>&& names_ );
+
+    std::string  d_path;
+    DataObjPtr   d_reference;
+    std::shared_ptr<RWLock>  d_lock;
+    size_t       d_lo = 0;                  // a slice: entry ids [d_lo, d_hi) of 'd'
+    size_t       d_hi = ~size_t(0);
+    size_t       d_count = 0;               //   and its live entries
+};
+
+
+
+} // namespace AuData
+
+#pragma once
+
+
+// ================================================================
+// DETAILS
+// ================================================================
+
+namespace AuData {
+
+
+template <typename T>
+Dict<T>::Dict ( SchemaPtr sch_,
+                std::shared_ptr<std::vector<char>>& names_,
+                std::shared_ptr<NameIdPair>& nip_,
+                std::shared_ptr<Hset>& d_ )
+    : DataObj( sch_ ),
+      names( names_ ),
+      nip( nip_ ),
+      d( d_ )
+{}
+
+
+template <typename T>
+Dict<T>::Dict ( SchemaPtr sch )
+    : DataObj( sch ),
+      names( std::make_shared<std::vector<char>>() ),
+      nip( std::make_shared<NameIdPair>( names ) ),
+      d( std::make_shared<Hset>( 256, V{},  *nip, *nip ) )
+{}
+
+
+template <typename T>
+Dict<T>::Dict ( SchemaPtr sch, const std::string& path )
+    : DataObj( sch ),
+      names( std::make_shared<std::vector<char>>() ),
+      nip( std::make_shared<NameIdPair>( names ) ),
+      d( std::make_shared<Hset>( 256, V{},  *nip, *nip ) ),
+      d_path( path )
+{}
+
+
+template <typename T>
+Dict<T>::Lock::Lock ( RWLock* lock, bool exclusive )
+{
+    if ( !lock )
+        return;
+    std::vector<Held>&  held = _held();
+    for ( const Held& h : held )
+        if ( h.lock == lock ) {
+            if ( exclusive && !h.exclusive )
+                throw std::logic_error( "Dict: a write inside a read of the same Dict" );
+            return;         // the outer call's lock covers this one
+        }
+    if ( exclusive ) {
+        lock->writers_waiting++;
+        lock->mutex.lock();
+        lock->writers_waiting--;
+    }
+    else {
+        while ( lock->writers_waiting.load( std::memory_order_relaxed ) > 0 )
+            std::this_thread::yield();
+        lock->mutex.lock_shared();
+    }
+    held.push_back( { lock, exclusive } );
+    d_lock = lock;
+    d_exclusive = exclusive;
+}
+
+
+template <typename T>
+Dict<T>::Lock::~Lock ()
+{
+    if ( !d_lock )
+        return;
+    std::vector<Held>&  held = _held();
+    held.erase( std::find_if( held.begin(), held.end(), [&]( const Held& h ) { return h.lock == d_lock; } ) );
+    if ( d_exclusive )
+        d_lock->mutex.unlock();
+    else
+        d_lock->mutex.unlock_shared();
+}
+
+
+template <typename T>
+Dict<T>::Reference::operator T () const
+{
+    auto  lock = _dict._read_lock();
+    int  id = _dict._find( Util::prehash( _key ) );
+    if ( id >= 0 )
+        return _dict.d->at( id ).second;
+    else
+        throw Util::Error( "key \"%s\" not present in dictionary", _key.c_str() );
+}
+
+
+// template <typename T>
+// std::ostream&  operator<< ( std::ostream& s, const typename Dict<T>::Reference& c )
+// {
+//     const char* local_name = c._key.c_str();
+//     Id s_id = c._nip->local_name( local_name );
+//     auto iter = c._d->find( V( s_id, T{} ) );
+//     if ( !iter.second ) throw Util::Error( "Dict with key: \"%s\" is not existed! Please check the key name!\n",
+//                                            local_name );
+//     else return s << iter.first.second;
+// }
+
+
+template <typename T>
+int  Dict<T>::_insert ( std::vector<char>& names, Hset& d, const NameIdPair& nip, std::string_view key, const T& value )
+{
+    Key  hashed = Util::prehash( key );
+    int  id = _find( d, nip, hashed );
+    if ( id >= 0 ) {
+        const_cast<V&>( d.at( id ) ).second = value;
+        return id;
+    }
+    StringId  s_id = names.size();
+    names.insert( names.end(), key.begin(), key.end() );
+    names.push_back( '\0' );
+    d.insert( V( s_id, value ) );
+    return _find( d, nip, hashed );
+}
+
+
+// returns the entry id, as string_id() does
+template <typename T>
+typename Dict<T>::StringId  Dict<T>::insert ( std::string_view key, T value )
+{
+    auto  lock = _write_lock();
+    _own();
+    return _insert( *names, *d, *nip, key, value );
+}
+
+
+template <typename T>
+const T&  Dict<T>::lookup ( const Key& key, const T& dflt ) const
+{
+    auto  lock = _read_lock();
+    int  id = _find( key );
+    if ( id >= 0 )
+        return d->at( id ).second;
+    else
+        return dflt;
+}
+
+
+template <typename T>
+T  Dict<T>::lookup_copy ( const Key& key, const T& dflt ) const
+{
+    auto  lock = _read_lock();
+    int  id = _find( key );
+    return id >= 0 ? d->at( id ).second : dflt;
+}
+
+
+template <typename T>
+const T&  Dict<T>::operator[] ( const Key& key ) const
+{
+    auto  lock = _read_lock();
+    int  id = _find( key );
+    if ( id >= 0 )
+        return d->at( id ).second;
+    else
+        throw Util::Error( "dictionary key error: '%.*s' not found", int( key.key.size() ), key.key.data() );
+}
+
+
+template <typename T>
+const T&  Dict<T>::operator[] ( IdType id ) const
+{
+    auto  lock = _read_lock();
+    int  e = _entry( id );
+    if ( e >= 0 )
+        return d->at( e ).second;
+    else
+        throw Util::Error( "dictionary index error: '%d' not valid", id );
+}
+
+
+// the entry id is the index in the entry vector
+template <typename T>
+typename Dict<T>::iterator Dict<T>::find ( const std::string& key )
+{
+    auto  lock = _read_lock();
+    int  id = _find( Util::prehash( key ) );
+    if ( id >= 0 )
+        return iterator( _at( id ), *this );
+    else
+        return this->end();
+}
+
+
+template <typename T>
+GenericValue  Dict<T>::gvget ( const char* key ) const
+{
+    auto  lock = _read_lock();
+    int  id = _find( Util::prehash( key ) );
+    if ( id >= 0 )
+        return GenericValue( d->at( id ).second );
+    else
+        throw Util::Error( "The dictionary data with key \"%s\" is not existed!\n", key );
+}
+
+
+template <typename T>
+GenericValue  Dict<T>::gvget ( int id ) const
+{
+    auto  lock = _read_lock();
+    int  e = _entry( id );
+    if ( e >= 0 )
+        return GenericValue( d->at( e ).second );
+    else throw Util::Error( "dictionary index out of bounds" );
+}
+
+
+template <typename T>
+std::string  Dict<T>::key_at ( IdType id ) const
+{
+    auto  lock = _read_lock();
+    int  e = _entry( id );
+    if ( e >= 0 )
+        return std::string( nip->name( d->at( e ).first ) );
+    else throw Util::Error( "dictionary index out of bounds" );
+}
+
+
+template <typename T>
+int  Dict<T>::gvset ( const char* key, GenericValue val )
+{
+    return this->insert( key, val.get<T>() );
+}
+
+
+template <typename T>
+int  Dict<T>::_entry ( IdType id ) const
+{
+    if ( id < 0 )
+        return -1;
+    size_t  e = d_lo + size_t( id );
+    return e < d_hi && e < d->id_end() && d->live( e ) ? int( e ) : -1;
+}
+
+
+template <typename T>
+std::pair<size_t, size_t>  Dict<T>::_range ( size_t offset, size_t n ) const
+{
+    size_t  span = std::min( d_hi, d->id_end() ) - std::min( d_lo, d->id_end() );
+    offset = std::min( offset, span );
+    return { d_lo + offset, d_lo + offset + std::min( n, span - offset ) };
+}
+
+
+template <typename T>
+void  Dict<T>::_copy ( size_t lo, size_t hi, std::vector<char>& names_, Hset& d_ ) const
+{
+    hi = std::min( hi, d->id_end() );
+    for ( size_t e = lo;  e < hi;  e++ ) {
+        if ( !d->live( e ) )
+            continue;
+        const V&     v = d->at( e );
+        const char*  name = nip->name( v.first );
+        StringId     s_id = names_.size();
+        names_.insert( names_.end(), name, name + strlen( name ) + 1 );
+        d_.insert( V( s_id, v.second ) );
+    }
+}
+
+
+// a table that is shared is never written: slices and the Dict they came from go on
+// reading it while the writer works on a copy
+template <typename T>
+void  Dict<T>::_own ( bool copy )
+{
+    if ( !_sliced() && d.use_count() == 1 && names.use_count() == 1 )
+        return;
+    size_t  n = copy ? ( _sliced() ? d_count : d->size() ) : 0;
+    auto  names_ = std::make_shared<std::vector<char>>();
+    auto  nip_ = std::make_shared<NameIdPair>( names_ );
+    auto  d_ = std::make_shared<Hset>( std::max<size_t>( 256, n ), V{}, *nip_, *nip_ );
+    if ( copy )
+        _copy( d_lo, d_hi, *names_, *d_ );
+    names = names_;
+    nip = nip_;
+    d = d_;
+    d_lo = 0;
+    d_hi = ~size_t(0);
+}
+
+
+// shares the tables; the parent's lock is not needed (see _own)
+template <typename T>
+DataObjPtr  Dict<T>::slice ( size_t offset, size_t slice_size )
+{
+    auto  lock = _read_lock();
+    auto [lo, hi] = _range( offset, slice_size );
+    DictData<T>* zero_copy_dict_data = new DictData<T>( this->schema(), names, nip, d );
+    Dict<T>*  sliced = zero_copy_dict_data;
+    sliced->d_lo = lo;
+    sliced->d_hi = hi;
+    if ( d->dead_count() == 0 )
+        sliced->d_count = hi - lo;
+    else
+        for ( size_t e = lo;  e < hi;  e++ )
+            sliced->d_count += d->live( e );
+    zero_copy_dict_data->d_parent = d_parent;
+    return DataObjPtr( zero_copy_dict_data );
+}
+
+
+// only the entries in the range are copied
+template <typename T>
+DataObjPtr Dict<T>::slice_copy ( size_t offset, size_t slice_size )
+{
+    auto  lock = _read_lock();
+    auto [lo, hi] = _range( offset, slice_size );
+    SchemaPtr sch = SchemaPtr( this->schema()->copy() );
+    std::shared_ptr<std::vector<char>> names_ = std::make_shared<std::vector<char>>();
+    std::shared_ptr<NameIdPair> nip_ = std::make_shared<NameIdPair>( names_ );
+    std::shared_ptr<Hset> d_ = std::make_shared<Hset>( std::max<size_t>( 256, hi - lo ), V{}, *nip_, *nip_ );
+    _copy( lo, hi, *names_, *d_ );
+    Dict<T>* copy_dict_data = new Dict<T>( sch, names_, nip_, d_ );
+    return DataObjPtr( copy_dict_data );
+}
+
+
+// does not load the tables
+template <typename T>
+Util::MemoryUsage  Dict<T>::memory_usage () const
+{
+    auto  lock = read_lock( d_lock.get() );
+    Util::MemoryUsage  u = d->memory_usage();
+    u.strings = Util::container_bytes( *names );
+    u.slack += Util::container_slack( *names );
+    u.control = Util::shared_block_bytes<std::vector<char>>() + Util::shared_block_bytes<NameIdPair>() +
+                Util::shared_block_bytes<Hset>();
+    u = u.shared( d.use_count() );
+    if ( d_lock )
+        u.control += Util::shared_block_bytes<RWLock>();
+    return u;
+}
+
+
+template <typename T>
+void  Dict<T>::shrink_to_fit ()
+{
+    auto  lock = _write_lock();
+    if ( _sliced() || d.use_count() > 1 )
+        return;     // slices are reading the tables: see _own
+    names->shrink_to_fit();
+    d->shrink_to_fit();
+}
+
+
+// a slice sends its own entries: it is copied out of the shared table first
+template <typename T>
+void  Dict<T>::serialize ( MPSys::Message& msg, DataObjPtr p )
+{
+    if ( _sliced() ) {
+        auto  lock = _write_lock();
+        _own();
+    }
+    DataObjPtr  held = Util::pinned( p, *this );     // the frames reference the tables: not unloaded until sent
+    msg.frame( MPSys::make_frame< VectorReferenceData<std::vector<char>> >( *names, Defer(held) ));
+    msg.frame( MPSys::make_frame< StaticMemoryData >( d->get_hash_info(), Defer(held) ));
+    msg.frame( MPSys::make_frame< VectorReferenceData<std::vector<int>> >( d->get_hash_table(), Defer(held) ));
+    msg.frame( MPSys::make_frame< VectorReferenceData<std::vector<typename Hset::Entry>> >( d->get_hash_data(), Defer(held)  ));
+}
+
+
+template <typename T>
+void  Dict<T>::set_concurrent ( bool on )
+{
+    if ( on && pool() )
+        throw std::runtime_error( "Dict::set_concurrent: a Dict in a LoadPool belongs to one thread" );
+    d_lock = on ? std::make_shared<RWLock>() : nullptr;
+}
+
+
+// in a pool, the tables come back on the next access
+template<typename T>
+void  Dict<T>::unload ()
+{
+    if ( pool() ) {
+        pool()->unload( *this );
+        return;
+    }
+    names = std::make_shared< std::vector<char> >();
+    nip   = std::make_shared<NameIdPair>( names );
+    d     = std::make_shared<Hset>( 256, V{},  *nip, *nip );
+    d_lo  = 0;
+    d_hi  = ~size_t(0);
+    d_deferral->unload( *this );
+}
+
+
+template <typename T>
+void  Dict<T>::_spill ( const std::string& path )
+{
+    if constexpr ( std::is_trivially_copyable_v<T> ) {
+        if ( _sliced() )
+            _own();
+        const typename Hset::HashInfo&  info = d->get_hash_info();
+        Util::spill_write( path, Util::spill_layout<typename Hset::HashInfo, typename Hset::Entry>(),
+                           { { reinterpret_cast<const char*>( &info ), sizeof( info ) },
+                             Util::spill_bytes( d->get_hash_table() ),
+                             Util::spill_bytes( d->get_hash_data() ),
+                             Util::spill_bytes( *names ) } );
+    }
+}
+
+
+// the tables as they were spilled: copies, no inserts
+template <typename T>
+void  Dict<T>::_load ( const std::string& path )
+{
+    using Entry = typename Hset::Entry;
+    Util::SpillMap  m( path, Util::spill_layout<typename Hset::HashInfo, Entry>(), 4 );
+    auto  table = m.section<int>( 1 );
+    auto  entries = m.section<Entry>( 2 );
+    auto  chars = m.section<char>( 3 );
+    names = std::make_shared<std::vector<char>>( chars.begin(), chars.end() );
+    nip   = std::make_shared<NameIdPair>( names );
+    d     = std::make_shared<Hset>( 16, V{},  *nip, *nip );
+    d->assign( m.section<typename Hset::HashInfo>( 0 )[0], std::vector<int>( table.begin(), table.end() ),
+               std::vector<Entry>( entries.begin(), entries.end() ) );
+}
+
+
+template <typename T>
+void  Dict<T>::_drop ()
+{
+    _reset( {} );
+}
+
+
+template <typename T>
+void  Dict<T>::_reset ( std::vector<char>&& names_ )
+{
+    names = std::make_shared< std::vector<char> >( std::move( names_ ) );
+    nip   = std::make_shared<NameIdPair>( names );
+    d     = std::make_shared<Hset>( 16, V{},  *nip, *nip );
+    d_lo  = 0;
+    d_hi  = ~size_t(0);
+}
+
+
+// a name's cached hash and its bucket in a table of 1021: another hash function or
+// Bucket puts adopted entries in chains a lookup here would not search
+template <typename T>
+uint64_t  Dict<T>::_frame_probe ()
+{
+    uint32_t  h = uint32_t( Util::Hash<const char*>()( "AuData::Dict frame probe" ) );
+    Util::ModuloIndex  bucket;
+    bucket.resize( 1021 );
+    return uint64_t( h ) << 32 | bucket( h );
+}
+
+
+template <typename T>
+Util::Frames  Dict<T>::frames ()
+{
+    static_assert( std::is_trivially_copyable_v<T>, "Dict::frames: values are sent as bytes" );
+    using Entry = typename Hset::Entry;
+    if ( _sliced() ) {
+        auto  lock = _write_lock();
+        _own();
+    }
+    auto  lock = _read_lock();       // a read: the spill file still holds the tables
+    Util::Frames  f( Util::spill_layout<typename Hset::HashInfo, Entry>() );
+    Entry  e{};
+    auto  offset = [&]( const void* field ) { return uint32_t( static_cast<const char*>( field ) - reinterpret_cast<const char*>( &e ) ); };
+    f.header.hash_probe   = _frame_probe();
+    f.header.value_size   = sizeof( T );
+    f.header.entry_size   = sizeof( Entry );
+    f.header.id_offset    = offset( &e.val.first );
+    f.header.value_offset = offset( &e.val.second );
+    f.header.next_offset  = offset( &e.next );
+    const typename Hset::HashInfo&  info = d->get_hash_info();
+    f.add( { reinterpret_cast<const char*>( &info ), sizeof( info ) } );
+    f.add( Util::spill_bytes( d->get_hash_table() ) );
+    f.add( Util::spill_bytes( d->get_hash_data() ) );
+    f.add( Util::spill_bytes( *names ) );
+    f.keep = std::make_shared<std::pair<std::shared_ptr<Hset>, std::shared_ptr<std::vector<char>>>>( d, names );
+    return f;
+}
+
+
+// the vectors are sized from the header, once its sizes agree with the hash info, and
+// read into: the tables own what came off the socket, after well_formed() and a range
+// check of every name.  A foreign fingerprint reads the entries as bytes and inserts them
+template <typename T>
+void  Dict<T>::adopt_frames ( int fd )
+{
+    static_assert( std::is_trivially_copyable_v<T>, "Dict::adopt_frames: values are sent as bytes" );
+    using Entry = typename Hset::Entry;
+    using HashInfo = typename Hset::HashInfo;
+    Util::FrameHeader  h = Util::recv_frame_header( fd, 4 );
+    if ( h.value_size != sizeof( T ) )
+        throw std::runtime_error( "Dict::adopt_frames: sender has another value type" );
+    auto  names_ok = [&]( const std::vector<char>& names_ ) {
+        if ( !names_.empty() && names_.back() != '\0' )
+            throw std::runtime_error( "Dict::adopt_frames: the names sent do not end with '\\0'" );
+    };
+    auto  lock = _write_lock();
+
+    if ( h.layout == Util::spill_layout<HashInfo, Entry>() && h.hash_probe == _frame_probe() ) {
+        HashInfo  info;
+        Util::recv_sections( fd, h, { { reinterpret_cast<char*>( &info ), sizeof( info ) } } );
+        size_t  n_table = Util::frame_count( h, 1, sizeof( int ) );
+        size_t  n_entries = Util::frame_count( h, 2, sizeof( Entry ) );
+        if ( info.hash_size <= 0 || n_table != size_t( info.hash_size ) || info.size < 0 || size_t( info.size ) > n_entries )
+            throw std::runtime_error( "Dict::adopt_frames: hash info does not match its tables" );
+        std::vector<int>  table( n_table );
+        std::vector<Entry>  entries( n_entries );
+        std::vector<char>  names_( Util::frame_count( h, 3, 1 ) );
+        Util::recv_sections( fd, h, { Util::frame_dest( table ), Util::frame_dest( entries ), Util::frame_dest( names_ ) }, 1 );
+        names_ok( names_ );
+        if ( !d->well_formed( info, table, entries, [&]( const V& v ) { return v.first >= 0 && size_t( v.first ) < names_.size(); } ) )
+            throw std::runtime_error( "Dict::adopt_frames: the tables sent are not well formed" );
+        _reset( std::move( names_ ) );
+        d->assign( info, std::move( table ), std::move( entries ) );
+        return;
+    }
+
+    // an entry is the value, the ids and maybe a hash: not much more than the value
+    if ( std::max( h.id_offset, h.next_offset ) + sizeof( int ) > h.entry_size || h.value_offset + sizeof( T ) > h.entry_size ||
+         h.entry_size > sizeof( T ) + 64 )
+        throw std::runtime_error( "Dict::adopt_frames: sender's entries are not readable" );
+    std::vector<char>  entries( Util::frame_count( h, 2, h.entry_size ) * h.entry_size );
+    std::vector<char>  names_( Util::frame_count( h, 3, 1 ) );
+    Util::frame_skip( fd, h.bytes[0] );        // the sender's hash info and table: not ours
+    Util::frame_skip( fd, h.bytes[1] );
+    Util::recv_sections( fd, h, { Util::frame_dest( entries ), Util::frame_dest( names_ ) }, 2 );
+    names_ok( names_ );
+    _reset( {} );
+    for ( size_t k = 0;  k + h.entry_size <= entries.size();  k += h.entry_size ) {
+        const char*  p = entries.data() + k;
+        int  next, id;
+        T    value;
+        memcpy( &next, p + h.next_offset, sizeof( next ) );
+        if ( next < -1 )
+            continue;       // a hole: live entries end their chain with -1 or go on
+        memcpy( &id, p + h.id_offset, sizeof( id ) );
+        memcpy( &value, p + h.value_offset, sizeof( T ) );
+        if ( id < 0 || size_t( id ) >= names_.size() )
+            throw std::runtime_error( "Dict::adopt_frames: an entry's name is outside the names sent" );
+        _insert( *names, *d, *nip, names_.data() + id, value );
+    }
+}
+
+
+template <typename T>
+void  Dict<T>::print ( int level ) const
+{
+    this->repr(std::cout, level); std::cout<<std::flush;
+}
+
+template<typename T>
+void Dict<T>::repr (std::ostream& s, int level) const
+{
+    auto  lock = _read_lock();
+    std::cout << Util::indent( level ) << schema()->name() << " Dict[" << size() << "] = [";
+    size_t  limit = DataObj::s_print_limit;
+    size_t count = 0;
+    size_t  n = size();
+    size_t  hi = std::min( d_hi, d->id_end() );
+    for ( size_t e = d_lo;  e < hi;  e++ ) {
+        if ( !d->live( e ) )
+            continue;
+        count++;
+        if ( count == limit ) {
+            std::cout << " ...";
+            break;
+        }
+
+        const V&  v = d->at( e );
+        std::cout << " \"" << nip->name( v.first ) << "\" : " << v.second;
+        if ( count < n ) std::cout << ",";
+
+    }
+    std::cout << " ]\n" << std::flush;
+}
+template <typename T>
+void  Dict<T>::set_reference_ptrs ( DataObjPtr this_node )
+{
+    if ( not d_path.empty() ) {
+        assert( not d_reference );
+        d_reference = this->find_path( d_path );
+    }
+}
+
+
+} // namespace AuData
+
+
+// ================================================================
+// to test Dict reads from many threads:
+//   create file with:
+//          #define TEST_DICT_THREADS
+//          #include "Dict.h"
+//   compile with -pthread (add -fsanitize=thread to check for races) and run.
+//   Readers share a Dict nobody writes, then a concurrent() one a writer
+//   adds to; every value read must belong to its key
+
+#ifdef TEST_DICT_THREADS
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+int  main ()
+{
+    const int  base = 20000, added = 20000, readers = 8;
+    std::vector<std::string>  keys;
+    for (int i = 0;  i < base + added;  i++)
+        keys.push_back( "table_" + std::to_string( i % 97 ) + ".column_" + std::to_string( i ) );
+
+    AuData::Dict<long>  dict{ AuData::SchemaPtr() };
+    for (int i = 0;  i < base;  i++)
+        dict.insert( keys[i], 3L * i );
+
+    // readers only: no locks, the read path writes nothing
+    std::atomic<long>  errors{ 0 };
+    std::vector<std::thread>  pool;
+    for (int t = 0;  t < readers;  t++)
+        pool.emplace_back( [&, t] {
+                for (int n = 0;  n < 5 * base;  n++) {
+                    int  i = ( n * 7919 + t * 104729 ) % base;
+                    if (dict.lookup( keys[i], -1L ) != 3L * i || !dict.contains( keys[i] ))
+                        errors++;
+                }
+            } );
+    for (std::thread& t : pool)
+        t.join();
+    pool.clear();
+    printf( "readers only: %ld errors\n", errors.load() );
+
+    // one writer adding keys and rewriting old values, readers taking copies
+    dict.set_concurrent();
+    std::atomic<bool>  done{ false };
+    std::atomic<long>  reads{ 0 }, found{ 0 };
+    long  errors_before = errors;
+    for (int t = 0;  t < readers;  t++)
+        pool.emplace_back( [&, t] {
+                unsigned  seed = t + 1;
+                while (!done) {
+                    seed = seed * 1103515245 + 12345;
+                    int   i = ( seed >> 4 ) % ( base + added );
+                    long  v = dict.lookup_copy( keys[i], -1L );
+                    if (v == -1 ? i < base : v != 3L * i)
+                        errors++;
+                    found += v != -1;
+                    if (++reads % 4096 == 0 && dict.stats().size > size_t( base + added ))
+                        errors++;
+                }
+            } );
+    for (int i = base;  i < base + added;  i++) {
+        dict.insert( keys[i], 3L * i );
+        dict[ keys[i - base] ] = 3L * ( i - base );
+    }
+    done = true;
+    for (std::thread& t : pool)
+        t.join();
+    printf( "with a writer: %ld reads, %ld found, %ld errors\n", reads.load(), found.load(), errors - errors_before );
+    printf( "size = %zu (expect %d)\n", dict.size(), base + added );
+    return errors == 0 && int( dict.size() ) == base + added ? 0 : 1;
+}
+
+#endif
+
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "HashOps.h"
+
+
+namespace Util {
+
+// ================================================================
+// shared memory arena
+//
+// One shm_open region, carved up by a bump allocator. Allocations are
+// offsets from the start of the region, not pointers, so every process
+// that maps the region finds them, wherever it is mapped. Nothing is
+// freed: a region lives as long as what it holds.
+//
+//   ShmArena  a( "/name", bytes );         // create, failing if it exists; unlinked by the destructor
+//   ShmArena  a( "/name", bytes, true );   // create, replacing an old one
+//   ShmArena  a( "/name" );                // attach read-only
+//
+// root() is the offset of the creator's first object, for attachers to
+// start from.
+// ================================================================
+
+class ShmArena
+{
+    struct Header {
+        uint64_t  magic;
+        uint64_t  size;
+        uint64_t  used;
+        uint64_t  root;
+    };
+    static constexpr uint64_t  MAGIC = 0x414e455241484d53ULL;   // "SHMARENA"
+
+public:
+    ShmArena (const std::string& name, size_t bytes, bool replace = false);
+    explicit ShmArena (const std::string& name);
+    ~ShmArena ();
+
+    ShmArena (ShmArena&& x) noexcept    : d_name( std::move( x.d_name ) ), d_base( x.d_base ),
+                                          d_size( x.d_size ), d_owner( x.d_owner )  { x.d_base = nullptr; }
+    ShmArena (const ShmArena&) = delete;
+    ShmArena&  operator= (const ShmArena&) = delete;
+
+    // offset of 'bytes' new, zeroed bytes; throws std::length_error when the region is full
+    uint64_t  allocate (size_t bytes, size_t align = 64);
+
+    template <typename U>
+    U*        at (uint64_t offset) const    { return reinterpret_cast<U*>( d_base + offset ); }
+
+    uint64_t  root () const                 { return _header()->root; }
+    void      set_root (uint64_t offset)    { _header()->root = offset; }
+
+    size_t    size () const                 { return d_size; }
+    size_t    used () const                 { return _header()->used; }
+    bool      owner () const                { return d_owner; }
+
+private:
+    Header*  _header () const               { return reinterpret_cast<Header*>( d_base ); }
+
+    std::string  d_name;
+    char*        d_base = nullptr;
+    size_t       d_size = 0;
+    bool         d_owner = false;
+};
+
+
+inline ShmArena::ShmArena (const std::string& name, size_t bytes, bool replace)
+    : d_name( name ), d_size( bytes + sizeof(Header) ), d_owner( true )
+{
+    if (replace)
+        shm_unlink( name.c_str() );     // attached processes keep the old region
+    int  fd = shm_open( name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644 );
+    if (fd == -1)
+        throw std::runtime_error( "ShmArena: cannot create " + name + ": " + strerror( errno ) );
+    void*  p = MAP_FAILED;
+    if (ftruncate( fd, d_size ) == 0)
+        p = mmap( nullptr, d_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    int  error = errno;
+    close( fd );
+    if (p == MAP_FAILED) {
+        shm_unlink( name.c_str() );
+        throw std::runtime_error( "ShmArena: cannot map " + name + ": " + strerror( error ) );
+    }
+    d_base = static_cast<char*>( p );
+    *_header() = Header{ MAGIC, d_size, sizeof(Header), 0 };
+}
+
+
+inline ShmArena::ShmArena (const std::string& name)
+    : d_name( name )
+{
+    int  fd = shm_open( name.c_str(), O_RDONLY, 0 );
+    if (fd == -1)
+        throw std::runtime_error( "ShmArena: cannot open " + name + ": " + strerror( errno ) );
+    struct stat  st;
+    void*  p = MAP_FAILED;
+    if (fstat( fd, &st ) == 0 && size_t( st.st_size ) >= sizeof(Header)) {
+        d_size = st.st_size;
+        p = mmap( nullptr, d_size, PROT_READ, MAP_SHARED, fd, 0 );
+    }
+    int  error = errno;
+    close( fd );
+    if (p == MAP_FAILED)
+        throw std::runtime_error( "ShmArena: cannot map " + name + ": " + strerror( error ) );
+    d_base = static_cast<char*>( p );
+    if (_header()->magic != MAGIC || _header()->size != d_size) {
+        munmap( d_base, d_size );
+        d_base = nullptr;
+        throw std::runtime_error( "ShmArena: " + name + " is not an arena" );
+    }
+}
+
+
+inline ShmArena::~ShmArena ()
+{
+    if (!d_base)
+        return;
+    munmap( d_base, d_size );
+    if (d_owner)
+        shm_unlink( d_name.c_str() );     // attached processes keep their mappings
+}
+
+
+inline uint64_t  ShmArena::allocate (size_t bytes, size_t align)
+{
+    uint64_t  offset = (_header()->used + align - 1) / align * align;
+    if (offset + bytes > d_size)
+        throw std::length_error( "ShmArena: " + d_name + " is full" );
+    _header()->used = offset + bytes;
+    return offset;      // ftruncate'd memory is zero
+}
+
+} // namesapce Util
+
+
+namespace AuData {
+
+// ================================================================
+// SharedDict: a Dict in shared memory
+//
+// The names, the bucket table and the entries all live in one ShmArena.
+// One writer process creates it and inserts; any number of reader
+// processes attach read-only and look up in place, with no copy and no
+// lock.
+//
+//   - names are appended and never rewritten, and entries are never
+//     reused (until clear), so a chain walk can meet stale links but not
+//     freed memory. Walks are bounded and every index is range checked.
+//   - the generation counter is a seqlock: odd while the writer changes
+//     the dict. A reader notes it, reads (copying the value out), and
+//     retries if it moved. generation() also tells a reader whether
+//     anything changed since it last looked.
+//   - a reader that finds the dict busy spins, then yields, then sleeps
+//     (1us doubling to 1ms). It throws std::runtime_error if the writer
+//     process is gone (it died mid-write: the generation stays odd), or
+//     once it has waited past set_read_timeout() (default 1s).
+//   - capacities are fixed at creation (entries and name bytes); the
+//     table has a bucket per entry, so it never rehashes. insert throws
+//     std::length_error when full.
+//
+// T must be trivially copyable: it is shared as bytes. A StringId is the
+// entry index: stable, and valid in every process.
+// Writer calls (insert, clear) are for one thread of the writer process.
+// ================================================================
+
+template <typename T>
+class SharedDict
+{
+    static_assert( std::is_trivially_copyable_v<T>, "SharedDict values are shared as bytes" );
+
+public:
+    using StringId = int;
+
+private:
+    static const StringId  EOL = -1;
+    static constexpr uint64_t  MAGIC = 0x5443494448524853ULL;   // "SHRDDICT"
+
+    struct Entry {
+        uint32_t               name;        // offset in the names
+        uint32_t               length;
+        uint32_t               hash;        // low bits of the full hash, compared before the name
+        std::atomic<StringId>  next;
+        T                      value;
+    };
+
+    struct Header {
+        uint64_t               magic;
+        uint32_t               value_size;
+        std::atomic<uint32_t>  ready;       // set once laid out
+        std::atomic<uint64_t>  generation;  // odd while the writer changes the dict
+        std::atomic<int32_t>   writer;      // its process id, for readers to tell it died
+        uint64_t               names;       // arena offsets and capacities
+        uint64_t               names_capacity;
+        uint64_t               table;
+        uint64_t               table_size;  // power of 2
+        uint64_t               entries;
+        uint64_t               entry_capacity;
+        std::atomic<uint64_t>  names_size;
+        std::atomic<StringId>  count;       // entries used
+    };
+
+public:
+    // writer: create shared memory 'shm_name' with room for the given number of entries
+    // and bytes of names (with their terminating '\0's); throws std::runtime_error if it
+    // exists, unless 'replace'
+    SharedDict (const std::string& shm_name, size_t max_entries, size_t max_name_bytes, bool replace = false);
+
+    // reader: attach to a SharedDict created by another process
+    explicit SharedDict (const std::string& shm_name);
+
+    SharedDict (const SharedDict&) = delete;
+    SharedDict&  operator= (const SharedDict&) = delete;
+
+    // ==== writer
+    // insert, or update the value if 'key' is there; returns its id
+    StringId     insert (const std::string& key, const T& value);
+    void         clear ();
+
+    // ==== readers (and the writer)
+    bool         contains (const std::string& key) const    { return string_id( key ) != EOL; }
+    // value for 'key', or 'dflt'
+    T            lookup (const std::string& key, const T& dflt = T{}) const;
+    // ~0 if not found
+    StringId     string_id (const std::string& key) const;
+
+    T            operator[] (StringId id) const;            // throws std::out_of_range
+    std::string  key_at (StringId id) const;
+
+    size_t       size () const                  { return _header()->count.load( std::memory_order_acquire ); }
+    bool         empty () const                 { return size() == 0; }
+    uint64_t     generation () const            { return _header()->generation.load( std::memory_order_acquire ); }
+    size_t       capacity () const              { return _header()->entry_capacity; }
+    size_t       region_bytes () const          { return d_arena.size(); }
+
+    // how long a read waits out a busy dict before it throws
+    void         set_read_timeout (std::chrono::milliseconds t)     { d_read_timeout = t; }
+
+private:
+    Header*  _header () const                   { return d_arena.template at<Header>( d_arena.root() ); }
+    Entry*   _entries () const                  { return d_arena.template at<Entry>( _header()->entries ); }
+    std::atomic<StringId>*  _table () const     { return d_arena.template at<std::atomic<StringId>>( _header()->table ); }
+    const char*  _names () const                { return d_arena.template at<char>( _header()->names ); }
+
+    static size_t  _hash (const std::string& key)   { return Util::hash_bytes( key.data(), key.size() ); }
+
+    static size_t  _table_size (size_t max_entries)
+                        {
+                            size_t  n = 1;
+                            while (n < max_entries)
+                                n *= 2;
+                            return n;
+                        }
+
+    // the four allocations, each aligned to 64 bytes
+    static size_t  _region_bytes (size_t max_entries, size_t max_name_bytes)
+                        {
+                            if (max_entries >= size_t( std::numeric_limits<StringId>::max() ) ||
+                                max_name_bytes > UINT32_MAX)
+                                throw std::length_error( "SharedDict: too large" );
+                            return sizeof(Header) + max_name_bytes + _table_size( max_entries ) * sizeof(StringId)
+                                   + max_entries * sizeof(Entry) + 4 * 64;
+                        }
+
+    void  _write_begin ()
+                        {
+                            std::atomic<uint64_t>&  g = _header()->generation;
+                            g.store( g.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+                            std::atomic_thread_fence( std::memory_order_release );
+                        }
+    void  _write_end ()
+                        {
+                            std::atomic<uint64_t>&  g = _header()->generation;
+                            g.store( g.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+                        }
+
+    // f() under the seqlock: retried, with _backoff, until no write overlapped it
+    template <typename F>
+    auto  _read (F f) const
+                        {
+                            const std::atomic<uint64_t>&  g = _header()->generation;
+                            for (unsigned tries = 0;  ;  tries++) {
+                                uint64_t  before = g.load( std::memory_order_acquire );
+                                if (!(before & 1)) {
+                                    auto  r = f();
+                                    std::atomic_thread_fence( std::memory_order_acquire );
+                                    if (g.load( std::memory_order_relaxed ) == before)
+                                        return r;
+                                }
+                                _backoff( tries );
+                            }
+                        }
+    // wait before retry 'tries' of a read; throws if the writer died or the timeout passed
+    void  _backoff (unsigned tries) const;
+
+    StringId  _search (const std::string& key, size_t h) const;
+
+    Util::ShmArena  d_arena;
+    std::chrono::milliseconds  d_read_timeout{ 1000 };
+};
+
+
+template <typename T>
+SharedDict<T>::SharedDict (const std::string& shm_name, size_t max_entries, size_t max_name_bytes, bool replace)
+    : d_arena( shm_name, _region_bytes( max_entries, max_name_bytes ), replace )
+{
+    size_t  table_size = _table_size( max_entries );
+    d_arena.set_root( d_arena.allocate( sizeof(Header) ) );
+    Header*  hd = new (_header()) Header{};
+    hd->magic = MAGIC;
+    hd->value_size = sizeof(T);
+    hd->names = d_arena.allocate( max_name_bytes );
+    hd->names_capacity = max_name_bytes;
+    hd->table = d_arena.allocate( table_size * sizeof(StringId) );
+    hd->table_size = table_size;
+    hd->entries = d_arena.allocate( max_entries * sizeof(Entry) );
+    hd->entry_capacity = max_entries;
+    hd->writer.store( getpid(), std::memory_order_relaxed );
+    std::atomic<StringId>*  table = _table();
+    for (size_t b = 0;  b < table_size;  b++)
+        new (&table[b]) std::atomic<StringId>( EOL );
+    hd->ready.store( 1, std::memory_order_release );
+}
+
+
+template <typename T>
+SharedDict<T>::SharedDict (const std::string& shm_name)
+    : d_arena( shm_name )
+{
+    const Header*  hd = d_arena.root() ? _header() : nullptr;
+    if (!hd || hd->magic != MAGIC || !hd->ready.load( std::memory_order_acquire ))
+        throw std::runtime_error( "SharedDict: " + shm_name + " is not a SharedDict, or not ready" );
+    if (hd->value_size != sizeof(T))
+        throw std::runtime_error( "SharedDict: " + shm_name + " holds another value type" );
+}
+
+
+// a write is a few stores: spin through it, then yield, then sleep 1us, 2us .. 1ms a try.
+// From the first sleep on, a reader checks the writer is alive: kill( pid, 0 ) fails with
+// ESRCH once it has gone (a recycled pid only delays this to the timeout)
+template <typename T>
+void  SharedDict<T>::_backoff (unsigned tries) const
+{
+    constexpr unsigned  SPINS = 64, YIELDS = 64, DOUBLINGS = 10;
+    if (tries < SPINS)
+        return;
+    if (tries < SPINS + YIELDS) {
+        std::this_thread::yield();
+        return;
+    }
+    pid_t  writer = _header()->writer.load( std::memory_order_relaxed );
+    if (writer > 0 && kill( writer, 0 ) == -1 && errno == ESRCH)
+        throw std::runtime_error( "SharedDict: the writer process died while writing" );
+    unsigned  sleeps = tries - SPINS - YIELDS;
+    // every try from here on sleeps at least 1ms
+    if (sleeps > DOUBLINGS && std::chrono::milliseconds( sleeps - DOUBLINGS ) > d_read_timeout)
+        throw std::runtime_error( "SharedDict: busy past the read timeout" );
+    std::this_thread::sleep_for( std::chrono::microseconds( 1u << std::min( sleeps, DOUBLINGS ) ) );
+}
+
+
+// chain walk without locks, for _read; bounded, and every index is checked,
+// since a racing writer can leave anything
+template <typename T>
+typename SharedDict<T>::StringId  SharedDict<T>::_search (const std::string& key, size_t h) const
+{
+    const Header*  hd = _header();
+    const Entry*   entries = _entries();
+    const char*    names = _names();
+    StringId  i = _table()[ h & (hd->table_size - 1) ].load( std::memory_order_acquire );
+    for (size_t n = 0;  i != EOL && n < hd->entry_capacity;  n++) {
+        if (size_t(i) >= hd->entry_capacity)
+            return EOL;
+        const Entry&  e = entries[i];
+        if (e.hash == uint32_t( h ) && e.length == key.size() &&
+            uint64_t( e.name ) + e.length <= hd->names_capacity &&
+            memcmp( names + e.name, key.data(), key.size() ) == 0)
+            return i;
+        i = e.next.load( std::memory_order_acquire );
+    }
+    return EOL;
+}
+
+
+template <typename T>
+typename SharedDict<T>::StringId  SharedDict<T>::insert (const std::string& key, const T& value)
+{
+    Header*   hd = _header();
+    size_t    h = _hash( key );
+    StringId  i = _search( key, h );   // the writer needs no seqlock
+    if (i != EOL) {
+        _write_begin();
+        _entries()[i].value = value;
+        _write_end();
+        return i;
+    }
+    StringId  count = hd->count.load( std::memory_order_relaxed );
+    uint64_t  names_size = hd->names_size.load( std::memory_order_relaxed );
+    if (size_t(count) >= hd->entry_capacity || names_size + key.size() + 1 > hd->names_capacity)
+        throw std::length_error( "SharedDict: full" );
+
+    // not reachable until linked, so filled in outside the seqlock
+    char*  names = const_cast<char*>( _names() );
+    memcpy( names + names_size, key.data(), key.size() );
+    names[ names_size + key.size() ] = '\0';
+    Entry&  e = _entries()[count];
+    e.name = names_size;
+    e.length = key.size();
+    e.hash = uint32_t( h );
+    e.value = value;
+    std::atomic<StringId>&  head = _table()[ h & (hd->table_size - 1) ];
+    e.next.store( head.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+
+    _write_begin();
+    head.store( count, std::memory_order_release );
+    hd->names_size.store( names_size + key.size() + 1, std::memory_order_relaxed );
+    hd->count.store( count + 1, std::memory_order_release );
+    _write_end();
+    return count;
+}
+
+
+template <typename T>
+void  SharedDict<T>::clear ()
+{
+    Header*  hd = _header();
+    _write_begin();
+    for (size_t b = 0;  b < hd->table_size;  b++)
+        _table()[b].store( EOL, std::memory_order_relaxed );
+    hd->names_size.store( 0, std::memory_order_relaxed );
+    hd->count.store( 0, std::memory_order_relaxed );
+    _write_end();
+}
+
+
+template <typename T>
+T  SharedDict<T>::lookup (const std::string& key, const T& dflt) const
+{
+    size_t  h = _hash( key );
+    return _read( [&] {
+                        StringId  i = _search( key, h );
+                        return i == EOL ? dflt : _entries()[i].value;
+                    } );
+}
+
+
+template <typename T>
+typename SharedDict<T>::StringId  SharedDict<T>::string_id (const std::string& key) const
+{
+    size_t  h = _hash( key );
+    return _read( [&] { return _search( key, h ); } );
+}
+
+
+template <typename T>
+T  SharedDict<T>::operator[] (StringId id) const
+{
+    if (id < 0 || size_t(id) >= size())
+        throw std::out_of_range( "SharedDict: bad id" );
+    return _read( [&] { return _entries()[id].value; } );
+}
+
+
+template <typename T>
+std::string  SharedDict<T>::key_at (StringId id) const
+{
+    if (id < 0 || size_t(id) >= size())
+        throw std::out_of_range( "SharedDict: bad id" );
+    // a name's bytes are not rewritten until clear()
+    return _read( [&] {
+                        const Entry&  e = _entries()[id];
+                        size_t  n = uint64_t( e.name ) + e.length <= _header()->names_capacity ? e.length : 0;
+                        return std::string( _names() + e.name, n );
+                    } );
+}
+
+
+} // namespace AuData
+
+
+
+
+#include <vector>
+#include <functional>
+#include <type_traits>
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <cassert>
+#include <climits>
+
+#include "HashOps.h"
+
+namespace Util {
+
+// Bucket: hash value -> bucket index, see "bucket index policies" in HashOps.h
+// CachedHash: uint32_t or uint64_t to keep each entry's hash, so chain hops
+//   compare hashes before calling Comper and rehash does not call Hasher.
+//   void (the default) to not.
+// Counters: HashCounters to count lookups (find, find2, contains), see "table statistics"
+template <typename T, typename Hasher = std::hash<T>, typename Comper = std::equal_to<T>,
+          typename Bucket = ModuloIndex, typename CachedHash = void, typename Counters = NoHashCounters>
+class HashSet {
+    using Int = int;
+    static constexpr Int EOL = -1;
+    static Int _free_list_link(Int x) { return -3 - x; }
+
+    static constexpr bool CACHED_HASH = !std::is_void_v<CachedHash>;
+    template <typename H> struct EntryHash { H hash = 0; };
+    struct EntryNoHash {};
+
+public:
+    struct Entry : std::conditional_t<CACHED_HASH, EntryHash<CachedHash>, EntryNoHash> {
+        T val;
+        Int next;
+        Entry(const T& v, Int n) : val(v), next(n) {}
+        Entry() = default;
+    };
+
+    struct HashInfo {
+        Int hash_size;
+        Int size;
+        Int max_depth;
+        Int rehash_mult;
+        Int free_list;
+        T null_val;
+    };
+
+private:
+    HashInfo d;
+    std::vector<Int> d_table;
+    std::vector<Entry> d_entries;
+    Hasher d_hasher;
+    Comper d_comper;
+    Bucket d_bucket;
+    [[no_unique_address]] Counters d_counters;
+    RehashClock d_rehash_clock;
+
+public:
+    HashSet(int hash_size = 256, const T& null_val = T(), Hasher hasher = Hasher(), Comper comper = Comper());
+
+    std::pair<const T&, bool> insert(const T& v);
+    bool remove(const T& v);
+    void rehash(int new_hash_size);
+    void clear();
+    bool empty() const { return d.size == 0; }
+    size_t size() const { return d.size; }
+    bool contains(const T& v) const;
+    std::pair<const T&, bool> find(const T& v) const;
+    size_t bucket_count() const { return d.hash_size; }
+
+    // entry ids: the index of an entry in the entry vector; see set_remap
+    int find2(const T& v) const;     // -1 if not found
+    const T& at(int id) const { return d_entries[id].val; }
+    // ids run from 0 to id_end(); live(id) is false for a hole left by remove()
+    size_t id_end() const { return d_entries.size(); }
+    bool live(size_t id) const { return d_entries[id].next >= EOL; }
+
+    // find2 without a T: 'hash' is what Hasher gives for the entry sought and
+    // eq(const T&) tells it from the others in its chain. For lookups by a key that
+    // is not a T (a string_view for a stored name id), with no temporary T
+    template <typename Eq> int find_hashed(size_t hash, Eq eq) const;
+
+    // f(const T&) for each entry
+    template <typename F> void for_each(F f) const;
+
+    // ==== compaction
+    // remove() leaves a hole in the entry vector (reused by a later insert). Holes are
+    // filled by moving entries:
+    //   swap remove   remove() moves the last entry into the hole; there are never holes
+    //   online        once holes pass 'threshold' of the entry vector, each insert / remove
+    //                 also moves entries from the end into holes at the front, 'budget'
+    //                 slots per call, until no hole is left. threshold 0 (default) = off
+    // An entry's id (its index in the entry vector) changes when it moves; remap(from, to)
+    // is called for every move so holders of ids can follow.
+    using RemapFn = std::function<void(int from, int to)>;
+    void set_remap(RemapFn fn) { d_remap = std::move(fn); }
+    void set_swap_remove(bool x = true) { d_swap_remove = x; if (x) compact(); }
+    void set_compact_threshold(double x) { d_compact_threshold = x; }
+    void set_compact_budget(size_t x) { d_compact_budget = x; }
+    void compact();     // fill every hole now
+    size_t dead_count() const { return d_entries.size() - d.size; }
+
+    // chain depths, holes and iteration cost
+    void print_histogram(FILE* f = NULL) const;
+
+    // shape, probes, rehashes and bytes; see "table statistics" in HashOps.h
+    HashStats stats() const;
+    void reset_counters() { d_counters.reset(); }
+
+    // allocated bytes, O(1); see "memory accounting" in HashOps.h
+    MemoryUsage memory_usage() const;
+
+    // the raw tables, to frame or save as bytes (a T that is trivially copyable), and
+    // assign() to take them back as they were: no hashing
+    const HashInfo& get_hash_info() const { return d; }
+    const std::vector<Int>& get_hash_table() const { return d_table; }
+    const std::vector<Entry>& get_hash_data() const { return d_entries; }
+    std::vector<Entry>& get_hash_data() { return d_entries; }
+    void assign(const HashInfo& info, std::vector<Int> table, std::vector<Entry> entries);
+    // what assign() takes on trust, for tables from outside (a socket): every link in
+    // range, each live entry on its bucket's chain and on no other, the free list over
+    // holes only. ok(const T&) checks each live value before it is hashed
+    template <typename Ok>
+    bool well_formed(const HashInfo& info, const std::vector<Int>& table, const std::vector<Entry>& entries, Ok ok) const;
+    // give back the entry vector's slack, and shrink a table that removes or clear()
+    // left too big. Entry ids stay: compact() first to drop the holes too
+    void shrink_to_fit();
+
+private:
+    RemapFn d_remap;
+    bool d_swap_remove = false;
+    double d_compact_threshold = 0;
+    size_t d_compact_budget = 32;
+    bool d_compacting = false;      // holes are not on the free list while set
+    Int d_compact_lo = 0;           // while compacting, entries below this are live
+
+    Int _new_entry(const T& val, Int next, size_t h);
+    void check_load_factor();
+    void _kill(Int idx);
+    void _maybe_compact();
+    void _compact_step(size_t budget);
+
+    // the table slot or 'next' field that points at live entry 'i'
+    Int* _link_to(Int i) {
+        Int* link = &d_table[d_bucket(_entry_hash(d_entries[i]))];
+        while (*link != i) link = &d_entries[*link].next;
+        return link;
+    }
+    // move live entry 'from' into the hole at 'to'
+    void _move_entry(Int from, Int to) {
+        *_link_to(from) = to;
+        d_entries[to] = std::move(d_entries[from]);
+        if (d_remap) d_remap(from, to);
+    }
+
+    // hash of 'v', truncated to CachedHash if entries keep it
+    size_t _hash(const T& v) const {
+        if constexpr (CACHED_HASH) return CachedHash(d_hasher(v));
+        else return d_hasher(v);
+    }
+    size_t _entry_hash(const Entry& e) const {
+        if constexpr (CACHED_HASH) return e.hash;
+        else return d_hasher(e.val);
+    }
+    bool _match(const T& v, size_t h, const Entry& e) const {
+        if constexpr (CACHED_HASH)
+            if (e.hash != h) return false;
+        return d_comper(v, e.val);
+    }
+};
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::HashSet(int hash_size, const T& null_val, Hasher hasher, Comper comper)
+    : d_hasher(hasher), d_comper(comper) {
+    d.hash_size = d_bucket.resize(hash_size);
+    d_table.assign(d.hash_size, EOL);
+    d.size = 0;
+    d.max_depth = 4;
+    d.rehash_mult = 4;
+    d.free_list = _free_list_link(EOL);
+    d.null_val = null_val;
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+std::pair<const T&, bool> HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::insert(const T& v) {
+    _maybe_compact();   // first: it may move entries, and the returned ref must stay valid
+    check_load_factor();
+    size_t hash = _hash(v);
+    size_t h = d_bucket(hash);
+    for (Int i = d_table[h]; i != EOL; i = d_entries[i].next) {
+        if (_match(v, hash, d_entries[i]))
+            return { d_entries[i].val, false };
+    }
+    Int idx = _new_entry(v, d_table[h], hash);
+    d_table[h] = idx;
+    return { d_entries[idx].val, true };
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+bool HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::remove(const T& v) {
+    size_t hash = _hash(v);
+    size_t h = d_bucket(hash);
+    for (Int* i = &d_table[h]; *i != EOL; i = &d_entries[*i].next) {
+        Entry& e = d_entries[*i];
+        if (_match(v, hash, e)) {
+            int idx = *i;
+            *i = e.next;
+            d.size--;
+            _kill(idx);
+            _maybe_compact();
+            return true;
+        }
+    }
+    return false;
+}
+
+// entry 'idx' was unlinked from its chain
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+void HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::_kill(Int idx) {
+    Entry& e = d_entries[idx];
+    e.val = d.null_val;
+    if (d_swap_remove) {
+        Int last = d_entries.size() - 1;
+        if (idx != last) _move_entry(last, idx);
+        d_entries.pop_back();
+    } else if (d_compacting) {
+        e.next = _free_list_link(EOL);  // a hole, but not on the free list:
+        d_compact_lo = std::min(d_compact_lo, idx);  // the pass must come back for it
+    } else {
+        e.next = d.free_list;
+        d.free_list = _free_list_link(idx);
+    }
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+void HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::_maybe_compact() {
+    if (!d_compacting && d_compact_threshold > 0 && d_entries.size() >= 32 &&
+        dead_count() > d_compact_threshold * d_entries.size()) {
+        // holes at the end are dropped, not reused: take them all off the free list
+        d_compacting = true;
+        d.free_list = _free_list_link(EOL);
+        d_compact_lo = 0;
+    }
+    if (d_compacting) _compact_step(d_compact_budget);
+}
+
+// two fingers: d_compact_lo moves up to the next hole, the end of the vector moves
+// down to the last live entry, which is moved into the hole. Each slot looked at
+// costs one unit of 'budget'.
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+void HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::_compact_step(size_t budget) {
+    for (; d_compacting && budget > 0; budget--) {
+        Int last = Int(d_entries.size()) - 1;
+        if (last >= 0 && d_entries[last].next < EOL) {
+            d_entries.pop_back();
+        } else if (d_compact_lo < last && d_entries[d_compact_lo].next >= EOL) {
+            d_compact_lo++;
+        } else if (d_compact_lo < last) {
+            _move_entry(last, d_compact_lo++);
+            d_entries.pop_back();
+        } else {
+            d_compacting = false;   // everything up to 'last' is live
+        }
+    }
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+void HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::compact() {
+    if (!d_compacting && dead_count() > 0) {
+        d_compacting = true;
+        d.free_list = _free_list_link(EOL);
+        d_compact_lo = 0;
+    }
+    _compact_step(~size_t(0));
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+template <typename F>
+void HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::for_each(F f) const {
+    for (const Entry& e : d_entries)
+        if (e.next >= EOL) f(e.val);
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+void HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::print_histogram(FILE* f) const {
+    if (!f) f = stdout;
+    std::map<Int, int> hist;
+    for (Int head : d_table) {
+        int depth = 0;
+        for (Int i = head; i != EOL; i = d_entries[i].next) depth++;
+        hist[depth] += 1;
+    }
+    fprintf(f, "Table Histogram:\n");
+    for (auto x : hist)
+        fprintf(f, "   %5d %8d\n", x.first, x.second);
+
+    size_t slots = d_entries.size(), dead = dead_count();
+    fprintf(f, "Entries: %zu slots, %zu live, %zu holes (%.1f%% fragmentation, %zu bytes)\n",
+            slots, size_t(d.size), dead, slots ? 100.0 * dead / slots : 0.0, dead * sizeof(Entry));
+
+    // iteration visits every slot, live or not
+    size_t n = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for_each([&](const T&) { n++; });
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    fprintf(f, "Iteration: %.2f ns per entry, %.2f slots scanned per entry\n",
+            n ? ns / n : 0.0, n ? double(slots) / n : 0.0);
+    fprintf(f, "\n");
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+HashStats HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::stats() const {
+    HashStats s;
+    s.size = d.size;
+    s.slots = d_entries.size();
+    s.free_list = dead_count();
+    for (Int head : d_table) {
+        size_t len = 0;
+        for (Int i = head; i != EOL; i = d_entries[i].next) len++;
+        s.add_chain(len);
+    }
+    s.finish();
+    d_counters.fill(s);
+    d_rehash_clock.fill(s);
+    s.table_bytes = container_bytes(d_table);
+    s.entry_bytes = container_bytes(d_entries);
+    return s;
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+MemoryUsage HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::memory_usage() const {
+    MemoryUsage u;
+    u.table = container_bytes(d_table);
+    u.entries = container_bytes(d_entries);
+    u.slack = container_slack(d_table) + container_slack(d_entries);
+    return u;
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+void HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::assign(const HashInfo& info, std::vector<Int> table,
+                                                                      std::vector<Entry> entries) {
+    assert(table.size() == size_t(info.hash_size));
+    d = info;
+    d_table = std::move(table);
+    d_entries = std::move(entries);
+    d_bucket.resize(d.hash_size);
+    d_compacting = false;
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+template <typename Ok>
+bool HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::well_formed(const HashInfo& info, const std::vector<Int>& table,
+                                                                           const std::vector<Entry>& entries, Ok ok) const {
+    if (info.hash_size <= 0 || table.size() != size_t(info.hash_size) || entries.size() > size_t(INT_MAX) ||
+        info.size < 0 || info.max_depth <= 0 || info.rehash_mult < 2 || info.free_list >= EOL)
+        return false;
+    Bucket bucket;
+    if (bucket.resize(info.hash_size) != size_t(info.hash_size))
+        return false;
+    Int n = entries.size();
+    auto in_range = [n](Int i) { return i >= EOL && i < n; };
+    Int live = 0;
+    for (const Entry& e : entries) {
+        if (e.next >= EOL ? !in_range(e.next) || !ok(e.val) : !in_range(-3 - e.next))
+            return false;
+        live += e.next >= EOL;
+    }
+    if (live != info.size)
+        return false;
+    // each live entry reached once, from its own bucket: no loops, no joined chains
+    Int seen = 0;
+    for (size_t b = 0; b < table.size(); b++) {
+        if (!in_range(table[b]))
+            return false;
+        for (Int i = table[b]; i != EOL; i = entries[i].next)
+            if (entries[i].next < EOL || ++seen > live || bucket(_entry_hash(entries[i])) != b)
+                return false;
+    }
+    if (seen != live)
+        return false;
+    Int holes = n - live;
+    for (Int i = -3 - info.free_list; i != EOL; i = -3 - entries[i].next)
+        if (!in_range(i) || entries[i].next >= EOL || holes-- == 0)
+            return false;
+    return true;
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+void HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::shrink_to_fit() {
+    if (d.hash_size > 16 && d.size * 2 < d.hash_size)
+        rehash(std::max<Int>(d.size, 16));
+    d_table.shrink_to_fit();
+    d_entries.shrink_to_fit();
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+void HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::rehash(int new_hash_size) {
+    RehashClock::Scope timer(d_rehash_clock);
+    d_rehash_clock.count++;
+    Bucket bucket;
+    new_hash_size = bucket.resize(new_hash_size);
+    std::vector<Int> new_table(new_hash_size, EOL);
+    for (Int i = 0; i < d_entries.size(); ++i) {
+        if (d_entries[i].next >= EOL) {
+            size_t h = bucket(_entry_hash(d_entries[i]));
+            d_entries[i].next = new_table[h];
+            new_table[h] = i;
+        }
+    }
+    d_table = std::move(new_table);
+    d_bucket = bucket;
+    d.hash_size = new_hash_size;
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+void HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::clear() {
+    std::fill(d_table.begin(), d_table.end(), EOL);
+    d_entries.clear();
+    d.size = 0;
+    d.free_list = _free_list_link(EOL);
+    d_compacting = false;
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+bool HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::contains(const T& v) const {
+    size_t hash = _hash(v);
+    size_t h = d_bucket(hash);
+    size_t probes = 0;
+    for (Int i = d_table[h]; i != EOL; i = d_entries[i].next) {
+        probes++;
+        if (_match(v, hash, d_entries[i])) {
+            d_counters.hit(probes);
+            return true;
+        }
+    }
+    d_counters.miss(probes);
+    return false;
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+int HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::find2(const T& v) const {
+    size_t hash = _hash(v);
+    size_t probes = 0;
+    for (Int i = d_table[d_bucket(hash)]; i != EOL; i = d_entries[i].next) {
+        probes++;
+        if (_match(v, hash, d_entries[i])) {
+            d_counters.hit(probes);
+            return i;
+        }
+    }
+    d_counters.miss(probes);
+    return EOL;
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+template <typename Eq>
+int HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::find_hashed(size_t hash, Eq eq) const {
+    if constexpr (CACHED_HASH) hash = CachedHash(hash);
+    size_t probes = 0;
+    for (Int i = d_table[d_bucket(hash)]; i != EOL; i = d_entries[i].next) {
+        probes++;
+        if constexpr (CACHED_HASH)
+            if (d_entries[i].hash != hash) continue;
+        if (eq(d_entries[i].val)) {
+            d_counters.hit(probes);
+            return i;
+        }
+    }
+    d_counters.miss(probes);
+    return EOL;
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+std::pair<const T&, bool> HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::find(const T& v) const {
+    size_t hash = _hash(v);
+    size_t h = d_bucket(hash);
+    size_t probes = 0;
+    for (Int i = d_table[h]; i != EOL; i = d_entries[i].next) {
+        probes++;
+        if (_match(v, hash, d_entries[i])) {
+            d_counters.hit(probes);
+            return { d_entries[i].val, true };
+        }
+    }
+    d_counters.miss(probes);
+    return { v, false };
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+typename HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::Int HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::_new_entry(const T& val, Int next, size_t h) {
+    d.size++;
+    Int idx;
+    if (d.free_list != _free_list_link(EOL)) {
+        idx = _free_list_link(d.free_list);
+        d.free_list = d_entries[idx].next;
+        d_entries[idx].val = val;
+        d_entries[idx].next = next;
+    } else {
+        idx = d_entries.size();
+        d_entries.emplace_back(val, next);
+    }
+    if constexpr (CACHED_HASH) d_entries[idx].hash = CachedHash(h);
+    return idx;
+}
+
+template <typename T, typename Hasher, typename Comper, typename Bucket, typename CachedHash, typename Counters>
+void HashSet<T, Hasher, Comper, Bucket, CachedHash, Counters>::check_load_factor() {
+    if (d.size > d.hash_size * d.max_depth) {
+        rehash(d.hash_size * d.rehash_mult);
+    }
+}
+
+} // namespace Util
+
+#ifdef TEST_HASH_SET
+// to test: create file with
+//   #define TEST_HASH_SET
+//   #include "Hash.h"
+int main() {
+    Util::HashSet<int> hashSet;
+    hashSet.insert(1);
+    hashSet.insert(2);
+    hashSet.insert(3);
+    hashSet.remove(2);
+
+    // a hole made behind an online pass is filled by compact(), so swap remove finds none
+    Util::HashSet<int> holes;
+    holes.set_compact_threshold(0.25);
+    holes.set_compact_budget(1);
+    for (int i = 0; i < 200; i++) holes.insert(i);
+    for (int i = 100; i < 160; i++) holes.remove(i);
+    holes.remove(7);
+    holes.set_swap_remove();
+    assert( holes.dead_count() == 0 );
+    for (int i = 199; i >= 8; i--) holes.remove(i);
+    holes.remove(0);
+    assert( holes.size() == 6 && holes.dead_count() == 0 );
+    for (int i = 1; i < 7; i++) assert( holes.contains(i) );
+    return 0;
+}
+#endif
+
+
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+
+namespace Util {
+
+// ================================================================
+// concurrent hash set
+//
+// HashSet for many threads, with the same chained layout: bucket heads
+// index into the entries, entries link through 'next'.
+//
+//   - writers lock one of 'Stripes' mutexes, picked by the low bits of
+//     the hash, so writers on different stripes do not contend.
+//   - readers take no lock.  Each stripe has a sequence counter that is
+//     odd while a writer relinks the stripe's chains; a reader retries
+//     if the counter moved under it (seqlock).
+//   - entries live in chunks that never move.  A removed slot goes back
+//     to its stripe, and is rewritten only once no operation that could
+//     have reached it is still running (epochs, below), so a racing
+//     reader can only see stale links, never a torn value.
+//   - growing allocates a new bucket array and old buckets are migrated
+//     a few at a time by later writers.  A migrated bucket holds MOVED
+//     and lookups follow the table's 'next_table', so a resize never
+//     blocks readers.  The old array is freed the same way as a slot.
+//
+// Bucket counts are powers of 2 and at least 'Stripes', so a key maps to
+// the same stripe in every table and migrating a bucket takes one lock.
+// Each entry has a link per table generation (even / odd), because
+// during a migration it can be reached from both tables.
+//
+// Epochs: every operation counts itself under the current epoch's parity
+// while it runs.  The epoch moves from E to E + 1 only when nothing is
+// counted under E - 1, so what was unlinked during E is out of reach once
+// the epoch is E + 2.  Writers try to move it on every few writes.
+//
+// clear() and the destructor need exclusive access.
+// ================================================================
+
+template <typename T, typename Hasher = std::hash<T>, typename Comper = std::equal_to<T>, int Stripes = 64>
+class ConcurrentHashSet {
+    static_assert( Stripes > 0 && (Stripes & (Stripes - 1)) == 0, "Stripes must be a power of 2" );
+
+    using Int = int;
+    static const Int EOL   = -1;
+    static const Int MOVED = -3;     // bucket head in a table whose bucket was migrated
+
+    static const Int FIRST_CHUNK = 1024;
+    static const int MAX_CHUNKS  = 21;      // FIRST_CHUNK * (2^21 - 1) slots: every index fits an Int
+    static constexpr int64_t MAX_SLOTS = int64_t(FIRST_CHUNK) * ((int64_t(1) << MAX_CHUNKS) - 1);
+    static_assert( MAX_SLOTS <= std::numeric_limits<Int>::max(), "slot indexes must fit an Int" );
+
+    static const int READER_SLOTS = 16;     // operation counters, spread over cache lines
+
+    enum : uint8_t { BUILDING, LIVE, REMOVED };
+
+    struct Entry {
+        T                     val;
+        std::atomic<Int>      next[2];
+        std::atomic<uint8_t>  state { BUILDING };
+    };
+
+    struct Table {
+        size_t                                mask;        // bucket count - 1
+        int                                   gen;         // entries link through next[gen & 1]
+        std::unique_ptr< std::atomic<Int>[] > heads;
+        std::atomic<Table*>                   next_table { nullptr };  // set while migrating out
+        std::atomic<size_t>                   claim { 0 };             // next bucket to migrate
+        std::atomic<size_t>                   migrated { 0 };
+
+        Table (size_t n, int g) : mask( n - 1 ), gen( g ), heads( new std::atomic<Int>[n] )
+                        { for (size_t i = 0;  i < n;  i++) heads[i].store( EOL, std::memory_order_relaxed ); }
+    };
+
+    struct alignas(64) Stripe {
+        std::mutex             lock;
+        std::atomic<uint64_t>  seq { 0 };    // odd while a writer relinks
+        std::deque< std::pair<Int, uint64_t> >  retired;     // removed slots, with the epoch they were unlinked in
+    };
+
+    struct alignas(64) Readers {
+        std::atomic<long>      active[2] { { 0 }, { 0 } };   // operations running, by epoch parity
+    };
+
+    // an operation in progress: nothing it can reach is rewritten or freed
+    class Guard {
+    public:
+        explicit Guard (const ConcurrentHashSet& set);
+        ~Guard ()                       { d_count->fetch_sub( 1, std::memory_order_release ); }
+
+        Guard (const Guard&) = delete;
+        Guard&  operator= (const Guard&) = delete;
+
+    private:
+        std::atomic<long>*  d_count;
+    };
+
+public:
+    ConcurrentHashSet (int hash_size = 256, Hasher hasher = Hasher(), Comper comper = Comper());
+    ~ConcurrentHashSet ();
+
+    ConcurrentHashSet (const ConcurrentHashSet&) = delete;
+    ConcurrentHashSet&  operator= (const ConcurrentHashSet&) = delete;
+
+    // ==== writers (lock one stripe)
+    bool    insert (const T& v);        // false if already present
+    bool    remove (const T& v);
+    void    clear ();
+
+    // ==== readers (lock free)
+    bool    contains (const T& v) const;
+    bool    find (const T& v, T& out) const;       // copy of the stored value
+    size_t  size () const               { return d_size.load( std::memory_order_relaxed ); }
+    bool    empty () const              { return size() == 0; }
+
+    // visit live entries in slot order; safe alongside writers
+    void    for_each (const std::function<void (const T&)>& fn) const;
+
+    // ==== tuning, set before sharing
+    void    set_max_depth (int x)       { d_max_depth = x; }
+    void    set_rehash_mult (int x)     { d_rehash_mult = x; }     // rounded up to a power of 2
+    void    set_migrate_batch (int x)   { d_migrate_batch = x; }   // old buckets moved per write
+
+    size_t  bucket_count () const       { return d_table.load( std::memory_order_acquire )->mask + 1; }
+    bool    resizing () const           { return d_table.load( std::memory_order_acquire )->next_table.load() != nullptr; }
+    size_t  slot_count () const         { return size_t( std::min( d_count.load( std::memory_order_relaxed ), MAX_SLOTS )); }   // entry slots allocated
+
+private:
+    Stripe&  _stripe (size_t h) const   { return d_stripes[ h & (Stripes - 1) ]; }
+
+    static void  _write_begin (Stripe& s)
+                        {
+                            s.seq.store( s.seq.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+                            std::atomic_thread_fence( std::memory_order_release );
+                        }
+    static void  _write_end (Stripe& s)
+                        { s.seq.store( s.seq.load( std::memory_order_relaxed ) + 1, std::memory_order_release ); }
+
+    Entry&  _entry (Int i) const
+                        {
+                            size_t  c = 63 - __builtin_clzll( size_t(i) / FIRST_CHUNK + 1 );
+                            size_t  base = FIRST_CHUNK * ((size_t(1) << c) - 1);
+                            return d_chunks[c].load( std::memory_order_acquire )[ i - base ];
+                        }
+
+    Table*  _table_for (size_t h) const;
+    Int     _search (const T& v, size_t h) const;
+    Int     _new_entry (const T& v, Stripe& s);
+    void    _migrate (Table* from, size_t b);
+    void    _after_write ();
+    void    _retire (Table* t);
+    void    _advance ();
+    void    _reclaim ();
+
+    mutable Stripe                       d_stripes[Stripes];
+    mutable Readers                      d_readers[READER_SLOTS];
+    std::atomic<uint64_t>                d_epoch { 2 };
+    std::atomic<size_t>                  d_retired { 0 };   // slots and tables waiting for the epoch
+    std::atomic<Table*>                  d_table;
+    std::vector< std::unique_ptr<Table> > d_tables;     // the current table and the one it migrates to
+    std::deque< std::pair<std::unique_ptr<Table>, uint64_t> >  d_retired_tables;   // fully migrated, with the epoch they left in
+    std::mutex                           d_resize_lock;
+    std::atomic<Entry*>                  d_chunks[MAX_CHUNKS];
+    std::atomic<int64_t>                 d_count { 0 };  // entry slots handed out; may overshoot MAX_SLOTS
+    std::atomic<size_t>                  d_size { 0 };
+
+    int      d_max_depth = 4;
+    int      d_rehash_mult = 4;
+    int      d_migrate_batch = 8;
+    Hasher   d_hasher;
+    Comper   d_comper;
+};
+
+template <typename T, typename Hasher, typename Comper, int Stripes>
+ConcurrentHashSet<T, Hasher, Comper, Stripes>::ConcurrentHashSet (int hash_size, Hasher hasher, Comper comper)
+    : d_hasher( hasher ), d_comper( comper )
+{
+    size_t  n = Stripes;
+    while (n < size_t(hash_size))
+        n *= 2;
+    d_tables.emplace_back( new Table( n, 0 ));
+    d_table.store( d_tables.back().get() );
+    for (int c = 0;  c < MAX_CHUNKS;  c++)
+        d_chunks[c].store( nullptr );
+}
+
+template <typename T, typename Hasher, typename Comper, int Stripes>
+ConcurrentHashSet<T, Hasher, Comper, Stripes>::~ConcurrentHashSet ()
+{
+    for (int c = 0;  c < MAX_CHUNKS;  c++)
+        delete[] d_chunks[c].load();
+}
+
+// count the operation under the current epoch.  If the epoch moved before
+// the count was visible, the count may be under one the epoch already left
+// behind: take it back and retry.
+template <typename T, typename Hasher, typename Comper, int Stripes>
+ConcurrentHashSet<T, Hasher, Comper, Stripes>::Guard::Guard (const ConcurrentHashSet& set)
+{
+    static std::atomic<unsigned>  threads { 0 };
+    thread_local unsigned         slot = threads.fetch_add( 1, std::memory_order_relaxed ) % READER_SLOTS;
+
+    Readers&  r = set.d_readers[slot];
+    for (;;) {
+        uint64_t  e = set.d_epoch.load();
+        d_count = &r.active[ e & 1 ];
+        d_count->fetch_add( 1 );
+        if (set.d_epoch.load() == e)
+            return;
+        d_count->fetch_sub( 1 );
+    }
+}
+
+// writers: the table holding h's bucket, following migrated buckets forward.
+// Stable while the stripe lock is held.
+template <typename T, typename Hasher, typename Comper, int Stripes>
+typename ConcurrentHashSet<T, Hasher, Comper, Stripes>::Table*
+ConcurrentHashSet<T, Hasher, Comper, Stripes>::_table_for (size_t h) const
+{
+    Table*  t = d_table.load( std::memory_order_acquire );
+    while (t->heads[ h & t->mask ].load( std::memory_order_acquire ) == MOVED)
+        t = t->next_table.load( std::memory_order_acquire );
+    return t;
+}
+
+// chain walk without locks; the caller validates it against the stripe sequence.
+// Links may be stale, so the walk is bounded by the number of entries.
+template <typename T, typename Hasher, typename Comper, int Stripes>
+typename ConcurrentHashSet<T, Hasher, Comper, Stripes>::Int
+ConcurrentHashSet<T, Hasher, Comper, Stripes>::_search (const T& v, size_t h) const
+{
+    Table*  t = d_table.load( std::memory_order_acquire );
+    Int     i;
+    while ((i = t->heads[ h & t->mask ].load( std::memory_order_acquire )) == MOVED)
+        t = t->next_table.load( std::memory_order_acquire );
+
+    int  p = t->gen & 1;
+    for (int64_t n = slot_count();  i != EOL && n >= 0;  n--) {
+        const Entry&  e = _entry( i );
+        if (d_comper( v, e.val ))
+            return i;
+        i = e.next[p].load( std::memory_order_acquire );
+    }
+    return EOL;
+}
+
+// under the stripe lock: the oldest slot the stripe removed, once no operation can
+// still reach it, else a fresh one.  A slot only returns to its own stripe, so
+// readers of other stripes never meet it.
+template <typename T, typename Hasher, typename Comper, int Stripes>
+typename ConcurrentHashSet<T, Hasher, Comper, Stripes>::Int
+ConcurrentHashSet<T, Hasher, Comper, Stripes>::_new_entry (const T& v, Stripe& s)
+{
+    Int  i;
+    if (!s.retired.empty() && s.retired.front().second + 2 <= d_epoch.load()) {
+        i = s.retired.front().first;
+        s.retired.pop_front();
+        d_retired.fetch_sub( 1, std::memory_order_relaxed );
+        _entry( i ).state.store( BUILDING, std::memory_order_relaxed );
+    }
+    else {
+        int64_t  n = d_count.fetch_add( 1 );
+        if (n >= MAX_SLOTS)
+            throw std::length_error( "ConcurrentHashSet: too many entries" );
+        i = Int( n );
+        size_t  c = 63 - __builtin_clzll( size_t(i) / FIRST_CHUNK + 1 );
+        if (!d_chunks[c].load( std::memory_order_acquire )) {
+            Entry*  chunk = new Entry[ size_t(FIRST_CHUNK) << c ];
+            Entry*  expected = nullptr;
+            if (!d_chunks[c].compare_exchange_strong( expected, chunk ))
+                delete[] chunk;     // another writer got there first
+        }
+    }
+    Entry&  e = _entry( i );
+    e.val = v;
+    e.next[0].store( EOL, std::memory_order_relaxed );
+    e.next[1].store( EOL, std::memory_order_relaxed );
+    e.state.store( LIVE, std::memory_order_release );
+    return i;
+}
+
+template <typename T, typename Hasher, typename Comper, int Stripes>
+bool  ConcurrentHashSet<T, Hasher, Comper, Stripes>::insert (const T& v)
+{
+    size_t   h = d_hasher( v );
+    Stripe&  s = _stripe( h );
+    {
+        Guard  guard( *this );
+        {
+            std::lock_guard<std::mutex>  lock( s.lock );
+            Table*  t = _table_for( h );
+            std::atomic<Int>&  head = t->heads[ h & t->mask ];
+            int  p = t->gen & 1;
+            for (Int i = head.load( std::memory_order_relaxed );  i != EOL;  i = _entry( i ).next[p].load( std::memory_order_relaxed )) {
+                if (d_comper( v, _entry( i ).val ))
+                    return false;
+            }
+            Int  idx = _new_entry( v, s );
+            _write_begin( s );
+            _entry( idx ).next[p].store( head.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+            head.store( idx, std::memory_order_release );
+            _write_end( s );
+            d_size.fetch_add( 1, std::memory_order_relaxed );
+        }
+        _after_write();
+    }
+    _advance();
+    return true;
+}
+
+template <typename T, typename Hasher, typename Comper, int Stripes>
+bool  ConcurrentHashSet<T, Hasher, Comper, Stripes>::remove (const T& v)
+{
+    size_t   h = d_hasher( v );
+    Stripe&  s = _stripe( h );
+    bool     removed = false;
+    {
+        Guard  guard( *this );
+        {
+            std::lock_guard<std::mutex>  lock( s.lock );
+            Table*  t = _table_for( h );
+            int  p = t->gen & 1;
+            std::atomic<Int>*  link = &t->heads[ h & t->mask ];
+            for (Int i = link->load( std::memory_order_relaxed );  i != EOL;  i = link->load( std::memory_order_relaxed )) {
+                Entry&  e = _entry( i );
+                if (d_comper( v, e.val )) {
+                    _write_begin( s );
+                    link->store( e.next[p].load( std::memory_order_relaxed ), std::memory_order_release );
+                    _write_end( s );
+                    e.state.store( REMOVED, std::memory_order_release );
+                    s.retired.emplace_back( i, d_epoch.load() );
+                    d_retired.fetch_add( 1, std::memory_order_relaxed );
+                    d_size.fetch_sub( 1, std::memory_order_relaxed );
+                    removed = true;
+                    break;
+                }
+                link = &e.next[p];
+            }
+        }
+        if (removed)
+            _after_write();
+    }
+    if (removed)
+        _advance();
+    return removed;
+}
+
+template <typename T, typename Hasher, typename Comper, int Stripes>
+void  ConcurrentHashSet<T, Hasher, Comper, Stripes>::clear ()
+{
+    std::lock_guard<std::mutex>  lock( d_resize_lock );
+    Table*  t = d_table.load();
+    while (Table* n = t->next_table.load())
+        t = n;
+    std::unique_ptr<Table>  fresh( new Table( t->mask + 1, 0 ));
+    d_table.store( fresh.get() );
+    d_tables.clear();
+    d_tables.push_back( std::move( fresh ));
+    d_retired_tables.clear();
+    for (Stripe& s : d_stripes)
+        s.retired.clear();
+    d_retired.store( 0 );
+    for (int c = 0;  c < MAX_CHUNKS;  c++)
+        delete[] d_chunks[c].exchange( nullptr );
+    d_count.store( 0 );
+    d_size.store( 0 );
+}
+
+template <typename T, typename Hasher, typename Comper, int Stripes>
+bool  ConcurrentHashSet<T, Hasher, Comper, Stripes>::contains (const T& v) const
+{
+    size_t   h = d_hasher( v );
+    Stripe&  s = _stripe( h );
+    Guard    guard( *this );
+    for (;;) {
+        uint64_t  seq = s.seq.load( std::memory_order_acquire );
+        if (seq & 1)
+            continue;
+        Int  i = _search( v, h );
+        std::atomic_thread_fence( std::memory_order_acquire );
+        if (s.seq.load( std::memory_order_relaxed ) == seq)
+            return i != EOL;
+    }
+}
+
+template <typename T, typename Hasher, typename Comper, int Stripes>
+bool  ConcurrentHashSet<T, Hasher, Comper, Stripes>::find (const T& v, T& out) const
+{
+    size_t   h = d_hasher( v );
+    Stripe&  s = _stripe( h );
+    Guard    guard( *this );
+    for (;;) {
+        uint64_t  seq = s.seq.load( std::memory_order_acquire );
+        if (seq & 1)
+            continue;
+        Int  i = _search( v, h );
+        std::atomic_thread_fence( std::memory_order_acquire );
+        if (s.seq.load( std::memory_order_relaxed ) == seq) {
+            if (i == EOL)
+                return false;
+            out = _entry( i ).val;      // not rewritten while the guard is held
+            return true;
+        }
+    }
+}
+
+// chunk by chunk: a slot may be handed out before its chunk is allocated
+template <typename T, typename Hasher, typename Comper, int Stripes>
+void  ConcurrentHashSet<T, Hasher, Comper, Stripes>::for_each (const std::function<void (const T&)>& fn) const
+{
+    Guard    guard( *this );
+    size_t   n = slot_count();
+    for (int c = 0;  c < MAX_CHUNKS;  c++) {
+        size_t  base = FIRST_CHUNK * ((size_t(1) << c) - 1);
+        if (base >= n)
+            break;
+        const Entry*  chunk = d_chunks[c].load( std::memory_order_acquire );
+        if (!chunk)
+            continue;
+        for (size_t j = 0, m = std::min( size_t(FIRST_CHUNK) << c, n - base );  j < m;  j++) {
+            if (chunk[j].state.load( std::memory_order_acquire ) == LIVE)
+                fn( chunk[j].val );
+        }
+    }
+}
+
+// move old bucket 'b' of 'from' into from->next_table, under the bucket's stripe lock
+template <typename T, typename Hasher, typename Comper, int Stripes>
+void  ConcurrentHashSet<T, Hasher, Comper, Stripes>::_migrate (Table* from, size_t b)
+{
+    Table*   to = from->next_table.load( std::memory_order_acquire );
+    Stripe&  s = d_stripes[ b & (Stripes - 1) ];
+    std::lock_guard<std::mutex>  lock( s.lock );
+    _write_begin( s );
+    int  pf = from->gen & 1,  pt = to->gen & 1;
+    for (Int i = from->heads[b].load( std::memory_order_relaxed );  i != EOL; ) {
+        Entry&  e = _entry( i );
+        Int     next = e.next[pf].load( std::memory_order_relaxed );
+        std::atomic<Int>&  head = to->heads[ d_hasher( e.val ) & to->mask ];
+        e.next[pt].store( head.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+        head.store( i, std::memory_order_release );
+        i = next;
+    }
+    from->heads[b].store( MOVED, std::memory_order_release );
+    _write_end( s );
+}
+
+// after each write, inside its guard: start a resize if the table is too deep, or help one along
+template <typename T, typename Hasher, typename Comper, int Stripes>
+void  ConcurrentHashSet<T, Hasher, Comper, Stripes>::_after_write ()
+{
+    Table*  t = d_table.load( std::memory_order_acquire );
+    if (!t->next_table.load( std::memory_order_acquire )) {
+        if (size() <= (t->mask + 1) * d_max_depth)
+            return;
+        std::lock_guard<std::mutex>  lock( d_resize_lock );
+        if (d_table.load() != t || t->next_table.load())
+            return;     // someone else started it
+        size_t  mult = 2;
+        while (mult < size_t(d_rehash_mult))
+            mult *= 2;
+        d_tables.emplace_back( new Table( (t->mask + 1) * mult, t->gen + 1 ));
+        t->next_table.store( d_tables.back().get(), std::memory_order_release );
+    }
+
+    size_t  nbuckets = t->mask + 1;
+    for (int n = 0;  n < d_migrate_batch;  n++) {
+        size_t  b = t->claim.fetch_add( 1 );
+        if (b >= nbuckets)
+            return;
+        _migrate( t, b );
+        if (t->migrated.fetch_add( 1 ) + 1 == nbuckets) {
+            // every bucket of 't' is MOVED: the new table becomes current
+            d_table.store( t->next_table.load(), std::memory_order_release );
+            _retire( t );
+            return;
+        }
+    }
+}
+
+// 't' is no longer current; free it once no operation can be reading it
+template <typename T, typename Hasher, typename Comper, int Stripes>
+void  ConcurrentHashSet<T, Hasher, Comper, Stripes>::_retire (Table* t)
+{
+    std::lock_guard<std::mutex>  lock( d_resize_lock );
+    for (auto it = d_tables.begin();  it != d_tables.end();  ++it) {
+        if (it->get() == t) {
+            d_retired_tables.emplace_back( std::move( *it ), d_epoch.load() );
+            d_tables.erase( it );
+            d_retired.fetch_add( 1, std::memory_order_relaxed );
+            return;
+        }
+    }
+}
+
+// after a write, outside its guard (an operation counted under the old
+// epoch would hold the epoch back itself).  Every 16th write of a thread,
+// if anything waits.
+template <typename T, typename Hasher, typename Comper, int Stripes>
+void  ConcurrentHashSet<T, Hasher, Comper, Stripes>::_advance ()
+{
+    thread_local unsigned  writes = 0;
+    if (d_retired.load( std::memory_order_relaxed ) == 0 || ++writes % 16 != 0)
+        return;
+    std::unique_lock<std::mutex>  lock( d_resize_lock, std::try_to_lock );
+    if (lock)
+        _reclaim();
+}
+
+// under d_resize_lock: move to the next epoch if nothing is counted under the
+// one before the current, then free the tables no operation can reach.
+// Removed slots are taken back by _new_entry.
+template <typename T, typename Hasher, typename Comper, int Stripes>
+void  ConcurrentHashSet<T, Hasher, Comper, Stripes>::_reclaim ()
+{
+    uint64_t  e = d_epoch.load();
+    for (const Readers& r : d_readers) {
+        if (r.active[ (e + 1) & 1 ].load( std::memory_order_acquire ) != 0)   // parity of e - 1
+            return;
+    }
+    d_epoch.store( ++e );
+    while (!d_retired_tables.empty() && d_retired_tables.front().second + 2 <= e) {
+        d_retired_tables.pop_front();
+        d_retired.fetch_sub( 1, std::memory_order_relaxed );
+    }
+}
+
+} // namespace Util
+
+// ================================================================
+// to benchmark:
+//   create file with:
+//          #define BENCH_CONCURRENT_HASH_SET
+//          #include "ConcurrentHashSet.h"
+//   compile with -O2 -pthread and run; prints Mops/s for 1..64 threads
+//   under 90/10 and 50/50 read/write mixes
+
+#ifdef BENCH_CONCURRENT_HASH_SET
+
+#include <cstdio>
+#include <chrono>
+#include <thread>
+
+int  main ()
+{
+    const int     nkeys = 1 << 21;
+    const size_t  ops_per_thread = 1 << 20;
+
+    for (int write_pct : { 10, 50 }) {
+        printf( "%d%% reads / %d%% writes\n", 100 - write_pct, write_pct );
+        for (int nthreads = 1;  nthreads <= 64;  nthreads *= 2) {
+            Util::ConcurrentHashSet<int>  set;
+            for (int k = 0;  k < nkeys;  k += 2)
+                set.insert( k );
+
+            auto  worker = [&] (int id) {
+                uint64_t  x = 88172645463325252ull + id;
+                for (size_t i = 0;  i < ops_per_thread;  i++) {
+                    x ^= x << 13;  x ^= x >> 7;  x ^= x << 17;
+                    int  key = int(x >> 11) & (nkeys - 1);
+                    int  dice = int(x % 100);
+                    if (dice >= write_pct)
+                        set.contains( key );
+                    else if (dice & 1)
+                        set.insert( key );
+                    else
+                        set.remove( key );
+                }
+            };
+
+            auto  t0 = std::chrono::steady_clock::now();
+            std::vector<std::thread>  threads;
+            for (int i = 0;  i < nthreads;  i++)
+                threads.emplace_back( worker, i );
+            for (auto& t : threads)
+                t.join();
+            std::chrono::duration<double>  dt = std::chrono::steady_clock::now() - t0;
+
+            printf( "  %2d threads  %8.2f Mops/s   size %zu  buckets %zu\n", nthreads,
+                    nthreads * ops_per_thread / dt.count() / 1e6, set.size(), set.bucket_count() );
+        }
+    }
+}
+
+#endif
+
+
+// ================================================================
+// to test:
+//   create file with:
+//          #define TEST_CONCURRENT_HASH_SET
+//          #include "ConcurrentHashSet.h"
+//   compile with -pthread (add -fsanitize=thread to check for races) and run.
+//   Writers churn keys of their own in and out while the table grows;
+//   readers check keys that are always there and keys that never are.
+//   How soon removed slots come back depends on the scheduler (a thread
+//   preempted mid-operation holds the epoch), so reuse is checked after:
+//   churning alone must run on the removed slots
+
+#ifdef TEST_CONCURRENT_HASH_SET
+
+#include <cstdio>
+#include <thread>
+
+int  main ()
+{
+    const int  fixed = 5000, writers = 4, readers = 4, own = 2000, rounds = 40;
+    Util::ConcurrentHashSet<int>  set( 16 );
+    for (int k = 0;  k < fixed;  k++)
+        set.insert( 2 * k );        // even keys below 2 * fixed are always there, odd ones never
+
+    std::atomic<long>  errors{ 0 }, reads{ 0 };
+    std::atomic<bool>  done{ false };
+    std::vector<std::thread>  pool;
+    for (int t = 0;  t < readers;  t++)
+        pool.emplace_back( [&, t] {
+                unsigned  seed = t + 1;
+                while (!done) {
+                    seed = seed * 1103515245 + 12345;
+                    int  k = ( seed >> 4 ) % ( 2 * fixed ),  out = -1;
+                    bool  there = !( k & 1 );
+                    if (set.contains( k ) != there || set.find( k, out ) != there || (there && out != k))
+                        errors++;
+                    reads++;
+                }
+            } );
+
+    std::vector<std::thread>  churn;
+    for (int w = 0;  w < writers;  w++)
+        churn.emplace_back( [&, w] {
+                int  first = 2 * fixed + w * own;
+                for (int r = 0;  r < rounds;  r++) {
+                    for (int k = first;  k < first + own;  k++)
+                        if (!set.insert( k ) || set.insert( k ) || !set.contains( k ))
+                            errors++;
+                    for (int k = first;  k < first + own;  k++)
+                        if (!set.remove( k ) || set.remove( k ) || set.contains( k ))
+                            errors++;
+                }
+            } );
+    for (std::thread& t : churn)
+        t.join();
+    done = true;
+    for (std::thread& t : pool)
+        t.join();
+
+    size_t  live = 0;
+    set.for_each( [&] (const int& k) { live++;  if (k >= 2 * fixed || (k & 1)) errors++; } );
+    printf( "%ld reads, %ld errors, size %zu, for_each %zu (expect %d), %zu slots for a peak of %d (%d without reuse)\n",
+            reads.load(), errors.load(), set.size(), live, fixed, set.slot_count(),
+            fixed + writers * own, fixed + writers * own * rounds );
+
+    size_t  slots = set.slot_count();
+    for (int r = 0;  r < rounds;  r++) {
+        for (int k = 2 * fixed;  k < 2 * fixed + own;  k++)
+            set.insert( k );
+        for (int k = 2 * fixed;  k < 2 * fixed + own;  k++)
+            set.remove( k );
+    }
+    printf( "alone: %zu slots after %d more rounds (expect at most %zu)\n", set.slot_count(), rounds, slots + 32 );
+    bool  ok = errors == 0 && set.size() == size_t(fixed) && live == size_t(fixed) && set.slot_count() <= slots + 32;   // the epoch may need 32 writes to move on
+    return ok ? 0 : 1;
+}
+
+#endif
+
+
+
+#pragma once
+
+#include <cstring>
+#include <vector>
+#include <span>
+#include <string_view>
+#include <algorithm>
+#include <stdexcept>
+
+#include "HashOps.h"
+
+
+namespace Util {
+
+// ================================================================
+// For serialization, store all strings in a single vector and access through indexes into the
+// vector.  Duplications detected and merged.
+//
+// 'name_vector' is the arena: the names, each followed by a '\0', in insertion order; a
+// name's Id is its offset there.  The index is an open addressing table (linear probing,
+// power of 2 size, at most 3/4 full) of { Id, 32 bits of hash }: a lookup hashes the name
+// once and strcmp's only on a hash match.  8 bytes a slot, about 12 a name, against a
+// std::set node of ~48 bytes and O(log n) strcmp's.
+//
+// Iteration is in insertion (Id) order; sorted() builds a sorted view on demand.
+
+class NameMap
+{
+public:
+    using  Id = unsigned int;
+    static const Id  NOT_FOUND = ~0;
+
+    // what iteration gives
+    class NameIdPair
+    {
+        Id           id_;
+        const char*  name_;
+
+        friend class NameMap;
+        NameIdPair (Id i, const char* n)            : id_(i), name_(n) {}
+
+    public:
+        Id  id () const                             { return id_; }
+        const char*  name () const                  { return name_; }
+
+        bool  operator< (const NameIdPair& rhs) const
+                { return (strcmp( name(), rhs.name()) < 0); }
+    };
+
+    // In normal use, pass in an empty vector which will contain the serialized string data at
+    // the conclusion of 'insert's.  Names already in the vector (a deserialized one) are
+    // indexed, with their Ids.
+    NameMap (const std::vector<char>& vec = std::vector<char>())
+                : name_vector( const_cast<std::vector<char>&>(vec))
+                {
+                    size_t  n = 0;
+                    for (size_t id = 0;  id < name_vector.size();  id += strlen( &name_vector[id] ) + 1)
+                        n++;
+                    _reserve( n );
+                    for (size_t id = 0;  id < name_vector.size();  id += strlen( &name_vector[id] ) + 1) {
+                        const char*  name = &name_vector[id];
+                        size_t  h = _hash( name, strlen( name ) );
+                        Slot*   s = _find( name, strlen( name ), h );
+                        if (s->id == NOT_FOUND) {       // a duplicate keeps the first Id
+                            *s = Slot{ Id(id), uint32_t(h) };
+                            count++;
+                        }
+                    }
+                }
+
+    Id  insert (const char* name)                   { return insert( std::string_view( name ) ); }
+
+    // a name is stored '\0' terminated, so it cannot hold one: std::invalid_argument
+    Id  insert (std::string_view name)
+                {
+                    if (name.find( '\0' ) != std::string_view::npos)
+                        throw std::invalid_argument( "NameMap: name contains a '\\0'" );
+                    return _insert( name, _hash( name.data(), name.size() ));
+                }
+
+    // insert all of 'names'; ids[i] = Id of names[i] if 'ids' is given.  Room in the
+    // vector and the index is made once, and the names are hashed in 'threads' threads
+    // (0 = one per core).
+    void  insert (std::span<const char* const> names, Id* ids = nullptr, unsigned threads = 0)
+                {
+                    std::vector<size_t>  lens( names.size() ), hashes( names.size() );
+                    size_t  bytes = 0;
+                    for (size_t i = 0;  i < names.size();  i++) {
+                        lens[i] = strlen( names[i] );
+                        bytes += lens[i] + 1;
+                    }
+                    parallel_hash( names.size(), hashes.data(),
+                                   [&] (size_t i) { return _hash( names[i], lens[i] ); }, threads );
+                    name_vector.reserve( name_vector.size() + bytes );
+                    _reserve( count + names.size() );
+                    for (size_t i = 0;  i < names.size();  i++) {
+                        Id  id = _insert( std::string_view( names[i], lens[i] ), hashes[i] );
+                        if (ids)
+                            ids[i] = id;
+                    }
+                }
+
+    Id  lookup (const char* name) const             { return lookup( std::string_view( name ) ); }
+
+    Id  lookup (std::string_view name) const
+                {
+                    if (count == 0)
+                        return NOT_FOUND;
+                    return _find( name.data(), name.size(), _hash( name.data(), name.size() ))->id;
+                }
+
+    bool  contains (const char* name) const         { return lookup( name ) != NOT_FOUND; }
+    bool  contains (std::string_view name) const    { return lookup( name ) != NOT_FOUND; }
+
+    const char*  operator[] (Id id) const           { return name_vector.data() + id; }
+
+    int  size () const    { return count; }
+
+    // ==== iterate, in Id order
+    class iterator
+    {
+        const std::vector<char>*  v;
+        Id                        id;
+    public:
+        iterator (const std::vector<char>* v_, Id i)    : v(v_), id(i) {}
+        NameIdPair  operator* () const                  { return NameIdPair( id, v->data() + id ); }
+        iterator&   operator++ ()                       { id += strlen( v->data() + id ) + 1;  return *this; }
+        bool        operator!= (const iterator& x) const { return id != x.id; }
+        bool        operator== (const iterator& x) const { return id == x.id; }
+    };
+
+    iterator  begin () const    { return iterator( &name_vector, 0 ); }
+    iterator  end () const      { return iterator( &name_vector, Id(name_vector.size()) ); }
+
+    // sorted by strcmp, built on each call: O(n log n); keep it while the map does not change
+    std::vector<NameIdPair>  sorted () const
+                {
+                    std::vector<NameIdPair>  out;
+                    out.reserve( count );
+                    for (NameIdPair x : *this)
+                        out.push_back( x );
+                    std::sort( out.begin(), out.end() );
+                    return out;
+                }
+
+    size_t  bucket_count () const   { return index.size(); }
+
+private:
+    struct Slot {
+        Id        id = NOT_FOUND;
+        uint32_t  hash = 0;
+    };
+
+    static size_t  _hash (const char* p, size_t len)    { return hash_bytes( p, len ); }
+
+    // the slot holding 'name', or the empty slot where it would go.  A stored name
+    // is read no further than its '\0', whatever 'name' holds
+    Slot*  _find (const char* name, size_t len, size_t h) const
+                {
+                    size_t  mask = index.size() - 1;
+                    for (size_t i = h & mask;  ;  i = (i + 1) & mask) {
+                        const Slot&  s = index[i];
+                        if (s.id == NOT_FOUND)
+                            return const_cast<Slot*>( &s );
+                        if (s.hash == uint32_t(h)) {
+                            const char*  stored = &name_vector[s.id];
+                            if (strnlen( stored, len + 1 ) == len && memcmp( stored, name, len ) == 0)
+                                return const_cast<Slot*>( &s );
+                        }
+                    }
+                }
+
+    Id  _insert (std::string_view name, size_t h)
+                {
+                    _reserve( count + 1 );
+                    Slot*  s = _find( name.data(), name.size(), h );
+                    if (s->id != NOT_FOUND)
+                        return s->id;
+
+                    Id  id = name_vector.size();
+                    name_vector.insert( name_vector.end(), name.begin(), name.end() );
+                    name_vector.push_back( '\0' );
+                    *s = Slot{ id, uint32_t(h) };
+                    count++;
+                    return id;
+                }
+
+    // room for 'n' names at most 3/4 full
+    void  _reserve (size_t n)
+                {
+                    size_t  size = std::max<size_t>( index.size(), 16 );
+                    while (n * 4 > size * 3)
+                        size *= 2;
+                    if (size == index.size())
+                        return;
+                    std::vector<Slot>  old( size );
+                    old.swap( index );
+                    size_t  mask = size - 1;
+                    for (const Slot& s : old) {
+                        if (s.id == NOT_FOUND)
+                            continue;
+                        // rehash from the stored 32 bits: the bucket only needs the low bits
+                        size_t  i = s.hash & mask;
+                        while (index[i].id != NOT_FOUND)
+                            i = (i + 1) & mask;
+                        index[i] = s;
+                    }
+                }
+
+    std::vector<Slot>     index;
+    size_t                count = 0;
+    std::vector<char>&    name_vector;
+};
+
+};    // namespace Util
+
+// ================================================================
+// to test:
+//   create file with:
+//          #define TEST_NAME_MAP
+//          #include "NameMap.h"
+//   compile and run
+
+#ifdef TEST_NAME_MAP
+
+#include <cstdio>
+
+
+int  main ()
+{
+    std::vector<char>  v;
+    Util::NameMap::Id  md;
+    {
+        Util::NameMap  nm(v);
+
+        const char*  atlantic_states[] = {
+            "Maine", "New Hampshire", "Massachusetts", "Rhode Island", "Connecticut", "New York",
+            "New Jersey", "Delaware", "Maryland", "Virginia", "North Carolina", "South Carolina",
+            "Georgia", "Georgia", "Florida", nullptr
+        };
+
+        for (int i = 0;  atlantic_states[i];  i++)
+            nm.insert( atlantic_states[i] );
+
+        md = nm.insert( "Maryland" );
+    
+        printf( "no. states = %d\n", nm.size() );
+        printf( "MD = %s\n", nm[md] );
+        printf( "has MA = %c\n", nm.contains("Massachusetts") ? 'T' : 'F' );
+        printf( "has CA = %c\n", nm.contains("California") ? 'T' : 'F' );
+        printf( "MA = %s\n", nm[ nm.lookup("Massachusetts") ] );
+        printf( "id CA = %d\n", nm.lookup("California") );
+
+        printf( "sorted entries\n" );
+        for (auto x : nm.sorted())
+            printf( "  %3d = %s\n", x.id(), x.name() );
+    }
+
+    printf( "MD = %s\n", &v[md] );
+
+    // reopen the serialized names: same Ids
+    Util::NameMap  again(v);
+    printf( "reopened: no. states = %d, MD = %s\n", again.size(), again[ again.lookup("Maryland") ] );
+    printf( "same MD id = %c\n", again.lookup("Maryland") == md ? 'T' : 'F' );
+
+    const char*  pacific_states[] = { "California", "Oregon", "Washington", "Alaska", "Hawaii", "Maine" };
+    Util::NameMap::Id  ids[6];
+    again.insert( pacific_states, ids );
+    printf( "bulk: no. states = %d, id ME = %d (was %d)\n", again.size(), ids[5], again.lookup("Maine") );
+
+    // a '\0' inside a name: not stored, and a lookup does not match "Maine"
+    std::string_view  nul( "Maine\0 and more", 15 );
+    bool  refused = false;
+    try { again.insert( nul ); } catch (const std::invalid_argument&) { refused = true; }
+    printf( "embedded nul refused = %c, found = %c\n", refused ? 'T' : 'F', again.contains( nul ) ? 'T' : 'F' );
+}
+
+
+#endif
+
+
+
+
+#pragma once
+
+#include "Hash.h"
+#include <unordered_set>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace AuData {
+
+// ================================================================
+
+template <typename T>
+class Dict : public DataObj {
+public:
+
+    using Id = int;
+    using StringId = int;
+
+    // HashSet entry type
+    using V = std::pair<StringId, T>;  // [ index of string in the 'names' vector, data value ]
+
+    // ================
+    // Hash and compare function class for the hash table.  Both only see stored names:
+    // lookups pass their key on the stack to find_hashed, so nothing here is written
+    // after construction and any number of threads can share it.
+    class NameIdPair {
+        const std::vector<char>*  stored_names_;
+
+    public:
+        NameIdPair ( std::shared_ptr<std::vector<char>>& names ) : stored_names_( names.get() ) {}
+
+        const char*  name ( StringId id ) const          { return stored_names_->data() + id; }
+
+        // the stored name 'id' is 'key', which need not be '\0' terminated
+        bool         equal ( StringId id, std::string_view key ) const
+                        { const char* s = stored_names_->data() + id;
+                          return strnlen( s, key.size() + 1 ) == key.size() && memcmp( s, key.data(), key.size() ) == 0; }
+
+        // Hasher
+        size_t       operator() ( const V& v ) const     { return Util::Hash<const char*>()( name( v.first ) ); }
+
+        // Comper
+        bool         operator() ( const V& a, const V& b ) const { return strcmp( name( a.first ), name( b.first ) ) == 0; }
+    };
+
+
+    // entries keep a 32 bit hash: chain hops skip strcmp on a hash mismatch and rehash
+    // does not rehash the names. 4 more bytes per entry (BENCH_CACHED_HASH)
+    using Hset = Util::HashSet<V, NameIdPair, NameIdPair, Util::ModuloIndex, uint32_t>;
+    using Iter = typename std::vector<typename Hset::Entry>::iterator;
+
+    // ================
+    // set_concurrent()'s lock.  A waiting writer holds off new readers: glibc's rwlock
+    // prefers readers, and a steady stream of them starves a writer for good.  So a thread
+    // that read-locked a Dict and reads it again would wait for a writer that waits for it:
+    // Lock keeps what its thread holds, and a call nested in another of the same Dict (repr()
+    // calls size(); a read inside a write) takes nothing.  A write nested in a read
+    // of the same Dict cannot wait its own read out: it throws std::logic_error.
+    struct RWLock {
+        std::shared_mutex  mutex;
+        std::atomic<int>   writers_waiting{ 0 };
+    };
+
+    // holds 'lock', shared or exclusive, unless it is null or this thread holds it already
+    class Lock {
+    public:
+        Lock () = default;
+        Lock ( RWLock* lock, bool exclusive );
+        Lock ( Lock&& x ) noexcept : d_lock( std::exchange( x.d_lock, nullptr ) ), d_exclusive( x.d_exclusive ) {}
+        Lock&  operator= ( Lock&& ) = delete;
+        ~Lock ();
+
+    private:
+        struct Held { RWLock* lock; bool exclusive; };
+        static std::vector<Held>&  _held ()            { thread_local std::vector<Held> held; return held; }
+
+        RWLock*  d_lock = nullptr;
+        bool     d_exclusive = false;
+    };
+
+    using ReadLock  = Lock;
+    using WriteLock = Lock;
+
+    // no-ops for a null 'lock'
+    static ReadLock   read_lock ( RWLock* lock )        { return Lock( lock, false ); }
+    static WriteLock  write_lock ( RWLock* lock )       { return Lock( lock, true ); }
+
+    // ================
+    class Reference {
+    public:
+        std::string                        _key;
+        std::shared_ptr<std::vector<char>> _names;
+        std::shared_ptr<NameIdPair>        _nip;
+        std::shared_ptr<Hset>              _d;
+        std::shared_ptr<RWLock>            _lock;    // the Dict's, if concurrent
+
+        Reference( const std::string& key_,
+                   std::shared_ptr<std::vector<char>>& names_,
+                   std::shared_ptr<NameIdPair>& nip_,
+                   std::shared_ptr<Hset>& d_,
+                   std::shared_ptr<RWLock> lock_ = nullptr )
+            : _key( key_ ),  _names( names_ ), _nip( nip_ ), _d( d_ ), _lock( lock_ ) {};
+
+        Reference& operator= ( T value );
+
+        // unlike std::map or ordered_map, do NOT insert if key is not already in the dict, throw Error instead
+        operator T () const;
+
+        // friend std::ostream&  operator<< ( std::ostream& s, const Reference& c );
+    };
+
+    // ================
+    class iterator {
+        Iter _current;
+        Dict& _d;
+        using V = std::pair<std::string, Reference>;
+    public:
+
+        iterator( Iter iter_, Dict& d_ ) : _current( iter_ ), _d( d_ ) {}
+
+        StringId       string_id () const               { return _current->first; }
+
+        V              operator*()                      { std::string name = _d.nip->name( ( *_current ).val.first ); return V( name, _d[name] ); }
+        const V        operator*() const                { std::string name = _d.nip->name( ( *_current ).val.first ); return V( name, _d[name] ); }
+        iterator&      operator++() noexcept            { _current++; return *this; }
+        iterator       operator++( int ) noexcept       { iterator temp( *this );  ++( *this ); return temp; }
         iterator       operator+( int i ) noexcept      { iterator temp( *this );  _current += i; return temp; }
         const iterator operator++( int ) const noexcept { iterator temp( *this );  ++( *const_cast<iterator*>( this ) ); return temp; }
         iterator&      operator--() noexcept            {  _current--; return *this; }
@@ -825,1394 +7207,3625 @@ public:
         iterator       operator-( int i )  noexcept     {  _current -= i; return *this; }
         const iterator operator--( int ) const noexcept { iterator temp( *this );  --( *const_cast<iterator*>( this ) ); return temp; }
 
-        // comparison
-        bool operator== ( const iterator& rhs ) const noexcept  { return _current == rhs._current; }
-        bool operator!= ( const iterator& rhs ) const noexcept  { return _current != rhs._current; }
-        bool operator<  ( const iterator& rhs ) const noexcept  { return _current < rhs._current; }
-        bool operator>  ( const iterator& rhs ) const noexcept  { return _current > rhs._current; }
-        bool operator<= ( const iterator& rhs ) const noexcept  { return _current <= rhs._current; }
-        bool operator>= ( const iterator& rhs ) const noexcept  { return _current >= rhs._current; }
+        // comparison
+        bool operator== ( const iterator& rhs ) const noexcept  { return _current == rhs._current; }
+        bool operator!= ( const iterator& rhs ) const noexcept  { return _current != rhs._current; }
+        bool operator<  ( const iterator& rhs ) const noexcept  { return _current < rhs._current; }
+        bool operator>  ( const iterator& rhs ) const noexcept  { return _current > rhs._current; }
+        bool operator<= ( const iterator& rhs ) const noexcept  { return _current <= rhs._current; }
+        bool operator>= ( const iterator& rhs ) const noexcept  { return _current >= rhs._current; }
+    };
+
+
+    //public:      // why public?
+    std::shared_ptr<std::vector<char>> names;
+    std::shared_ptr<NameIdPair>        nip;
+    std::shared_ptr<Hset>              d;
+    std::unordered_set<StringId>       deleted_ids; // Track deleted IDs
+
+    Dict ( SchemaPtr sch_,
+               std::shared_ptr<std::vector<char>>& names_,
+               std::shared_ptr<NameIdPair>& nip_,
+               std::shared_ptr<Hset>& d_ );
+
+public: // ================================================================
+
+    using value_type = T;
+
+    Dict ( SchemaPtr sch );
+    Dict ( SchemaPtr sch, const std::string& path );
+
+    // If not find key in d, insert the value
+    // If dind key in d, update the old value with provided one
+    // returns string_id
+    StringId        insert ( std::string_view key, T value );
+
+    // Lookups take a std::string_view (a std::string or a const char* converts), a
+    // pointer and a length, or a key hashed ahead by Util::prehash().  They do not
+    // allocate and do not write to the dict.
+    //
+    // Reads are const and reentrant: any number of threads may read a Dict no thread is
+    // writing.  To read while others write, call set_concurrent() before sharing the Dict:
+    // every call then holds a std::shared_mutex, shared for reads and exclusive for insert,
+    // clear and Reference::operator=; see RWLock.  lookup and operator[] return references into the
+    // table, which an insert may move; concurrent readers use lookup_copy.
+    using Key = Util::Prehashed<std::string_view>;
+
+    void            set_concurrent ( bool on = true )        { d_lock = on ? std::make_shared<RWLock>() : nullptr; }
+    bool            concurrent () const                      { return d_lock != nullptr; }
+
+    bool            contains ( const Key& key ) const                { auto lock = _read_lock(); return _find( key ) >= 0; }
+    bool            contains ( std::string_view key ) const          { return contains( Util::prehash( key ) ); }
+    bool            contains ( const char* key, size_t len ) const   { return contains( Util::prehash( { key, len } ) ); }
+
+    // return value connected with 'key' if it exists in dictionary, else return 'dflt'
+    const T&        lookup ( const Key& key, const T& dflt = T{} ) const;
+    // (no pointer and length form: lookup( p, n ) would take n for 'dflt'; pass a string_view)
+    const T&        lookup ( std::string_view key, const T& dflt = T{} ) const
+                                                             { return lookup( Util::prehash( key ), dflt ); }
+    // the same, copied while the lock is held
+    T               lookup_copy ( const Key& key, const T& dflt = T{} ) const;
+    T               lookup_copy ( std::string_view key, const T& dflt = T{} ) const
+                                                             { return lookup_copy( Util::prehash( key ), dflt ); }
+    // return id which can be efficently stored and used to lookup string with dict[str_id]; or ~0 if not found
+    IdType          string_id ( const Key& key ) const               { auto lock = _read_lock(); return _find( key ); }
+    IdType          string_id ( std::string_view key ) const         { return string_id( Util::prehash( key ) ); }
+    IdType          string_id ( const char* key, size_t len ) const  { return string_id( Util::prehash( { key, len } ) ); }
+
+    // Operator= of reference will perform the same thing as insert function
+    Reference       operator[] ( const std::string& key )    { return Reference( key, names, nip, d, d_lock ); }
+
+    const T&        operator[] ( const Key& key ) const;    // same as lookup, but throws excetion on error
+    const T&        operator[] ( std::string_view key ) const                { return ( *this )[ Util::prehash( key ) ]; }
+    const T&        operator[] ( IdType id ) const;
+    std::string     key_at ( IdType id ) const;
+
+    bool            empty () const                           { return size() == 0; }
+
+    void            clear ()                                 { auto lock = _write_lock(); std::vector<char>().swap( *names ); d->clear(); deleted_ids.clear(); }
+
+    iterator        find ( const std::string& key );
+
+    iterator        begin ()                                 { return iterator( d->get_hash_data().begin(), *this );  }
+    iterator        end ()                                   { return iterator( d->get_hash_data().end(), *this ); }
+
+    const iterator  begin () const                           { return iterator( d->get_hash_data().begin(), *this );  }
+    const iterator  end () const                             { return iterator( d->get_hash_data().end(), *this ); }
+
+    size_t          size () const override                   { auto lock = _read_lock(); return d->size(); }
+    // see "memory accounting" in HashOps.h.  Erased names stay in 'names' until compact()
+    Util::MemoryUsage  memory_usage () const;
+    size_t          size_bytes () const override             { return memory_usage().total(); }
+    Util::HashStats stats () const                           { auto s = d->stats(); s.string_bytes = names->capacity(); return s; }
+
+    DataObjPtr      slice ( size_t offset, size_t slice_size = ~0 ) override;
+    DataObjPtr      slice_copy ( size_t offset, size_t slice_size = ~0 ) override;
+
+    void            repr (std::ostream& s, int level) const override;
+    void            print ( int level = 0 ) const override;
+
+    // ================ internal ================
+    GenericValue    gvget ( const char* key ) const override;
+    GenericValue    gvget ( int id ) const override;
+    int             gvset ( const char* key, GenericValue val ) override;
+    void            serialize ( MPSys::Message& msg, DataObjPtr p ) override;
+    void            unload () override;
+    void            set_reference_ptrs ( DataObjPtr this_node );
+    DataObjPtr      reference ()        { return d_reference; }
+
+    // Erase method to remove a key-value pair
+    bool erase(const std::string& key) {
+        auto lock = _write_lock();
+        auto iter = find(key);
+        if (iter == end()) {
+            return false;
+        }
+        deleted_ids.insert(iter.string_id());
+        d->erase(iter._current);
+        return true;
+    }
+
+    // Compact the names vector by removing deleted entries
+    void compact() {
+        auto lock = _write_lock();
+        std::vector<char> new_names;
+        std::unordered_map<StringId, StringId> id_map;
+
+        StringId new_id = 0;
+        for (StringId old_id = 0; old_id < names->size(); ) {
+            if (deleted_ids.find(old_id) == deleted_ids.end()) {
+                const char* name = &(*names)[old_id];
+                id_map[old_id] = new_id;
+                new_names.insert(new_names.end(), name, name + strlen(name) + 1);
+                new_id += strlen(name) + 1;
+            }
+            old_id += strlen(&(*names)[old_id]) + 1;
+        }
+
+        *names = std::move(new_names);
+        deleted_ids.clear();
+
+        // Update the hash set with new IDs
+        for (auto& entry : *d) {
+            entry.val.first = id_map[entry.val.first];
+        }
+    }
+
+private:
+    // entry id of 'key' in 'd', or -1
+    static int      _find ( const Hset& d, const NameIdPair& nip, const Key& key )
+                        { return d.find_hashed( key.hash, [&]( const V& v ) { return nip.equal( v.first, key.key ); } ); }
+    int             _find ( const Key& key ) const           { return _find( *d, *nip, key ); }
+
+    // set 'key' to 'value', adding it to 'names' if new; its entry id
+    static int      _insert ( std::vector<char>& names, Hset& d, const NameIdPair& nip, std::string_view key, const T& value );
+
+    // no-ops unless concurrent()
+    ReadLock        _read_lock () const                      { return read_lock( d_lock.get() ); }
+    WriteLock       _write_lock ()                           { return write_lock( d_lock.get() ); }
+
+    std::string  d_path;
+    DataObjPtr   d_reference;
+    std::shared_ptr<RWLock>  d_lock;
+};
+
+
+// deleted_ids is counted as its buckets and one node per id
+template <typename T>
+Util::MemoryUsage  Dict<T>::memory_usage () const
+{
+    auto  lock = _read_lock();
+    Util::MemoryUsage  u = d->memory_usage();
+    u.strings = Util::container_bytes( *names );
+    u.slack += Util::container_slack( *names );
+    u.control = Util::shared_block_bytes<std::vector<char>>() + Util::shared_block_bytes<NameIdPair>() +
+                Util::shared_block_bytes<Hset>() + deleted_ids.bucket_count() * sizeof( void* ) +
+                deleted_ids.size() * ( sizeof( void* ) + sizeof( StringId ) );
+    if ( d_lock )
+        u.control += Util::shared_block_bytes<RWLock>();
+    return u;
+}
+
+} // namespace AuData
+
+Using a custom dictionary implementation like the one you have, which keeps all data in continuous memory, can indeed be beneficial for IPC (Inter-Process Communication) due to the following reasons:
+
+1. **Continuous Memory**: Keeping all data in a continuous memory block can simplify the process of sharing data between processes, as it avoids the need for complex serialization and deserialization steps.
+2. **Performance**: Accessing data in continuous memory can be faster due to better cache locality compared to scattered memory allocations.
+
+However, there are trade-offs to consider, especially regarding the `erase` operation and the potential need for compaction:
+
+### Pros
+
+1. **Efficient IPC**: Continuous memory layout is ideal for IPC, as it can be shared directly between processes without the need for serialization.
+2. **Cache Efficiency**: Access patterns that benefit from cache locality can see performance improvements.
+3. **Simplified Serialization**: Direct memory sharing reduces the overhead of serialization and deserialization.
+
+### Cons
+
+1. **Compaction Overhead**: The need to compact the memory after deletions can introduce significant overhead, especially if deletions are frequent. Compaction involves copying data and updating references, which can be time-consuming.
+2. **Memory Fragmentation**: Without compaction, the memory can become fragmented, leading to inefficient use of memory and potential performance degradation.
+3. **Complexity**: Implementing and maintaining a custom data structure with compaction logic can be more complex compared to using standard containers like `std::unordered_map`.
+
+### Evaluation
+
+1. **Use Case Suitability**: If your application involves frequent IPC and the data structure is shared between processes, the benefits of continuous memory might outweigh the compaction overhead. However, if deletions are frequent, the overhead of compaction could become a bottleneck.
+2. **Frequency of Operations**: Evaluate the frequency of insertions, deletions, and lookups. If deletions are rare, the compaction overhead might be negligible. Conversely, if deletions are common, the overhead could be significant.
+3. **Performance Testing**: Conduct performance testing to measure the impact of compaction on your specific workload. Compare the performance with a standard `std::unordered_map` to determine if the benefits of continuous memory outweigh the costs.
+4. **Hybrid Approach**: Consider a hybrid approach where you use `std::unordered_map` for operations that involve frequent deletions and the custom dictionary for IPC scenarios where data is mostly read-only.
+
+
+#include <cstring>
+#include <functional>
+#include <string_view>
+
+struct CStringHash {
+    size_t operator()(const char* str) const {
+        return std::hash<std::string_view>{}(std::string_view(str));
+    }
+};
+
+struct CStringEqual {
+    bool operator()(const char* lhs, const char* rhs) const {
+        return std::strcmp(lhs, rhs) == 0;
+    }
+};
+
+// for std::string keys (HashMap<std::string, Value, StringHash, StringEqual>): lookups
+// then take a std::string_view or a const char* with no temporary std::string.
+// std::hash<std::string_view> hashes as std::hash<std::string> does.
+struct StringHash {
+    size_t operator()(std::string_view str) const {
+        return std::hash<std::string_view>{}(str);
+    }
+};
+
+struct StringEqual {
+    bool operator()(std::string_view lhs, std::string_view rhs) const {
+        return lhs == rhs;
+    }
+};
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <functional>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <limits>
+#include <cstring>
+#include <span>
+#include <algorithm>
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <cerrno>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "HashOps.h"
+
+// next >= -1: live, the next entry in its chain (-1 = end).
+// next <= -2: removed; -3 - next is the next free entry (-2 = end of free list)
+template <typename T>
+struct Entry {
+    T value;
+    int next;
+};
+
+struct HashInfo {
+    int freeIndex;
+    size_t entryCount;
+    size_t maxDepth;
+    double rehashMultiplier;
+    size_t rehashStepBudget = 0; // if > 0, grow incrementally: old buckets moved per insert / remove
+};
+
+// Bucket maps a hash value to a bucket index (Util::ModuloIndex, Util::PowerOfTwoIndex, ...)
+// Counters is Util::HashCounters to count lookups for stats() (Util::NoHashCounters: none)
+template <typename T, typename Hasher = std::hash<T>, typename Comparer = std::equal_to<T>,
+          typename Bucket = Util::ModuloIndex, typename Counters = Util::NoHashCounters>
+class FlatHash {
+public:
+    FlatHash(size_t tableSize, size_t maxDepth = 5, double rehashMultiplier = 2.0)
+        : hashInfo{endOfList, 0, maxDepth, rehashMultiplier} {
+        table.assign(bucketIndex.resize(tableSize), endOfList);
+    }
+
+    // for hashers and comparers with state (e.g. StorageHasherComparer)
+    FlatHash(size_t tableSize, Hasher hasher, Comparer comparer, size_t maxDepth = 5, double rehashMultiplier = 2.0)
+        : hashInfo{endOfList, 0, maxDepth, rehashMultiplier}, hashFunction(std::move(hasher)),
+          comparer(std::move(comparer)) {
+        table.assign(bucketIndex.resize(tableSize), endOfList);
+    }
+
+    bool insert(const T& value) {
+        return insertImpl(value);
+    }
+
+    bool insert(T&& value) {
+        return insertImpl(std::move(value));
+    }
+
+    bool contains(const T& value) const {
+        return findIndex(value) != endOfList;
+    }
+
+    // entry index of 'key', or -1; stable except as reported to the remap callback.
+    // K is T, or any key type that Hasher and Comparer(T, K) accept
+    template <typename K>
+    int indexOf(const K& key) const {
+        return findIndex(key);
+    }
+
+    // the same, with the hash computed ahead by prehash() (or any function that
+    // hashes as Hasher does)
+    template <typename K>
+    int indexOf(const Util::Prehashed<K>& key) const {
+        return findIndex(key.key, key.hash);
+    }
+
+    template <typename K>
+    Util::Prehashed<K> prehash(const K& key) const {
+        return {key, hashFunction(key)};
+    }
+
+    const T& at(int index) const {
+        return entries[index].value;
+    }
+
+    // out[k] = contains(values[k]), with the cache misses of a batch overlapped;
+    // out.size() must be >= values.size()
+    void containsBatch(std::span<const T> values, std::span<bool> out) const {
+        int indexes[batchStride];
+        for (size_t base = 0; base < values.size(); base += batchStride) {
+            size_t count = std::min(batchStride, values.size() - base);
+            findIndexBatch(values.subspan(base, count), std::span<int>(indexes, count));
+            for (size_t k = 0; k < count; ++k) {
+                out[base + k] = indexes[k] != endOfList;
+            }
+        }
+    }
+
+    // K as for indexOf
+    template <typename K = T>
+    bool remove(const K& key) {
+        rehashStep();
+        int* link = bucketHead(hashFunction(key));
+        while (*link != endOfList) {
+            int index = *link;
+            if (comparer(entries[index].value, key)) {
+                *link = entries[index].next;
+                --hashInfo.entryCount;
+                killEntry(index);
+                maybeCompact();
+                return true;
+            }
+            link = &entries[index].next;
+        }
+        return false;
+    }
+
+    // ==== compaction
+    // remove() leaves a hole in 'entries' (reused by a later insert). Holes are filled
+    // by moving entries:
+    //   swap remove   remove() moves the last entry into the hole; there are never holes
+    //   online        once holes pass the threshold fraction of 'entries', each insert /
+    //                 remove also moves entries from the end into holes at the front,
+    //                 'budget' slots per call, until none is left. 0 (default) = off
+    // An entry index changes when the entry moves (or on a full rehash); the remap
+    // callback gets (from, to) for every move.
+    using RemapCallback = std::function<void(int from, int to)>;
+
+    void setRemapCallback(RemapCallback callback) {
+        remapCallback = std::move(callback);
+    }
+
+    void setSwapRemove(bool enable) {
+        swapRemove = enable;
+        if (enable) {
+            compact();
+        }
+    }
+
+    void setCompactThreshold(double threshold) {
+        compactThreshold = threshold;
+    }
+
+    void setCompactBudget(size_t budget) {
+        compactBudget = budget;
+    }
+
+    // fill every hole now
+    void compact() {
+        if (!compacting && getDeadCount() > 0) {
+            startCompaction();
+        }
+        compactStep(std::numeric_limits<size_t>::max());
+    }
+
+    size_t getDeadCount() const {
+        return entries.size() - hashInfo.entryCount;
+    }
+
+    // chain depths, holes and iteration cost
+    void printHistogram(FILE* out = nullptr) const {
+        if (!out) {
+            out = stdout;
+        }
+        std::map<size_t, size_t> histogram;
+        for (int head : table) {
+            ++histogram[chainDepth(head)];
+        }
+        for (size_t bucket = migrateNext; bucket < oldTable.size(); ++bucket) {
+            ++histogram[chainDepth(oldTable[bucket])];
+        }
+        fprintf(out, "Table Histogram:\n");
+        for (const auto& [depth, count] : histogram) {
+            fprintf(out, "   %5zu %8zu\n", depth, count);
+        }
+
+        size_t slots = entries.size(), dead = getDeadCount();
+        fprintf(out, "Entries: %zu slots, %zu live, %zu holes (%.1f%% fragmentation, %zu bytes)\n",
+                slots, hashInfo.entryCount, dead, slots ? 100.0 * dead / slots : 0.0, dead * sizeof(Entry<T>));
+
+        // iteration visits every slot, live or not
+        size_t count = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (auto it = begin(); it != end(); ++it) {
+            ++count;
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        fprintf(out, "Iteration: %.2f ns per entry, %.2f slots scanned per entry\n\n",
+                count ? ns / count : 0.0, count ? double(slots) / count : 0.0);
+    }
+
+    // shape, probes, rehashes and bytes; see "table statistics" in HashOps.h.
+    // Lookups (contains, indexOf, the batches, HashMap::get) are counted.
+    Util::HashStats stats() const {
+        Util::HashStats stats;
+        stats.size = hashInfo.entryCount;
+        stats.slots = entries.size();
+        stats.free_list = getDeadCount();
+        for (int head : table) {
+            stats.add_chain(chainDepth(head));
+        }
+        for (size_t bucket = migrateNext; bucket < oldTable.size(); ++bucket) {
+            stats.add_chain(chainDepth(oldTable[bucket]));
+        }
+        stats.finish();
+        counters.fill(stats);
+        rehashClock.fill(stats);
+        stats.table_bytes = Util::container_bytes(table) + Util::container_bytes(oldTable);
+        stats.entry_bytes = Util::container_bytes(entries);
+        return stats;
+    }
+
+    void resetCounters() {
+        counters.reset();
+    }
+
+    size_t getTableSize() const {
+        return table.size();
+    }
+
+    size_t getEntryCount() const {
+        return hashInfo.entryCount;
+    }
+
+    size_t getMaxDepth() const {
+        return hashInfo.maxDepth;
+    }
+
+    double getRehashMultiplier() const {
+        return hashInfo.rehashMultiplier;
+    }
+
+    void setRehashStepBudget(size_t budget) {
+        hashInfo.rehashStepBudget = budget;
+    }
+
+    size_t getRehashStepBudget() const {
+        return hashInfo.rehashStepBudget;
+    }
+
+    bool isRehashing() const {
+        return !oldTable.empty();
+    }
+
+    // complete an incremental rehash now
+    void finishRehash() {
+        migrateBuckets(oldTable.size());
+    }
+
+    // Replace the contents with 'values'. The table is sized once (at least one bucket
+    // per value), values are hashed in 'threads' threads (0 = one per core), grouped by
+    // bucket with a counting sort and written out in one sweep, each chain contiguous.
+    // Returns the entry count.
+    size_t bulkBuild(std::span<const T> values, Util::DupPolicy dups = Util::DupPolicy::FirstWins,
+                     unsigned threads = 0) {
+        size_t n = values.size();
+        std::vector<size_t> hashes(n), starts, order;
+        Util::parallel_hash(n, hashes.data(), [&](size_t i) { return hashFunction(values[i]); }, threads);
+
+        std::vector<int>().swap(oldTable);
+        size_t tableSize = bucketIndex.resize(std::max(table.size(), n));
+        table.assign(tableSize, endOfList);
+        Util::bucket_order(hashes.data(), n, bucketIndex, tableSize, starts, order);
+
+        entries.clear();
+        entries.reserve(n);
+        hashInfo.freeIndex = endOfList;
+        compacting = false;
+        for (size_t bucket = 0; bucket < tableSize; ++bucket) {
+            int first = entries.size();
+            for (size_t k = starts[bucket]; k < starts[bucket + 1]; ++k) {
+                const T& value = values[order[k]];
+                int dup = first;
+                while (dup < int(entries.size()) && !comparer(entries[dup].value, value)) {
+                    ++dup;
+                }
+                if (dup == int(entries.size())) {
+                    entries.push_back({value, endOfList});
+                } else if (dups == Util::DupPolicy::LastWins) {
+                    entries[dup].value = value;
+                } else if (dups == Util::DupPolicy::Error) {
+                    entries.clear();
+                    table.assign(tableSize, endOfList);
+                    hashInfo.entryCount = 0;
+                    throw std::runtime_error("Duplicate key in bulkBuild");
+                }
+            }
+            // the bucket's entries are contiguous: chain them in order
+            int end = entries.size();
+            if (first < end) {
+                table[bucket] = first;
+            }
+            for (int j = first; j < end; ++j) {
+                entries[j].next = j + 1 < end ? j + 1 : endOfList;
+            }
+        }
+        hashInfo.entryCount = entries.size();
+        return entries.size();
+    }
+
+    class Iterator {
+    public:
+        Iterator(const FlatHash& set, int index) : set(set), index(index) {}
+
+        bool operator!=(const Iterator& other) const {
+            return index != other.index;
+        }
+
+        const T& operator*() const {
+            return set.entries[index].value;
+        }
+
+        Iterator& operator++() {
+            do {
+                ++index;
+            } while (index < int(set.entries.size()) && set.entries[index].next < endOfList);
+            return *this;
+        }
+
+    private:
+        const FlatHash& set;
+        int index;
     };
 
+    Iterator begin() const {
+        int startIndex = 0;
+        while (startIndex < int(entries.size()) && entries[startIndex].next < endOfList) {
+            ++startIndex;
+        }
+        return Iterator(*this, startIndex);
+    }
+
+    Iterator end() const {
+        return Iterator(*this, entries.size());
+    }
 
-    //public:      // why public?
-    const char*                        dflt_name = nullptr; // what is this for?
-    std::shared_ptr<std::vector<char>> names;
-    std::shared_ptr<NameIdPair>        nip;
-    std::shared_ptr<Hset>              d;
+protected:
+    std::vector<int> table;
+    std::vector<Entry<T>> entries;
+    HashInfo hashInfo;
+    // incremental rehash: the previous table, while its buckets are moved into 'table'
+    std::vector<int> oldTable;
+    size_t migrateNext = 0;
+    Bucket bucketIndex;     // hash value -> index in table
+    Bucket oldBucketIndex;  // same for oldTable
+    Hasher hashFunction;
+    Comparer comparer;
+    [[no_unique_address]] Counters counters;
+    Util::RehashClock rehashClock;
 
-    Dict ( SchemaPtr sch_,
-               std::shared_ptr<std::vector<char>>& names_,
-               std::shared_ptr<NameIdPair>& nip_,
-               std::shared_ptr<Hset>& d_ );
+    static constexpr int endOfList = -1;
+    static constexpr T nullValue = T();
+    static constexpr size_t batchStride = 16;
+
+    RemapCallback remapCallback;
+    bool swapRemove = false;
+    double compactThreshold = 0;
+    size_t compactBudget = 32;
+    bool compacting = false;    // holes are not on the free list while set
+    int compactLow = 0;         // while compacting, entries below this are live
+
+    // free list link <-> 'next' of a removed entry (its own inverse)
+    static int freeLink(int index) {
+        return -3 - index;
+    }
 
-public: // ================================================================
+    int getFreeIndex() {
+        if (hashInfo.freeIndex != endOfList) {
+            int index = hashInfo.freeIndex;
+            hashInfo.freeIndex = freeLink(entries[index].next);
+            return index;
+        }
+        entries.push_back({nullValue, endOfList});
+        return entries.size() - 1;
+    }
 
-    using value_type = T;
+    // entry 'index' was unlinked from its chain
+    void killEntry(int index) {
+        entries[index].value = nullValue;
+        if (swapRemove) {
+            int last = entries.size() - 1;
+            if (index != last) {
+                moveEntry(last, index);
+            }
+            entries.pop_back();
+        } else if (compacting) {
+            entries[index].next = freeLink(endOfList); // a hole, but not on the free list:
+            compactLow = std::min(compactLow, index);  // the pass must come back for it
+        } else {
+            entries[index].next = freeLink(hashInfo.freeIndex);
+            hashInfo.freeIndex = index;
+        }
+    }
 
-    Dict ( SchemaPtr sch );
-    Dict ( SchemaPtr sch, const std::string& path );
+    // move live entry 'from' into the hole at 'to'
+    void moveEntry(int from, int to) {
+        int* link = bucketHead(hashFunction(entries[from].value));
+        while (*link != from) {
+            link = &entries[*link].next;
+        }
+        *link = to;
+        entries[to] = std::move(entries[from]);
+        if (remapCallback) {
+            remapCallback(from, to);
+        }
+    }
 
-    // If not find key in d, insert the value
-    // If dind key in d, update the old value with provided one
-    // returns string_id
-    StringId        insert ( const std::string& key, T value );
+    void startCompaction() {
+        // holes at the end are dropped, not reused: take them all off the free list
+        compacting = true;
+        hashInfo.freeIndex = endOfList;
+        compactLow = 0;
+    }
+
+    void maybeCompact() {
+        if (!compacting && compactThreshold > 0 && entries.size() >= 32 &&
+            getDeadCount() > compactThreshold * entries.size()) {
+            startCompaction();
+        }
+        if (compacting) {
+            compactStep(compactBudget);
+        }
+    }
+
+    // two fingers: compactLow moves up to the next hole, the end of 'entries' moves down
+    // to the last live entry, which is moved into the hole. Each slot looked at costs one
+    // unit of 'budget'.
+    void compactStep(size_t budget) {
+        for (; compacting && budget > 0; --budget) {
+            int last = int(entries.size()) - 1;
+            if (last >= 0 && entries[last].next < endOfList) {
+                entries.pop_back();
+            } else if (compactLow < last && entries[compactLow].next >= endOfList) {
+                ++compactLow;
+            } else if (compactLow < last) {
+                moveEntry(last, compactLow++);
+                entries.pop_back();
+            } else {
+                compacting = false; // everything up to 'last' is live
+            }
+        }
+    }
+
+    size_t chainDepth(int index) const {
+        size_t depth = 0;
+        while (index != endOfList) {
+            ++depth;
+            index = entries[index].next;
+        }
+        return depth;
+    }
+
+    // chain head for a hash value; in oldTable while that bucket has not been moved yet
+    int* bucketHead(size_t hashValue) {
+        if (!oldTable.empty()) {
+            size_t oldBucket = oldBucketIndex(hashValue);
+            if (oldBucket >= migrateNext) {
+                return &oldTable[oldBucket];
+            }
+        }
+        return &table[bucketIndex(hashValue)];
+    }
+
+    const int* bucketHead(size_t hashValue) const {
+        if (!oldTable.empty()) {
+            size_t oldBucket = oldBucketIndex(hashValue);
+            if (oldBucket >= migrateNext) {
+                return &oldTable[oldBucket];
+            }
+        }
+        return &table[bucketIndex(hashValue)];
+    }
+
+    // move up to 'budget' buckets of oldTable into table
+    void migrateBuckets(size_t budget) {
+        if (oldTable.empty()) {
+            return;
+        }
+        Util::RehashClock::Scope timer(rehashClock);
+        for (; !oldTable.empty() && budget > 0; --budget) {
+            for (int index = oldTable[migrateNext]; index != endOfList; ) {
+                int next = entries[index].next;
+                size_t hashValue = bucketIndex(hashFunction(entries[index].value));
+                entries[index].next = table[hashValue];
+                table[hashValue] = index;
+                index = next;
+            }
+            if (++migrateNext == oldTable.size()) {
+                std::vector<int>().swap(oldTable);
+            }
+        }
+    }
+
+    // index of the entry matching 'key', or endOfList. K is T, or any key type that
+    // hashFunction and comparer(T, K) accept (HashMap looks up by Key)
+    template <typename K>
+    int findIndex(const K& key) const {
+        return findIndex(key, hashFunction(key));
+    }
+
+    template <typename K>
+    int findIndex(const K& key, size_t hashValue) const {
+        size_t probes = 0;
+        for (int index = *bucketHead(hashValue); index != endOfList; index = entries[index].next) {
+            ++probes;
+            if (comparer(entries[index].value, key)) {
+                counters.hit(probes);
+                return index;
+            }
+        }
+        counters.miss(probes);
+        return endOfList;
+    }
+
+    // findIndex for each key, batchStride keys at a time: hash them all and prefetch
+    // their buckets, load the heads and prefetch the first entries, then walk the chains
+    template <typename K>
+    void findIndexBatch(std::span<const K> keys, std::span<int> out) const {
+        const int* heads[batchStride];
+        for (size_t base = 0; base < keys.size(); base += batchStride) {
+            size_t count = std::min(batchStride, keys.size() - base);
+            for (size_t k = 0; k < count; ++k) {
+                heads[k] = bucketHead(hashFunction(keys[base + k]));
+                __builtin_prefetch(heads[k]);
+            }
+            for (size_t k = 0; k < count; ++k) {
+                int index = *heads[k];
+                if (index != endOfList) {
+                    __builtin_prefetch(&entries[index]);
+                }
+                out[base + k] = index;
+            }
+            for (size_t k = 0; k < count; ++k) {
+                int index = out[base + k];
+                size_t probes = index != endOfList;
+                while (index != endOfList && !comparer(entries[index].value, keys[base + k])) {
+                    index = entries[index].next;
+                    probes += index != endOfList;
+                }
+                if (index != endOfList) {
+                    counters.hit(probes);
+                } else {
+                    counters.miss(probes);
+                }
+                out[base + k] = index;
+            }
+        }
+    }
+
+    // writes move buckets; const lookups search both tables and move none, so they stay
+    // safe to share between readers while a rehash is in progress
+    void rehashStep() {
+        if (!oldTable.empty()) {
+            migrateBuckets(hashInfo.rehashStepBudget);
+        }
+    }
+
+    void rehash() {
+        finishRehash();
+        Util::RehashClock::Scope timer(rehashClock);
+        ++rehashClock.count;
+        oldBucketIndex = bucketIndex;
+        size_t newSize = bucketIndex.resize(table.size() * hashInfo.rehashMultiplier);
+        if (hashInfo.rehashStepBudget > 0) {
+            // keep the old table; buckets move over on later calls
+            oldTable.swap(table);
+            table.assign(newSize, endOfList);
+            migrateNext = 0;
+            return;
+        }
+
+        // relink in place: entry indexes stay put, holes are left to the free list
+        // (or to compaction)
+        std::vector<int> newTable(newSize, endOfList);
+        for (int head : table) {
+            for (int index = head; index != endOfList; ) {
+                int next = entries[index].next;
+                size_t hashValue = bucketIndex(hashFunction(entries[index].value));
+                entries[index].next = newTable[hashValue];
+                newTable[hashValue] = index;
+                index = next;
+            }
+        }
+        table = std::move(newTable);
+    }
+
+private:
+    template <typename U>
+    bool insertImpl(U&& value) {
+        maybeCompact();
+        rehashStep();
+        size_t hashValue = hashFunction(value);
+        // not findIndex: an insert is not a lookup for stats()
+        for (int index = *bucketHead(hashValue); index != endOfList; index = entries[index].next) {
+            if (comparer(entries[index].value, value)) {
+                return false; // Value already exists
+            }
+        }
+        int index = getFreeIndex();
+        int* head = bucketHead(hashValue);
+        entries[index] = {std::forward<U>(value), *head};
+        *head = index;
+        ++hashInfo.entryCount;
+        // unmoved old chains are still deep; don't grow again until they are moved
+        if (oldTable.empty() && chainDepth(index) > hashInfo.maxDepth) {
+            rehash();
+        }
+        return true;
+    }
+};
+
+template <typename T, typename Hasher = std::hash<T>, typename Comparer = std::equal_to<T>,
+          typename Bucket = Util::ModuloIndex, typename Counters = Util::NoHashCounters>
+using HashSet = FlatHash<T, Hasher, Comparer, Bucket, Counters>;
+
+// ================================================================
+// mapped file format: HashMap::save / MappedHashMap, Dictionary::save / MappedDictionary
+//
+//   header | table: int32 per bucket | entries | strings (Dictionary only)
+//
+// Everything past the header is an index or a byte offset, never a pointer, so a
+// file maps read-only at any address and lookups run on the mapping itself: opening
+// checks the header and calls mmap, O(1) in the table size, and pages fault in as
+// lookups touch them. save() writes each chain's entries next to each other, so a
+// lookup reads one run of entries.
+//
+// The header has a magic, the format version, a layout tag (sizes of Key, Value and
+// the entry, byte order), a fingerprint of the Hasher, and a checksum of everything
+// after the header. A file from another version, another Key / Value, a big endian
+// host or another Hasher is refused. The checksum costs a full read of the file, so
+// opening does not check it; verify() does. Opening does check that the sections fit
+// the file; bucket and 'next' links and string offsets are checked as lookups follow
+// them, and a chain may only run forward, so a corrupt file fails a lookup with an
+// exception instead of reading outside the mapping or looping.
+// ================================================================
+
+namespace FlatHashFile {
+
+constexpr char magic[8] = {'F', 'L', 'A', 'T', 'H', 'S', 'H', '\0'};
+constexpr uint32_t version = 2;
+constexpr uint32_t byteOrderMark = 0x01020304;
+constexpr size_t sectionAlign = 64;
+
+enum Kind : uint32_t { HashMapFile = 1, DictionaryFile = 2 };
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;     // byteOrderMark as written by the host
+    uint32_t kind;
+    uint32_t entrySize;
+    uint64_t layout;        // see layoutTag
+    uint64_t probeHash;     // see probeHash()
+    uint64_t entryCount;
+    uint64_t tableSize;     // buckets
+    uint64_t tableOffset;   // from the start of the file
+    uint64_t entriesOffset;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    uint64_t fileSize;
+    uint64_t checksum;      // of table, entries and strings
+};
+
+// next: index of the next entry in the chain, -1 at the end; always past this entry
+template <typename Key, typename Value>
+struct FileEntry {
+    Key key;
+    Value value;
+    int32_t next;
+};
 
-    bool            contains ( const std::string& key ) const;
+template <typename Key, typename Value>
+constexpr uint64_t layoutTag() {
+    using E = FileEntry<Key, Value>;
+    return uint64_t(sizeof(Key)) | uint64_t(sizeof(Value)) << 16 | uint64_t(sizeof(E)) << 32 |
+           uint64_t(alignof(E)) << 48;
+}
 
-    // return value connected with 'key' if it exists in dictionary, else return 'dflt'
-    const T&        lookup ( const std::string& key, const T& dflt = T{} ) const;
-    // return id which can be efficently stored and used to lookup string with dict[str_id]; or ~0 if not found
-    IdType          string_id ( const std::string& key ) const;
+// A fingerprint of the hash function, to refuse a file written with another one.
+// Hasher( Key() ) alone is 0 for an identity hash such as std::hash<long>, so a few
+// nonzero keys go in too, each hash mixed before it is folded in.
+template <typename Key, typename Hasher>
+uint64_t probeHash(const Hasher& hasher) {
+    uint64_t fingerprint = Util::mix_hash(hasher(Key()));
+    if constexpr (std::is_constructible_v<Key, int>) {
+        for (int probe : {1, -7, 0x5bd1e995}) {
+            fingerprint = Util::mix_hash(fingerprint ^ hasher(Key(probe)));
+        }
+    } else if constexpr (std::is_constructible_v<Key, const char*>) {
+        for (const char* probe : {"a", "FlatHash probe"}) {
+            fingerprint = Util::mix_hash(fingerprint ^ hasher(Key(probe)));
+        }
+    }
+    return fingerprint;
+}
 
-    // Operator= of reference will perform the same thing as insert function
-    Reference       operator[] ( const std::string& key )    { return Reference( key, names, nip, d ); }
+inline uint64_t alignUp(uint64_t n) {
+    return (n + sectionAlign - 1) / sectionAlign * sectionAlign;
+}
 
-    const T&        operator[] ( const std::string& key ) const; // same as lookup, but throws excetion on error
-    const T&        operator[] ( IdType id ) const;
-    std::string     key_at ( IdType id ) const;
+inline uint64_t checksum(const char* table, size_t tableBytes, const char* entries, size_t entryBytes,
+                         const char* strings, size_t stringBytes) {
+    size_t sum = Util::hash_bytes(table, tableBytes);
+    Util::hash_combine(sum, Util::hash_bytes(entries, entryBytes));
+    Util::hash_combine(sum, Util::hash_bytes(strings, stringBytes));
+    return sum;
+}
 
-    bool            empty () const                           { return d->size() == 0; }
+// Write 'items' with their 'hashes' into a table of 'tableSize' buckets. The file is
+// written next to 'path' and renamed over it, so readers never see half a file.
+template <typename Key, typename Value, typename Bucket>
+void write(const std::string& path, Kind kind, uint64_t probeHash, std::span<const std::pair<Key, Value>> items,
+           const size_t* hashes, size_t tableSize, std::string_view strings = {}) {
+    static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>,
+                  "mapped files hold Key and Value as raw bytes");
+    using E = FileEntry<Key, Value>;
+    if (items.size() >= size_t(std::numeric_limits<int32_t>::max())) {
+        throw std::runtime_error("FlatHashFile: too many entries for " + path);
+    }
 
-    void            clear ()                                 { std::vector<char>().swap( *names ); d->clear(); }
+    Bucket bucket;
+    tableSize = bucket.resize(std::max<size_t>(tableSize, 1));
+    std::vector<size_t> starts, order;
+    Util::bucket_order(hashes, items.size(), bucket, tableSize, starts, order);
+    std::vector<int32_t> table(tableSize, -1);
+    std::vector<E> entries(items.size());
+    for (size_t b = 0; b < tableSize; ++b) {
+        if (starts[b] < starts[b + 1]) {
+            table[b] = starts[b];
+        }
+        for (size_t k = starts[b]; k < starts[b + 1]; ++k) {
+            entries[k].key = items[order[k]].first;
+            entries[k].value = items[order[k]].second;
+            entries[k].next = k + 1 < starts[b + 1] ? int32_t(k + 1) : -1;
+        }
+    }
 
-    iterator        find ( const std::string& key );
+    Header header{};
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.byteOrder = byteOrderMark;
+    header.kind = kind;
+    header.entrySize = sizeof(E);
+    header.layout = layoutTag<Key, Value>();
+    header.probeHash = probeHash;
+    header.entryCount = entries.size();
+    header.tableSize = tableSize;
+    header.tableOffset = alignUp(sizeof(Header));
+    header.entriesOffset = alignUp(header.tableOffset + table.size() * sizeof(int32_t));
+    header.stringsOffset = alignUp(header.entriesOffset + entries.size() * sizeof(E));
+    header.stringsSize = strings.size();
+    header.fileSize = header.stringsOffset + strings.size();
+    header.checksum = checksum((const char*)table.data(), table.size() * sizeof(int32_t),
+                               (const char*)entries.data(), entries.size() * sizeof(E),
+                               strings.data(), strings.size());
+
+    std::string tmp = path + ".tmp";
+    FILE* out = fopen(tmp.c_str(), "wb");
+    if (!out) {
+        throw std::runtime_error("FlatHashFile: cannot create " + tmp + ": " + strerror(errno));
+    }
+    static const char zeros[sectionAlign] = {};
+    uint64_t at = 0;
+    auto put = [&](uint64_t offset, const void* data, size_t bytes) {
+        bool ok = fwrite(zeros, 1, offset - at, out) == offset - at &&
+                  (bytes == 0 || fwrite(data, 1, bytes, out) == bytes);
+        at = offset + bytes;
+        return ok;
+    };
+    bool ok = put(0, &header, sizeof(header)) &&
+              put(header.tableOffset, table.data(), table.size() * sizeof(int32_t)) &&
+              put(header.entriesOffset, entries.data(), entries.size() * sizeof(E)) &&
+              put(header.stringsOffset, strings.data(), strings.size());
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        int error = errno;
+        remove(tmp.c_str());
+        throw std::runtime_error("FlatHashFile: cannot write " + path + ": " + strerror(error));
+    }
+}
 
-    iterator        begin ()                                 { return iterator( d->get_hash_data().begin(), *this );  }
-    iterator        end ()                                   { return iterator( d->get_hash_data().end(), *this ); }
+// a read-only mapping of a whole file
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("MappedFile: cannot open " + path + ": " + strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            length = st.st_size;
+            address = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        int error = errno;
+        ::close(fd);
+        if (address == MAP_FAILED || address == nullptr) {
+            address = nullptr;
+            throw std::runtime_error("MappedFile: cannot map " + path + ": " + strerror(error));
+        }
+    }
 
-    const iterator  begin () const                           { return iterator( d->get_hash_data().begin(), *this );  }
-    const iterator  end () const                             { return iterator( d->get_hash_data().end(), *this ); }
+    MappedFile(MappedFile&& other) noexcept : address(other.address), length(other.length) {
+        other.address = nullptr;
+    }
 
-    size_t          size () const override                   { return d->size(); }
-    size_t          size_bytes () const override             { return 0; }// TODO
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
 
-    DataObjPtr      slice ( size_t offset, size_t slice_size = ~0 ) override;
-    DataObjPtr      slice_copy ( size_t offset, size_t slice_size = ~0 ) override;
+    ~MappedFile() {
+        if (address) {
+            munmap(address, length);
+        }
+    }
 
-    void            repr (std::ostream& s, int level) const override;
-    void            print ( int level = 0 ) const override;
+    const char* data() const {
+        return static_cast<const char*>(address);
+    }
 
-    // ================ internal ================
-    GenericValue    gvget ( const char* key ) const override;
-    GenericValue    gvget ( int id ) const override;
-    int             gvset ( const char* key, GenericValue val ) override;
-    void            serialize ( MPSys::Message& msg, DataObjPtr p ) override;
-    void            unload () override;
-    void            set_reference_ptrs ( DataObjPtr this_node );
-    DataObjPtr      reference ()        { return d_reference; }
+    size_t size() const {
+        return length;
+    }
 
 private:
-    std::string  d_path;
-    DataObjPtr   d_reference;
+    void* address = nullptr;
+    size_t length = 0;
 };
 
+// the sections of a mapped file, after checking its header
+template <typename Key, typename Value>
+struct View {
+    const Header* header;
+    const int32_t* table;
+    const FileEntry<Key, Value>* entries;
+    const char* strings;
+
+    View(const MappedFile& file, const std::string& path, Kind kind, uint64_t probeHash) {
+        header = reinterpret_cast<const Header*>(file.data());
+        auto refuse = [&](const char* why) {
+            throw std::runtime_error("FlatHashFile: " + path + ": " + why);
+        };
+        if (file.size() < sizeof(Header) || memcmp(header->magic, magic, sizeof(magic)) != 0) {
+            refuse("not a FlatHash file");
+        }
+        if (header->version != version) {
+            refuse("unsupported version");
+        }
+        if (header->byteOrder != byteOrderMark) {
+            refuse("written with another byte order");
+        }
+        if (header->kind != kind || header->entrySize != sizeof(FileEntry<Key, Value>) ||
+            header->layout != layoutTag<Key, Value>()) {
+            refuse("written for another key / value type");
+        }
+        if (header->probeHash != probeHash) {
+            refuse("written with another hash function");
+        }
+        // each section in order inside the file, with no overflow on the way
+        auto fits = [](uint64_t offset, uint64_t count, uint64_t size, uint64_t end) {
+            return offset <= end && count <= (end - offset) / size;
+        };
+        const uint64_t maxCount = uint64_t(std::numeric_limits<int32_t>::max());
+        if (header->fileSize != file.size() || header->tableSize == 0 || header->tableSize > maxCount ||
+            header->entryCount >= maxCount || header->tableOffset < sizeof(Header) ||
+            header->tableOffset % sectionAlign != 0 || header->entriesOffset % sectionAlign != 0 ||
+            !fits(header->tableOffset, header->tableSize, sizeof(int32_t), header->entriesOffset) ||
+            !fits(header->entriesOffset, header->entryCount, sizeof(FileEntry<Key, Value>), header->stringsOffset) ||
+            !fits(header->stringsOffset, header->stringsSize, 1, header->fileSize) ||
+            header->stringsOffset + header->stringsSize != header->fileSize) {
+            refuse("truncated or inconsistent");
+        }
+        table = reinterpret_cast<const int32_t*>(file.data() + header->tableOffset);
+        entries = reinterpret_cast<const FileEntry<Key, Value>*>(file.data() + header->entriesOffset);
+        strings = file.data() + header->stringsOffset;
+    }
 
+    // the chain of bucket 'b' (< tableSize) and the entry after 'index'; -1 at the end.
+    // Checked here, not at open: a link must name an entry past the one it leaves, so
+    // a walk ends within entryCount steps
+    int32_t head(size_t b) const {
+        return checked(table[b], -1);
+    }
 
-} // namespace AuData
-
-#pragma once
+    int32_t next(int32_t index) const {
+        return checked(entries[index].next, index);
+    }
 
+    int32_t checked(int32_t index, int32_t from) const {
+        if (index != -1 && (index <= from || uint64_t(index) >= header->entryCount)) {
+            throw std::runtime_error("FlatHashFile: corrupt chain link");
+        }
+        return index;
+    }
 
-// ================================================================
-// DETAILS
-// ================================================================
+    // reads the whole file
+    bool verify() const {
+        return header->checksum == checksum((const char*)table, header->tableSize * sizeof(int32_t),
+                                            (const char*)entries, header->entryCount * sizeof(FileEntry<Key, Value>),
+                                            strings, header->stringsSize);
+    }
+};
 
-namespace AuData {
+} // namespace FlatHashFile
 
+// HashMap stores pairs in a FlatHash but hashes and compares them by key only;
+// these take a stored pair, or a bare Key or anything else Hasher / Comparer take.
+// They hold the user's Hasher / Comparer rather than derive from it, so a final
+// class or a function pointer works too
+template <typename Key, typename Value, typename Hasher>
+struct PairKeyHasher {
+    [[no_unique_address]] Hasher hasher;
 
-template <typename T>
-Dict<T>::Dict ( SchemaPtr sch_,
-                std::shared_ptr<std::vector<char>>& names_,
-                std::shared_ptr<NameIdPair>& nip_,
-                std::shared_ptr<Hset>& d_ )
-    : DataObj( sch_ ),
-      names( names_ ),
-      nip( nip_ ),
-      d( d_ )
-{}
+    size_t operator()(const std::pair<Key, Value>& entry) const {
+        return hasher(entry.first);
+    }
+    template <typename K>
+    size_t operator()(const K& key) const {
+        return hasher(key);
+    }
+};
 
+template <typename Key, typename Value, typename Comparer>
+struct PairKeyComparer {
+    [[no_unique_address]] Comparer comparer;
 
-template <typename T>
-Dict<T>::Dict ( SchemaPtr sch )
-    : DataObj( sch ),
-      names( std::make_shared<std::vector<char>>() ),
-      nip( std::make_shared<NameIdPair>( dflt_name, names ) ),
-      d( std::make_shared<Hset>( 256, V{},  *nip, *nip ) )
-{}
+    bool operator()(const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) const {
+        return comparer(a.first, b.first);
+    }
+    template <typename K>
+    bool operator()(const std::pair<Key, Value>& entry, const K& key) const {
+        return comparer(entry.first, key);
+    }
+};
 
+template <typename Key, typename Value, typename Hasher = std::hash<Key>, typename Comparer = std::equal_to<Key>,
+          typename Bucket = Util::ModuloIndex, typename Counters = Util::NoHashCounters>
+class HashMap : public FlatHash<std::pair<Key, Value>, PairKeyHasher<Key, Value, Hasher>,
+                                PairKeyComparer<Key, Value, Comparer>, Bucket, Counters> {
+public:
+    using Base = FlatHash<std::pair<Key, Value>, PairKeyHasher<Key, Value, Hasher>,
+                          PairKeyComparer<Key, Value, Comparer>, Bucket, Counters>;
+    using Base::Base;
 
-template <typename T>
-Dict<T>::Dict ( SchemaPtr sch, const std::string& path )
-    : DataObj( sch ),
-      names( std::make_shared<std::vector<char>>() ),
-      nip( std::make_shared<NameIdPair>( dflt_name, names ) ),
-      d( std::make_shared<Hset>( 256, V{},  *nip, *nip ) ),
-      d_path( path )
-{}
+    HashMap(size_t tableSize, Hasher hasher, Comparer comparer, size_t maxDepth = 5, double rehashMultiplier = 2.0)
+        : Base(tableSize, PairKeyHasher<Key, Value, Hasher>{std::move(hasher)},
+               PairKeyComparer<Key, Value, Comparer>{std::move(comparer)}, maxDepth, rehashMultiplier) {}
 
+    bool insert(const Key& key, const Value& value) {
+        return Base::insert({key, value});
+    }
 
-template <typename T>
-typename Dict<T>::Reference& Dict<T>::Reference::operator= ( T value )
-{
-    const char* local_name = _key.c_str();
-    Id s_id = _nip->local_name( local_name );
-    auto iter = _d->find( V( s_id, value ) );
-    if ( !iter.second ) {
-        int  id = _names->size();
-        _names->insert( _names->end(), local_name, local_name + strlen( local_name ) + 1 );
-        _d->insert( V( id, value ) );
+    bool insert(Key&& key, Value&& value) {
+        return Base::insert({std::move(key), std::move(value)});
     }
-    else
-        const_cast<V&>( iter.first ).second = value;
-    return *this;
-}
 
+    // Lookups take a Key, anything Hasher and Comparer take in its place (a string_view
+    // with StringHash / StringEqual, say) or a key from prehash(); none makes a Key.
+    template <typename K = Key>
+    bool contains(const K& key) const {
+        return this->indexOf(key) != this->endOfList;
+    }
 
-template <typename T>
-Dict<T>::Reference::operator T () const
-{
-    const char*  local_name = _key.c_str();
-    auto iter = _d->find( V( _nip->local_name( local_name ), T{} ) );
-    if (iter.second)
-        return iter.first.second;
-    else
-        throw Util::Error( "key \"%s\" not present in dictionary", local_name );
-}
+    template <typename K = Key>
+    Value get(const K& key) const {
+        const Value* value = find(key);
+        if (!value) {
+            throw std::runtime_error("Key not found");
+        }
+        return *value;
+    }
 
+    // nullptr if absent; valid until the next insert or remove
+    template <typename K = Key>
+    const Value* find(const K& key) const {
+        int index = this->indexOf(key);
+        return index == this->endOfList ? nullptr : &this->entries[index].value.second;
+    }
 
-// template <typename T>
-// std::ostream&  operator<< ( std::ostream& s, const typename Dict<T>::Reference& c )
-// {
-//     const char* local_name = c._key.c_str();
-//     Id s_id = c._nip->local_name( local_name );
-//     auto iter = c._d->find( V( s_id, T{} ) );
-//     if ( !iter.second ) throw Util::Error( "Dict with key: \"%s\" is not existed! Please check the key name!\n",
-//                                            local_name );
-//     else return s << iter.first.second;
-// }
+    // out[k] = contains(keys[k]) for a batch, see FlatHash::findIndexBatch
+    void containsBatch(std::span<const Key> keys, std::span<bool> out) const {
+        int indexes[Base::batchStride];
+        for (size_t base = 0; base < keys.size(); base += Base::batchStride) {
+            size_t count = std::min(Base::batchStride, keys.size() - base);
+            this->findIndexBatch(keys.subspan(base, count), std::span<int>(indexes, count));
+            for (size_t k = 0; k < count; ++k) {
+                out[base + k] = indexes[k] != this->endOfList;
+            }
+        }
+    }
 
+    // out[k] = the value for keys[k], or nullptr if absent. The pointers are
+    // valid until the next insert or remove.
+    void findBatch(std::span<const Key> keys, std::span<const Value*> out) const {
+        int indexes[Base::batchStride];
+        for (size_t base = 0; base < keys.size(); base += Base::batchStride) {
+            size_t count = std::min(Base::batchStride, keys.size() - base);
+            this->findIndexBatch(keys.subspan(base, count), std::span<int>(indexes, count));
+            for (size_t k = 0; k < count; ++k) {
+                out[base + k] = indexes[k] == this->endOfList ? nullptr : &this->entries[indexes[k]].value.second;
+            }
+        }
+    }
 
-template <typename T>
-typename Dict<T>::StringId  Dict<T>::insert ( const std::string& key, T value )
-{
-    const char* local_name = key.c_str();
-    Id s_id = nip->local_name( local_name );
-    auto  search = d->find( V( s_id, value ) );
-    if ( !search.second ) {
-        StringId  id = names->size();
-        names->insert( names->end(), local_name, local_name + strlen( local_name ) + 1 );
-        return d->insert2( V( id, value ) ).first;
+    template <typename K = Key>
+    bool remove(const K& key) {
+        return Base::remove(key);
     }
-    else {
-        const_cast<V&>( search.first ).second = value;
-        return search.first.first; // ?
+
+    // Write the live entries to 'path' in the mapped file format; open it with
+    // MappedHashMap<Key, Value, Hasher, Comparer, Bucket>. Key and Value must be
+    // trivially copyable and Hasher must hash the same in every process.
+    void save(const std::string& path) const {
+        std::vector<std::pair<Key, Value>> items;
+        std::vector<size_t> hashes;
+        items.reserve(this->getEntryCount());
+        hashes.reserve(this->getEntryCount());
+        for (const auto& entry : *this) {
+            items.push_back(entry);
+            hashes.push_back(this->hashFunction(entry.first));
+        }
+        FlatHashFile::write<Key, Value, Bucket>(path, FlatHashFile::HashMapFile,
+                                                FlatHashFile::probeHash<Key>(this->hashFunction),
+                                                items, hashes.data(), this->getTableSize());
     }
-}
 
+    class Iterator {
+    public:
+        Iterator(const HashMap& map, int index) : map(map), index(index) {}
 
-template <typename T>
-bool Dict<T>::contains ( const std::string& key ) const
-{
-    const char* local_name = key.c_str();
-    // TODO: mutex lock
-    StringId s_id = nip->local_name( local_name );
-    return d->contains( V( s_id, T{} ) );
-    // mutex unlock
-}
+        bool operator!=(const Iterator& other) const {
+            return index != other.index;
+        }
 
+        const std::pair<Key, Value>& operator*() const {
+            return map.entries[index].value;
+        }
 
-template <typename T>
-const T&  Dict<T>::lookup ( const std::string& key, const T& dflt ) const
-{
-    auto non_const_this = const_cast<Dict<T>*> ( this );
-    Id s_id = non_const_this->nip->local_name( key.c_str() );
-    auto iter = non_const_this->d->find( V( s_id, T{} ) );
-    if ( iter.second )
-        return iter.first.second;
-    else
-        return dflt;
-}
+        Iterator& operator++() {
+            do {
+                ++index;
+            } while (index < int(map.entries.size()) && map.entries[index].next < map.endOfList);
+            return *this;
+        }
 
+    private:
+        const HashMap& map;
+        int index;
+    };
 
-template <typename T>
-IdType  Dict<T>::string_id ( const std::string& key ) const
-{
-    auto non_const_this = const_cast<Dict<T>*> ( this );
-    Id s_id = non_const_this->nip->local_name( key.c_str() );
-    auto iter = non_const_this->d->find2( V( s_id, T{} ) );
-    return iter.first;
-    // if ( iter.second )
-    //     return iter.first.first;
-    // else
-    //     return ~0;
-}
+    Iterator begin() const {
+        int startIndex = 0;
+        while (startIndex < int(this->entries.size()) && this->entries[startIndex].next < this->endOfList) {
+            ++startIndex;
+        }
+        return Iterator(*this, startIndex);
+    }
 
+    Iterator end() const {
+        return Iterator(*this, this->entries.size());
+    }
+};
 
-template <typename T>
-const T&  Dict<T>::operator[] ( const std::string& key ) const
-{
-    auto non_const_this = const_cast<Dict<T>*> ( this );
-    Id s_id = non_const_this->nip->local_name( key.c_str() );
-    auto iter = non_const_this->d->find( V( s_id, T{} ) );
-    if ( iter.second )
-        return iter.first.second;
-    else
-        throw Util::Error( "dictionary key error: '%s' not found", key.c_str() );
-}
+// a key in Dictionary's storage: storage[offset, offset + length), then a '\0'.
+// Unlike a pointer or string_view into storage, it stays valid when storage grows,
+// and it is what Dictionary::save writes.
+struct StorageKey {
+    uint32_t offset;
+    uint32_t length;
+};
 
+// hashes and compares StorageKeys by their characters; lookups pass a string_view.
+// Util::hash_bytes is the same in every process, as mapped files need.
+class StorageHasherComparer {
+public:
+    StorageHasherComparer(const std::vector<char>& storage) : storage(storage) {}
 
-template <typename T>
-const T&  Dict<T>::operator[] ( IdType id ) const
-{
-    auto  search = d->at(id);
-    if (search.second)
-        return search.first;
-    else
-        throw Util::Error( "dictionary index error: '%d' not valid", id );
-}
+    size_t operator()(std::string_view key) const {
+        return Util::hash_bytes(key.data(), key.size());
+    }
 
+    size_t operator()(const StorageKey& key) const {
+        return (*this)(view(key));
+    }
 
-template <typename T>
-typename Dict<T>::iterator Dict<T>::find ( const std::string& key )
-{
-    const char* local_name = key.c_str();
-    Id s_id = nip->local_name( local_name );
-    auto iter = d->find( V( s_id, T{} ) );
-    if ( iter.second ) {
-        Id index = d->get_hash_table()[ ( *nip )( iter.first ) % d->bucket_count() ];
-        Iter pos = d->get_hash_data().begin() + index;
-        return iterator( pos, *this );
+    bool operator()(const StorageKey& a, std::string_view key) const {
+        return view(a) == key;
     }
-    else
-        return this->end();
-}
 
+    bool operator()(const StorageKey& a, const StorageKey& b) const {
+        return view(a) == view(b);
+    }
 
-template <typename T>
-GenericValue  Dict<T>::gvget ( const char* key ) const
-{
-    auto non_const_this = const_cast<Dict<T>*> ( this );
-    Id s_id = non_const_this->nip->local_name( key );
-    auto iter = non_const_this->d->find( V( s_id, T{} ) );
-    if ( iter.second )
-        return GenericValue( iter.first.second );
-    else
-        throw Util::Error( "The dictionary data with key \"%s\" is not existed!\n", key );
-}
+    std::string_view view(const StorageKey& key) const {
+        return std::string_view(storage.data() + key.offset, key.length);
+    }
 
+private:
+    const std::vector<char>& storage;
+};
 
-template <typename T>
-GenericValue  Dict<T>::gvget ( int id ) const
-{
-    auto  x = d->at(id);
-    if (x.second)
-        return GenericValue( x.first.second );
-    else throw Util::Error( "dictionary index out of bounds" );
-}
+// Keys live in one char vector, the map holds their offsets. The hasher refers to
+// 'storage', so a Dictionary is not copyable. The characters of removed keys stay
+// in storage until save().
+template <typename Value, typename Counters = Util::NoHashCounters>
+class Dictionary {
+    using Map = HashMap<StorageKey, Value, StorageHasherComparer, StorageHasherComparer, Util::ModuloIndex, Counters>;
 
+public:
+    Dictionary(size_t tableSize) : storage(), hasher(storage), hashMap(tableSize, hasher, hasher) {}
 
-template <typename T>
-std::string  Dict<T>::key_at ( IdType id ) const
-{
-    auto  x = d->at(id);
-    if (x.second)
-        return std::string( names->data() + x.first.first );
-    else throw Util::Error( "dictionary index out of bounds" );
-}
+    Dictionary(const Dictionary&) = delete;
+    Dictionary& operator=(const Dictionary&) = delete;
 
+    bool add(std::string_view key, const Value& value) {
+        if (contains(key)) {
+            return false; // Key already exists
+        }
+        if (storage.size() + key.size() >= std::numeric_limits<uint32_t>::max()) {
+            throw std::runtime_error("Dictionary storage is full");
+        }
+        StorageKey stored{uint32_t(storage.size()), uint32_t(key.size())};
+        storage.insert(storage.end(), key.begin(), key.end());
+        storage.push_back('\0'); // Null-terminate the string
+        hashMap.insert(stored, value);
+        return true;
+    }
 
-template <typename T>
-int  Dict<T>::gvset ( const char* key, GenericValue val )
-{
-    return this->insert( key, val.get<T>() );
-}
+    // Lookups take a std::string_view (a std::string or a const char* converts), a
+    // pointer and a length, or a key from Util::prehash(); they do not allocate.
+    using Key = Util::Prehashed<std::string_view>;
 
+    bool contains(const Key& key) const {
+        return find(key) != nullptr;
+    }
 
-template <typename T>
-DataObjPtr  Dict<T>::slice ( size_t offset, size_t slice_size )
-{
-    DictData<T>* zero_copy_dict_data = new DictData<T>( this->schema(), names, nip, d );
-    zero_copy_dict_data->d_parent = d_parent;
-    return DataObjPtr( zero_copy_dict_data );
-}
+    bool contains(std::string_view key) const {
+        return contains(Util::prehash(key));
+    }
+
+    bool contains(const char* key, size_t length) const {
+        return contains(Util::prehash({key, length}));
+    }
+
+    Value get(const Key& key) const {
+        const Value* value = find(key);
+        if (!value) {
+            throw std::runtime_error("Key not found");
+        }
+        return *value;
+    }
 
+    Value get(std::string_view key) const {
+        return get(Util::prehash(key));
+    }
 
-template <typename T>
-DataObjPtr Dict<T>::slice_copy ( size_t offset, size_t slice_size )
-{
-    SchemaPtr sch = SchemaPtr( this->schema()->copy() );
-    std::shared_ptr<std::vector<char>> names_ = std::make_shared<std::vector<char>>( *names );
-    std::shared_ptr<NameIdPair> nip_ = std::make_shared<NameIdPair>( this->dflt_name, names_ );
-    std::shared_ptr<Hset> d_ = std::make_shared<Hset>( *d ) ;
-    d_->set_hasher( *nip_ );
-    d_->set_comper( *nip_ );
-    Dict<T>* copy_dict_data = new Dict<T>( sch, names_, nip_, d_ );
-    return DataObjPtr( copy_dict_data );
-}
+    Value get(const char* key, size_t length) const {
+        return get(Util::prehash({key, length}));
+    }
 
+    // nullptr if absent; valid until the next add or remove
+    const Value* find(const Key& key) const {
+        return hashMap.find(key);
+    }
 
-template <typename T>
-void  Dict<T>::serialize ( MPSys::Message& msg, DataObjPtr p )
-{
-    msg.frame( MPSys::make_frame< VectorReferenceData<std::vector<char>> >( *names, Defer(p) ));
-    msg.frame( MPSys::make_frame< StaticMemoryData >( d->get_hash_info(), Defer(p) ));
-    msg.frame( MPSys::make_frame< VectorReferenceData<std::vector<int>> >( d->get_hash_table(), Defer(p) ));
-    msg.frame( MPSys::make_frame< VectorReferenceData<std::vector<typename Hset::Entry>> >( d->get_hash_data(), Defer(p)  ));
-}
+    const Value* find(std::string_view key) const {
+        return find(Util::prehash(key));
+    }
 
+    bool remove(std::string_view key) {
+        return hashMap.remove(key);
+    }
 
-template<typename T>
-void  Dict<T>::unload ()
-{
-    names = std::make_shared< std::vector<char> >();
-    nip   = std::make_shared<NameIdPair>( dflt_name, names );
-    d     = std::make_shared<Hset>( 256, V{},  *nip, *nip );
-    d_deferral->unload( *this );
-}
+    size_t size() const {
+        return hashMap.getEntryCount();
+    }
 
+    // the map's stats, plus the key storage
+    Util::HashStats stats() const {
+        Util::HashStats stats = hashMap.stats();
+        stats.string_bytes = storage.capacity();
+        return stats;
+    }
 
-template <typename T>
-void  Dict<T>::print ( int level ) const
-{
-    this->repr(std::cout, level); std::cout<<std::flush;
-}
+    // Write the live keys and values to 'path' in the mapped file format; open it with
+    // MappedDictionary<Value>. Value must be trivially copyable.
+    void save(const std::string& path) const {
+        std::vector<std::pair<StorageKey, Value>> items;
+        std::vector<size_t> hashes;
+        std::string strings;
+        items.reserve(size());
+        hashes.reserve(size());
+        for (const auto& [key, value] : hashMap) {
+            std::string_view name = hasher.view(key);
+            items.push_back({StorageKey{uint32_t(strings.size()), key.length}, value});
+            hashes.push_back(hasher(name));
+            strings.append(name);
+            strings.push_back('\0');
+        }
+        FlatHashFile::write<StorageKey, Value, Util::ModuloIndex>(path, FlatHashFile::DictionaryFile,
+                                                                  FlatHashFile::probeHash<std::string_view>(hasher), items,
+                                                                  hashes.data(), hashMap.getTableSize(), strings);
+    }
 
-template<typename T>
-void Dict<T>::repr (std::ostream& s, int level) const
-{
-    std::cout << Util::indent( level ) << schema()->name() << " Dict[" << size() << "] = [";
-    size_t  limit = DataObj::s_print_limit;
-    size_t count = 0;
-    auto non_const_this = const_cast<Dict<T>*> ( this );
-    for ( typename Hset::Iterator it( *( non_const_this->d ) );  it();  ++it ) {
-        count++;
-        if ( count == limit ) {
-            std::cout << " ...";
-            break;
+    class Iterator {
+    public:
+        Iterator(const Dictionary& dict, typename Map::Iterator it) : dict(dict), it(it) {}
+
+        bool operator!=(const Iterator& other) const {
+            return it != other.it;
         }
 
-        std::cout << " \"" << nip->name( ( *it ).first ) << "\" : " << ( *it ).second;
-        if ( count < size() ) std::cout << ",";
+        std::pair<std::string, Value> operator*() const {
+            const auto& entry = *it;
+            return {std::string(dict.hasher.view(entry.first)), entry.second};
+        }
+
+        Iterator& operator++() {
+            ++it;
+            return *this;
+        }
 
+    private:
+        const Dictionary& dict;
+        typename Map::Iterator it;
+    };
+
+    Iterator begin() const {
+        return Iterator(*this, hashMap.begin());
     }
-    std::cout << " ]\n" << std::flush;
-}
-template <typename T>
-void  Dict<T>::set_reference_ptrs ( DataObjPtr this_node )
-{
-    if ( not d_path.empty() ) {
-        assert( not d_reference );
-        d_reference = this->find_path( d_path );
+
+    Iterator end() const {
+        return Iterator(*this, hashMap.end());
     }
-}
 
+private:
+    std::vector<char> storage;
+    StorageHasherComparer hasher;
+    Map hashMap;
+};
 
-} // namespace AuData
+// A HashMap file written by HashMap::save, mapped read-only; lookups read the
+// mapping. The template arguments must be the ones the HashMap had.
+template <typename Key, typename Value, typename Hasher = std::hash<Key>, typename Comparer = std::equal_to<Key>,
+          typename Bucket = Util::ModuloIndex>
+class MappedHashMap {
+public:
+    explicit MappedHashMap(const std::string& path)
+        : file(path), view(file, path, FlatHashFile::HashMapFile, FlatHashFile::probeHash<Key>(hashFunction)) {
+        if (bucketIndex.resize(view.header->tableSize) != view.header->tableSize) {
+            throw std::runtime_error("MappedHashMap: " + path + ": table size does not fit the Bucket policy");
+        }
+    }
 
+    template <typename K = Key>
+    bool contains(const K& key) const {
+        return findIndex(key) != -1;
+    }
 
-template <typename T, typename Hasher, typename Comper>
-void HashSet<T, Hasher, Comper>::rehash(int new_hash_size) {
-    // Create new table and entries vector
-    std::vector<int> new_table(new_hash_size, EOL);
-    std::vector<Entry> new_entries;
-    new_entries.reserve(d.size); // Reserve space for non-removed entries
+    // nullptr if absent; valid while the map is
+    template <typename K = Key>
+    const Value* find(const K& key) const {
+        int index = findIndex(key);
+        return index == -1 ? nullptr : &view.entries[index].value;
+    }
 
-    // Rehash and compact entries
-    for (const auto& entry : d_entries) {
-        if (entry.next >= EOL) {
-            size_t h = d_hasher(entry.val) % new_hash_size;
-            new_entries.emplace_back(entry.val, new_table[h]);
-            new_table[h] = new_entries.size() - 1;
+    template <typename K = Key>
+    Value get(const K& key) const {
+        int index = findIndex(key);
+        if (index == -1) {
+            throw std::runtime_error("Key not found");
         }
+        return view.entries[index].value;
     }
 
-    // Swap the new table and entries with the old ones
-    d_table.swap(new_table);
-    d_entries.swap(new_entries);
-    d.hash_size = new_hash_size;
-}
-
-template <typename T, typename Hasher, typename Comper>
-bool HashSet<T, Hasher, Comper>::remove(const T& v) {
-    size_t h = d_hasher(v) % d.hash_size;
-    for (Int* i = d_table.data() + h; *i != EOL; i = &(d_entries[*i].next)) {
-        Entry& e = d_entries[*i];
-        if (d_comper(v, e.val)) {
-            e.next = -2; // Mark as deleted
-            d.size--;
-            return true;
+    // f(const Key&, const Value&) for each entry, in file order
+    template <typename F>
+    void forEach(F f) const {
+        for (size_t i = 0; i < view.header->entryCount; ++i) {
+            f(view.entries[i].key, view.entries[i].value);
         }
     }
-    return false;
-}
 
-template <typename T, typename Hasher, typename Comper>
-void HashSet<T, Hasher, Comper>::compact() {
-    std::vector<Entry> new_entries;
-    new_entries.reserve(d.size); // Reserve space for non-removed entries
+    size_t getEntryCount() const {
+        return view.header->entryCount;
+    }
 
-    for (const auto& entry : d_entries) {
-        if (entry.next >= EOL) {
-            new_entries.push_back(entry);
-        }
+    size_t getTableSize() const {
+        return view.header->tableSize;
     }
 
-    d_entries.swap(new_entries);
-}
+    // compare the checksum; reads the whole file
+    bool verify() const {
+        return view.verify();
+    }
 
-if (d.size / d.hash_size > d.max_depth || d.size < d_entries.size() / 2) {
-    this->compact();
-}
+private:
+    template <typename K>
+    int findIndex(const K& key) const {
+        int index = view.head(bucketIndex(hashFunction(key)));
+        while (index != -1 && !comparer(view.entries[index].key, key)) {
+            index = view.next(index);
+        }
+        return index;
+    }
 
+    Hasher hashFunction;
+    Comparer comparer;
+    Bucket bucketIndex;
+    FlatHashFile::MappedFile file;
+    FlatHashFile::View<Key, Value> view;
+};
 
+// A Dictionary file written by Dictionary::save, mapped read-only
+template <typename Value>
+class MappedDictionary {
+public:
+    explicit MappedDictionary(const std::string& path)
+        : file(path), view(file, path, FlatHashFile::DictionaryFile, FlatHashFile::probeHash<std::string_view>(&hash)) {
+        if (bucketIndex.resize(view.header->tableSize) != view.header->tableSize) {
+            throw std::runtime_error("MappedDictionary: " + path + ": table size does not fit the Bucket policy");
+        }
+    }
 
-#include <vector>
-#include <functional>
-#include <cassert>
+    bool contains(std::string_view key) const {
+        return findIndex(key) != -1;
+    }
 
-namespace Util {
+    // nullptr if absent; valid while the dictionary is
+    const Value* find(std::string_view key) const {
+        int index = findIndex(key);
+        return index == -1 ? nullptr : &view.entries[index].value;
+    }
 
-template <typename T, typename Hasher = std::hash<T>, typename Comper = std::equal_to<T>>
-class HashSet {
-    using Int = int;
-    static const Int EOL = -1;
+    Value get(std::string_view key) const {
+        int index = findIndex(key);
+        if (index == -1) {
+            throw std::runtime_error("Key not found");
+        }
+        return view.entries[index].value;
+    }
 
-public:
-    struct Entry {
-        T val;
-        Int next;
-        Entry(const T& v, Int n) : val(v), next(n) {}
-        Entry() = default;
-    };
+    // f(std::string_view, const Value&) for each entry, in file order
+    template <typename F>
+    void forEach(F f) const {
+        for (size_t i = 0; i < view.header->entryCount; ++i) {
+            f(name(view.entries[i].key), view.entries[i].value);
+        }
+    }
 
-    struct HashInfo {
-        Int hash_size;
-        Int size;
-        Int max_depth;
-        Int rehash_mult;
-        Int free_list;
-        T null_val;
-    };
+    size_t size() const {
+        return view.header->entryCount;
+    }
+
+    // compare the checksum; reads the whole file
+    bool verify() const {
+        return view.verify();
+    }
 
 private:
-    HashInfo d;
-    std::vector<Int> d_table;
-    std::vector<Entry> d_entries;
-    Hasher d_hasher;
-    Comper d_comper;
+    static size_t hash(std::string_view key) {
+        return Util::hash_bytes(key.data(), key.size());   // as StorageHasherComparer
+    }
 
-public:
-    HashSet(int hash_size = 256, const T& null_val = T(), Hasher hasher = Hasher(), Comper comper = Comper());
+    // checked like the chain links: the offsets come from the file
+    std::string_view name(const StorageKey& key) const {
+        if (key.offset > view.header->stringsSize || key.length > view.header->stringsSize - key.offset) {
+            throw std::runtime_error("MappedDictionary: corrupt key offset");
+        }
+        return std::string_view(view.strings + key.offset, key.length);
+    }
 
-    std::pair<const T&, bool> insert(const T& v);
-    bool remove(const T& v);
-    void rehash(int new_hash_size);
-    void clear();
-    bool empty() const { return d.size == 0; }
-    size_t size() const { return d.size; }
-    bool contains(const T& v) const;
-    std::pair<const T&, bool> find(const T& v) const;
+    int findIndex(std::string_view key) const {
+        int index = view.head(bucketIndex(hash(key)));
+        while (index != -1 && name(view.entries[index].key) != key) {
+            index = view.next(index);
+        }
+        return index;
+    }
 
-private:
-    Int _new_entry(const T& val, Int next);
-    void check_load_factor();
+    Util::ModuloIndex bucketIndex;
+    FlatHashFile::MappedFile file;
+    FlatHashFile::View<StorageKey, Value> view;
 };
 
-template <typename T, typename Hasher, typename Comper>
-HashSet<T, Hasher, Comper>::HashSet(int hash_size, const T& null_val, Hasher hasher, Comper comper)
-    : d_table(hash_size, EOL), d_hasher(hasher), d_comper(comper) {
-    d.hash_size = hash_size;
-    d.size = 0;
-    d.max_depth = 4;
-    d.rehash_mult = 4;
-    d.free_list = _free_list_link(EOL);
-    d.null_val = null_val;
-}
+// ================================================================
+// to test:
+//   create file with:
+//          #define TEST_FLAT_HASH
+//          #include "FlatHash.h"
+//   compile and run
 
-template <typename T, typename Hasher, typename Comper>
-std::pair<const T&, bool> HashSet<T, Hasher, Comper>::insert(const T& v) {
-    check_load_factor();
-    size_t h = d_hasher(v) % d.hash_size;
-    for (Int i = d_table[h]; i != EOL; i = d_entries[i].next) {
-        if (d_comper(v, d_entries[i].val))
-            return { d_entries[i].val, false };
+#ifdef TEST_FLAT_HASH
+
+int main() {
+    HashSet<const char*, CStringHash, CStringEqual> hashSet(10);
+    hashSet.insert("hello");
+    hashSet.insert("world");
+
+    for (const auto& value : hashSet) {
+        std::cout << "HashSet value: " << value << std::endl;
     }
-    Int idx = _new_entry(v, d_table[h]);
-    d_table[h] = idx;
-    return { d_entries[idx].val, true };
-}
 
-template <typename T, typename Hasher, typename Comper>
-bool HashSet<T, Hasher, Comper>::remove(const T& v) {
-    size_t h = d_hasher(v) % d.hash_size;
-    for (Int* i = &d_table[h]; *i != EOL; i = &d_entries[*i].next) {
-        Entry& e = d_entries[*i];
-        if (d_comper(v, e.val)) {
-            int idx = *i;
-            *i = e.next;
-            e.val = d.null_val;
-            e.next = d.free_list;
-            d.free_list = _free_list_link(idx);
-            d.size--;
-            return true;
-        }
+    HashMap<const char*, int, CStringHash, CStringEqual> hashMap(10);
+    hashMap.insert("hello", 1);
+    hashMap.insert("world", 2);
+
+    for (const auto& pair : hashMap) {
+        std::cout << "HashMap key: " << pair.first << ", value: " << pair.second << std::endl;
     }
-    return false;
-}
 
-template <typename T, typename Hasher, typename Comper>
-void HashSet<T, Hasher, Comper>::rehash(int new_hash_size) {
-    std::vector<Int> new_table(new_hash_size, EOL);
-    for (Int i = 0; i < d_entries.size(); ++i) {
-        if (d_entries[i].next >= EOL) {
-            size_t h = d_hasher(d_entries[i].val) % new_hash_size;
-            d_entries[i].next = new_table[h];
-            new_table[h] = i;
-        }
+    Dictionary<int> dict(10);
+    dict.add("hello", 1);
+    dict.add("world", 2);
+
+    for (const auto& pair : dict) {
+        std::cout << "Dictionary key: " << pair.first << ", value: " << pair.second << std::endl;
     }
-    d_table = std::move(new_table);
-    d.hash_size = new_hash_size;
-}
 
-template <typename T, typename Hasher, typename Comper>
-void HashSet<T, Hasher, Comper>::clear() {
-    std::fill(d_table.begin(), d_table.end(), EOL);
-    d_entries.clear();
-    d.size = 0;
-}
+    dict.remove("hello");
 
-template <typename T, typename Hasher, typename Comper>
-bool HashSet<T, Hasher, Comper>::contains(const T& v) const {
-    size_t h = d_hasher(v) % d.hash_size;
-    for (Int i = d_table[h]; i != EOL; i = d_entries[i].next) {
-        if (d_comper(v, d_entries[i].val))
-            return true;
+    if (!dict.contains("hello")) {
+        std::cout << "Key 'hello' not found in dictionary" << std::endl;
     }
-    return false;
-}
 
-template <typename T, typename Hasher, typename Comper>
-std::pair<const T&, bool> HashSet<T, Hasher, Comper>::find(const T& v) const {
-    size_t h = d_hasher(v) % d.hash_size;
-    for (Int i = d_table[h]; i != EOL; i = d_entries[i].next) {
-        if (d_comper(v, d_entries[i].val))
-            return { d_entries[i].val, true };
+    // transparent lookups
+    const char* line = "world wide";
+    Util::Prehashed<std::string_view> world = Util::prehash("world");
+    std::cout << "Dictionary lookups: " << dict.get(line, 5) << " " << dict.get(world) << " "
+              << dict.contains(std::string_view(line, 4)) << " " << (dict.find("hello") == nullptr) << std::endl;
+
+    HashMap<std::string, int, StringHash, StringEqual> names(10);
+    names.insert("alpha", 1);
+    names.insert("beta", 2);
+    std::cout << "HashMap<std::string> lookups: " << names.get("beta") << " " << names.get(std::string_view("alphabet", 5))
+              << " " << *names.find(names.prehash(std::string_view("alpha"))) << std::endl;
+
+    // mapped files
+    HashMap<long, double> numbers(10);
+    for (long i = 0; i < 1000; ++i) {
+        numbers.insert(i, i / 2.0);
+    }
+    numbers.save("/tmp/test_flat_hash.map");
+    MappedHashMap<long, double> mappedNumbers("/tmp/test_flat_hash.map");
+    std::cout << "MappedHashMap entries: " << mappedNumbers.getEntryCount() << ", 7 -> " << mappedNumbers.get(7)
+              << ", has 1000: " << mappedNumbers.contains(1000) << ", checksum ok: " << mappedNumbers.verify()
+              << std::endl;
+
+    dict.add("again", 3);
+    dict.save("/tmp/test_flat_hash.dict");
+    MappedDictionary<int> mappedDict("/tmp/test_flat_hash.dict");
+    mappedDict.forEach([](std::string_view key, int value) {
+        std::cout << "MappedDictionary key: " << key << ", value: " << value << std::endl;
+    });
+
+    try {
+        MappedDictionary<long> wrongType("/tmp/test_flat_hash.dict");
+    } catch (const std::runtime_error& error) {
+        std::cout << "refused: " << error.what() << std::endl;
     }
-    return { v, false };
-}
 
-template <typename T, typename Hasher, typename Comper>
-typename HashSet<T, Hasher, Comper>::Int HashSet<T, Hasher, Comper>::_new_entry(const T& val, Int next) {
-    d.size++;
-    if (d.free_list != _free_list_link(EOL)) {
-        Int idx = _free_list_link(d.free_list);
-        d.free_list = d_entries[idx].next;
-        d_entries[idx].val = val;
-        d_entries[idx].next = next;
-        return idx;
-    } else {
-        Int idx = d_entries.size();
-        d_entries.emplace_back(val, next);
-        return idx;
+    // a hole made behind an online pass is filled by compact(), so swap remove finds none
+    FlatHash<int> holes(16);
+    holes.setCompactThreshold(0.25);
+    holes.setCompactBudget(1);
+    for (int i = 0; i < 200; ++i) {
+        holes.insert(i);
+    }
+    for (int i = 100; i < 160; ++i) {
+        holes.remove(i);
+    }
+    holes.remove(7);
+    holes.setSwapRemove(true);
+    size_t deadAfterCompact = holes.getDeadCount();
+    for (int i = 199; i >= 8; --i) {
+        holes.remove(i);
     }
+    holes.remove(0);
+    std::cout << "swap remove after compaction: " << deadAfterCompact << " holes, " << holes.getEntryCount()
+              << " entries, has 1..6: " << (holes.contains(1) && holes.contains(6)) << std::endl;
+
+    return 0;
 }
 
-template <typename T, typename Hasher, typename Comper>
-void HashSet<T, Hasher, Comper>::check_load_factor() {
-    if (d.size > d.hash_size * d.max_depth) {
-        rehash(d.hash_size * d.rehash_mult);
+#endif
+
+// ================================================================
+// to benchmark incremental rehash:
+//   create file with:
+//          #define BENCH_INCREMENTAL_REHASH
+//          #include "HashBase.h"
+//          #include "FlatHash.h"
+//   compile with -O2 and run, optionally with an insert count (default 10M);
+//   prints insert latency percentiles for several rehash step budgets
+
+#ifdef BENCH_INCREMENTAL_REHASH
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+struct LatencyEntry {
+    int v, n = -1;
+    LatencyEntry(int x = 0) : v(x) {}
+    LatencyEntry& operator=(int x) { v = x; return *this; }
+    int& next() { return n; }
+    void next(int x) { n = x; }
+    int& val() { return v; }
+};
+
+struct LatencyOps {
+    size_t operator()(int x) const { return std::hash<int>()(x); }
+    size_t operator()(const LatencyEntry& e) const { return std::hash<int>()(e.v); }
+    bool operator()(int a, const LatencyEntry& b) const { return a == b.v; }
+};
+
+template <typename Insert>
+void reportLatency(const char* name, size_t budget, size_t count, Insert insert) {
+    std::vector<double> ns(count);
+    uint64_t x = 88172645463325252ull;
+    for (size_t i = 0; i < count; ++i) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        auto t0 = std::chrono::steady_clock::now();
+        insert(int(x));
+        ns[i] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
     }
+    double total = 0;
+    for (double t : ns) {
+        total += t;
+    }
+    std::sort(ns.begin(), ns.end());
+    printf("  %-9s budget %4zu   p50 %7.0f   p99 %7.0f   p999 %9.0f   max %11.0f ns   total %6.2f s\n",
+           name, budget, ns[count / 2], ns[count * 99 / 100], ns[count * 999 / 1000], ns.back(), total / 1e9);
 }
 
-} // namespace Util
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
 
-int main() {
-    Util::HashSet<int> hashSet;
-    hashSet.insert(1);
-    hashSet.insert(2);
-    hashSet.insert(3);
-    hashSet.remove(2);
+    for (size_t budget : {0, 1, 4, 16}) {
+        std::vector<LatencyEntry> ev;
+        std::vector<int> tv;
+        LatencyOps ops;
+        using Base = Util::HashBase<std::vector<LatencyEntry>, std::vector<int>, LatencyOps, int>;
+        Base h(ev, tv, ops, Base::Attrs().set_rehash_step_budget(budget));
+        reportLatency("HashBase", budget, count, [&](int k) { h.insert2(k); });
+    }
+    for (size_t budget : {0, 1, 4, 16}) {
+        FlatHash<int> f(101);
+        f.setRehashStepBudget(budget);
+        reportLatency("FlatHash", budget, count, [&](int k) { f.insert(k); });
+    }
     return 0;
 }
 
+#endif
 
+// ================================================================
+// to benchmark the bucket index policies:
+//   create file with:
+//          #define BENCH_BUCKET_INDEX
+//          #include "HashBase.h"
+//          #include "Hash.h"
+//          #include "FlatHash.h"
+//   compile with -O2 and run, optionally with a key count (default 1M);
+//   prints ns per lookup (half hits, half misses) for each table and policy
 
-#pragma once
-
-#include <cstring>
-#include <set>
-#include <vector>
+#ifdef BENCH_BUCKET_INDEX
 
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+struct IndexBenchEntry {
+    int v, n = -1;
+    IndexBenchEntry(int x = 0) : v(x) {}
+    IndexBenchEntry& operator=(int x) { v = x; return *this; }
+    int& next() { return n; }
+    int next() const { return n; }
+    void next(int x) { n = x; }
+    const int& val() const { return v; }
+};
 
-namespace Util {
+struct IndexBenchOps {
+    size_t operator()(int x) const { return std::hash<int>()(x); }
+    size_t operator()(const IndexBenchEntry& e) const { return std::hash<int>()(e.v); }
+    bool operator()(int a, const IndexBenchEntry& b) const { return a == b.v; }
+};
 
-// ================================================================
-// For serialization, store all strings in a single vector and access through indexes into the
-// vector.  Duplications detected and merged.
+static std::vector<int> indexBenchKeys(size_t count, uint64_t x) {
+    std::vector<int> keys(count);
+    for (int& k : keys) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        k = int(x);
+    }
+    return keys;
+}
 
-class NameMap
-{
-public:
-    using  Id = unsigned int;
+// 'contains' is called once per probe key; returns ns per call
+template <typename Contains>
+double timeLookups(const std::vector<int>& probes, Contains contains) {
+    size_t found = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int k : probes) {
+        found += contains(k);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    if (found == size_t(-1)) {
+        printf("unreachable\n");  // keep 'found' live
+    }
+    return ns / probes.size();
+}
 
-    class NameIdPair
+template <typename Bucket>
+void benchIndex(const char* name, const std::vector<int>& keys, const std::vector<int>& probes) {
+    double baseNs, setNs, flatNs;
+    size_t baseBuckets, setBuckets, flatBuckets;
+    {
+        std::vector<IndexBenchEntry> ev;
+        std::vector<int> tv;
+        IndexBenchOps ops;
+        using Base = Util::HashBase<std::vector<IndexBenchEntry>, std::vector<int>, IndexBenchOps, int, Bucket>;
+        Base h(ev, tv, ops);
+        for (int k : keys) {
+            h.insert2(k);
+        }
+        baseNs = timeLookups(probes, [&](int k) { return h.contains(k); });
+        baseBuckets = h.bucket_count();
+    }
+    {
+        Util::HashSet<int, std::hash<int>, std::equal_to<int>, Bucket> h(101);
+        for (int k : keys) {
+            h.insert(k);
+        }
+        setNs = timeLookups(probes, [&](int k) { return h.contains(k); });
+        setBuckets = h.bucket_count();
+    }
     {
-        static const Id  NotSet = ~0;
+        FlatHash<int, std::hash<int>, std::equal_to<int>, Bucket> f(101);
+        for (int k : keys) {
+            f.insert(k);
+        }
+        flatNs = timeLookups(probes, [&](int k) { return f.contains(k); });
+        flatBuckets = f.getTableSize();
+    }
+    printf("  %-16s  HashBase %6.1f ns (%9zu buckets)   HashSet %6.1f ns (%9zu)   FlatHash %6.1f ns (%9zu)\n",
+           name, baseNs, baseBuckets, setNs, setBuckets, flatNs, flatBuckets);
+}
 
-        // map entry: will hold either a string in 'name_vector' or a user supplied string
-        Id  id_;
-        union {
-            const char*         name;     // not in vec, id == NotSet
-            std::vector<char>*  vec;      // in vec, id is vec index
-        }  u;
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
 
-        friend class NameMap;
-        NameIdPair (const char* n)                  : id_(NotSet) { u.name = n; }
-        NameIdPair (std::vector<char>& v, Id i)     : id_(i)      { u.vec = &v; }
+    std::vector<int> keys = indexBenchKeys(count, 88172645463325252ull);
+    std::vector<int> probes = indexBenchKeys(count, 1181783497276652981ull);
+    for (size_t i = 0; i < count; i += 2) {
+        probes[i] = keys[(i * 7919) % count];     // hits
+    }
 
-    public:
+    printf("%zu keys, %zu lookups\n", count, probes.size());
+    benchIndex<Util::ModuloIndex>("ModuloIndex", keys, probes);
+    benchIndex<Util::PowerOfTwoIndex>("PowerOfTwoIndex", keys, probes);
+    benchIndex<Util::FastRangeIndex>("FastRangeIndex", keys, probes);
+    benchIndex<Util::MagicModIndex>("MagicModIndex", keys, probes);
+    return 0;
+}
 
-        Id  id () const                             { return id_; }
-        const char*  name () const
-                { if (id_ == NotSet) return u.name; else return &(*u.vec)[id_]; }
+#endif
 
-        bool  operator< (const NameIdPair& rhs) const
-                { return (strcmp( name(), rhs.name()) < 0); }
-    };
+// ================================================================
+// to benchmark batched lookup:
+//   create file with:
+//          #define BENCH_BATCH_LOOKUP
+//          #include "HashBase.h"
+//          #include "FlatHash.h"
+//   compile with -O2 -std=c++20 and run, optionally with a key count (default 10M,
+//   big enough to miss in cache); prints ns per key for scalar lookup and for
+//   find2_batch / containsBatch at batch sizes 8 .. 4096
 
-    // In normal use, pass in an empty vector which will contain the serialized string data at
-    // the conclusion of 'insert's
-    NameMap (const std::vector<char>& vec = std::vector<char>())
-                : name_vector( const_cast<std::vector<char>&>(vec)) {}
+#ifdef BENCH_BATCH_LOOKUP
 
-    // Id  insert (const std::string& name)   { return insert( name.c_str() ); }
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+struct BatchBenchEntry {
+    int v, n = -1;
+    BatchBenchEntry(int x = 0) : v(x) {}
+    BatchBenchEntry& operator=(int x) { v = x; return *this; }
+    int& next() { return n; }
+    int next() const { return n; }
+    void next(int x) { n = x; }
+    const int& val() const { return v; }
+};
 
-    Id  insert (const char* name)
-                {
-                    auto  iter = str_map.find( NameIdPair(name) );
-                    if (iter != str_map.end())
-                        return iter->id();
+struct BatchBenchOps {
+    size_t operator()(int x) const { return std::hash<int>()(x); }
+    size_t operator()(const BatchBenchEntry& e) const { return std::hash<int>()(e.v); }
+    bool operator()(int a, const BatchBenchEntry& b) const { return a == b.v; }
+};
 
-                    Id  id = name_vector.size();
-                    name_vector.insert( name_vector.end(), name, name + strlen(name) + 1 );
-                    str_map.insert( NameIdPair( name_vector, id ));
-                    return id;
-                }
+// 'lookup(first, n)' looks up keys [first, first + n); returns ns per key
+template <typename Lookup>
+double timeBatches(const std::vector<int>& probes, size_t batch, Lookup lookup) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < probes.size(); i += batch) {
+        lookup(i, std::min(batch, probes.size() - i));
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / probes.size();
+}
 
-    static const Id  NOT_FOUND = ~0;
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+    const size_t batches[] = {8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096};
 
-    Id  lookup (const char* name) const
-                {
-                    auto  iter = str_map.find( NameIdPair(name) );
-                    return (iter != str_map.end()) ? iter->id() : NOT_FOUND;
-                }
+    std::vector<int> keys(count), probes(count);
+    uint64_t x = 88172645463325252ull;
+    for (size_t i = 0; i < count; ++i) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        keys[i] = int(x);
+        probes[i] = int(x >> 32);                                 // mostly misses
+    }
+    for (size_t i = 0; i < count; i += 2) {
+        probes[i] = keys[(i * 7919) % count];                     // hits
+    }
 
-    bool  contains (const char* name) const
-                {  return (str_map.find( NameIdPair(name) ) != str_map.end());  }
+    std::vector<BatchBenchEntry> ev;
+    std::vector<int> tv;
+    BatchBenchOps ops;
+    using Base = Util::HashBase<std::vector<BatchBenchEntry>, std::vector<int>, BatchBenchOps, int>;
+    Base h(ev, tv, ops);
+    FlatHash<int> f(101);
+    HashMap<int, int> m(101);
+    for (int k : keys) {
+        h.insert2(k);
+        f.insert(k);
+        m.insert(k, k);
+    }
 
-    const char*  operator[] (Id id)  { return name_vector.data() + id; }
+    std::vector<int> ids(count);
+    std::vector<const int*> vals(count);
+    std::unique_ptr<bool[]> hits(new bool[count]);
+    std::span<const int> all(probes);
+
+    printf("%zu keys, ns per lookup\n", count);
+    printf("  %-6s %10s %10s %10s\n", "batch", "HashBase", "FlatHash", "HashMap");
+    double hs = timeBatches(probes, 1, [&](size_t i, size_t) { ids[i] = h.find2(probes[i]); });
+    double fs = timeBatches(probes, 1, [&](size_t i, size_t) { hits[i] = f.contains(probes[i]); });
+    double ms = timeBatches(probes, 1, [&](size_t i, size_t) { hits[i] = m.contains(probes[i]); });
+    printf("  %-6s %10.1f %10.1f %10.1f\n", "scalar", hs, fs, ms);
+    for (size_t batch : batches) {
+        double hb = timeBatches(probes, batch, [&](size_t i, size_t n) {
+            h.find2_batch(all.subspan(i, n), std::span<int>(ids).subspan(i, n));
+        });
+        double fb = timeBatches(probes, batch, [&](size_t i, size_t n) {
+            f.containsBatch(all.subspan(i, n), std::span<bool>(hits.get() + i, n));
+        });
+        double mb = timeBatches(probes, batch, [&](size_t i, size_t n) {
+            m.findBatch(all.subspan(i, n), std::span<const int*>(vals).subspan(i, n));
+        });
+        printf("  %-6zu %10.1f %10.1f %10.1f\n", batch, hb, fb, mb);
+    }
+    return 0;
+}
 
-    int  size () const    { return str_map.size(); }
+#endif
 
-    // iterator type is NameIdPair
-    using iterator = std::set<NameIdPair>::iterator;
+// ================================================================
+// to benchmark the string hash kernels:
+//   create file with:
+//          #define BENCH_STRING_HASH
+//          #include "HashOps.h"
+//   compile with -O2 and run; prints ns per key for key lengths 4 .. 4096,
+//   for the old byte-at-a-time hash_combine loop and each stripe kernel
 
-    iterator  begin ()    { return str_map.begin(); }
-    iterator  end ()      { return str_map.end(); }
+#ifdef BENCH_STRING_HASH
 
-private:
-    std::set<NameIdPair>  str_map;
-    std::vector<char>&    name_vector;
-};
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
 
-};    // namespace Util
+// what Hash<const char*> / BinStringNoCase did before hash_bytes
+template <bool NoCase>
+size_t hashPerByte(const char* s) {
+    size_t seed = 0;
+    for (; *s; s++) {
+        Util::hash_combine(seed, NoCase ? char(tolower(*s)) : *s);
+    }
+    return seed;
+}
+
+// 'hash(key)' over keys.size() keys, repeated to ~64MB of input; returns ns per key
+template <typename Hash>
+double timeHash(const std::vector<std::string>& keys, Hash hash) {
+    size_t len = keys[0].size();
+    size_t reps = std::max<size_t>(1, (64 << 20) / (len * keys.size()));
+    size_t sink = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; ++r) {
+        for (const std::string& k : keys) {
+            sink += hash(k);
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    if (sink == 42) {
+        printf(" ");    // keep 'sink' live
+    }
+    return ns / (reps * keys.size());
+}
+
+template <bool NoCase>
+void benchKernels(const char* title) {
+    using namespace Util::hash_detail;
+    printf("%s, ns per key\n", title);
+    printf("  %6s %10s %10s %10s %10s %10s\n", "bytes", "per-byte", "scalar", "sse2", "avx2", "GB/s best");
+    for (size_t len : {4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096}) {
+        std::vector<std::string> keys(256);
+        uint64_t x = 88172645463325252ull;
+        for (std::string& k : keys) {
+            for (size_t i = 0; i < len; ++i) {
+                x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+                k += char('A' + x % 58);    // letters and a few punctuation, no '\0'
+            }
+        }
+        double old = timeHash(keys, [](const std::string& k) { return hashPerByte<NoCase>(k.c_str()); });
+        double sc = timeHash(keys, [](const std::string& k) {
+            return hash_bytes_with<NoCase>(stripes_scalar<NoCase>, k.data(), k.size()); });
+        double s2 = sc, av = sc;
+#if defined(__x86_64__) || defined(__i386__)
+        s2 = timeHash(keys, [](const std::string& k) {
+            return hash_bytes_with<NoCase>(stripes_sse2<NoCase>, k.data(), k.size()); });
+        if (__builtin_cpu_supports("avx2")) {
+            av = timeHash(keys, [](const std::string& k) {
+                return hash_bytes_with<NoCase>(stripes_avx2<NoCase>, k.data(), k.size()); });
+        }
+#endif
+        printf("  %6zu %10.1f %10.1f %10.1f %10.1f %10.2f\n", len, old, sc, s2, av, len / std::min({sc, s2, av}));
+    }
+}
+
+int main() {
+    benchKernels<false>("hash_bytes");
+    benchKernels<true>("hash_bytes_nocase");
+    return 0;
+}
+
+#endif
 
 // ================================================================
-// to test:
+// to benchmark cached hash values on a Dict shaped table:
 //   create file with:
-//          #define TEST_NAME_MAP
-//          #include "NameMap.h"
-//   compile and run
+//          #define BENCH_CACHED_HASH
+//          #include "HashBase.h"
+//          #include "Hash.h"
+//   compile with -O2 -std=c++20 and run, optionally with a key count (default 10M).
+//   Entries are (string id, value) pairs whose names live in one char vector
+//   and are hashed / compared through it, the way Dict::NameIdPair does.
 
-#ifdef TEST_NAME_MAP
+#ifdef BENCH_CACHED_HASH
 
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
 
+using DictBenchV = std::pair<int, int>;     // [ offset of name in 'names', value ]
 
-int  main ()
-{
-    std::vector<char>  v;
-    Util::NameMap::Id  md;
-    {
-        Util::NameMap  nm(v);
+// hasher and comper for DictBenchV; id -1 is the name being looked up (Dict's local_name)
+struct DictBenchNames {
+    const std::vector<char>* names = nullptr;
+    const char** probe = nullptr;
 
-        const char*  atlantic_states[] = {
-            "Maine", "New Hampshire", "Massachusetts", "Rhode Island", "Connecticut", "New York",
-            "New Jersey", "Delaware", "Maryland", "Virginia", "North Carolina", "South Carolina",
-            "Georgia", "Georgia", "Florida", nullptr
-        };
+    const char* name(int id) const { return id < 0 ? *probe : names->data() + id; }
+    size_t operator()(const DictBenchV& v) const { return Util::Hash<const char*>()(name(v.first)); }
+    bool operator()(const DictBenchV& a, const DictBenchV& b) const { return strcmp(name(a.first), name(b.first)) == 0; }
+};
 
-        for (int i = 0;  atlantic_states[i];  i++)
-            nm.insert( atlantic_states[i] );
+static double benchSeconds(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
 
-        md = nm.insert( "Maryland" );
-    
-        printf( "no. states = %d\n", nm.size() );
-        printf( "MD = %s\n", nm[md] );
-        printf( "has MA = %c\n", nm.contains("Massachusetts") ? 'T' : 'F' );
-        printf( "has CA = %c\n", nm.contains("California") ? 'T' : 'F' );
-        printf( "MA = %s\n", nm[ nm.lookup("Massachusetts") ] );
-        printf( "id CA = %d\n", nm.lookup("California") );
+template <typename CachedHash>
+void benchDictTable(const char* title, const std::vector<char>& names, const std::vector<int>& ids,
+                    const std::vector<std::string>& misses) {
+    const char* probe = nullptr;
+    DictBenchNames ops{&names, &probe};
+    using Set = Util::HashSet<DictBenchV, DictBenchNames, DictBenchNames, Util::ModuloIndex, CachedHash>;
+    Set set(101, DictBenchV(), ops, ops);
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ids.size(); ++i) {
+        set.insert(DictBenchV(ids[i], int(i)));
+    }
+    double insertS = benchSeconds(t0);
 
-        printf( "sorted entries\n" );
-        for (auto x : nm)
-            printf( "  %3d = %s\n", x.id(), x.name() );
+    size_t found = 0;
+    t0 = std::chrono::steady_clock::now();
+    for (int id : ids) {
+        probe = names.data() + id;
+        found += set.contains(DictBenchV(-1, 0));
     }
+    double hitNs = benchSeconds(t0) * 1e9 / ids.size();
 
-    printf( "MD = %s\n", &v[md] );
+    t0 = std::chrono::steady_clock::now();
+    for (const std::string& m : misses) {
+        probe = m.c_str();
+        found += set.contains(DictBenchV(-1, 0));
+    }
+    double missNs = benchSeconds(t0) * 1e9 / misses.size();
+
+    t0 = std::chrono::steady_clock::now();
+    set.rehash(set.bucket_count() * 2);
+    double rehashS = benchSeconds(t0);
+
+    size_t entryBytes = sizeof(typename Set::Entry);
+    printf("  %-10s %6zu B/entry %8.0f MB   insert %6.2f s   hit %6.1f ns   miss %6.1f ns   rehash %5.2f s  (%zu)\n",
+           title, entryBytes, (entryBytes * ids.size() + 4.0 * set.bucket_count()) / 1e6,
+           insertS, hitNs, missNs, rehashS, found);
 }
 
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+
+    // Dict keys tend to share long prefixes, which is where strcmp costs most
+    std::vector<char> names;
+    std::vector<int> ids(count);
+    std::vector<std::string> misses(count);
+    char buf[64];
+    for (size_t i = 0; i < count; ++i) {
+        ids[i] = names.size();
+        snprintf(buf, sizeof(buf), "experiment/run_%04zu/channel/%08zu", i % 1000, i);
+        names.insert(names.end(), buf, buf + strlen(buf) + 1);
+        snprintf(buf, sizeof(buf), "experiment/run_%04zu/channel/%08zu", i % 1000, i + count);
+        misses[i] = buf;
+    }
+
+    printf("%zu string keys, Util::HashSet< pair<StringId, int> > as in Dict<int>\n", count);
+    benchDictTable<void>("no cache", names, ids, misses);
+    benchDictTable<uint32_t>("uint32_t", names, ids, misses);
+    benchDictTable<uint64_t>("uint64_t", names, ids, misses);
+    return 0;
+}
 
 #endif
 
+// ================================================================
+// to benchmark bulk build against repeated insert:
+//   create file with:
+//          #define BENCH_BULK_BUILD
+//          #include "HashBase.h"
+//          #include "FlatHash.h"
+//   compile with -O2 -std=c++20 -pthread and run, optionally with an entry
+//   count (default 20M); prints the time to load a table from a snapshot
 
+#ifdef BENCH_BULK_BUILD
 
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 
-#pragma once
+using BulkEntry = Util::HashedEntry<const char*, uint32_t>;
 
-#include "Hash.h"
-#include <unordered_set>
+struct BulkOps {
+    size_t operator()(const char* s) const { return Util::Hash<const char*>()(s); }
+    bool operator()(const char* a, const BulkEntry& b) const { return strcmp(a, b.val()) == 0; }
+};
 
-namespace AuData {
+template <typename Build>
+void timeBuild(const char* name, Build build) {
+    auto t0 = std::chrono::steady_clock::now();
+    size_t n = build();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    printf("  %-34s %7.2f s   (%zu entries)\n", name, s, n);
+}
 
-// ================================================================
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 20000000;
+
+    // the snapshot: names in one buffer, plus (key, value) pairs
+    std::vector<char> pool;
+    std::vector<size_t> offsets(count);
+    char buf[64];
+    for (size_t i = 0; i < count; ++i) {
+        offsets[i] = pool.size();
+        snprintf(buf, sizeof(buf), "snapshot/table_%03zu/row_%010zu", i % 997, i * 2654435761u % (count * 4));
+        pool.insert(pool.end(), buf, buf + strlen(buf) + 1);
+    }
+    std::vector<const char*> names(count);
+    std::vector<std::pair<long, int>> pairs(count);
+    for (size_t i = 0; i < count; ++i) {
+        names[i] = pool.data() + offsets[i];
+        pairs[i] = {long(i * 2654435761u % (count * 4)), int(i)};
+    }
+    printf("%zu entries, %u cores\n", count, std::thread::hardware_concurrency());
+
+    using Base = Util::HashBase<std::vector<BulkEntry>, std::vector<int>, BulkOps, const char*>;
+    BulkOps ops;
+    timeBuild("HashBase string insert2", [&] {
+        std::vector<BulkEntry> ev;
+        std::vector<int> tv;
+        Base h(ev, tv, ops);
+        for (const char* s : names) {
+            h.insert2(s);
+        }
+        return h.size();
+    });
+    for (unsigned threads : {1u, 0u}) {
+        timeBuild(threads ? "HashBase string bulk_build, 1 thr" : "HashBase string bulk_build, all", [&] {
+            std::vector<BulkEntry> ev;
+            std::vector<int> tv;
+            Base h(ev, tv, ops);
+            return h.bulk_build(names, Util::DupPolicy::FirstWins, threads);
+        });
+    }
 
-template <typename T>
-class Dict : public DataObj {
-public:
+    timeBuild("HashMap<long,int> insert", [&] {
+        HashMap<long, int> m(101);
+        for (const auto& p : pairs) {
+            m.insert(p.first, p.second);
+        }
+        return m.getEntryCount();
+    });
+    for (unsigned threads : {1u, 0u}) {
+        timeBuild(threads ? "HashMap<long,int> bulkBuild, 1 thr" : "HashMap<long,int> bulkBuild, all", [&] {
+            HashMap<long, int> m(101);
+            return m.bulkBuild(pairs, Util::DupPolicy::LastWins, threads);
+        });
+    }
+    return 0;
+}
 
-    using Id = int;
-    using StringId = int;
+#endif
 
-    // HashSet entry type
-    using V = std::pair<StringId, T>;  // [ index of string in the 'names' vector, data value ]
+// ================================================================
+// to benchmark compaction under churn:
+//   create file with:
+//          #define BENCH_COMPACTION
+//          #include "Hash.h"
+//          #include "FlatHash.h"
+//   compile with -O2 -std=c++20 and run, optionally with a live set size
+//   (default 1M); the table fills, shrinks to a tenth, then churns at that size.
+//   Prints slots and holes after the churn, iteration cost, and remove latency
 
-    // ================
-    // Hash and compare function class for the hash table
-    class NameIdPair {
-        static const Id   NotSet = ~0; // use local rather than stored
-        // Reason to use reference here: to make hasher and comper have the same things with nip;
-        const char*&              local_name_;
-        const std::vector<char>*  stored_names_;
+#ifdef BENCH_COMPACTION
 
-    public:
-        NameIdPair ( const char*& local_name, std::shared_ptr<std::vector<char>>& names )
-                                                         : local_name_( local_name ),
-                                                           stored_names_( names.get() ) {}
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
 
-        Id           local_name( const char* name )      { local_name_ = name; return NotSet; }
-        const char*  name ( StringId id ) const          { return id == NotSet ? local_name_ : stored_names_->data() + id; }
+using Clock = std::chrono::steady_clock;
 
-        void         operator= ( const NameIdPair& nip ) { local_name_ = nip.local_name_;
-                                                           stored_names_ = nip.stored_names_; }
-        // Hasher
-        size_t       operator() ( V v ) const            { return Util::Hash<const char*>()( name( v.first ) ); }
+struct ChurnResult {
+    size_t live, holes;
+    double iterNs;      // per live entry
+    double removeP50, removeP99, removeMax;     // ns
+};
 
-        // Comper
-        bool         operator() ( V a, V b ) const       { return strcmp( name( a.first ), name( b.first ) ) == 0; }
+// 'Set' is adapted by the callers below: insert, remove, size, holes, sum
+template <typename Set>
+ChurnResult churn(Set& set, size_t count) {
+    std::vector<double> lat;
+    lat.reserve(count * 2);
+    auto removeTimed = [&](long key) {
+        auto t0 = Clock::now();
+        set.remove(key);
+        lat.push_back(std::chrono::duration<double, std::nano>(Clock::now() - t0).count());
     };
+    for (size_t i = 0; i < count; ++i) {
+        set.insert(long(i));
+    }
+    std::vector<long> live;
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 10 != 0) {
+            removeTimed(long(i));
+        } else {
+            live.push_back(long(i));
+        }
+    }
+    // steady churn at a tenth of the peak: replace the oldest key with a new one
+    long next = count;
+    for (size_t i = 0; i < count; ++i) {
+        long& oldest = live[i % live.size()];
+        removeTimed(oldest);
+        set.insert(oldest = next++);
+    }
 
+    ChurnResult r;
+    r.live = set.size();
+    r.holes = set.holes();
+    auto t0 = Clock::now();
+    long sum = 0;
+    for (int rep = 0; rep < 10; ++rep) {
+        sum += set.sum();
+    }
+    r.iterNs = std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / (10.0 * r.live);
+    if (sum == 42) {
+        printf("!");
+    }
+    std::sort(lat.begin(), lat.end());
+    r.removeP50 = lat[lat.size() / 2];
+    r.removeP99 = lat[lat.size() * 99 / 100];
+    r.removeMax = lat.back();
+    return r;
+}
 
-    using Hset = Util::HashSet<V, NameIdPair, NameIdPair>;
-    using Iter = typename std::vector<typename Hset::Entry>::iterator;
+void report(const char* name, const ChurnResult& r) {
+    printf("  %-26s %9zu live %9zu holes (%5.1f%%)  iterate %6.2f ns/entry"
+           "  remove p50 %5.0f p99 %6.0f max %8.0f ns\n",
+           name, r.live, r.holes, 100.0 * r.holes / (r.live + r.holes), r.iterNs,
+           r.removeP50, r.removeP99, r.removeMax);
+}
 
-    // ================
-    class Reference {
-    public:
-        std::string                        _key;
-        std::shared_ptr<std::vector<char>> _names;
-        std::shared_ptr<NameIdPair>        _nip;
-        std::shared_ptr<Hset>              _d;
+struct UtilSet {
+    Util::HashSet<long> h;
+    void insert(long k) { h.insert(k); }
+    void remove(long k) { h.remove(k); }
+    size_t size() const { return h.size(); }
+    size_t holes() const { return h.dead_count(); }
+    long sum() const { long s = 0; h.for_each([&](long k) { s += k; }); return s; }
+};
 
-        Reference( const std::string& key_,
-                   std::shared_ptr<std::vector<char>>& names_,
-                   std::shared_ptr<NameIdPair>& nip_,
-                   std::shared_ptr<Hset>& d_ )
-            : _key( key_ ),  _names( names_ ), _nip( nip_ ), _d( d_ ) {};
+struct FlatSet {
+    FlatHash<long> h{256};
+    void insert(long k) { h.insert(k); }
+    void remove(long k) { h.remove(k); }
+    size_t size() const { return h.getEntryCount(); }
+    size_t holes() const { return h.getDeadCount(); }
+    long sum() const { long s = 0; for (long k : h) s += k; return s; }
+};
 
-        Reference& operator= ( T value );
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    printf("Util::HashSet<long>, peak %zu\n", count);
+    {
+        UtilSet s;
+        report("free list (off)", churn(s, count));
+    }
+    {
+        UtilSet s;
+        s.h.set_swap_remove();
+        report("swap remove", churn(s, count));
+    }
+    {
+        UtilSet s;
+        s.h.set_compact_threshold(0.25);
+        report("online, threshold 0.25", churn(s, count));
+    }
+    printf("FlatHash<long>, peak %zu\n", count);
+    {
+        FlatSet s;
+        report("free list (off)", churn(s, count));
+    }
+    {
+        FlatSet s;
+        s.h.setSwapRemove(true);
+        report("swap remove", churn(s, count));
+    }
+    {
+        FlatSet s;
+        s.h.setCompactThreshold(0.25);
+        report("online, threshold 0.25", churn(s, count));
+    }
+    return 0;
+}
 
-        // unlike std::map or ordered_map, do NOT insert if key is not already in the dict, throw Error instead
-        operator T () const;
+#endif
 
-        // friend std::ostream&  operator<< ( std::ostream& s, const Reference& c );
-    };
+// ================================================================
+// to benchmark the cost of the lookup counters:
+//   create file with:
+//          #define BENCH_HASH_STATS
+//          #include "HashBase.h"
+//          #include "FlatHash.h"
+//   compile with -O2 -std=c++20 and run, optionally with an entry count
+//   (default 1M); prints lookup times with and without counters, then the
+//   counted tables' stats()
 
-    // ================
-    class iterator {
-        Iter _current;
-        Dict& _d;
-        using V = std::pair<std::string, Reference>;
-    public:
+#ifdef BENCH_HASH_STATS
 
-        iterator( Iter iter_, Dict& d_ ) : _current( iter_ ), _d( d_ ) {}
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
 
-        StringId       string_id () const               { return _current->first; }
+struct StatsEntry {
+    long v;
+    int  n = -1;
+    StatsEntry (long x = 0) : v( x ) {}
+    int&  next ()               { return n; }
+    int   next () const         { return n; }
+    void  next (int x)          { n = x; }
+    long  val () const          { return v; }
+    long& val ()                { return v; }
+};
 
-        V              operator*()                      { std::string name = _d.nip->name( ( *_current ).val.first ); return V( name, _d[name] ); }
-        const V        operator*() const                { std::string name = _d.nip->name( ( *_current ).val.first ); return V( name, _d[name] ); }
-        iterator&      operator++() noexcept            { _current++; return *this; }
-        iterator       operator++( int ) noexcept       { iterator temp( *this );  ++( *this ); return temp; }
-        iterator       operator+( int i ) noexcept      { iterator temp( *this );  _current += i; return temp; }
-        const iterator operator++( int ) const noexcept { iterator temp( *this );  ++( *const_cast<iterator*>( this ) ); return temp; }
-        iterator&      operator--() noexcept            {  _current--; return *this; }
-        iterator       operator--( int )  noexcept      { iterator temp( *this );  --( *this ); return temp; }
-        iterator       operator-( int i )  noexcept     {  _current -= i; return *this; }
-        const iterator operator--( int ) const noexcept { iterator temp( *this );  --( *const_cast<iterator*>( this ) ); return temp; }
+struct StatsOps {
+    size_t  operator() (long x) const                       { return Util::mix_hash( x ); }
+    size_t  operator() (const StatsEntry& e) const          { return Util::mix_hash( e.v ); }
+    bool    operator() (long a, const StatsEntry& b) const  { return a == b.v; }
+};
+
+struct MixHash {
+    size_t operator()(long x) const { return Util::mix_hash(x); }
+};
+
+// half hits, half misses
+template <typename Lookup>
+double timeLookups(size_t count, Lookup lookup) {
+    auto t0 = std::chrono::steady_clock::now();
+    size_t found = 0;
+    for (int rep = 0; rep < 5; ++rep) {
+        for (size_t i = 0; i < 2 * count; ++i) {
+            found += lookup(long(i * 7919 % (2 * count)));
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    if (found != 5 * count) {
+        printf("bad lookup count %zu\n", found);
+    }
+    return ns / (10.0 * count);
+}
+
+template <typename Counters>
+Util::HashStats benchHashBase(size_t count) {
+    std::vector<StatsEntry> ev;
+    std::vector<int> tv;
+    StatsOps ops;
+    Util::HashBase<std::vector<StatsEntry>, std::vector<int>, StatsOps, long, Util::ModuloIndex, Counters> h(ev, tv, ops);
+    for (size_t i = 0; i < count; ++i) {
+        h.insert2(long(i));
+    }
+    printf("  HashBase %-16s %6.2f ns/lookup\n", Counters::enabled ? "HashCounters" : "NoHashCounters",
+           timeLookups(count, [&](long k) { return h.contains(k); }));
+    return h.stats();
+}
 
-        // comparison
-        bool operator== ( const iterator& rhs ) const noexcept  { return _current == rhs._current; }
-        bool operator!= ( const iterator& rhs ) const noexcept  { return _current != rhs._current; }
-        bool operator<  ( const iterator& rhs ) const noexcept  { return _current < rhs._current; }
-        bool operator>  ( const iterator& rhs ) const noexcept  { return _current > rhs._current; }
-        bool operator<= ( const iterator& rhs ) const noexcept  { return _current <= rhs._current; }
-        bool operator>= ( const iterator& rhs ) const noexcept  { return _current >= rhs._current; }
-    };
+template <typename Counters>
+Util::HashStats benchHashMap(size_t count) {
+    HashMap<long, int, MixHash, std::equal_to<long>, Util::ModuloIndex, Counters> m(101);
+    for (size_t i = 0; i < count; ++i) {
+        m.insert(long(i), int(i));
+    }
+    printf("  HashMap  %-16s %6.2f ns/lookup\n", Counters::enabled ? "HashCounters" : "NoHashCounters",
+           timeLookups(count, [&](long k) { return m.contains(k); }));
+    return m.stats();
+}
 
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    printf("%zu entries, %zu lookups\n", count, 10 * count);
+    benchHashBase<Util::NoHashCounters>(count);
+    Util::HashStats base = benchHashBase<Util::HashCounters>(count);
+    benchHashMap<Util::NoHashCounters>(count);
+    Util::HashStats map = benchHashMap<Util::HashCounters>(count);
+    printf("\nHashBase:\n");
+    base.print();
+    printf("\nHashMap:\n");
+    map.print();
+    return 0;
+}
 
-    //public:      // why public?
-    const char*                        dflt_name = nullptr; // what is this for?
-    std::shared_ptr<std::vector<char>> names;
-    std::shared_ptr<NameIdPair>        nip;
-    std::shared_ptr<Hset>              d;
-    std::unordered_set<StringId>       deleted_ids; // Track deleted IDs
+#endif
 
-    Dict ( SchemaPtr sch_,
-               std::shared_ptr<std::vector<char>>& names_,
-               std::shared_ptr<NameIdPair>& nip_,
-               std::shared_ptr<Hset>& d_ );
+// ================================================================
+// to benchmark loading a Dictionary against mapping a saved one:
+//   create file with:
+//          #define BENCH_MAPPED_LOAD
+//          #include "FlatHash.h"
+//   compile with -O2 -std=c++20 and run, optionally with a key count (default 5M)
+//   and a file (default /tmp/bench_mapped_load.dict); drop the page cache
+//   before a run to see cold-start page faults
 
-public: // ================================================================
+#ifdef BENCH_MAPPED_LOAD
 
-    using value_type = T;
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 
-    Dict ( SchemaPtr sch );
-    Dict ( SchemaPtr sch, const std::string& path );
+using Clock = std::chrono::steady_clock;
 
-    // If not find key in d, insert the value
-    // If dind key in d, update the old value with provided one
-    // returns string_id
-    StringId        insert ( const std::string& key, T value );
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
 
-    bool            contains ( const std::string& key ) const;
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 5000000;
+    std::string path = argc > 2 ? argv[2] : "/tmp/bench_mapped_load.dict";
 
-    // return value connected with 'key' if it exists in dictionary, else return 'dflt'
-    const T&        lookup ( const std::string& key, const T& dflt = T{} ) const;
-    // return id which can be efficently stored and used to lookup string with dict[str_id]; or ~0 if not found
-    IdType          string_id ( const std::string& key ) const;
+    std::vector<std::string> names(count);
+    char buf[64];
+    for (size_t i = 0; i < count; ++i) {
+        snprintf(buf, sizeof(buf), "schema/table_%03zu/column_%09zu", i % 997, i * 2654435761u % (count * 4));
+        names[i] = buf;
+    }
+    std::vector<size_t> probes(1000000);
+    for (size_t i = 0; i < probes.size(); ++i) {
+        probes[i] = i * 7919 % count;
+    }
+    printf("%zu keys\n", count);
 
-    // Operator= of reference will perform the same thing as insert function
-    Reference       operator[] ( const std::string& key )    { return Reference( key, names, nip, d ); }
+    auto start = Clock::now();
+    {
+        Dictionary<long> dict(1024);
+        for (size_t i = 0; i < count; ++i) {
+            dict.add(names[i], long(i));
+        }
+        printf("  build Dictionary            %8.3f s\n", secondsSince(start));
 
-    const T&        operator[] ( const std::string& key ) const; // same as lookup, but throws excetion on error
-    const T&        operator[] ( IdType id ) const;
-    std::string     key_at ( IdType id ) const;
+        start = Clock::now();
+        long sum = 0;
+        for (size_t k : probes) {
+            sum += dict.get(names[k]);
+        }
+        printf("  Dictionary lookups          %8.1f ns each (%ld)\n", secondsSince(start) * 1e9 / probes.size(), sum);
 
-    bool            empty () const                           { return d->size() == 0; }
+        start = Clock::now();
+        dict.save(path);
+        printf("  save                        %8.3f s\n", secondsSince(start));
+    }
 
-    void            clear ()                                 { std::vector<char>().swap( *names ); d->clear(); deleted_ids.clear(); }
+    start = Clock::now();
+    MappedDictionary<long> mapped(path);
+    printf("  open MappedDictionary       %8.6f s\n", secondsSince(start));
 
-    iterator        find ( const std::string& key );
+    start = Clock::now();
+    long first = mapped.get(names[count / 2]);
+    printf("  first lookup                %8.6f s (%ld)\n", secondsSince(start), first);
 
-    iterator        begin ()                                 { return iterator( d->get_hash_data().begin(), *this );  }
-    iterator        end ()                                   { return iterator( d->get_hash_data().end(), *this ); }
+    start = Clock::now();
+    long sum = 0;
+    for (size_t k : probes) {
+        sum += mapped.get(names[k]);
+    }
+    printf("  MappedDictionary lookups    %8.1f ns each (%ld)\n", secondsSince(start) * 1e9 / probes.size(), sum);
 
-    const iterator  begin () const                           { return iterator( d->get_hash_data().begin(), *this );  }
-    const iterator  end () const                             { return iterator( d->get_hash_data().end(), *this ); }
+    start = Clock::now();
+    bool ok = mapped.verify();
+    printf("  verify checksum             %8.3f s (%s)\n", secondsSince(start), ok ? "ok" : "BAD");
+    return 0;
+}
 
-    size_t          size () const override                   { return d->size(); }
-    size_t          size_bytes () const override             { return 0; }// TODO
+#endif
 
-    DataObjPtr      slice ( size_t offset, size_t slice_size = ~0 ) override;
-    DataObjPtr      slice_copy ( size_t offset, size_t slice_size = ~0 ) override;
+// ================================================================
+// to benchmark SharedDict readers across processes:
+//   create file with:
+//          #define BENCH_SHARED_DICT
+//          #include "SharedDict.h"
+//   compile with -O2 -std=c++20 (and -lrt on old glibc) and run, optionally
+//   with a key count (default 1M) and lookups per reader (default 2M).
+//   Forks 1 .. 32 reader processes that attach to the writer's dict, first
+//   with the writer idle, then with it updating values as fast as it can;
+//   prints the total lookup rate and checks every value read
 
-    void            repr (std::ostream& s, int level) const override;
-    void            print ( int level = 0 ) const override;
+#ifdef BENCH_SHARED_DICT
 
-    // ================ internal ================
-    GenericValue    gvget ( const char* key ) const override;
-    GenericValue    gvget ( int id ) const override;
-    int             gvset ( const char* key, GenericValue val ) override;
-    void            serialize ( MPSys::Message& msg, DataObjPtr p ) override;
-    void            unload () override;
-    void            set_reference_ptrs ( DataObjPtr this_node );
-    DataObjPtr      reference ()        { return d_reference; }
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <sys/wait.h>
 
-    // Erase method to remove a key-value pair
-    bool erase(const std::string& key) {
-        auto iter = find(key);
-        if (iter == end()) {
-            return false;
-        }
-        deleted_ids.insert(iter.string_id());
-        d->erase(iter._current);
-        return true;
+using Clock = std::chrono::steady_clock;
+
+struct SharedValue {
+    long id;
+    long version;   // updated by the writer; id must not change
+};
+
+// each reader looks up 'lookups' keys and exits 0 if every value matched its key
+int runReader(const char* shm, const std::vector<std::string>& keys, size_t lookups, unsigned seed) {
+    AuData::SharedDict<SharedValue> dict(shm);
+    size_t bad = 0;
+    for (size_t i = 0; i < lookups; ++i) {
+        seed = seed * 1103515245 + 12345;
+        size_t k = (seed >> 4) % keys.size();
+        SharedValue v = dict.lookup(keys[k], SharedValue{-1, 0});
+        bad += v.id != long(k);
     }
+    return bad ? 1 : 0;
+}
 
-    // Compact the names vector by removing deleted entries
-    void compact() {
-        std::vector<char> new_names;
-        std::unordered_map<StringId, StringId> id_map;
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t lookups = argc > 2 ? strtoull(argv[2], nullptr, 10) : 2000000;
+    const char* shm = "/bench_shared_dict";
 
-        StringId new_id = 0;
-        for (StringId old_id = 0; old_id < names->size(); ) {
-            if (deleted_ids.find(old_id) == deleted_ids.end()) {
-                const char* name = &(*names)[old_id];
-                id_map[old_id] = new_id;
-                new_names.insert(new_names.end(), name, name + strlen(name) + 1);
-                new_id += strlen(name) + 1;
+    std::vector<std::string> keys(count);
+    char buf[64];
+    for (size_t i = 0; i < count; ++i) {
+        snprintf(buf, sizeof(buf), "schema/table_%03zu/column_%09zu", i % 997, i);
+        keys[i] = buf;
+    }
+    AuData::SharedDict<SharedValue> dict(shm, count, count * 40, true);   // replace one a killed run left
+    for (size_t i = 0; i < count; ++i) {
+        dict.insert(keys[i], SharedValue{long(i), 0});
+    }
+    printf("%zu keys, %zu lookups per reader, %zu bytes of shared memory\n", count, lookups, dict.region_bytes());
+
+    for (bool writing : {false, true}) {
+        printf(writing ? "writer updating:\n" : "writer idle:\n");
+        for (int procs : {1, 2, 4, 8, 16, 32}) {
+            auto start = Clock::now();
+            std::vector<pid_t> pids;
+            for (int p = 0; p < procs; ++p) {
+                pid_t pid = fork();
+                if (pid == 0) {
+                    _exit(runReader(shm, keys, lookups, 17 + p));
+                }
+                pids.push_back(pid);
             }
-            old_id += strlen(&(*names)[old_id]) + 1;
+            size_t updates = 0;
+            int failed = 0;
+            for (pid_t pid : pids) {
+                int status = 0;
+                while (writing && waitpid(pid, &status, WNOHANG) == 0) {
+                    for (int i = 0; i < 1000; ++i, ++updates) {
+                        size_t k = updates * 7919 % count;
+                        dict.insert(keys[k], SharedValue{long(k), long(updates)});
+                    }
+                }
+                if (!writing) {
+                    waitpid(pid, &status, 0);
+                }
+                failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+            }
+            double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            printf("  %2d readers  %8.1f M lookups/s   %8.1f M updates/s%s\n", procs,
+                   procs * lookups / seconds / 1e6, updates / seconds / 1e6, failed ? "   BAD VALUES" : "");
         }
+    }
+    return 0;
+}
 
-        *names = std::move(new_names);
-        deleted_ids.clear();
+#endif
 
-        // Update the hash set with new IDs
-        for (auto& entry : *d) {
-            entry.val.first = id_map[entry.val.first];
-        }
+// ================================================================
+// to benchmark NameMap's index against the std::set it replaced:
+//   create file with:
+//          #define BENCH_NAME_MAP
+//          #include "NameMap.h"
+//   compile with -O2 -std=c++20 -pthread and run, optionally with a name
+//   count (default 1M).  Times one-at-a-time insert, bulk insert, and
+//   lookups of present and absent names; the serialized vectors must match
+
+#ifdef BENCH_NAME_MAP
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+// the previous NameMap: a std::set of offsets into the vector, compared with strcmp
+class SetNameMap {
+public:
+    using Id = unsigned int;
+    static constexpr Id NOT_FOUND = ~0u;
+
+    explicit SetNameMap(std::vector<char>& v) : vec(v), names(Less{&v}) {}
+
+    Id insert(const char* name) {
+        Id found = lookup(name);
+        if (found != NOT_FOUND)
+            return found;
+        Id id = vec.size();
+        vec.insert(vec.end(), name, name + strlen(name) + 1);
+        names.insert(id);
+        return id;
+    }
+    Id lookup(const char* name) const {
+        probe = name;
+        auto it = names.find(NOT_FOUND);
+        return it == names.end() ? NOT_FOUND : *it;
     }
 
 private:
-    std::string  d_path;
-    DataObjPtr   d_reference;
+    // NOT_FOUND stands for the name being looked up
+    struct Less {
+        std::vector<char>* vec;
+        const char* str(Id id) const { return id == NOT_FOUND ? probe : vec->data() + id; }
+        bool operator()(Id a, Id b) const { return strcmp(str(a), str(b)) < 0; }
+    };
+    static inline thread_local const char* probe = nullptr;
+
+    std::vector<char>& vec;
+    std::set<Id, Less> names;
 };
 
-} // namespace AuData
+template <typename F>
+double seconds(F f) {
+    auto start = Clock::now();
+    f();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
 
-Using a custom dictionary implementation like the one you have, which keeps all data in continuous memory, can indeed be beneficial for IPC (Inter-Process Communication) due to the following reasons:
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+
+    // identifier-like names with long shared prefixes, a third of them repeated
+    std::vector<std::string> strings(count), absent(count);
+    char buf[64];
+    for (size_t i = 0; i < count; ++i) {
+        size_t k = i % (count - count / 3);
+        snprintf(buf, sizeof(buf), "module_%03zu.field_%07zu", (k * 7919) % 613, k);
+        strings[i] = buf;
+        snprintf(buf, sizeof(buf), "module_%03zu.field_%07zu_", (i * 7919) % 613, i);
+        absent[i] = buf;
+    }
+    std::vector<const char*> names(count);
+    for (size_t i = 0; i < count; ++i)
+        names[i] = strings[i].c_str();
+
+    std::vector<char> setVec, flatVec, bulkVec;
+    SetNameMap setMap(setVec);
+    Util::NameMap flatMap(flatVec), bulkMap(bulkVec);
+
+    size_t sink = 0;
+    double setInsert = seconds([&] { for (const char* n : names) sink += setMap.insert(n); });
+    double flatInsert = seconds([&] { for (const char* n : names) sink += flatMap.insert(n); });
+    double bulkInsert = seconds([&] { bulkMap.insert(names); });
+
+    double setHit = seconds([&] { for (const char* n : names) sink += setMap.lookup(n); });
+    double flatHit = seconds([&] { for (const char* n : names) sink += flatMap.lookup(n); });
+    double setMiss = seconds([&] { for (auto& n : absent) sink += setMap.lookup(n.c_str()); });
+    double flatMiss = seconds([&] { for (auto& n : absent) sink += flatMap.lookup(n.c_str()); });
+
+    printf("%zu names, %d distinct, %zu bytes of names\n", count, flatMap.size(), flatVec.size());
+    printf("%-12s %12s %12s %12s\n", "ns/name", "std::set", "flat", "flat bulk");
+    printf("%-12s %12.1f %12.1f %12.1f\n", "insert",
+           setInsert * 1e9 / count, flatInsert * 1e9 / count, bulkInsert * 1e9 / count);
+    printf("%-12s %12.1f %12.1f\n", "lookup hit", setHit * 1e9 / count, flatHit * 1e9 / count);
+    printf("%-12s %12.1f %12.1f\n", "lookup miss", setMiss * 1e9 / count, flatMiss * 1e9 / count);
+    printf("index bytes: std::set ~%zu, flat %zu\n",
+           size_t(flatMap.size()) * 48, flatMap.bucket_count() * 2 * sizeof(Util::NameMap::Id));
+    printf("vectors %s (%zu)\n", setVec == flatVec && flatVec == bulkVec ? "match" : "DIFFER", sink);
+    return setVec == flatVec && flatVec == bulkVec ? 0 : 1;
+}
 
-1. **Continuous Memory**: Keeping all data in a continuous memory block can simplify the process of sharing data between processes, as it avoids the need for complex serialization and deserialization steps.
-2. **Performance**: Accessing data in continuous memory can be faster due to better cache locality compared to scattered memory allocations.
+#endif
 
-However, there are trade-offs to consider, especially regarding the `erase` operation and the potential need for compaction:
+// ================================================================
+// to benchmark transparent lookups and check that they do not allocate:
+//   create file with:
+//          #define BENCH_TRANSPARENT_LOOKUP
+//          #include "FlatHash.h"
+//   compile with -O2 -std=c++20 and run, optionally with a key count
+//   (default 1M).  Looks up const char* keys in a Dictionary and a
+//   HashMap<std::string> through a temporary std::string (as the
+//   const std::string& lookups did), a string_view and a prehashed key;
+//   operator new counts the allocations of each and the run fails if a
+//   transparent lookup makes one
+
+#ifdef BENCH_TRANSPARENT_LOOKUP
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
 
-### Pros
+using Clock = std::chrono::steady_clock;
 
-1. **Efficient IPC**: Continuous memory layout is ideal for IPC, as it can be shared directly between processes without the need for serialization.
-2. **Cache Efficiency**: Access patterns that benefit from cache locality can see performance improvements.
-3. **Simplified Serialization**: Direct memory sharing reduces the overhead of serialization and deserialization.
+static std::atomic<size_t> allocations{0};
 
-### Cons
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
 
-1. **Compaction Overhead**: The need to compact the memory after deletions can introduce significant overhead, especially if deletions are frequent. Compaction involves copying data and updating references, which can be time-consuming.
-2. **Memory Fragmentation**: Without compaction, the memory can become fragmented, leading to inefficient use of memory and potential performance degradation.
-3. **Complexity**: Implementing and maintaining a custom data structure with compaction logic can be more complex compared to using standard containers like `std::unordered_map`.
+void operator delete(void* p) noexcept {
+    free(p);
+}
 
-### Evaluation
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
 
-1. **Use Case Suitability**: If your application involves frequent IPC and the data structure is shared between processes, the benefits of continuous memory might outweigh the compaction overhead. However, if deletions are frequent, the overhead of compaction could become a bottleneck.
-2. **Frequency of Operations**: Evaluate the frequency of insertions, deletions, and lookups. If deletions are rare, the compaction overhead might be negligible. Conversely, if deletions are common, the overhead could be significant.
-3. **Performance Testing**: Conduct performance testing to measure the impact of compaction on your specific workload. Compare the performance with a standard `std::unordered_map` to determine if the benefits of continuous memory outweigh the costs.
-4. **Hybrid Approach**: Consider a hybrid approach where you use `std::unordered_map` for operations that involve frequent deletions and the custom dictionary for IPC scenarios where data is mostly read-only.
+struct Result {
+    double ns;
+    double allocations;
+};
 
+// ns and allocations per lookup of f(i) for i in [0, count)
+template <typename F>
+Result measure(size_t count, F f) {
+    size_t found = 0, before = allocations.load();
+    auto start = Clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        found += f(i);
+    }
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    size_t made = allocations.load() - before;
+    if (found != count) {
+        printf("missed %zu keys\n", count - found);
+    }
+    return {ns / count, double(made) / count};
+}
 
-#include <cstring>
-#include <functional>
-#include <string_view>
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+
+    // past the small string buffer, so a temporary std::string allocates
+    std::vector<char> text;
+    std::vector<size_t> offsets(count);
+    char buf[64];
+    for (size_t i = 0; i < count; ++i) {
+        int n = snprintf(buf, sizeof(buf), "request.header.field_%09zu", i);
+        offsets[i] = text.size();
+        text.insert(text.end(), buf, buf + n + 1);
+    }
+    auto key = [&](size_t i) { return (const char*)&text[offsets[i]]; };
 
-struct CStringHash {
-    size_t operator()(const char* str) const {
-        return std::hash<std::string_view>{}(std::string_view(str));
+    Dictionary<size_t> dict(count);
+    HashMap<std::string, size_t, StringHash, StringEqual> map(count);
+    for (size_t i = 0; i < count; ++i) {
+        dict.add(key(i), i);
+        map.insert(key(i), i);
+    }
+    std::vector<Util::Prehashed<std::string_view>> dictKeys(count), mapKeys(count);
+    for (size_t i = 0; i < count; ++i) {
+        dictKeys[i] = Util::prehash(key(i));
+        mapKeys[i] = map.prehash(std::string_view(key(i)));
     }
-};
 
-struct CStringEqual {
-    bool operator()(const char* lhs, const char* rhs) const {
-        return std::strcmp(lhs, rhs) == 0;
+    struct Row {
+        const char* name;
+        Result result;
+        bool transparent;
+    };
+    Row rows[] = {
+        {"Dictionary std::string", measure(count, [&](size_t i) { return dict.contains(std::string(key(i))); }), false},
+        {"Dictionary const char*", measure(count, [&](size_t i) { return dict.contains(key(i)); }), true},
+        {"Dictionary prehashed", measure(count, [&](size_t i) { return dict.contains(dictKeys[i]); }), true},
+        {"HashMap std::string", measure(count, [&](size_t i) { return map.contains(std::string(key(i))); }), false},
+        {"HashMap const char*", measure(count, [&](size_t i) { return map.contains(std::string_view(key(i))); }), true},
+        {"HashMap prehashed", measure(count, [&](size_t i) { return map.contains(mapKeys[i]); }), true},
+    };
+
+    bool ok = true;
+    printf("%zu keys\n%-24s %10s %14s\n", count, "lookup", "ns", "allocations");
+    for (const Row& row : rows) {
+        printf("%-24s %10.1f %14.2f\n", row.name, row.result.ns, row.result.allocations);
+        ok = ok && (!row.transparent || row.result.allocations == 0);
     }
-};
+    printf("%s\n", ok ? "transparent lookups: no allocations" : "FAIL: a transparent lookup allocated");
+    return ok ? 0 : 1;
+}
 
-#include <vector>
-#include <string>
-#include <iostream>
-#include <functional>
-#include <stdexcept>
-#include <string_view>
-#include <utility>
-#include <limits>
-#include <cstring>
+#endif
 
-template <typename T>
-struct Entry {
-    T value;
-    int next;
-};
+// ================================================================
+// to benchmark Dict lookups as reader threads are added:
+//   create file with:
+//          #define BENCH_DICT_SCALING
+//          #include "Dict.h"
+//   compile with -O2 -std=c++20 -pthread and run, optionally with a key
+//   count (default 1M) and lookups per thread (default 2M).  Runs 1, 2, 4 ..
+//   hardware threads looking up keys in one Dict: lock free reads, reads
+//   under set_concurrent()'s shared_mutex, and those with a writer updating
+//   values; prints lookups per second and the speedup over one thread
 
-struct HashInfo {
-    int freeIndex;
-    size_t entryCount;
-    size_t maxDepth;
-    double rehashMultiplier;
-};
+#ifdef BENCH_DICT_SCALING
 
-template <typename T, typename Hasher = std::hash<T>, typename Comparer = std::equal_to<T>>
-class FlatHash {
-public:
-    FlatHash(size_t tableSize, size_t maxDepth = 5, double rehashMultiplier = 2.0)
-        : table(tableSize, endOfList), hashInfo{endOfList, 0, maxDepth, rehashMultiplier} {}
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
 
-    bool insert(const T& value) {
-        return insertImpl(value);
-    }
+using Clock = std::chrono::steady_clock;
 
-    bool insert(T&& value) {
-        return insertImpl(std::move(value));
-    }
+enum class Mode { Plain, Shared, Writer };
 
-    bool contains(const T& value) const {
-        size_t hashValue = hashFunction(value) % table.size();
-        int index = table[hashValue];
-        while (index != endOfList) {
-            if (comparer(entries[index].value, value)) {
-                return true;
+// lookups per second of 'threads' readers doing 'lookups' each
+double run(AuData::Dict<long>& dict, const std::vector<std::string>& keys, unsigned threads, size_t lookups,
+           Mode mode) {
+    std::atomic<bool> done{false};
+    std::atomic<long> bad{0};
+    std::thread writer;
+    if (mode == Mode::Writer) {
+        writer = std::thread([&] {
+            for (size_t i = 0; !done; i = (i + 1) % keys.size()) {
+                dict.insert(keys[i], long(i));
             }
-            index = entries[index].next;
-        }
-        return false;
+        });
     }
-
-    bool remove(const T& value) {
-        size_t hashValue = hashFunction(value) % table.size();
-        int index = table[hashValue];
-        int prevIndex = endOfList;
-        while (index != endOfList) {
-            if (comparer(entries[index].value, value)) {
-                if (prevIndex == endOfList) {
-                    table[hashValue] = entries[index].next;
-                } else {
-                    entries[prevIndex].next = entries[index].next;
-                }
-                entries[index].value = nullValue;
-                entries[index].next = hashInfo.freeIndex;
-                hashInfo.freeIndex = index;
-                --hashInfo.entryCount;
-                return true;
+    std::vector<std::thread> pool;
+    auto start = Clock::now();
+    for (unsigned t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t] {
+            unsigned seed = t + 1;
+            long miss = 0;
+            for (size_t n = 0; n < lookups; ++n) {
+                seed = seed * 1103515245 + 12345;
+                size_t i = (seed >> 4) % keys.size();
+                long v = mode == Mode::Plain ? dict.lookup(keys[i], -1L) : dict.lookup_copy(keys[i], -1L);
+                miss += v != long(i);
             }
-            prevIndex = index;
-            index = entries[index].next;
-        }
-        return false;
+            bad += miss;
+        });
     }
-
-    size_t getTableSize() const {
-        return table.size();
+    for (std::thread& t : pool) {
+        t.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    done = true;
+    if (writer.joinable()) {
+        writer.join();
     }
+    if (bad) {
+        printf("%ld wrong values\n", bad.load());
+    }
+    return threads * lookups / seconds;
+}
 
-    size_t getEntryCount() const {
-        return hashInfo.entryCount;
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t lookups = argc > 2 ? strtoull(argv[2], nullptr, 10) : 2000000;
+    unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::string> keys(count);
+    char buf[64];
+    for (size_t i = 0; i < count; ++i) {
+        snprintf(buf, sizeof(buf), "schema_%03zu.column_%09zu", i % 331, i);
+        keys[i] = buf;
+    }
+    AuData::Dict<long> dict{AuData::SchemaPtr()};
+    for (size_t i = 0; i < count; ++i) {
+        dict.insert(keys[i], long(i));
     }
 
-    size_t getMaxDepth() const {
-        return hashInfo.maxDepth;
+    printf("%zu keys, %zu lookups per thread, Mlookups/s (speedup)\n", count, lookups);
+    printf("%8s %20s %20s %20s\n", "threads", "lock free", "shared_mutex", "+ writer");
+    double base[3] = {};
+    for (unsigned threads = 1;; threads = std::min(threads * 2, maxThreads)) {
+        printf("%8u", threads);
+        for (Mode mode : {Mode::Plain, Mode::Shared, Mode::Writer}) {
+            dict.set_concurrent(mode != Mode::Plain);
+            double rate = run(dict, keys, threads, lookups, mode);
+            double& first = base[int(mode)];
+            if (threads == 1) {
+                first = rate;
+            }
+            printf(" %12.1f (%5.1fx)", rate / 1e6, rate / first);
+        }
+        printf("\n");
+        if (threads == maxThreads) {
+            break;
+        }
     }
+    return 0;
+}
+
+#endif
+
+// ================================================================
+// to benchmark SparseStore's representations:
+//   create file with:
+//          #define BENCH_SPARSE_STORE
+//          #include "SparseStore.h"
+//   compile with -O2 -std=c++20 and run, optionally with the span (default
+//   16M indexes).  At 0.1%, 1% and 10% density, for each mode: bytes per
+//   element, an in-order scan, random point lookups (half of them misses)
+//   and gathers of 4096 index windows
 
-    double getRehashMultiplier() const {
-        return hashInfo.rehashMultiplier;
-    }
+#ifdef BENCH_SPARSE_STORE
 
-    class Iterator {
-    public:
-        Iterator(const FlatHash& set, int index) : set(set), index(index) {}
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
 
-        bool operator!=(const Iterator& other) const {
-            return index != other.index;
-        }
+using Clock = std::chrono::steady_clock;
+using Store = Util::SparseStore<double>;
 
-        const T& operator*() const {
-            return set.entries[index].value;
-        }
+template <typename F>
+double seconds(F f) {
+    auto start = Clock::now();
+    f();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
 
-        Iterator& operator++() {
-            do {
-                ++index;
-            } while (index < set.entries.size() && set.entries[index].next == endOfList);
-            return *this;
+int main(int argc, char** argv) {
+    size_t span = argc > 1 ? strtoull(argv[1], nullptr, 10) : size_t(1) << 24;
+    const size_t lookups = 4000000, window = 4096, windows = 2000;
+
+    printf("span %zu; scan ns/element, lookup ns, gather ns/index\n", span);
+    printf("%8s %-11s %10s %8s %8s %8s %8s\n", "density", "mode", "elements", "bytes/e", "scan", "lookup", "gather");
+    for (double density : {0.001, 0.01, 0.1}) {
+        // indexes spread evenly with some jitter, appended in order
+        std::vector<size_t> indexes;
+        unsigned seed = 7;
+        size_t step = size_t(1 / density);
+        for (size_t i = 0; i < span; i += step) {
+            seed = seed * 1103515245 + 12345;
+            indexes.push_back(i + (seed >> 8) % step);
+        }
+        std::vector<size_t> probes(lookups);
+        for (size_t k = 0; k < lookups; ++k) {
+            seed = seed * 1103515245 + 12345;
+            size_t e = (seed >> 4) % indexes.size();
+            probes[k] = k % 2 ? indexes[e] : indexes[e] + 1;
         }
 
-    private:
-        const FlatHash& set;
-        int index;
-    };
+        for (Store::Mode mode : {Store::Mode::Hash, Store::Mode::Runs, Store::Mode::Bitmap, Store::Mode::Auto}) {
+            Store store(mode);
+            for (size_t i : indexes) {
+                store.set(i, double(i));
+            }
+            store.optimize();
 
-    Iterator begin() const {
-        int startIndex = 0;
-        while (startIndex < entries.size() && entries[startIndex].next == endOfList) {
-            ++startIndex;
+            double sum = 0;
+            double scan = seconds([&] {
+                for (auto x : store) {
+                    sum += x.second;
+                }
+            });
+            double lookup = seconds([&] {
+                for (size_t i : probes) {
+                    sum += store.get(i, 0.0);
+                }
+            });
+            std::vector<double> out(window);
+            double gather = seconds([&] {
+                for (size_t k = 0; k < windows; ++k) {
+                    store.gather(probes[k] % (span - window), window, out.data(), 0.0);
+                    sum += out[k % window];
+                }
+            });
+            char name[32];
+            snprintf(name, sizeof(name), "%s%s", mode == Store::Mode::Auto ? "auto:" : "",
+                     Store::mode_name(store.mode()));
+            printf("%7.1f%% %-11s %10zu %8.1f %8.2f %8.1f %8.2f%s\n", density * 100, name, store.size(),
+                   double(store.bytes()) / store.size(), scan * 1e9 / store.size(), lookup * 1e9 / lookups,
+                   gather * 1e9 / (windows * window), sum == 0 ? " !" : "");
         }
-        return Iterator(*this, startIndex);
     }
+    return 0;
+}
 
-    Iterator end() const {
-        return Iterator(*this, entries.size());
-    }
+#endif
 
-protected:
-    std::vector<int> table;
-    std::vector<Entry<T>> entries;
-    HashInfo hashInfo;
-    Hasher hashFunction;
-    Comparer comparer;
+// ================================================================
+// to benchmark slicing a SparseArray and a Dict into partitions:
+//   create file with:
+//          #define BENCH_SLICE
+//          #include "HashBase.h"
+//          #include "Dict.h"
+//   compile with -O2 -std=c++20 and run, optionally with the entry count
+//   (default 10M) and partitions (default 1024).  For each: slice() into
+//   partitions, a scan of every partition, slice_copy() into partitions,
+//   one full copy as the old slice_copy did per partition, and one write
+//   to every slice, which copies that slice's entries only
+
+#ifdef BENCH_SLICE
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
 
-    static constexpr int endOfList = -1;
-    static constexpr T nullValue = T();
+using Clock = std::chrono::steady_clock;
 
-    int getFreeIndex() {
-        if (hashInfo.freeIndex != endOfList) {
-            int index = hashInfo.freeIndex;
-            hashInfo.freeIndex = entries[hashInfo.freeIndex].next;
-            return index;
-        }
-        entries.push_back({nullValue, endOfList});
-        return entries.size() - 1;
-    }
+template <typename F>
+double seconds(F f) {
+    auto start = Clock::now();
+    f();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
 
-    size_t updateMaxDepth(size_t hashValue) {
-        size_t depth = 0;
-        int index = table[hashValue];
-        while (index != endOfList) {
-            ++depth;
-            index = entries[index].next;
-        }
-        return depth;
-    }
+struct Timing {
+    double slice = 0, scan = 0, sliceCopy = 0, fullCopy = 0, write = 0;
+    size_t seen = 0, copied = 0;
+};
 
-    void rehash() {
-        size_t newSize = table.size() * hashInfo.rehashMultiplier;
-        std::vector<int> newTable(newSize, endOfList);
-        std::vector<Entry<T>> newEntries;
-        newEntries.reserve(entries.size());
-
-        for (const auto& entry : entries) {
-            if (entry.next != endOfList) {
-                size_t hashValue = hashFunction(entry.value) % newSize;
-                newEntries.push_back({entry.value, newTable[hashValue]});
-                newTable[hashValue] = newEntries.size() - 1;
-            }
+void report(const char* name, size_t count, size_t parts, const Timing& t) {
+    printf("%-12s %10.2f %10.2f %10.2f %12.1f %10.2f   %s\n", name, t.slice * 1e3, t.scan * 1e3, t.sliceCopy * 1e3,
+           t.fullCopy * parts * 1e3, t.write * 1e3,
+           t.seen == count && t.copied == count ? "ok" : "FAIL: entries lost or repeated");
+}
+
+template <typename Obj, typename Scan, typename Write>
+Timing partition(Obj& whole, size_t count, size_t parts, Scan scan, Write write) {
+    Timing t;
+    size_t step = (count + parts - 1) / parts;
+    std::vector<AuData::DataObjPtr> slices;
+    slices.reserve(parts);
+    t.slice = seconds([&] {
+        for (size_t p = 0; p < parts; ++p) {
+            slices.push_back(whole.slice(p * step, step));
+        }
+    });
+    t.scan = seconds([&] {
+        for (auto& s : slices) {
+            t.seen += scan(dynamic_cast<Obj&>(*s));
+        }
+    });
+    t.sliceCopy = seconds([&] {
+        for (size_t p = 0; p < parts; ++p) {
+            t.copied += whole.slice_copy(p * step, step)->size();
         }
+    });
+    t.fullCopy = seconds([&] { whole.slice_copy(0); });
+    t.write = seconds([&] {
+        for (auto& s : slices) {
+            write(dynamic_cast<Obj&>(*s));
+        }
+    });
+    return t;
+}
 
-        table = std::move(newTable);
-        entries = std::move(newEntries);
-        hashInfo.freeIndex = endOfList;
-    }
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+    size_t parts = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1024;
 
-private:
-    template <typename U>
-    bool insertImpl(U&& value) {
-        size_t hashValue = hashFunction(value) % table.size();
-        if (contains(value)) {
-            return false; // Value already exists
+    printf("%zu entries, %zu partitions; ms\n", count, parts);
+    printf("%-12s %10s %10s %10s %12s %10s\n", "", "slice", "scan", "slice_copy", "full copies", "COW write");
+
+    {
+        SparseArray<double> array(AuData::SchemaPtr(), 0, -1.0);
+        for (size_t i = 0; i < count; ++i) {
+            double v = double(i);
+            array.vappend(&v);
         }
-        int index = getFreeIndex();
-        entries[index] = {std::forward<U>(value), table[hashValue]};
-        table[hashValue] = index;
-        ++hashInfo.entryCount;
-        if (updateMaxDepth(hashValue) > hashInfo.maxDepth) {
-            rehash();
+        Timing t = partition(
+            array, count, parts,
+            [](SparseArray<double>& s) {
+                size_t n = 0;
+                s.for_each([&](size_t, const double&) { ++n; });
+                return n;
+            },
+            [](SparseArray<double>& s) {
+                double v = 0.5;
+                s.vset(0, &v);
+            });
+        report("SparseArray", count, parts, t);
+    }
+    {
+        AuData::Dict<long> dict{AuData::SchemaPtr()};
+        char buf[64];
+        for (size_t i = 0; i < count; ++i) {
+            snprintf(buf, sizeof(buf), "key_%09zu", i);
+            dict.insert(buf, long(i));
         }
-        return true;
+        Timing t = partition(
+            dict, count, parts,
+            [](AuData::Dict<long>& s) {
+                size_t n = 0;
+                for (size_t i = 0; i < s.size(); ++i) {
+                    n += s[AuData::IdType(i)] >= 0;
+                }
+                return n;
+            },
+            [](AuData::Dict<long>& s) { s.insert("written", 1); });
+        report("Dict", count, parts, t);
     }
-};
+    return 0;
+}
 
-template <typename T, typename Hasher = std::hash<T>, typename Comparer = std::equal_to<T>>
-using HashSet = FlatHash<T, Hasher, Comparer>;
+#endif
 
-template <typename Key, typename Value, typename Hasher = std::hash<Key>, typename Comparer = std::equal_to<Key>>
-class HashMap : public FlatHash<std::pair<Key, Value>, Hasher, Comparer> {
-public:
-    using Base = FlatHash<std::pair<Key, Value>, Hasher, Comparer>;
-    using Base::Base;
+// ================================================================
+// to benchmark memory accounting and shrink_to_fit on an object graph:
+//   create file with:
+//          #define BENCH_MEMORY
+//          #include "HashBase.h"
+//          #include "Dict.h"
+//   compile with -O2 -std=c++20 and run, optionally with a scale (default 1).
+//   Builds Dicts and SparseArrays the way loaders do -- grown by appends,
+//   some cleared, some sliced -- and counts heap bytes by replacing
+//   operator new.  Prints the per node report, the heap against the sum of
+//   memory_usage() (plus the objects), then the same after shrink_to_fit(),
+//   with the time of both
+
+#ifdef BENCH_MEMORY
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
 
-    bool insert(const Key& key, const Value& value) {
-        return Base::insert({key, value});
-    }
+using Clock = std::chrono::steady_clock;
 
-    bool insert(Key&& key, Value&& value) {
-        return Base::insert({std::move(key), std::move(value)});
-    }
+// live heap bytes: each block keeps its size in front of it
+static size_t heapBytes = 0;
 
-    bool contains(const Key& key) const {
-        return Base::contains({key, Value()});
+void* operator new(size_t n) {
+    size_t* p = static_cast<size_t*>(malloc(n + 16));
+    if (!p) {
+        throw std::bad_alloc();
     }
+    *p = n;
+    heapBytes += n;
+    return p + 2;
+}
 
-    Value get(const Key& key) const {
-        size_t hashValue = this->hashFunction(key) % this->table.size();
-        int index = this->table[hashValue];
-        while (index != this->endOfList) {
-            if (this->comparer(this->entries[index].value.first, key)) {
-                return this->entries[index].value.second;
-            }
-            index = this->entries[index].next;
-        }
-        throw std::runtime_error("Key not found");
+void operator delete(void* p) noexcept {
+    if (p) {
+        size_t* block = static_cast<size_t*>(p) - 2;
+        heapBytes -= *block;
+        free(block);
     }
+}
 
-    bool remove(const Key& key) {
-        return Base::remove({key, Value()});
-    }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
 
-    class Iterator {
-    public:
-        Iterator(const HashMap& map, int index) : map(map), index(index) {}
+template <typename F>
+double seconds(F f) {
+    auto start = Clock::now();
+    f();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
 
-        bool operator!=(const Iterator& other) const {
-            return index != other.index;
+using Names = AuData::Dict<long>;
+using Weights = SparseArray<double>;
+
+struct Graph {
+    std::vector<std::unique_ptr<Names>> dicts;
+    std::vector<const char*> dictNodes;
+    std::vector<std::unique_ptr<Weights>> arrays;
+    std::vector<const char*> arrayNodes;
+    std::vector<AuData::DataObjPtr> slices;
+    std::vector<const char*> sliceNodes;
+    size_t objectBytes = 0;     // the objects themselves, which memory_usage() leaves out
+
+    template <typename F>
+    void forEach(F f) {
+        for (size_t i = 0; i < dicts.size(); ++i) {
+            f(dictNodes[i], *dicts[i]);
         }
-
-        const std::pair<Key, Value>& operator*() const {
-            return map.entries[index].value;
+        for (size_t i = 0; i < arrays.size(); ++i) {
+            f(arrayNodes[i], *arrays[i]);
         }
-
-        Iterator& operator++() {
-            do {
-                ++index;
-            } while (index < map.entries.size() && map.entries[index].next == map.endOfList);
-            return *this;
+        for (size_t i = 0; i < slices.size(); ++i) {
+            if (auto* d = dynamic_cast<Names*>(slices[i].get())) {
+                f(sliceNodes[i], *d);
+            } else {
+                f(sliceNodes[i], dynamic_cast<Weights&>(*slices[i]));
+            }
         }
+    }
+};
 
-    private:
-        const HashMap& map;
-        int index;
-    };
-
-    Iterator begin() const {
-        int startIndex = 0;
-        while (startIndex < this->entries.size() && this->entries[startIndex].next == this->endOfList) {
-            ++startIndex;
+void build(Graph& g, size_t scale) {
+    char buf[64];
+    for (size_t t = 0; t < 16; ++t) {
+        // column names: grown by inserts; every fourth table was cleared and reloaded smaller
+        auto names = std::make_unique<Names>(AuData::SchemaPtr());
+        size_t keys = 20000 * scale * (t % 4 + 1);
+        for (size_t i = 0; i < keys; ++i) {
+            snprintf(buf, sizeof(buf), "table_%02zu.column_%07zu", t, i);
+            names->insert(buf, long(i));
         }
-        return Iterator(*this, startIndex);
+        if (t % 4 == 0) {
+            names->clear();
+            for (size_t i = 0; i < keys / 10; ++i) {
+                snprintf(buf, sizeof(buf), "table_%02zu.column_%07zu", t, i);
+                names->insert(buf, long(i));
+            }
+        }
+        // weights: dense, 1% and 0.1% of 1M, appended
+        auto weights = std::make_unique<Weights>(AuData::SchemaPtr(), 0, -1.0);
+        size_t every = t % 3 == 0 ? 1 : t % 3 == 1 ? 100 : 1000;
+        for (size_t i = 0; i < 1000000 * scale / (every == 1 ? 8 : 1); ++i) {
+            double v = i % every ? -1.0 : double(i);
+            weights->vappend(&v);
+        }
+        // four partitions of each
+        for (size_t p = 0; p < 4; ++p) {
+            g.slices.push_back(names->slice(p * keys / 4, keys / 4));
+            g.sliceNodes.push_back("tables.names[slice]");
+            g.slices.push_back(weights->slice(p * weights->size() / 4, weights->size() / 4));
+            g.sliceNodes.push_back("tables.weights[slice]");
+        }
+        g.objectBytes += sizeof(Names) + sizeof(Weights) + 4 * (sizeof(Names) + sizeof(Weights));
+        g.dicts.push_back(std::move(names));
+        g.dictNodes.push_back("tables.names");
+        g.arrays.push_back(std::move(weights));
+        g.arrayNodes.push_back("tables.weights");
     }
+}
 
-    Iterator end() const {
-        return Iterator(*this, this->entries.size());
-    }
-};
+void report(const char* when, Graph& g, size_t heap) {
+    Util::MemoryReport report;
+    size_t accounted = 0;
+    double poll = seconds([&] {
+        g.forEach([&](const char* node, const auto& obj) {
+            obj.memory_report(report, node);
+            accounted += obj.size_bytes();
+        });
+    });
+    printf("\n%s:\n", when);
+    report.print();
+    accounted += g.objectBytes;
+    printf("heap %zu, accounted %zu (%.2f%%), slack %zu; memory_usage() of all: %.3f ms\n", heap, accounted,
+           100.0 * accounted / heap, report.total().slack, poll * 1e3);
+}
 
-class StorageHasherComparer {
-public:
-    StorageHasherComparer(const std::vector<char>& storage) : storage(storage) {}
+int main(int argc, char** argv) {
+    size_t scale = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1;
+    Graph g;
+    g.dicts.reserve(16);
+    g.dictNodes.reserve(16);
+    g.arrays.reserve(16);
+    g.arrayNodes.reserve(16);
+    g.slices.reserve(128);
+    g.sliceNodes.reserve(128);
+
+    size_t base = heapBytes;
+    build(g, scale);
+    size_t before = heapBytes - base;
+    report("as built", g, before);
+
+    // slices are done with: drop them so shrink_to_fit() may touch the stores
+    g.slices.clear();
+    g.sliceNodes.clear();
+    g.objectBytes = 16 * (sizeof(Names) + sizeof(Weights));
+    double shrink = seconds([&] { g.forEach([](const char*, auto& obj) { obj.shrink_to_fit(); }); });
+    size_t after = heapBytes - base;
+    report("slices dropped, after shrink_to_fit()", g, after);
+    printf("\nshrink_to_fit: %.2f ms, heap %zu -> %zu bytes\n", shrink * 1e3, before, after);
+    return 0;
+}
 
-    size_t operator()(const std::string_view& key) const {
-        return std::hash<std::string_view>{}(key);
-    }
+#endif
 
-    bool operator()(int index, const std::string_view& key) const {
-        return std::string_view(&storage[index], key.size()) == key;
-    }
+// ================================================================
+// to benchmark lazy loading under a memory cap:
+//   create file with:
+//          #define BENCH_LAZY_LOAD
+//          #include "Dict.h"
+//   compile with -O2 -std=c++20 and run, optionally with the directory for
+//   the spill files (default /tmp; /dev/shm for shared memory), the number
+//   of Dicts (default 64) and keys in each (default 50000).  Reports what a
+//   load from the spill file costs against building the Dict again, then
+//   runs skewed lookups -- 90% on a tenth of the Dicts -- with the pool
+//   capped at an eighth of the total
+
+#ifdef BENCH_LAZY_LOAD
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
 
-private:
-    const std::vector<char>& storage;
-};
+using Clock = std::chrono::steady_clock;
+using Names = AuData::Dict<long>;
 
-template <typename Value>
-class Dictionary {
-public:
-    Dictionary(size_t tableSize) : storage(), hasher(storage), comparer(storage), hashMap(tableSize, hasher, comparer) {}
+template <typename F>
+double seconds(F f) {
+    auto start = Clock::now();
+    f();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
 
-    bool add(const std::string& key, const Value& value) {
-        if (hashMap.contains(key)) {
-            return false; // Key already exists
-        }
-        size_t pos = storage.size();
-        storage.insert(storage.end(), key.begin(), key.end());
-        storage.push_back('\0'); // Null-terminate the string
-        hashMap.insert(std::string_view(&storage[pos], key.size()), {pos, value});
-        return true;
-    }
+std::string key(size_t dict, size_t i) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "dict_%03zu.column_%07zu", dict, i);
+    return buf;
+}
 
-    bool contains(const std::string& key) const {
-        return hashMap.contains(key);
+int main(int argc, char** argv) {
+    const char* dir = argc > 1 ? argv[1] : "/tmp";
+    size_t count = argc > 2 ? strtoull(argv[2], nullptr, 10) : 64;
+    size_t keys = argc > 3 ? strtoull(argv[3], nullptr, 10) : 50000;
+
+    Util::LoadPool pool(dir);
+    std::vector<std::unique_ptr<Names>> dicts;
+    double build = seconds([&] {
+        for (size_t k = 0; k < count; ++k) {
+            dicts.push_back(std::make_unique<Names>(AuData::SchemaPtr()));
+            for (size_t i = 0; i < keys; ++i) {
+                dicts[k]->insert(key(k, i), long(i));
+            }
+        }
+    });
+    for (auto& d : dicts) {
+        d->set_pool(&pool);
     }
+    size_t total = pool.loaded_bytes();
+    printf("%zu Dicts of %zu keys, %.1f MB, spill files in %s\n", count, keys, total / 1e6, dir);
 
-    Value get(const std::string& key) const {
-        return hashMap.get(key);
+    // first unload writes the files, later ones find them clean
+    double spill = seconds([&] {
+        for (auto& d : dicts) {
+            d->unload();
+        }
+    });
+    long bad = 0;
+    double load = seconds([&] {
+        for (size_t k = 0; k < count; ++k) {
+            bad += dicts[k]->lookup(key(k, 1), -1) != 1;
+        }
+    });
+    double unload = seconds([&] {
+        for (auto& d : dicts) {
+            d->unload();
+        }
+    });
+    printf("per Dict, ms: build %.2f, spill %.2f, load %.2f (%.1fx faster than build), clean unload %.3f\n",
+           build / count * 1e3, spill / count * 1e3, load / count * 1e3, build / load, unload / count * 1e3);
+
+    pool.set_cap(total / 8);
+    size_t lookups = 200000, hot = std::max<size_t>(1, count / 10), maxLoaded = 0;
+    uint64_t loads = pool.loads(), spills = pool.spills();
+    unsigned seed = 1;
+    double run = seconds([&] {
+        for (size_t n = 0; n < lookups; ++n) {
+            seed = seed * 1103515245 + 12345;
+            size_t k = (seed >> 4) % 10 ? (seed >> 8) % hot : (seed >> 8) % count;
+            size_t i = (seed >> 12) % keys;
+            bad += dicts[k]->lookup(key(k, i), -1) != long(i);
+            if (n % 1000 == 0) {
+                maxLoaded = std::max(maxLoaded, pool.loaded_bytes());
+            }
+        }
+    });
+    printf("skewed lookups under a cap of %.1f MB: %.2f us per lookup, %llu loads, %llu spills, "
+           "at most %.1f MB loaded\n",
+           total / 8 / 1e6, run / lookups * 1e6, (unsigned long long)(pool.loads() - loads),
+           (unsigned long long)(pool.spills() - spills), maxLoaded / 1e6);
+    if (bad) {
+        printf("FAIL: %ld wrong values\n", bad);
     }
+    return bad != 0;
+}
 
-    bool remove(const std::string& key) {
-        return hashMap.remove(key);
-    }
+#endif
 
-    class Iterator {
-    public:
-        Iterator(const Dictionary& dict, typename HashMap<std::string_view, std::pair<int, Value>, StorageHasherComparer>::Iterator it)
-            : dict(dict), it(it) {}
+// ================================================================
+// to benchmark moving a Dict between processes as frames:
+//   create file with:
+//          #define BENCH_FRAMES
+//          #include "Dict.h"
+//   compile with -O2 -std=c++20 -pthread and run, optionally with the size of
+//   the Dict in MB (default 1024).  Sends it over a Unix socketpair to a
+//   receiving thread twice: as frames adopted as they are, and as names and
+//   values packed into a buffer and inserted again at the other end -- the
+//   rebuild a receiver does without frames
 
-        bool operator!=(const Iterator& other) const {
-            return it != other.it;
-        }
+#ifdef BENCH_FRAMES
 
-        std::pair<std::string, Value> operator*() const {
-            const auto& entry = *it;
-            return {std::string(&dict.storage[entry.second.first]), entry.second.second};
-        }
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
 
-        Iterator& operator++() {
-            ++it;
-            return *this;
-        }
+#include <sys/socket.h>
 
-    private:
-        const Dictionary& dict;
-        typename HashMap<std::string_view, std::pair<int, Value>, StorageHasherComparer>::Iterator it;
-    };
+using Clock = std::chrono::steady_clock;
+using Names = AuData::Dict<long>;
 
-    Iterator begin() const {
-        return Iterator(*this, hashMap.begin());
-    }
+template <typename F>
+double seconds(F f) {
+    auto start = Clock::now();
+    f();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
 
-    Iterator end() const {
-        return Iterator(*this, hashMap.end());
-    }
+std::string key(size_t i) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "table_%04zu.column_%09zu", i % 1000, i);
+    return buf;
+}
 
-private:
-    std::vector<char> storage;
-    StorageHasherComparer hasher;
-    StorageHasherComparer comparer;
-    HashMap<std::string_view, std::pair<int, Value>, StorageHasherComparer, StorageHasherComparer> hashMap;
-};
+// a length, then the bytes
+void sendBuffer(int fd, std::vector<char>& buf) {
+    uint64_t n = buf.size();
+    iovec iov[2] = {{&n, sizeof(n)}, {buf.data(), buf.size()}};
+    Util::frame_io(fd, iov, 2, true);
+}
 
-int main() {
-    HashSet<const char*, CStringHash, CStringEqual> hashSet(10);
-    hashSet.insert("hello");
-    hashSet.insert("world");
+std::vector<char> receiveBuffer(int fd) {
+    uint64_t n;
+    iovec head = {&n, sizeof(n)};
+    Util::frame_io(fd, &head, 1, false);
+    std::vector<char> buf(n);
+    iovec body = {buf.data(), buf.size()};
+    Util::frame_io(fd, &body, 1, false);
+    return buf;
+}
 
-    for (const auto& value : hashSet) {
-        std::cout << "HashSet value: " << value << std::endl;
+int main(int argc, char** argv) {
+    size_t megabytes = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1024;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        perror("socketpair");
+        return 1;
     }
 
-    HashMap<const char*, int, CStringHash, CStringEqual> hashMap(10);
-    hashMap.insert("hello", 1);
-    hashMap.insert("world", 2);
-
-    for (const auto& pair : hashMap) {
-        std::cout << "HashMap key: " << pair.first << ", value: " << pair.second << std::endl;
+    Names sent(AuData::SchemaPtr{});
+    size_t keys = 0;
+    while (sent.size_bytes() < megabytes << 20) {
+        for (size_t end = keys + 100000; keys < end; ++keys) {
+            sent.insert(key(keys), long(keys));
+        }
     }
+    double bytes = sent.size_bytes();
+    printf("Dict of %zu keys, %.1f MB\n", keys, bytes / 1e6);
+    long bad = 0;
 
-    Dictionary<int> dict(10);
-    dict.add("hello", 1);
-    dict.add("world", 2);
-
-    for (const auto& pair : dict) {
-        std::cout << "Dictionary key: " << pair.first << ", value: " << pair.second << std::endl;
+    double adopt;
+    {
+        Names received(AuData::SchemaPtr{});
+        adopt = seconds([&] {
+            std::thread sender([&] { Util::send_frames(sv[0], sent.frames()); });
+            received.adopt_frames(sv[1]);
+            sender.join();
+        });
+        bad += received.size() != keys || received.lookup(key(keys / 2), -1) != long(keys / 2);
     }
 
-    dict.remove("hello");
+    double rebuild;
+    {
+        Names received(AuData::SchemaPtr{});
+        rebuild = seconds([&] {
+            std::thread sender([&] {
+                std::vector<char> buf;
+                const auto& entries = sent.d->get_hash_data();
+                for (size_t id = 0; id < sent.d->id_end(); ++id) {
+                    if (sent.d->live(id)) {
+                        const char* name = sent.names->data() + entries[id].val.first;
+                        long value = entries[id].val.second;
+                        buf.insert(buf.end(), name, name + strlen(name) + 1);
+                        buf.insert(buf.end(), (const char*)&value, (const char*)(&value + 1));
+                    }
+                }
+                sendBuffer(sv[0], buf);
+            });
+            std::vector<char> buf = receiveBuffer(sv[1]);
+            for (const char* p = buf.data(); p < buf.data() + buf.size();) {
+                size_t n = strlen(p);
+                long value;
+                memcpy(&value, p + n + 1, sizeof(value));
+                received.insert(std::string_view(p, n), value);
+                p += n + 1 + sizeof(value);
+            }
+            sender.join();
+        });
+        bad += received.size() != keys || received.lookup(key(keys / 3), -1) != long(keys / 3);
+    }
 
-    if (!dict.contains("hello")) {
-        std::cout << "Key 'hello' not found in dictionary" << std::endl;
+    printf("frames, adopted:   %8.3f s  %7.0f MB/s\n", adopt, bytes / adopt / 1e6);
+    printf("packed, rebuilt:   %8.3f s  %7.0f MB/s  (%.1fx the time)\n", rebuild, bytes / rebuild / 1e6,
+           rebuild / adopt);
+    if (bad) {
+        printf("FAIL: %ld wrong dicts\n", bad);
     }
+    close(sv[0]);
+    close(sv[1]);
+    return bad != 0;
+}
 
-    return 0;
-}
\ No newline at end of file
+#endif
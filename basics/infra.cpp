@@ -10,9 +10,48 @@
 #include <memory>
 #include <cassert>
 #include <type_traits>
-
-// Debugging macro (can be enabled or disabled)
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <cstddef>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <climits>
+#include <stdexcept>
+#include <poll.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+// Debugging macro: build with -DINFRA_DEBUG_SERIALIZE to trace every field to std::cout
+#ifdef INFRA_DEBUG_SERIALIZE
 #define DBG_SERIALIZE(x) x
+#else
+#define DBG_SERIALIZE(x)
+#endif
+
+// The benchmarks at the end of the file replace the example server and client mains
+#if defined(BENCH_ALLOCATORS) || defined(BENCH_PAGES) || defined(BENCH_MMAP) || defined(BENCH_SERIALIZE) || \
+    defined(BENCH_WIRE)
+#define INFRA_BENCH
+#endif
 
 // Abstract MemoryAllocator class
 class MemoryAllocator {
@@ -20,6 +59,14 @@ public:
     virtual ~MemoryAllocator() = default;
     virtual uint8_t* allocate(size_t size) = 0;
     virtual void deallocate(uint8_t* data) = 0;
+
+    // 'data' resized to 'newSize', moved if it must be; the first min(oldSize, newSize) bytes are kept
+    virtual uint8_t* reallocate(uint8_t* data, size_t oldSize, size_t newSize) {
+        uint8_t* moved = allocate(newSize);
+        std::memcpy(moved, data, std::min(oldSize, newSize));
+        deallocate(data);
+        return moved;
+    }
 };
 
 // CPUMemoryAllocator class
@@ -34,29 +81,602 @@ public:
 };
 
 // MMapMemoryAllocator class
+// Shared mappings of a file per allocation, for arrays larger than memory or shared with
+// other processes:
+//   File      a unique file in 'dir', unlinked at once unless 'keepFiles' (then on deallocate
+//             it is left for another process or a later run)
+//   Memfd     memfd_create: anonymous memory another process can map through fd()
+//   map()     a file the caller names, created or extended to 'size', or its whole size for 0
+//             (not an empty file); the file stays
+// Each mapping's size, fd and path are kept, so deallocate() needs only the address.
+// reallocate() extends the file and mremaps, in place if the address space allows.
 class MMapMemoryAllocator : public MemoryAllocator {
 public:
+    enum class Backing { File, Memfd };
+
+private:
+    struct Mapping {
+        size_t size;
+        int fd;
+        std::string path;       // a kept file
+    };
+
+    Backing backing;
+    std::string dir;
+    bool keepFiles;
+    std::mutex lock;
+    std::unordered_map<uint8_t*, Mapping> mappings;
+
+    uint8_t* mapFd(int fd, size_t size, const std::string& path) {
+        void* p = mmap(nullptr, std::max<size_t>(size, 1), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Failed to mmap " + (path.empty() ? std::string("file") : path));
+        }
+        uint8_t* data = static_cast<uint8_t*>(p);
+        std::lock_guard<std::mutex> guard(lock);
+        mappings[data] = {size, fd, path};
+        return data;
+    }
+
+    Mapping& find(uint8_t* data) {
+        auto it = mappings.find(data);
+        if (it == mappings.end()) {
+            throw std::runtime_error("Not mapped by this allocator");
+        }
+        return it->second;
+    }
+
+    // [offset, offset + length) clipped to the mapping, widened to whole pages
+    std::pair<uint8_t*, size_t> pages(uint8_t* data, size_t offset, size_t length) {
+        size_t size = this->size(data);
+        offset = std::min(offset, size);
+        length = std::min(length, size - offset);
+        size_t start = offset & ~size_t(4095);
+        return {data + start, length + (offset - start)};
+    }
+
+public:
+    explicit MMapMemoryAllocator(Backing backing = Backing::File, const std::string& dir = "/tmp",
+                                 bool keepFiles = false)
+        : backing(backing), dir(dir), keepFiles(keepFiles) {}
+
+    ~MMapMemoryAllocator() {
+        for (auto& [data, m] : mappings) {
+            munmap(data, std::max<size_t>(m.size, 1));
+            close(m.fd);
+        }
+    }
+
     uint8_t* allocate(size_t size) override {
-        int fd = open("/tmp/mmapfile", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        int fd;
+        std::string path;
+        if (backing == Backing::Memfd) {
+            fd = memfd_create("mmap_array", MFD_CLOEXEC);
+        } else {
+            path = dir + "/mmap.XXXXXX";
+            fd = mkostemp(path.data(), O_CLOEXEC);
+            if (fd != -1 && !keepFiles) {
+                unlink(path.c_str());
+                path.clear();
+            }
+        }
         if (fd == -1) {
-            throw std::runtime_error("Failed to open file for mmap");
+            throw std::runtime_error("Failed to create a file for mmap in " + dir);
         }
         if (ftruncate(fd, size) == -1) {
             close(fd);
             throw std::runtime_error("Failed to set file size for mmap");
         }
-        uint8_t* data = static_cast<uint8_t*>(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
-        close(fd);
-        if (data == MAP_FAILED) {
-            throw std::runtime_error("Failed to mmap file");
+        return mapFd(fd, size, path);
+    }
+
+    // the file at 'path', made 'size' bytes long if shorter; all of it for size 0, which an
+    // empty file has not got
+    uint8_t* map(const std::string& path, size_t size = 0) {
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (fd == -1) {
+            throw std::runtime_error("Failed to open " + path + " for mmap");
+        }
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            close(fd);
+            throw std::runtime_error("Failed to open " + path + " for mmap");
+        }
+        if (size == 0 && st.st_size == 0) {
+            close(fd);
+            throw std::runtime_error("Failed to mmap " + path + ": the file is empty");
+        }
+        if (size > size_t(st.st_size) && ftruncate(fd, size) == -1) {
+            close(fd);
+            throw std::runtime_error("Failed to set size of " + path);
+        }
+        return mapFd(fd, size ? size : st.st_size, path);
+    }
+
+    void deallocate(uint8_t* data) override {
+        Mapping m;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = mappings.find(data);
+            if (it == mappings.end()) {
+                throw std::runtime_error("Failed to munmap: not mapped by this allocator");
+            }
+            m = it->second;
+            mappings.erase(it);
+        }
+        munmap(data, std::max<size_t>(m.size, 1));
+        close(m.fd);
+    }
+
+    uint8_t* reallocate(uint8_t* data, size_t, size_t newSize) override {
+        std::lock_guard<std::mutex> guard(lock);
+        Mapping& m = find(data);
+        if (newSize > m.size && ftruncate(m.fd, newSize) == -1) {
+            throw std::runtime_error("Failed to grow file for mmap");
+        }
+        void* p = mremap(data, std::max<size_t>(m.size, 1), std::max<size_t>(newSize, 1), MREMAP_MAYMOVE);
+        if (p == MAP_FAILED) {
+            throw std::runtime_error("Failed to mremap");
+        }
+        Mapping moved = m;
+        moved.size = newSize;
+        mappings.erase(data);
+        mappings[static_cast<uint8_t*>(p)] = moved;
+        return static_cast<uint8_t*>(p);
+    }
+
+    // write dirty pages of [offset, offset + length) back to the file, waiting for them unless 'async'
+    void sync(uint8_t* data, bool async = false, size_t offset = 0, size_t length = ~size_t(0)) {
+        auto [start, bytes] = pages(data, offset, length);
+        if (bytes && msync(start, bytes, async ? MS_ASYNC : MS_SYNC) == -1) {
+            throw std::runtime_error("Failed to msync");
         }
+    }
+
+    // madvise over [offset, offset + length): MADV_SEQUENTIAL, MADV_WILLNEED, MADV_DONTNEED...
+    void advise(uint8_t* data, int advice, size_t offset = 0, size_t length = ~size_t(0)) {
+        auto [start, bytes] = pages(data, offset, length);
+        if (bytes) {
+            madvise(start, bytes, advice);
+        }
+    }
+
+    size_t size(uint8_t* data) {
+        std::lock_guard<std::mutex> guard(lock);
+        return find(data).size;
+    }
+
+    // the file descriptor behind 'data', e.g. to pass a memfd to another process
+    int fd(uint8_t* data) {
+        std::lock_guard<std::mutex> guard(lock);
+        return find(data).fd;
+    }
+
+    // the file behind 'data' if it was kept or named by the caller, else ""
+    std::string path(uint8_t* data) {
+        std::lock_guard<std::mutex> guard(lock);
+        return find(data).path;
+    }
+};
+
+// ArenaAllocator class
+// Bump allocation out of large chunks, for memory that dies together, e.g. everything a
+// request deserializes.  deallocate() is a no-op; reset() frees it all at once and keeps
+// the largest chunk for the next round.  Not thread safe: forThread() gives each thread
+// its own arena.
+class ArenaAllocator : public MemoryAllocator {
+private:
+    static constexpr size_t alignment = alignof(std::max_align_t);
+
+    size_t chunkSize;
+    std::vector<std::unique_ptr<uint8_t[]>> chunks;
+    std::vector<size_t> chunkSizes;
+    uint8_t* next = nullptr;
+    uint8_t* end = nullptr;
+    size_t used = 0;
+
+    void newChunk(size_t size) {
+        size = std::max(size, chunkSize);
+        chunks.emplace_back(new uint8_t[size]);
+        chunkSizes.push_back(size);
+        next = chunks.back().get();
+        end = next + size;
+    }
+
+public:
+    explicit ArenaAllocator(size_t chunkSize = 1 << 20) : chunkSize(chunkSize) {}
+
+    // the calling thread's arena; buffers that hold it keep it alive after the thread exits
+    static std::shared_ptr<ArenaAllocator> forThread() {
+        thread_local std::shared_ptr<ArenaAllocator> arena = std::make_shared<ArenaAllocator>();
+        return arena;
+    }
+
+    uint8_t* allocate(size_t size) override {
+        size = (size + alignment - 1) & ~(alignment - 1);
+        if (size > size_t(end - next)) {
+            newChunk(size);
+        }
+        uint8_t* data = next;
+        next += size;
+        used += size;
         return data;
     }
 
-    void deallocate(uint8_t* data, size_t size) override {
-        if (munmap(data, size) == -1) {
-            throw std::runtime_error("Failed to munmap file");
+    void deallocate(uint8_t*) override {}
+
+    // free everything allocated since the last reset: no buffer from this arena may be in use
+    void reset() {
+        if (chunks.size() > 1) {
+            size_t largest = std::max_element(chunkSizes.begin(), chunkSizes.end()) - chunkSizes.begin();
+            std::swap(chunks[0], chunks[largest]);
+            std::swap(chunkSizes[0], chunkSizes[largest]);
+            chunks.resize(1);
+            chunkSizes.resize(1);
         }
+        next = chunks.empty() ? nullptr : chunks[0].get();
+        end = chunks.empty() ? nullptr : next + chunkSizes[0];
+        used = 0;
+    }
+
+    size_t bytesUsed() const {
+        return used;
+    }
+};
+
+// PoolAllocator class
+// Size classes of 16 bytes to 64 KB, powers of two; larger sizes go to the heap.  Each
+// thread allocates from a cache of its own with no locking: a free list per class,
+// refilled by carving 256 KB slabs.  A block keeps its owner in a header, and a thread
+// freeing another thread's block pushes it on that owner's lock-free remote list, which
+// the owner takes back in one exchange when a free list runs dry.  Caches and slabs live
+// as long as the pool.  A thread keeps a cache per pool it uses; when it exits, its caches
+// go back to their pools, and the next thread new to a pool adopts one whole: its free
+// lists, its slabs and the blocks other threads freed to it since.
+class PoolAllocator : public MemoryAllocator {
+private:
+    static constexpr size_t minShift = 4;
+    static constexpr size_t classes = 13;                   // 16 .. 64 KB
+    static constexpr size_t slabSize = 256 << 10;
+    static constexpr uint32_t large = ~0u;
+
+    struct ThreadCache;
+
+    struct alignas(std::max_align_t) Header {
+        ThreadCache* owner;
+        uint32_t sizeClass;
+    };
+
+    struct Block {
+        Block* next;
+    };
+
+    struct ThreadCache {
+        Block* free[classes] = {};
+        std::atomic<Block*> remote{nullptr};
+        std::vector<std::unique_ptr<uint8_t[]>> slabs;
+    };
+
+    static size_t classSize(size_t c) {
+        return size_t(1) << (c + minShift);
+    }
+
+    static size_t sizeClass(size_t size) {
+        size_t c = 0;
+        while (c < classes && classSize(c) < size) {
+            c++;
+        }
+        return c;
+    }
+
+    static Header* header(uint8_t* data) {
+        return reinterpret_cast<Header*>(data - sizeof(Header));
+    }
+
+    // the caches; threads reach it weakly, so a pool may die before a thread that used it
+    struct Shared {
+        std::mutex lock;
+        std::vector<std::unique_ptr<ThreadCache>> caches;
+        std::vector<ThreadCache*> orphans;      // their threads exited
+    };
+
+    // a thread's caches, by pool serial, the last used first.  At thread exit they go to
+    // their pools' orphans; 'exited' stays readable for later thread_local destructors
+    struct ThreadCaches {
+        struct Use {
+            uint64_t serial;
+            std::weak_ptr<Shared> shared;
+            ThreadCache* cache;
+        };
+        std::vector<Use> uses;
+        static inline thread_local bool exited = false;
+
+        ~ThreadCaches() {
+            exited = true;
+            for (Use& u : uses) {
+                if (auto shared = u.shared.lock()) {
+                    std::lock_guard<std::mutex> guard(shared->lock);
+                    shared->orphans.push_back(u.cache);
+                }
+            }
+        }
+    };
+
+    static std::atomic<uint64_t> serials;
+    const uint64_t serial = serials++;
+    std::shared_ptr<Shared> shared = std::make_shared<Shared>();
+
+    // the calling thread's cache for this pool: found by serial, else an orphan adopted or
+    // a new one.  nullptr once the thread is exiting
+    ThreadCache* cache() {
+        thread_local ThreadCaches mine;
+        if (ThreadCaches::exited) {
+            return nullptr;
+        }
+        auto& uses = mine.uses;
+        if (!uses.empty() && uses[0].serial == serial) {
+            return uses[0].cache;
+        }
+        for (size_t i = 1; i < uses.size(); i++) {
+            if (uses[i].serial == serial) {
+                std::swap(uses[0], uses[i]);
+                return uses[0].cache;
+            }
+        }
+        uses.erase(std::remove_if(uses.begin(), uses.end(), [](const auto& u) { return u.shared.expired(); }),
+                   uses.end());
+        ThreadCache* c;
+        {
+            std::lock_guard<std::mutex> guard(shared->lock);
+            if (!shared->orphans.empty()) {
+                c = shared->orphans.back();
+                shared->orphans.pop_back();
+            } else {
+                shared->caches.push_back(std::make_unique<ThreadCache>());
+                c = shared->caches.back().get();
+            }
+        }
+        uses.insert(uses.begin(), {serial, shared, c});
+        return c;
+    }
+
+    static uint8_t* allocateLarge(size_t size) {
+        Header* h = static_cast<Header*>(::operator new(sizeof(Header) + size));
+        h->owner = nullptr;
+        h->sizeClass = large;
+        return reinterpret_cast<uint8_t*>(h + 1);
+    }
+
+    // blocks other threads freed back onto their free lists, else a new slab's worth
+    void refill(ThreadCache& c, size_t sc) {
+        for (Block* b = c.remote.exchange(nullptr, std::memory_order_acquire); b;) {
+            Block* next = b->next;
+            Header* h = header(reinterpret_cast<uint8_t*>(b));
+            b->next = c.free[h->sizeClass];
+            c.free[h->sizeClass] = b;
+            b = next;
+        }
+        if (c.free[sc]) {
+            return;
+        }
+        size_t stride = sizeof(Header) + classSize(sc);
+        c.slabs.emplace_back(new uint8_t[slabSize]);
+        uint8_t* slab = c.slabs.back().get();
+        for (size_t off = 0; off + stride <= slabSize; off += stride) {
+            Header* h = reinterpret_cast<Header*>(slab + off);
+            h->owner = &c;
+            h->sizeClass = uint32_t(sc);
+            Block* b = reinterpret_cast<Block*>(h + 1);
+            b->next = c.free[sc];
+            c.free[sc] = b;
+        }
+    }
+
+public:
+    uint8_t* allocate(size_t size) override {
+        size_t sc = sizeClass(size);
+        ThreadCache* c = sc == classes ? nullptr : cache();
+        if (!c) {
+            return allocateLarge(size);     // too big, or the thread's caches are gone
+        }
+        if (!c->free[sc]) {
+            refill(*c, sc);
+        }
+        Block* b = c->free[sc];
+        c->free[sc] = b->next;
+        return reinterpret_cast<uint8_t*>(b);
+    }
+
+    void deallocate(uint8_t* data) override {
+        if (!data) {
+            return;
+        }
+        Header* h = header(data);
+        if (h->sizeClass == large) {
+            ::operator delete(h);
+            return;
+        }
+        Block* b = reinterpret_cast<Block*>(data);
+        ThreadCache* c = cache();
+        if (h->owner == c) {
+            b->next = c->free[h->sizeClass];
+            c->free[h->sizeClass] = b;
+            return;
+        }
+        b->next = h->owner->remote.load(std::memory_order_relaxed);
+        while (!h->owner->remote.compare_exchange_weak(b->next, b, std::memory_order_release,
+                                                       std::memory_order_relaxed)) {
+        }
+    }
+};
+
+inline std::atomic<uint64_t> PoolAllocator::serials{1};
+
+// AlignedMemoryAllocator class
+// Heap memory aligned to 'alignment' (a power of two): 64 for cache lines, 4096 for pages
+class AlignedMemoryAllocator : public MemoryAllocator {
+private:
+    size_t alignment;
+
+public:
+    explicit AlignedMemoryAllocator(size_t alignment = 64) : alignment(alignment) {
+        assert(alignment && (alignment & (alignment - 1)) == 0);
+    }
+
+    uint8_t* allocate(size_t size) override {
+        void* data = std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+        if (!data) {
+            throw std::bad_alloc();
+        }
+        return static_cast<uint8_t*>(data);
+    }
+
+    void deallocate(uint8_t* data) override {
+        std::free(data);
+    }
+};
+
+// How PageMemoryAllocator maps memory
+struct PagePolicy {
+    enum class HugePages {
+        None,           // 4 KB pages
+        Transparent,    // madvise(MADV_HUGEPAGE) on a 2 MB aligned mapping; THP must be "madvise" or "always"
+        Explicit        // MAP_HUGETLB from the reserved pool (vm.nr_hugepages), else Transparent
+    };
+    enum class Placement {
+        FirstTouch,     // each page on the node of the thread that first writes it
+        Bind,           // mbind to 'node'
+        Interleave      // mbind interleaved over all nodes
+    };
+
+    static constexpr int maxNodes = 1024;       // the nodes mbind's mask has room for
+
+    HugePages hugePages = HugePages::None;
+    Placement placement = Placement::FirstTouch;
+    int node = 0;               // 0 .. PagePolicy::maxNodes - 1
+    bool populate = false;      // fault every page in now (MAP_POPULATE), after placement
+    size_t touchThreads = 0;    // FirstTouch: fault the pages in now from this many threads, each its
+                                // share in order, to place them where as many workers will read them
+};
+
+// PageMemoryAllocator class
+// Anonymous mappings, page aligned (2 MB with huge pages), for the large arrays we stream.
+// Sizes are kept per mapping for munmap.
+class PageMemoryAllocator : public MemoryAllocator {
+private:
+    static constexpr size_t pageSize = 4096;
+    static constexpr size_t hugePageSize = 2 << 20;
+
+    PagePolicy policy;
+    std::mutex lock;
+    std::unordered_map<uint8_t*, size_t> sizes;
+
+    static size_t roundUp(size_t size, size_t to) {
+        return (size + to - 1) & ~(to - 1);
+    }
+
+    // 'size' bytes aligned to 'alignment': map more, unmap the ends
+    static uint8_t* mapAligned(size_t size, size_t alignment, int flags) {
+        size_t extra = alignment > pageSize ? alignment : 0;
+        void* p = mmap(nullptr, size + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+        if (p == MAP_FAILED) {
+            return nullptr;
+        }
+        uint8_t* data = static_cast<uint8_t*>(p);
+        if (extra) {
+            uint8_t* aligned = reinterpret_cast<uint8_t*>(roundUp(reinterpret_cast<uintptr_t>(data), alignment));
+            if (aligned > data) {
+                munmap(data, aligned - data);
+            }
+            munmap(aligned + size, data + extra - aligned);
+            data = aligned;
+        }
+        return data;
+    }
+
+    void place(uint8_t* data, size_t size) {
+        constexpr int bind = 2, interleave = 3;      // MPOL_BIND, MPOL_INTERLEAVE from <numaif.h>
+        if (policy.placement == PagePolicy::Placement::FirstTouch) {
+            return;
+        }
+        unsigned long mask[PagePolicy::maxNodes / 64] = {};
+        if (policy.placement == PagePolicy::Placement::Bind) {
+            mask[policy.node / 64] = 1ul << (policy.node % 64);
+        } else {
+            std::fill(std::begin(mask), std::end(mask), ~0ul);
+        }
+        int mode = policy.placement == PagePolicy::Placement::Bind ? bind : interleave;
+        if (syscall(SYS_mbind, data, size, mode, mask, sizeof(mask) * 8, 0) != 0 && mode == bind) {
+            throw std::runtime_error("Failed to bind memory to NUMA node " + std::to_string(policy.node));
+        }
+    }
+
+    void touch(uint8_t* data, size_t size, size_t threads) {
+        size_t pages = size / pageSize;
+        threads = std::min(threads, pages);
+        std::vector<std::thread> touchers;
+        for (size_t t = 0; t < threads; ++t) {
+            touchers.emplace_back([=] {
+                for (size_t p = pages * t / threads; p < pages * (t + 1) / threads; ++p) {
+                    data[p * pageSize] = 0;
+                }
+            });
+        }
+        for (auto& t : touchers) {
+            t.join();
+        }
+    }
+
+public:
+    explicit PageMemoryAllocator(const PagePolicy& policy = PagePolicy()) : policy(policy) {
+        if (policy.node < 0 || policy.node >= PagePolicy::maxNodes) {
+            throw std::invalid_argument("No NUMA node " + std::to_string(policy.node));
+        }
+    }
+
+    uint8_t* allocate(size_t size) override {
+        bool huge = policy.hugePages != PagePolicy::HugePages::None;
+        size = roundUp(std::max<size_t>(size, 1), huge ? hugePageSize : pageSize);
+        // pages are faulted in after mbind, so MAP_POPULATE is left for after it
+        int populate = policy.populate && policy.placement == PagePolicy::Placement::FirstTouch ? MAP_POPULATE : 0;
+        uint8_t* data = nullptr;
+        if (policy.hugePages == PagePolicy::HugePages::Explicit) {
+            data = mapAligned(size, hugePageSize, MAP_HUGETLB | populate);
+        }
+        if (!data) {
+            data = mapAligned(size, huge ? hugePageSize : pageSize, populate);
+            if (!data) {
+                throw std::bad_alloc();
+            }
+            if (huge) {
+                madvise(data, size, MADV_HUGEPAGE);
+            }
+        }
+        place(data, size);
+        if (policy.populate && !populate && madvise(data, size, MADV_POPULATE_WRITE) != 0) {
+            touch(data, size, 1);      // before Linux 5.14
+        }
+        if (policy.placement == PagePolicy::Placement::FirstTouch && !policy.populate) {
+            touch(data, size, policy.touchThreads);
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        sizes[data] = size;
+        return data;
+    }
+
+    void deallocate(uint8_t* data) override {
+        size_t size;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = sizes.find(data);
+            if (it == sizes.end()) {
+                throw std::runtime_error("Failed to munmap: not mapped by this allocator");
+            }
+            size = it->second;
+            sizes.erase(it);
+        }
+        munmap(data, size);
     }
 };
 
@@ -71,6 +691,11 @@ public:
         : size(size), allocator(allocator) {
         data = allocator->allocate(size);
     }
+    // takes 'data', which 'allocator' allocated
+    buffer(uint8_t* data, size_t size, std::shared_ptr<MemoryAllocator> allocator)
+        : data(data), size(size), allocator(allocator) {}
+    buffer(const buffer&) = delete;
+    buffer& operator=(const buffer&) = delete;
     ~buffer() {
         allocator->deallocate(data);
     }
@@ -80,26 +705,145 @@ public:
     size_t getSize() const {
         return size;
     }
+    std::shared_ptr<MemoryAllocator> getAllocator() const {
+        return allocator;
+    }
+    // getData() may change
+    void resize(size_t newSize) {
+        data = allocator->reallocate(data, size, newSize);
+        size = newSize;
+    }
 };
 
 // SerializeBuffer class
+// Writes fields one after another, in one of four modes:
+//   sizing      SerializeBuffer::sizing(): writes nothing, counts getSize(), for a first pass
+//   memory      (out, capacity): into memory allocated once, e.g. a buffer of the size a
+//               sizing pass gave; throws if it is too small
+//   vector      (vec): appended to a std::vector<char>, whose capacity grows by doubling;
+//               it holds just the fields written so far at any time
+//   segments    (vec, segments, minReference): like vector, but reference() payloads of at
+//               least minReference bytes are not copied: finish() lists the pieces in order
+//               as iovecs for writev, valid as long as vec and the payloads are
+// Fields are copied with a single memcpy each.  serialize() does both passes.
 class SerializeBuffer {
-    // Reference to the buffer where serialized data will be stored
-    std::vector<char>& buffer;
+    std::vector<char>* vec = nullptr;
+    uint8_t* out = nullptr;
+    size_t capacity = 0;
+    size_t pos = 0;             // bytes written to 'out' or 'vec'
+    size_t size = 0;            // bytes serialized, referenced ones included
+    std::vector<iovec>* segments = nullptr;
+    size_t minReference = 0;
+    size_t copiedFrom = 0;      // start of the copied bytes since the last reference
+    std::vector<size_t> copied; // segments of copied bytes, based at an offset into 'vec' until finish()
+
+    SerializeBuffer() = default;
+
+    // room for 'n' more bytes at 'pos' in 'out'
+    uint8_t* reserve(size_t n) {
+        if (pos + n > capacity) {
+            throw std::runtime_error("SerializeBuffer overflow");
+        }
+        return out + pos;
+    }
+
+    // 'n' bytes appended to 'vec', copied once: capacity grows by doubling, or is what the
+    // caller's reserve() gave it, so a sized vector is allocated once
+    void append(const void* ptr, size_t n) {
+        if (pos + n > vec->capacity()) {
+            vec->reserve(std::max(pos + n, 2 * vec->capacity()));
+        }
+        const char* bytes = static_cast<const char*>(ptr);
+        vec->insert(vec->end(), bytes, bytes + n);
+    }
+
+    // the copied bytes since the last reference, as a segment; 'vec' may still move
+    void closeSegment() {
+        if (pos > copiedFrom) {
+            copied.push_back(segments->size());
+            segments->push_back({reinterpret_cast<void*>(copiedFrom), pos - copiedFrom});
+        }
+        copiedFrom = pos;
+    }
 
 public:
-    // Constructor that initializes the buffer reference
-    SerializeBuffer(std::vector<char>& vec) : buffer(vec) {}
+    // Constructor that initializes the buffer reference: fields are appended to 'vec'
+    SerializeBuffer(std::vector<char>& vec) : vec(&vec), pos(vec.size()) {}
+
+    SerializeBuffer(uint8_t* out, size_t capacity) : out(out), capacity(capacity) {}
+
+    SerializeBuffer(std::vector<char>& vec, std::vector<iovec>& segments, size_t minReference = 64 << 10)
+        : vec(&vec), pos(vec.size()), segments(&segments), minReference(minReference), copiedFrom(vec.size()) {}
+
+    SerializeBuffer(const SerializeBuffer&) = delete;
+    SerializeBuffer& operator=(const SerializeBuffer&) = delete;
+
+    ~SerializeBuffer() {
+        finish();
+    }
+
+    static SerializeBuffer sizing() {
+        return SerializeBuffer();
+    }
+
+    // 'obj.serialize(SerializeBuffer&)' sized, then into a buffer allocated once by 'allocator'
+    template <typename T>
+    static std::shared_ptr<buffer> serialize(const T& obj,
+                                             std::shared_ptr<MemoryAllocator> allocator = std::make_shared<CPUMemoryAllocator>()) {
+        SerializeBuffer sizer = sizing();
+        obj.serialize(sizer);
+        auto buf = std::make_shared<buffer>(sizer.getSize(), allocator);
+        SerializeBuffer writer(buf->getData(), buf->getSize());
+        obj.serialize(writer);
+        return buf;
+    }
+
+    // bytes serialized so far
+    size_t getSize() const {
+        return size;
+    }
+
+    // fill in the segments; no more fields after this
+    void finish() {
+        if (!vec) {
+            return;
+        }
+        if (segments) {
+            closeSegment();
+        }
+        for (size_t i : copied) {
+            (*segments)[i].iov_base = vec->data() + reinterpret_cast<uintptr_t>((*segments)[i].iov_base);
+        }
+        vec = nullptr;
+    }
 
     // Method to insert raw data into the buffer
     void insert(const void* ptr, size_t sz_bytes) {
         DBG_SERIALIZE(
-            std::cout << "SER " << buffer.size() << " " << sz_bytes << " : \"";
+            std::cout << "SER " << size << " " << sz_bytes << " : \"";
             std::cout.write(static_cast<const char*>(ptr), sz_bytes);
             std::cout << "\"\n";
         );
-        const char* cptr = static_cast<const char*>(ptr);
-        buffer.insert(buffer.end(), cptr, cptr + sz_bytes);
+        size += sz_bytes;
+        if (vec) {
+            append(ptr, sz_bytes);
+            pos += sz_bytes;
+        } else if (out) {
+            std::memcpy(reserve(sz_bytes), ptr, sz_bytes);
+            pos += sz_bytes;
+        }
+    }
+
+    // a payload that stays put until the output is written: referenced in segments mode
+    void reference(const void* ptr, size_t sz_bytes) {
+        if (!segments || sz_bytes < minReference) {
+            insert(ptr, sz_bytes);
+            return;
+        }
+        DBG_SERIALIZE(std::cout << "SER " << size << " " << sz_bytes << " : referenced\n";);
+        closeSegment();
+        segments->push_back({const_cast<void*>(ptr), sz_bytes});
+        size += sz_bytes;
     }
 
     // Template method to insert a value of any type into the buffer
@@ -207,28 +951,65 @@ public:
         return buf;
     }
 
+    // the data is written with one memcpy, or referenced in segments mode
     void serialize(SerializeBuffer& serializer) const {
         size_t size = buf->getSize();
         serializer(size);
-        serializer(std::vector<uint8_t>(buf->getData(), buf->getData() + size));
+        serializer.reference(buf->getData(), size);
     }
 
-    void deserialize(DeSerializeBuffer& deserializer) {
+    // 'allocator' for the data, e.g. ArenaAllocator::forThread() for a request's arrays
+    void deserialize(DeSerializeBuffer& deserializer,
+                     std::shared_ptr<MemoryAllocator> allocator = std::make_shared<CPUMemoryAllocator>()) {
         size_t size;
         deserializer(size);
-        buf = std::make_shared<buffer>(size, std::make_shared<CPUMemoryAllocator>());
+        buf = std::make_shared<buffer>(size, allocator);
         deserializer.extractToBuffer(buf->getData(), size);
     }
 };
 
 // MMapArray class
+// Out of core: the data lives in a file and is paged in as it is read, so an array may be
+// larger than memory.  A scan calls advise(MADV_SEQUENTIAL) for read-ahead and release()
+// behind itself, so the pages it is done with go before memory fills.
 class mmap_array {
 private:
     std::shared_ptr<buffer> buf;
+
+    std::shared_ptr<MMapMemoryAllocator> mapper() const {
+        return std::dynamic_pointer_cast<MMapMemoryAllocator>(buf->getAllocator());
+    }
+
 public:
     mmap_array(size_t size, std::shared_ptr<MemoryAllocator> allocator) {
         buf = std::make_shared<buffer>(size, allocator);
     }
+    // the file at 'path', made 'size' bytes long if shorter; all of it for size 0
+    explicit mmap_array(const std::string& path, size_t size = 0,
+                        std::shared_ptr<MMapMemoryAllocator> allocator = std::make_shared<MMapMemoryAllocator>()) {
+        uint8_t* data = allocator->map(path, size);
+        buf = std::make_shared<buffer>(data, allocator->size(data), allocator);
+    }
+    // grows the file; getData() may change
+    void resize(size_t size) {
+        buf->resize(size);
+    }
+    // write dirty pages back to the file
+    void sync(bool async = false) {
+        if (auto m = mapper()) {
+            m->sync(buf->getData(), async);
+        }
+    }
+    void advise(int advice, size_t offset = 0, size_t length = ~size_t(0)) {
+        if (auto m = mapper()) {
+            m->advise(buf->getData(), advice, offset, length);
+        }
+    }
+    // drop the pages of [offset, offset + length) from this process; a later read pages them
+    // in again from the file
+    void release(size_t offset, size_t length) {
+        advise(MADV_DONTNEED, offset, length);
+    }
     uint8_t* getData() {
         return buf->getData();
     }
@@ -239,16 +1020,18 @@ public:
         return buf;
     }
 
+    // the data is written with one memcpy, or referenced in segments mode
     void serialize(SerializeBuffer& serializer) const {
         size_t size = buf->getSize();
         serializer(size);
-        serializer(std::vector<uint8_t>(buf->getData(), buf->getData() + size));
+        serializer.reference(buf->getData(), size);
     }
 
-    void deserialize(DeSerializeBuffer& deserializer) {
+    void deserialize(DeSerializeBuffer& deserializer,
+                     std::shared_ptr<MemoryAllocator> allocator = std::make_shared<MMapMemoryAllocator>()) {
         size_t size;
         deserializer(size);
-        buf = std::make_shared<buffer>(size, std::make_shared<MMapMemoryAllocator>());
+        buf = std::make_shared<buffer>(size, allocator);
         deserializer.extractToBuffer(buf->getData(), size);
     }
 };
@@ -262,11 +1045,23 @@ public:
     dataobj(const std::vector<array>& arrays) : arrays(arrays) {}
 
     void serialize(SerializeBuffer& serializer) const {
-        serializer(arrays);
+        serializer(arrays.size());
+        for (const array& a : arrays) {
+            a.serialize(serializer);
+        }
     }
 
-    void deserialize(DeSerializeBuffer& deserializer) {
-        deserializer(arrays);
+    void deserialize(DeSerializeBuffer& deserializer,
+                     std::shared_ptr<MemoryAllocator> allocator = std::make_shared<CPUMemoryAllocator>()) {
+        size_t count;
+        deserializer(count);
+        arrays.clear();
+        arrays.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            array a(0, allocator);
+            a.deserialize(deserializer, allocator);
+            arrays.push_back(a);
+        }
     }
 };
 
@@ -276,15 +1071,55 @@ public:
     virtual ~IPCStrategy() = default;
     virtual void send(const std::vector<char>& data) = 0;
     virtual std::vector<char> receive() = 0;
+
+    // Scatter/gather: a message of 'segments' in order, e.g. from SerializeBuffer's segments
+    // mode.  By default joined into one vector for send()
+    virtual void sendSegments(const std::vector<iovec>& segments) {
+        size_t size = 0;
+        for (const iovec& segment : segments) {
+            size += segment.iov_len;
+        }
+        std::vector<char> data;
+        data.reserve(size);
+        for (const iovec& segment : segments) {
+            const char* p = static_cast<const char*>(segment.iov_base);
+            data.insert(data.end(), p, p + segment.iov_len);
+        }
+        send(data);
+    }
+
+    // the next 'size' bytes of what sendSegments() sent, into 'dest': a reader takes a header,
+    // then reads the payload it announces straight into its buffer.  Only a strategy that
+    // streams() has it; the others get sendSegments()' message whole from receive()
+    virtual bool streams() const {
+        return false;
+    }
+
+    virtual void receiveInto(void*, size_t) {
+        throw std::logic_error("receiveInto: this IPC strategy does not stream, use receive()");
+    }
 };
 
 // SocketIPC class
+// send() and receive() connect for each message.  sendSegments() and receiveInto() keep one
+// connection, made on first use or given to the constructor (e.g. a server's accepted
+// socket), and write and read the stream directly: sendmsg from the segments, recv into the
+// caller's memory.  With setZeroCopy(), segments of 'threshold' bytes or more are sent with
+// MSG_ZEROCOPY where the kernel supports it: the pages are sent from where they are, and
+// sendSegments() waits for the kernel to be done with them before it returns.
 class SocketIPC : public IPCStrategy {
 private:
     std::string ip;
     int port;
-    int sockfd;
+    int sockfd = -1;
     struct sockaddr_in server_addr;
+    bool persistent = false;            // sockfd stays open between messages
+    size_t zeroCopyThreshold = 0;       // 0: off
+    uint32_t zeroCopySends = 0;         // sendmsg calls with MSG_ZEROCOPY ...
+    uint32_t zeroCopyDone = 0;          // ... and those the kernel has reported done
+    uint64_t zeroCopyCopied = 0;        //     of which it copied anyway (e.g. over loopback)
+    std::vector<char> readAhead = std::vector<char>(64 << 10);     // receiveInto()
+    size_t readPos = 0, readEnd = 0;
 
     void setupConnection() {
         sockfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -304,14 +1139,84 @@ private:
     }
 
     void closeConnection() {
-        close(sockfd);
+        if (!persistent) {
+            close(sockfd);
+            sockfd = -1;
+        }
+    }
+
+    int stream() {
+        if (sockfd < 0) {
+            setupConnection();
+        }
+        persistent = true;
+        return sockfd;
+    }
+
+    // completions of MSG_ZEROCOPY sends from the error queue, until 'until' sends are done
+    void reapZeroCopy(uint32_t until) {
+        while (int32_t(zeroCopyDone - until) < 0) {
+            pollfd pfd = {sockfd, 0, 0};
+            poll(&pfd, 1, -1);
+            char control[128];
+            msghdr msg = {};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(sockfd, &msg, MSG_ERRQUEUE) < 0) {
+                if (errno == EAGAIN || errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Failed to read zero copy completions");
+            }
+            for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+                auto* err = reinterpret_cast<sock_extended_err*>(CMSG_DATA(cm));
+                if (err->ee_errno == 0 && err->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                    uint32_t n = err->ee_data - err->ee_info + 1;
+                    zeroCopyDone += n;
+                    if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                        zeroCopyCopied += n;
+                    }
+                }
+            }
+        }
     }
 
 public:
     SocketIPC(const std::string& ip, int port) : ip(ip), port(port) {}
 
+    // a connected socket, closed with this object
+    explicit SocketIPC(int fd) : port(0), sockfd(fd), persistent(true) {}
+
+    SocketIPC(const SocketIPC&) = delete;
+    SocketIPC& operator=(const SocketIPC&) = delete;
+
+    ~SocketIPC() {
+        if (sockfd >= 0) {
+            close(sockfd);
+        }
+    }
+
+    // MSG_ZEROCOPY for segments of at least 'threshold' bytes (0 turns it off); false if
+    // the kernel does not offer it.  Below about 10 KB copying is cheaper
+    bool setZeroCopy(size_t threshold = 64 << 10) {
+        int on = threshold > 0;
+        if (setsockopt(stream(), SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) != 0) {
+            zeroCopyThreshold = 0;
+            return false;
+        }
+        zeroCopyThreshold = threshold;
+        return true;
+    }
+
+    // MSG_ZEROCOPY sends the kernel copied after all
+    uint64_t zeroCopiesCopied() const {
+        return zeroCopyCopied;
+    }
+
     void send(const std::vector<char>& data) override {
-        setupConnection();
+        if (!persistent) {
+            setupConnection();
+        }
         ssize_t sent_bytes = ::send(sockfd, data.data(), data.size(), 0);
         if (sent_bytes < 0) {
             throw std::runtime_error("Failed to send data");
@@ -320,7 +1225,9 @@ public:
     }
 
     std::vector<char> receive() override {
-        setupConnection();
+        if (!persistent) {
+            setupConnection();
+        }
         std::vector<char> buffer(1024);
         ssize_t received_bytes = ::recv(sockfd, buffer.data(), buffer.size(), 0);
         if (received_bytes < 0) {
@@ -330,6 +1237,85 @@ public:
         closeConnection();
         return buffer;
     }
+
+    // sendmsg of up to IOV_MAX segments at a time; a run of large segments goes as its own
+    // MSG_ZEROCOPY call when that is on
+    void sendSegments(const std::vector<iovec>& segments) override {
+        int fd = stream();
+        std::vector<iovec> iov(segments);
+        size_t i = 0;
+        while (i < iov.size()) {
+            bool zeroCopy = zeroCopyThreshold && iov[i].iov_len >= zeroCopyThreshold;
+            size_t end = i;
+            while (end < iov.size() && end - i < IOV_MAX &&
+                   (zeroCopyThreshold && iov[end].iov_len >= zeroCopyThreshold) == zeroCopy) {
+                end++;
+            }
+            msghdr msg = {};
+            msg.msg_iov = &iov[i];
+            msg.msg_iovlen = end - i;
+            ssize_t sent = sendmsg(fd, &msg, zeroCopy ? MSG_ZEROCOPY | MSG_NOSIGNAL : MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (zeroCopy && errno == ENOBUFS) {      // over the locked page limit: copy this one
+                    reapZeroCopy(zeroCopySends);
+                    sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+                }
+                if (sent < 0) {
+                    throw std::runtime_error("Failed to send data");
+                }
+            } else if (zeroCopy) {
+                zeroCopySends++;
+            }
+            for (; i < end && size_t(sent) >= iov[i].iov_len; i++) {
+                sent -= iov[i].iov_len;
+            }
+            if (i < end) {
+                iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + sent;
+                iov[i].iov_len -= sent;
+            }
+        }
+        if (zeroCopyThreshold) {
+            reapZeroCopy(zeroCopySends);
+        }
+    }
+
+    bool streams() const override {
+        return true;
+    }
+
+    // headers and small payloads come out of a read-ahead buffer, one recv for many of
+    // them; larger ones are received straight into 'dest'
+    void receiveInto(void* dest, size_t size) override {
+        int fd = stream();
+        while (size > 0) {
+            size_t n = std::min(size, readEnd - readPos);
+            std::memcpy(dest, readAhead.data() + readPos, n);
+            readPos += n;
+            dest = static_cast<char*>(dest) + n;
+            size -= n;
+            if (size == 0) {
+                break;
+            }
+            bool direct = size >= readAhead.size() / 4;
+            ssize_t got = direct ? ::recv(fd, dest, size, MSG_WAITALL) : ::recv(fd, readAhead.data(), readAhead.size(), 0);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                throw std::runtime_error(got < 0 ? "Failed to receive data" : "Connection closed");
+            }
+            if (direct) {
+                dest = static_cast<char*>(dest) + got;
+                size -= got;
+            } else {
+                readPos = 0;
+                readEnd = got;
+            }
+        }
+    }
 };
 
 // FileIPC class
@@ -504,16 +1490,22 @@ public:
 class Process {
 private:
     std::shared_ptr<IPCStrategy> ipc;
+    size_t maxArrays = 1 << 20;             // receiveSegments() limits on what the wire claims
+    size_t maxBytes = size_t(4) << 30;
 
 public:
     // Constructor that takes an IPCStrategy object
     Process(std::shared_ptr<IPCStrategy> ipc) : ipc(ipc) {}
 
-    // Method to send dataobj
+    // Method to send dataobj: sized first, so the message is allocated once
     void send(const dataobj& data) {
+        SerializeBuffer sizer = SerializeBuffer::sizing();
+        data.serialize(sizer);
         std::vector<char> buffer;
+        buffer.reserve(sizer.getSize());
         SerializeBuffer serializer(buffer);
         data.serialize(serializer);
+        serializer.finish();
         ipc->send(buffer);
     }
 
@@ -525,17 +1517,83 @@ public:
         data.deserialize(deserializer);
         return data;
     }
+
+    // Scatter/gather: the headers are copied, each array's data goes to the wire from
+    // where it is; see IPCStrategy::sendSegments
+    void sendSegments(const dataobj& data) {
+        std::vector<char> headers;
+        std::vector<iovec> segments;
+        SerializeBuffer serializer(headers, segments);
+        data.serialize(serializer);
+        serializer.finish();
+        ipc->sendSegments(segments);
+    }
+
+    // ... and received: each array's header, then its data straight into a new buffer.
+    // The count and sizes come off the wire: more than 'maxArrays' arrays or 'maxBytes'
+    // bytes of them, or a message that ends early, throw std::runtime_error before anything
+    // is allocated for them.  A stream is then out of step; close it
+    dataobj receiveSegments(std::shared_ptr<MemoryAllocator> allocator = std::make_shared<CPUMemoryAllocator>()) {
+        bool streams = ipc->streams();
+        std::vector<char> message = streams ? std::vector<char>() : ipc->receive();
+        size_t at = 0;
+        auto read = [&](void* dest, size_t size) {
+            if (streams) {
+                ipc->receiveInto(dest, size);
+                return;
+            }
+            if (size > message.size() - at) {
+                throw std::runtime_error("Message ended early");
+            }
+            if (size > 0) {
+                std::memcpy(dest, message.data() + at, size);
+            }
+            at += size;
+        };
+
+        size_t count;
+        read(&count, sizeof(count));
+        if (count > maxArrays) {
+            throw std::runtime_error("Message has too many arrays");
+        }
+        dataobj data;
+        data.arrays.reserve(std::min<size_t>(count, 4096));
+        size_t total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            size_t size;
+            read(&size, sizeof(size));
+            if (size > maxBytes - total) {
+                throw std::runtime_error("Message is too large");
+            }
+            total += size;
+            array a(size, allocator);
+            read(a.getData(), size);
+            data.arrays.push_back(a);
+        }
+        if (at != message.size()) {
+            throw std::runtime_error("Message has bytes past its arrays");
+        }
+        return data;
+    }
+
+    // caps for receiveSegments(): arrays in a message, and their bytes in all
+    void setReceiveLimits(size_t arrays, size_t bytes) {
+        maxArrays = arrays;
+        maxBytes = bytes;
+    }
 };
 
+#ifndef INFRA_BENCH
+
 // Server code
 void handleClient(int client_sock) {
     try {
-        // Create a SocketIPC object for the client connection
-        std::shared_ptr<IPCStrategy> client_ipc = std::make_shared<SocketIPC>("127.0.0.1", 8080);
+        // Create a SocketIPC object for the client connection; it closes client_sock
+        std::shared_ptr<IPCStrategy> client_ipc = std::make_shared<SocketIPC>(client_sock);
         Process process(client_ipc);
 
         // Receive data from client
-        dataobj received_data = process.receive();
+        dataobj received_data = process.receiveSegments();
 
         // Process data (for demonstration, we'll just print the size of the first array)
         if (!received_data.arrays.empty()) {
@@ -543,12 +1601,10 @@ void handleClient(int client_sock) {
         }
 
         // Send response to client (echo back the received data)
-        process.send(received_data);
+        process.sendSegments(received_data);
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
     }
-
-    close(client_sock);
 }
 
 int main() {
@@ -615,10 +1671,10 @@ int main() {
     Process process(client_ipc);
 
     // Send data to server
-    process.send(data);
+    process.sendSegments(data);
 
     // Receive response from server
-    dataobj received_data = process.receive();
+    dataobj received_data = process.receiveSegments();
 
     // Process response data (for demonstration, we'll just print the size of the first array)
     if (!received_data.arrays.empty()) {
@@ -626,4 +1682,486 @@ int main() {
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+#endif // INFRA_BENCH
+
+// to benchmark the allocators:
+//   compile this file with -DBENCH_ALLOCATORS -O2 -std=c++20 -pthread and run, optionally
+//   with the allocations per thread (default 2000000).  Each thread keeps a window of 64
+//   live buffers of 16 to 4096 bytes, as a request does, at 1 to 32 threads.  "handoff"
+//   passes each window through a shared mailbox and frees what it takes out, mostly
+//   other threads' buffers.  The arena is reset once per window instead of freeing.
+
+#ifdef BENCH_ALLOCATORS
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using Clock = std::chrono::steady_clock;
+
+struct Mailbox {
+    std::mutex lock;
+    std::vector<uint8_t*> blocks;
+};
+
+// millions of allocate + deallocate pairs per second over all threads
+template <typename MakeAllocator>
+double run(size_t threads, size_t count, bool handoff, MakeAllocator makeAllocator) {
+    constexpr bool arena = std::is_same_v<decltype(makeAllocator()), std::shared_ptr<ArenaAllocator>>;
+    Mailbox mailbox;
+    std::atomic<size_t> checksum{0};
+    auto start = Clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            auto allocator = makeAllocator();
+            std::vector<uint8_t*> window;
+            unsigned seed = unsigned(t) + 1;
+            size_t sum = 0;
+            for (size_t i = 0; i < count; ++i) {
+                seed = seed * 1103515245 + 12345;
+                size_t size = 16 + (seed >> 8) % 4080;
+                uint8_t* data = allocator->allocate(size);
+                data[0] = uint8_t(i);
+                sum += data[0];
+                window.push_back(data);
+                if (window.size() < 64) {
+                    continue;
+                }
+                if constexpr (arena) {
+                    allocator->reset();
+                } else if (handoff) {
+                    // swap the window for a window another thread put in, if there is one
+                    std::lock_guard<std::mutex> guard(mailbox.lock);
+                    if (mailbox.blocks.size() < 64) {
+                        mailbox.blocks.insert(mailbox.blocks.end(), window.begin(), window.end());
+                        window.clear();
+                    } else {
+                        std::swap_ranges(window.begin(), window.end(), mailbox.blocks.end() - 64);
+                    }
+                }
+                if constexpr (!arena) {
+                    for (uint8_t* b : window) {
+                        allocator->deallocate(b);
+                    }
+                }
+                window.clear();
+            }
+            for (uint8_t* b : window) {
+                allocator->deallocate(b);
+            }
+            checksum += sum;
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    auto allocator = makeAllocator();
+    for (uint8_t* b : mailbox.blocks) {
+        allocator->deallocate(b);
+    }
+    return threads * count / seconds / 1e6;
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000000;
+    printf("threads   new[] local   pool local   arena   new[] handoff   pool handoff   (M allocations/s)\n");
+    for (size_t threads = 1; threads <= 32; threads *= 2) {
+        auto cpu = [] { return std::shared_ptr<MemoryAllocator>(std::make_shared<CPUMemoryAllocator>()); };
+        auto pool = std::make_shared<PoolAllocator>();
+        auto pooled = [&] { return std::shared_ptr<MemoryAllocator>(pool); };
+        auto arena = [] { return std::make_shared<ArenaAllocator>(); };
+        printf("%7zu %13.1f %12.1f %7.1f %15.1f %14.1f\n", threads, run(threads, count, false, cpu),
+               run(threads, count, false, pooled), run(threads, count, false, arena),
+               run(threads, count, true, cpu), run(threads, count, true, pooled));
+    }
+    return 0;
+}
+
+#endif
+
+// to benchmark page policies:
+//   compile this file with -DBENCH_PAGES -O2 -std=c++20 -pthread and run, optionally with
+//   the buffer size in MB (default 1024).  For each allocator it times the first write
+//   (page faults included), sequential reads and random 8 byte reads.  Explicit huge
+//   pages need vm.nr_hugepages reserved, else they fall back to transparent ones.
+
+#ifdef BENCH_PAGES
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+
+using Clock = std::chrono::steady_clock;
+
+template <typename F>
+double seconds(F f) {
+    auto start = Clock::now();
+    f();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    size_t size = (argc > 1 ? strtoull(argv[1], nullptr, 10) : 1024) << 20;
+    std::string thp;
+    std::getline(std::ifstream("/sys/kernel/mm/transparent_hugepage/enabled"), thp);
+    printf("%zu MB, transparent huge pages: %s\n", size >> 20, thp.c_str());
+
+    auto pages = [](PagePolicy::HugePages huge, PagePolicy::Placement placement, bool populate) {
+        PagePolicy policy;
+        policy.hugePages = huge;
+        policy.placement = placement;
+        policy.populate = populate;
+        return std::make_shared<PageMemoryAllocator>(policy);
+    };
+    using H = PagePolicy::HugePages;
+    using P = PagePolicy::Placement;
+    std::vector<std::pair<const char*, std::shared_ptr<MemoryAllocator>>> allocators = {
+        {"new[]", std::make_shared<CPUMemoryAllocator>()},
+        {"aligned 64", std::make_shared<AlignedMemoryAllocator>(64)},
+        {"aligned 4096", std::make_shared<AlignedMemoryAllocator>(4096)},
+        {"pages 4K", pages(H::None, P::FirstTouch, false)},
+        {"pages 4K populate", pages(H::None, P::FirstTouch, true)},
+        {"pages THP", pages(H::Transparent, P::FirstTouch, false)},
+        {"pages THP populate", pages(H::Transparent, P::FirstTouch, true)},
+        {"pages hugetlb", pages(H::Explicit, P::FirstTouch, false)},
+        {"pages 4K bind 0", pages(H::None, P::Bind, true)},
+        {"pages THP interleave", pages(H::Transparent, P::Interleave, true)},
+    };
+
+    printf("%-22s %12s %12s %12s %14s\n", "", "alloc ms", "write GB/s", "read GB/s", "random ns/read");
+    uint64_t check = 0;
+    for (auto& [name, allocator] : allocators) {
+        double alloc, write, read = 1e9, random = 1e9;
+        uint64_t sum = 0;
+        {
+            std::unique_ptr<buffer> buf;
+            alloc = seconds([&] { buf = std::make_unique<buffer>(size, allocator); });
+            uint64_t* data = reinterpret_cast<uint64_t*>(buf->getData());
+            size_t n = size / sizeof(uint64_t);
+            write = seconds([&] {
+                for (size_t i = 0; i < n; ++i) {
+                    data[i] = i;
+                }
+            });
+            for (int pass = 0; pass < 3; ++pass) {
+                read = std::min(read, seconds([&] {
+                    for (size_t i = 0; i < n; ++i) {
+                        sum += data[i];
+                    }
+                }));
+            }
+            size_t reads = 20000000;
+            uint64_t seed = 1;
+            random = seconds([&] {
+                for (size_t i = 0; i < reads; ++i) {
+                    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+                    sum += data[(seed >> 20) % n];
+                }
+            }) / reads;
+        }
+        check += sum;       // the reads are not optimized away
+        printf("%-22s %12.1f %12.2f %12.2f %14.1f\n", name, alloc * 1e3, size / write / 1e9, size / read / 1e9,
+               random * 1e9);
+    }
+    return check == 0;
+}
+
+#endif
+
+// to benchmark an out-of-core scan:
+//   compile this file with -DBENCH_MMAP -O2 -std=c++20 -pthread and run, optionally with
+//   the dataset size in MB (default 8192, more than most test machines' memory) and its
+//   file (default /tmp/bench_mmap_array).  Writes the dataset through an mmap_array,
+//   drops it from the page cache, then sums it: through the mapping with read-ahead and
+//   release() behind the scan, and on the heap path -- read() into a buffer, then sum --
+//   when it fits in free memory.
+
+#ifdef BENCH_MMAP
+
+#include <chrono>
+#include <cstdio>
+#include <sys/resource.h>
+
+using Clock = std::chrono::steady_clock;
+
+template <typename F>
+double seconds(F f) {
+    auto start = Clock::now();
+    f();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void dropCache(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+long maxRssMB() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024;
+}
+
+int main(int argc, char** argv) {
+    size_t size = (argc > 1 ? strtoull(argv[1], nullptr, 10) : 8192) << 20;
+    std::string path = argc > 2 ? argv[2] : "/tmp/bench_mmap_array";
+    size_t window = 64 << 20;
+    size_t n = size / sizeof(uint64_t);
+    unlink(path.c_str());
+
+    double write = seconds([&] {
+        mmap_array dataset(path, size);
+        dataset.advise(MADV_SEQUENTIAL);
+        uint64_t* data = reinterpret_cast<uint64_t*>(dataset.getData());
+        for (size_t i = 0; i < n; ++i) {
+            data[i] = i;
+            if ((i + 1) * sizeof(uint64_t) % window == 0) {
+                size_t end = (i + 1) * sizeof(uint64_t);
+                dataset.sync(true);
+                dataset.release(end - window, window);
+            }
+        }
+        dataset.sync();
+    });
+    dropCache(path);
+    printf("%zu MB dataset in %s, written in %.1f s\n", size >> 20, path.c_str(), write);
+
+    uint64_t expected = uint64_t(n) * (n - 1) / 2, sum = 0;
+    double mapped = seconds([&] {
+        mmap_array dataset(path);
+        dataset.advise(MADV_SEQUENTIAL);
+        const uint64_t* data = reinterpret_cast<const uint64_t*>(dataset.getData());
+        for (size_t i = 0; i < n; ++i) {
+            sum += data[i];
+            if ((i + 1) * sizeof(uint64_t) % window == 0) {
+                dataset.release((i + 1) * sizeof(uint64_t) - window, window);
+            }
+        }
+    });
+    printf("mmap_array scan:  %6.2f GB/s, max RSS %ld MB%s\n", size / mapped / 1e9, maxRssMB(),
+           sum == expected ? "" : "  WRONG SUM");
+
+    size_t available = size_t(sysconf(_SC_AVPHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+    if (size > available * 3 / 4) {
+        printf("heap path:        skipped, %zu MB does not fit in %zu MB free\n", size >> 20, available >> 20);
+    } else {
+        dropCache(path);
+        sum = 0;
+        double heap = seconds([&] {
+            buffer copy(size, std::make_shared<CPUMemoryAllocator>());
+            int fd = open(path.c_str(), O_RDONLY);
+            for (size_t done = 0; done < size;) {
+                ssize_t got = read(fd, copy.getData() + done, std::min(size - done, window));
+                if (got <= 0) {
+                    break;
+                }
+                done += got;
+            }
+            close(fd);
+            const uint64_t* data = reinterpret_cast<const uint64_t*>(copy.getData());
+            for (size_t i = 0; i < n; ++i) {
+                sum += data[i];
+            }
+        });
+        printf("heap read + scan: %6.2f GB/s, max RSS %ld MB%s\n", size / heap / 1e9, maxRssMB(),
+               sum == expected ? "" : "  WRONG SUM");
+    }
+    unlink(path.c_str());
+    return 0;
+}
+
+#endif
+
+// to benchmark serialization:
+//   compile this file with -DBENCH_SERIALIZE -O2 -std=c++20 -pthread and run, optionally
+//   with the number of arrays (default 1024) and their size in KB (default 1024).  Times
+//   serializing a dataobj the old way -- fields appended to a growing vector, each array
+//   copied through a temporary vector -- against a vector sized by a first pass, a buffer
+//   allocated once, and iovec segments that reference the arrays.
+
+#ifdef BENCH_SERIALIZE
+
+#include <chrono>
+#include <cstdio>
+
+using Clock = std::chrono::steady_clock;
+
+template <typename F>
+double best(F f) {
+    double fastest = 1e9;
+    for (int pass = 0; pass < 3; ++pass) {
+        auto start = Clock::now();
+        f();
+        fastest = std::min(fastest, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    return fastest;
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1024;
+    size_t size = (argc > 2 ? strtoull(argv[2], nullptr, 10) : 1024) << 10;
+    auto allocator = std::make_shared<CPUMemoryAllocator>();
+    std::vector<array> arrays;
+    for (size_t i = 0; i < count; ++i) {
+        arrays.emplace_back(size, allocator);
+        std::memset(arrays.back().getData(), int(i), size);
+    }
+    dataobj data(arrays);
+    double bytes = double(count) * size;
+    size_t check = 0;
+
+    double before = best([&] {
+        std::vector<char> out;
+        size_t n = data.arrays.size();
+        out.insert(out.end(), (const char*)&n, (const char*)(&n + 1));
+        for (array& a : data.arrays) {
+            size_t sz = a.getSize();
+            std::vector<uint8_t> copy(a.getData(), a.getData() + sz);
+            out.insert(out.end(), (const char*)&sz, (const char*)(&sz + 1));
+            out.insert(out.end(), copy.begin(), copy.end());
+        }
+        check += out.size();
+    });
+    double vector = best([&] {
+        SerializeBuffer sizer = SerializeBuffer::sizing();
+        data.serialize(sizer);
+        std::vector<char> out;
+        out.reserve(sizer.getSize());
+        SerializeBuffer serializer(out);
+        data.serialize(serializer);
+        serializer.finish();
+        check += out.size();
+    });
+    double once = best([&] {
+        check += SerializeBuffer::serialize(data)->getSize();
+    });
+    double segments = best([&] {
+        std::vector<char> small;
+        std::vector<iovec> iov;
+        SerializeBuffer serializer(small, iov);
+        data.serialize(serializer);
+        serializer.finish();
+        check += serializer.getSize() + iov.size();
+    });
+
+    printf("%zu arrays x %zu KB\n", count, size >> 10);
+    printf("before: growing vector, temporary copies  %7.2f GB/s\n", bytes / before / 1e9);
+    printf("sized vector                              %7.2f GB/s\n", bytes / vector / 1e9);
+    printf("sized buffer, one memcpy per array        %7.2f GB/s\n", bytes / once / 1e9);
+    printf("iovec segments, arrays referenced         %7.2f GB/s\n", bytes / segments / 1e9);
+    return check == 0;
+}
+
+#endif
+
+// to benchmark sending dataobjs over one loopback connection:
+//   compile this file with -DBENCH_WIRE -O2 -std=c++20 -pthread and run, optionally with
+//   the MB sent per array size (default 1024).  For arrays of 1 KB to 256 MB, a receiving
+//   thread reads what is sent: serialized into one vector and read back into one
+//   (Process::send's copies), as segments with sendmsg and read into new buffers, and the
+//   same with MSG_ZEROCOPY.  Over loopback the kernel copies zero copy sends anyway (the
+//   count is shown); the gain needs a NIC.
+
+#ifdef BENCH_WIRE
+
+#include <chrono>
+#include <cstdio>
+
+using Clock = std::chrono::steady_clock;
+
+// a connected pair over 127.0.0.1
+std::pair<int, int> loopback() {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 1) < 0 ||
+        getsockname(listener, (sockaddr*)&addr, &len) < 0) {
+        throw std::runtime_error("Failed to listen on loopback");
+    }
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(client, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        throw std::runtime_error("Connection Failed");
+    }
+    int server = accept(listener, nullptr, nullptr);
+    close(listener);
+    return {client, server};
+}
+
+int main(int argc, char** argv) {
+    size_t total = (argc > 1 ? strtoull(argv[1], nullptr, 10) : 1024) << 20;
+    auto allocator = std::make_shared<CPUMemoryAllocator>();
+    auto [client, server] = loopback();
+    SocketIPC sender(client), receiver(server);
+    Process sending(std::shared_ptr<IPCStrategy>(&sender, [](IPCStrategy*) {}));
+    Process receiving(std::shared_ptr<IPCStrategy>(&receiver, [](IPCStrategy*) {}));
+    receiving.setReceiveLimits(SIZE_MAX, SIZE_MAX);     // our own loopback, and 'total' may be large
+    bool zeroCopy = sender.setZeroCopy();
+    sender.setZeroCopy(0);
+
+    printf("%10s %8s %14s %14s %14s\n", "array", "arrays", "vector MB/s", "segments MB/s",
+           zeroCopy ? "zerocopy MB/s" : "(no zerocopy)");
+    for (size_t size = 1 << 10; size <= size_t(256) << 20; size *= 4) {
+        size_t count = std::max<size_t>(1, total / size);
+        // arrays share one buffer: only the wire is measured, not memory
+        array one(size, allocator);
+        std::memset(one.getData(), 1, size);
+        dataobj data(std::vector<array>(count, one));
+        double bytes = double(count) * size;
+        bool bad = false;
+
+        auto timed = [&](auto send, auto receive) {
+            auto start = Clock::now();
+            std::thread t([&] { send(); });
+            dataobj got = receive();
+            t.join();
+            bad |= got.arrays.size() != count || got.arrays.back().getSize() != size ||
+                   got.arrays.back().getData()[size - 1] != 1;
+            return bytes / std::chrono::duration<double>(Clock::now() - start).count() / 1e6;
+        };
+        double vector = timed(
+            [&] {
+                SerializeBuffer sizer = SerializeBuffer::sizing();
+                data.serialize(sizer);
+                std::vector<char> message;
+                message.reserve(sizer.getSize());
+                SerializeBuffer serializer(message);
+                data.serialize(serializer);
+                serializer.finish();
+                uint64_t n = message.size();
+                sender.sendSegments({{&n, sizeof(n)}, {message.data(), message.size()}});
+            },
+            [&] {
+                uint64_t n;
+                receiver.receiveInto(&n, sizeof(n));
+                std::vector<char> message(n);
+                receiver.receiveInto(message.data(), n);
+                DeSerializeBuffer deserializer(message.data(), message.size());
+                dataobj got;
+                got.deserialize(deserializer, allocator);
+                return got;
+            });
+        double segments = timed([&] { sending.sendSegments(data); }, [&] { return receiving.receiveSegments(allocator); });
+        double zero = 0;
+        if (zeroCopy) {
+            sender.setZeroCopy();
+            zero = timed([&] { sending.sendSegments(data); }, [&] { return receiving.receiveSegments(allocator); });
+            sender.setZeroCopy(0);
+        }
+        printf("%9zuK %8zu %14.0f %14.0f %14.0f%s\n", size >> 10, count, vector, segments, zero,
+               bad ? "  WRONG DATA" : "");
+    }
+    if (zeroCopy) {
+        printf("zero copy sends the kernel copied: %llu\n", (unsigned long long)sender.zeroCopiesCopied());
+    }
+    return 0;
+}
+
+#endif